@@ -21,13 +21,35 @@
 #define OTRNG_ALLOC_PRIVATE
 
 #include "alloc.h"
+#include <pthread.h>
 #include <sodium.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "error.h"
+
 static void (*oom_handler)(void);
 
+/*
+ * Small secrets are carved out of fixed-size arenas. Every arena is a single
+ * sodium_malloc region (locked, and surrounded by guard pages), so a whole
+ * arena costs the page mappings and mprotect calls that every small secret
+ * would otherwise cost.
+ */
+static const size_t secure_size_classes[SECURE_SIZE_CLASSES] =
+    SECURE_SIZE_CLASS_BYTES;
+
+static secure_arena_s *secure_arenas[SECURE_SIZE_CLASSES];
+
+/* Every arena, sorted by base address, to find the one a chunk belongs to */
+static secure_arena_s **secure_arena_index;
+static size_t secure_arena_index_len;
+static size_t secure_arena_index_cap;
+static otrng_secure_alloc_stats_s secure_stats;
+static pthread_mutex_t secure_lock = PTHREAD_MUTEX_INITIALIZER;
+
 API void otrng_register_out_of_memory_handler(
     /*@null@*/ void (*handler)(void)) /*@modifies internalState @*/ {
   oom_handler = handler;
@@ -66,15 +88,229 @@ otrng_xrealloc(/*@only@*/ /*@null@*/ void *ptr, size_t size) {
   return result;
 }
 
+tstatic int secure_size_class(size_t size) {
+  int i;
+
+  for (i = 0; i < SECURE_SIZE_CLASSES; i++) {
+    if (size <= secure_size_classes[i]) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/* Must be called with secure_lock held. Returns the position of the last
+ * arena whose base is not above p, or secure_arena_index_len if none is. */
+static size_t secure_arena_index_find(const uint8_t *p) {
+  size_t low = 0, high = secure_arena_index_len;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+
+    if (secure_arena_index[mid]->base <= p) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low == 0 ? secure_arena_index_len : low - 1;
+}
+
+/* Must be called with secure_lock held */
+static void secure_arena_index_add(secure_arena_s *arena) {
+  size_t pos = secure_arena_index_find(arena->base);
+
+  pos = pos == secure_arena_index_len ? 0 : pos + 1;
+
+  if (secure_arena_index_len == secure_arena_index_cap) {
+    secure_arena_index_cap =
+        secure_arena_index_cap ? 2 * secure_arena_index_cap : 8;
+    secure_arena_index =
+        otrng_xrealloc(secure_arena_index,
+                       secure_arena_index_cap * sizeof(secure_arena_s *));
+  }
+
+  memmove(secure_arena_index + pos + 1, secure_arena_index + pos,
+          (secure_arena_index_len - pos) * sizeof(secure_arena_s *));
+  secure_arena_index[pos] = arena;
+  secure_arena_index_len++;
+}
+
+/* Must be called with secure_lock held */
+static void secure_arena_index_remove(secure_arena_s *arena) {
+  size_t pos = secure_arena_index_find(arena->base);
+
+  memmove(secure_arena_index + pos, secure_arena_index + pos + 1,
+          (secure_arena_index_len - pos - 1) * sizeof(secure_arena_s *));
+  secure_arena_index_len--;
+}
+
+/* Must be called with secure_lock held */
+static /*@null@*/ secure_arena_s *secure_arena_new(int size_class) {
+  secure_arena_s *arena;
+  uint8_t *base = sodium_malloc(SECURE_ARENA_BYTES);
+
+  if (!base) {
+    return NULL;
+  }
+
+  /* sodium_malloc fills the region with garbage */
+  sodium_memzero(base, SECURE_ARENA_BYTES);
+
+  arena = otrng_xmalloc_z(sizeof(secure_arena_s));
+  arena->base = base;
+  arena->size_class = size_class;
+  arena->chunk_size = secure_size_classes[size_class];
+  arena->chunks = SECURE_ARENA_BYTES / arena->chunk_size;
+
+  arena->next = secure_arenas[size_class];
+  if (arena->next) {
+    arena->next->prev = arena;
+  }
+  secure_arenas[size_class] = arena;
+  secure_arena_index_add(arena);
+
+  secure_stats.arenas_mapped++;
+  secure_stats.arenas_live++;
+
+  return arena;
+}
+
+/* Must be called with secure_lock held */
+static void secure_arena_free(secure_arena_s *arena) {
+  if (arena->prev) {
+    arena->prev->next = arena->next;
+  } else {
+    secure_arenas[arena->size_class] = arena->next;
+  }
+  if (arena->next) {
+    arena->next->prev = arena->prev;
+  }
+  secure_arena_index_remove(arena);
+
+  sodium_free(arena->base);
+  free(arena);
+
+  secure_stats.arenas_unmapped++;
+  secure_stats.arenas_live--;
+}
+
+/* Must be called with secure_lock held */
+static /*@null@*/ void *secure_chunk_alloc(int size_class) {
+  secure_arena_s *arena = secure_arenas[size_class];
+  uint8_t *chunk;
+
+  while (arena && arena->used == arena->chunks) {
+    arena = arena->next;
+  }
+
+  if (!arena) {
+    arena = secure_arena_new(size_class);
+    if (!arena) {
+      return NULL;
+    }
+  }
+
+  if (arena->free_list) {
+    chunk = arena->free_list;
+    memcpy(&arena->free_list, chunk, sizeof(void *));
+    /* The rest of the chunk was zeroed when it was freed */
+    memset(chunk, 0, sizeof(void *));
+  } else {
+    chunk = arena->base + arena->touched * arena->chunk_size;
+    arena->touched++;
+  }
+
+  arena->used++;
+  secure_stats.slab_allocs++;
+
+  return chunk;
+}
+
+/* Must be called with secure_lock held */
+static otrng_bool secure_chunk_free(void *p) {
+  uint8_t *chunk = p;
+  secure_arena_s *arena;
+  size_t pos = secure_arena_index_find(chunk);
+
+  /* Below the first arena, or nothing comes from the arenas at all */
+  if (pos == secure_arena_index_len) {
+    return otrng_false;
+  }
+
+  arena = secure_arena_index[pos];
+  if (chunk >= arena->base + arena->chunks * arena->chunk_size) {
+    return otrng_false;
+  }
+
+  sodium_memzero(chunk, arena->chunk_size);
+  memcpy(chunk, &arena->free_list, sizeof(void *));
+  arena->free_list = chunk;
+  arena->used--;
+  secure_stats.slab_frees++;
+
+  /* Give back empty arenas, but keep one around for the next secret */
+  if (arena->used == 0 && (arena->prev || arena->next)) {
+    secure_arena_free(arena);
+  }
+
+  return otrng_true;
+}
+
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_secure_alloc(size_t size) {
-  void *result = sodium_malloc(size);
+  void *result = NULL;
+#ifndef OTRNG_SECURE_ALLOC_DEBUG
+  int size_class = secure_size_class(size);
+
+  if (size_class >= 0) {
+    pthread_mutex_lock(&secure_lock);
+    result = secure_chunk_alloc(size_class);
+    pthread_mutex_unlock(&secure_lock);
+
+    if (result) {
+      return result;
+    }
+  }
+#endif
+
+  result = sodium_malloc(size);
+  if (result == NULL) {
+    if (oom_handler != NULL) {
+      oom_handler();
+    }
+    fprintf(stderr, "fatal: memory exhausted (secure alloc of %lu bytes).\n",
+            size);
+    exit(EXIT_FAILURE);
+  }
+
   memset(result, 0, size);
+
+  pthread_mutex_lock(&secure_lock);
+  secure_stats.sodium_allocs++;
+  pthread_mutex_unlock(&secure_lock);
+
   return result;
 }
 
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_secure_alloc_array(size_t count,
                                                                  size_t size) {
-  return sodium_allocarray(count, size);
+  if (size != 0 && count > SIZE_MAX / size) {
+    if (oom_handler != NULL) {
+      oom_handler();
+    }
+    fprintf(stderr, "fatal: secure alloc of %lu elements overflows.\n", count);
+    exit(EXIT_FAILURE);
+  }
+
+  return otrng_secure_alloc(count * size);
+}
+
+API void otrng_secure_alloc_get_stats(otrng_secure_alloc_stats_s *stats) {
+  pthread_mutex_lock(&secure_lock);
+  *stats = secure_stats;
+  pthread_mutex_unlock(&secure_lock);
 }
 
 INTERNAL void otrng_free(/*@notnull@*/ /*@only@*/ void *p) /*@modifies p@*/ {
@@ -83,7 +319,23 @@ INTERNAL void otrng_free(/*@notnull@*/ /*@only@*/ void *p) /*@modifies p@*/ {
 
 INTERNAL void
 otrng_secure_free(/*@notnull@*/ /*@only@*/ void *p) /*@modifies p@*/ {
-  sodium_free(p);
+  otrng_bool freed;
+
+  if (!p) {
+    return;
+  }
+
+  pthread_mutex_lock(&secure_lock);
+  freed = secure_chunk_free(p);
+  if (!freed) {
+    secure_stats.sodium_frees++;
+  }
+  pthread_mutex_unlock(&secure_lock);
+
+  if (!freed) {
+    /* sodium_free wipes the memory before releasing it */
+    sodium_free(p);
+  }
 }
 
 INTERNAL void otrng_secure_wipe(/*@notnull@*/ /*@only@*/ void *p,
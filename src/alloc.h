@@ -22,9 +22,33 @@
 #define OTRNG_ALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "shared.h"
 
+/**
+ * @brief Counters of the secure allocator. Every sodium_malloc call maps
+ * guard pages and calls mprotect, so sodium_allocs + arenas_mapped is the
+ * number of those calls made.
+ *
+ *  [slab_allocs]     secrets allocated from an arena
+ *  [slab_frees]      secrets given back to an arena
+ *  [sodium_allocs]   secrets allocated with their own sodium_malloc
+ *  [sodium_frees]    secrets freed with their own sodium_free
+ *  [arenas_mapped]   arenas allocated with sodium_malloc
+ *  [arenas_unmapped] arenas freed with sodium_free
+ *  [arenas_live]     arenas currently allocated
+ */
+typedef struct otrng_secure_alloc_stats_s {
+  size_t slab_allocs;
+  size_t slab_frees;
+  size_t sodium_allocs;
+  size_t sodium_frees;
+  size_t arenas_mapped;
+  size_t arenas_unmapped;
+  size_t arenas_live;
+} otrng_secure_alloc_stats_s;
+
 /**
  * @brief The function given to this function will be called if there is no
  * memory left.
@@ -44,15 +68,59 @@ INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_xmalloc_z(size_t size);
 INTERNAL /*@only@*/ /*@notnull@*/ void *
 otrng_xrealloc(/*@only@*/ /*@null@*/ void *ptr, size_t size);
 
+/**
+ * @brief Allocate zeroed memory for a secret.
+ *
+ * Small secrets are carved out of locked and guarded arenas, one set of arenas
+ * per size class. Everything else, or everything when built with
+ * OTRNG_SECURE_ALLOC_DEBUG, gets its own sodium_malloc region.
+ */
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_secure_alloc(size_t size);
 INTERNAL /*@only@*/ /*@notnull@*/ void *otrng_secure_alloc_array(size_t count,
                                                                  size_t size);
 
 INTERNAL void otrng_free(/*@notnull@*/ /*@only@*/ void *ptr);
 
+/**
+ * @brief Free memory from otrng_secure_alloc. The memory is zeroed first.
+ */
 INTERNAL void otrng_secure_free(/*@notnull@*/ /*@only@*/ void *ptr);
 
 INTERNAL void otrng_secure_wipe(/*@notnull@*/ /*@only@*/ void *p,
                                 size_t size) /*@modifies p@*/;
 
+/**
+ * @brief Get a snapshot of the secure allocator counters.
+ *
+ * @param [stats] The counters.
+ */
+API void otrng_secure_alloc_get_stats(otrng_secure_alloc_stats_s *stats);
+
+#ifdef OTRNG_ALLOC_PRIVATE
+
+#define SECURE_ARENA_BYTES (32 * 1024)
+
+/*
+ * The chunk sizes of the arenas, multiples of 16 to keep chunks aligned. The
+ * largest one holds a skipped_keys_s (the unit tests check it still fits).
+ */
+#define SECURE_SIZE_CLASSES 3
+#define SECURE_SIZE_CLASS_BYTES {64, 128, 192}
+
+typedef struct secure_arena_s {
+  uint8_t *base;
+  int size_class;
+  size_t chunk_size;
+  size_t chunks;
+  size_t used;   /* chunks handed out */
+  size_t touched; /* chunks ever handed out, the rest are still untouched */
+  /*@null@*/ void *free_list; /* linked through the first bytes of the chunks */
+  /*@null@*/ struct secure_arena_s *prev;
+  /*@null@*/ struct secure_arena_s *next;
+} secure_arena_s;
+
+tstatic int secure_size_class(size_t size);
+
+#endif
+
 #endif // OTRNG_ALLOC_H
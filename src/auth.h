@@ -138,6 +138,40 @@ INTERNAL otrng_bool otrng_rsig_verify_with_usage_and_domain(
     const otrng_public_key A1, const otrng_public_key A2,
     const otrng_public_key A3, const uint8_t *msg, size_t msg_len);
 
+/**
+ * @brief One signature to be checked by otrng_rsig_verify_batch.
+ *
+ *  [sigma] The signature of knowledge.
+ *  [A1..A3] The public keys of the ring.
+ *  [msg] The message to "verify", of [msg_len] bytes.
+ */
+typedef struct rsig_batch_item_s {
+  const ring_sig_s *sigma;
+  const goldilocks_448_point_s *A1;
+  const goldilocks_448_point_s *A2;
+  const goldilocks_448_point_s *A3;
+  const uint8_t *msg;
+  size_t msg_len;
+} rsig_batch_item_s;
+
+/**
+ * @brief Verifies many signatures of knowledge, as otrng_rsig_verify does.
+ *
+ * The challenge of a ring signature is a hash of the recomputed T values,
+ * so every signature is checked on its own. There is no linear equation
+ * that a random linear combination could merge.
+ *
+ * @param [results] If not NULL, receives whether each item is valid, one entry
+ *                  per item.
+ * @param [items] The signatures to verify.
+ * @param [items_len] The number of items.
+ *
+ * @return otrng_true if every signature is valid.
+ */
+INTERNAL otrng_bool otrng_rsig_verify_batch(/*@null@*/ otrng_bool *results,
+                                            const rsig_batch_item_s *items,
+                                            size_t items_len);
+
 /**
  * @brief Zero the values of the Ring Sig.
  *
@@ -10,3 +10,38 @@ INTERNAL char *otrng_base64_encode(uint8_t *src, size_t src_len) {
 
   return dst;
 }
+
+static const char base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+INTERNAL size_t otrng_base64_encode_into(char *dst, const uint8_t *src,
+                                         size_t src_len) {
+  size_t i;
+  size_t w = 0;
+  uint32_t group;
+
+  /* Every group of three bytes is read before its four characters are
+     written. This is what makes the overlap described in base64.h safe. */
+  for (i = 0; i + 3 <= src_len; i += 3) {
+    group = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) |
+            (uint32_t)src[i + 2];
+    dst[w++] = base64_alphabet[(group >> 18) & 0x3f];
+    dst[w++] = base64_alphabet[(group >> 12) & 0x3f];
+    dst[w++] = base64_alphabet[(group >> 6) & 0x3f];
+    dst[w++] = base64_alphabet[group & 0x3f];
+  }
+
+  if (i < src_len) {
+    group = (uint32_t)src[i] << 16;
+    if (i + 1 < src_len) {
+      group |= (uint32_t)src[i + 1] << 8;
+    }
+
+    dst[w++] = base64_alphabet[(group >> 18) & 0x3f];
+    dst[w++] = base64_alphabet[(group >> 12) & 0x3f];
+    dst[w++] = i + 1 < src_len ? base64_alphabet[(group >> 6) & 0x3f] : '=';
+    dst[w++] = '=';
+  }
+
+  return w;
+}
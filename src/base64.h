@@ -18,4 +18,16 @@
 
 INTERNAL char *otrng_base64_encode(uint8_t *src, size_t src_len);
 
+/**
+ * @brief Writes the base64 encoding of [src] to [dst], without a terminating
+ * NUL, and returns the number of characters written. [dst] must have room for
+ * OTRNG_BASE64_ENCODE_LEN(src_len) characters.
+ *
+ * [src] may overlap [dst], as long as it starts at least
+ * (src_len + 2) / 3 bytes after [dst]. This allows encoding a buffer that
+ * sits at the end of its own destination.
+ */
+INTERNAL size_t otrng_base64_encode_into(char *dst, const uint8_t *src,
+                                         size_t src_len);
+
 #endif
@@ -0,0 +1,641 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* for fileno and mmap */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define OTRNG_PERSISTENCE_PRIVATE
+
+#include "alloc.h"
+#include "binary_store.h"
+#include "deserialize.h"
+#include "fingerprint.h"
+#include "persistence.h"
+#include "serialize.h"
+
+#define BINARY_STORE_MAGIC "OTRNGBS"
+#define BINARY_STORE_MAGIC_BYTES 8
+#define BINARY_STORE_HEADER_BYTES (BINARY_STORE_MAGIC_BYTES + 4 + 4)
+#define BINARY_STORE_SECTION_BYTES (8 + 4)
+#define BINARY_STORE_ENTRY_BYTES                                               \
+  (BINARY_STORE_SECTIONS * BINARY_STORE_SECTION_BYTES)
+#define BINARY_STORE_FINGERPRINT_BYTES (FPRINT_LEN_BYTES + 1 + 4)
+
+struct otrng_binary_store_s {
+  uint8_t *map;
+  size_t map_len;
+  size_t len;
+};
+
+static int compare_clients(const void *a, const void *b) {
+  const otrng_client_s *ca = *(otrng_client_s *const *)a;
+  const otrng_client_s *cb = *(otrng_client_s *const *)b;
+  int c = strcmp(ca->client_id.protocol, cb->client_id.protocol);
+
+  if (c != 0) {
+    return c;
+  }
+
+  return strcmp(ca->client_id.account, cb->client_id.account);
+}
+
+static otrng_result write_bytes(FILE *f, uint64_t *offset, const void *data,
+                                size_t len) {
+  if (len > 0 && fwrite(data, 1, len, f) != len) {
+    return OTRNG_ERROR;
+  }
+
+  *offset += len;
+
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result write_uint32(FILE *f, uint64_t *offset, uint32_t n) {
+  uint8_t buf[4];
+
+  otrng_serialize_uint32(buf, n);
+
+  return write_bytes(f, offset, buf, sizeof(buf));
+}
+
+static otrng_result write_id(FILE *f, uint64_t *offset,
+                             const otrng_client_s *client) {
+  if (!write_bytes(f, offset, client->client_id.protocol,
+                   strlen(client->client_id.protocol) + 1)) {
+    return OTRNG_ERROR;
+  }
+
+  return write_bytes(f, offset, client->client_id.account,
+                     strlen(client->client_id.account) + 1);
+}
+
+static otrng_result write_forging_key(FILE *f, uint64_t *offset,
+                                      const otrng_client_s *client) {
+  uint8_t buf[2 + ED448_POINT_BYTES];
+  size_t w;
+
+  if (!client->forging_key) {
+    return OTRNG_SUCCESS;
+  }
+
+  w = otrng_serialize_forging_key(buf, *client->forging_key);
+  if (w == 0) {
+    return OTRNG_ERROR;
+  }
+
+  return write_bytes(f, offset, buf, w);
+}
+
+static otrng_result
+write_client_profile(FILE *f, uint64_t *offset,
+                     /*@null@*/ const otrng_client_profile_s *profile) {
+  uint8_t *buf = NULL;
+  size_t w = 0;
+  otrng_result result;
+
+  if (!profile) {
+    return OTRNG_SUCCESS;
+  }
+
+  if (!otrng_client_profile_serialize_with_metadata(&buf, &w, profile)) {
+    return OTRNG_ERROR;
+  }
+
+  result = write_bytes(f, offset, buf, w);
+  otrng_free(buf);
+
+  return result;
+}
+
+static otrng_result
+write_prekey_profile(FILE *f, uint64_t *offset,
+                     /*@null@*/ otrng_prekey_profile_s *profile) {
+  uint8_t *buf = NULL;
+  size_t w = 0;
+  otrng_result result;
+
+  if (!profile) {
+    return OTRNG_SUCCESS;
+  }
+
+  if (!otrng_prekey_profile_serialize_with_metadata(&buf, &w, profile)) {
+    return OTRNG_ERROR;
+  }
+
+  result = write_bytes(f, offset, buf, w);
+  otrng_free(buf);
+
+  return result;
+}
+
+static otrng_result write_prekey_messages(FILE *f, uint64_t *offset,
+                                          const otrng_client_s *client) {
+  uint8_t *buf;
+  const list_element_s *current;
+  otrng_result result = OTRNG_SUCCESS;
+
+  if (!client->our_prekeys) {
+    return OTRNG_SUCCESS;
+  }
+
+  buf = otrng_secure_alloc(PRE_KEY_WITH_METADATA_MAX_BYTES);
+
+  for (current = client->our_prekeys; current && otrng_succeeded(result);
+       current = current->next) {
+    size_t w = 0;
+
+    result = otrng_prekey_message_serialize_with_metadata(
+        buf, PRE_KEY_WITH_METADATA_MAX_BYTES, &w, current->data);
+    if (otrng_succeeded(result)) {
+      result = write_uint32(f, offset, w);
+    }
+    if (otrng_succeeded(result)) {
+      result = write_bytes(f, offset, buf, w);
+    }
+  }
+
+  otrng_secure_free(buf);
+
+  return result;
+}
+
+static otrng_result write_fingerprints(FILE *f, uint64_t *offset,
+                                       const otrng_client_s *client) {
+  const list_element_s *current;
+
+  if (!client->fingerprints) {
+    return OTRNG_SUCCESS;
+  }
+
+  for (current = client->fingerprints->fps; current; current = current->next) {
+    const otrng_known_fingerprint_s *kf = current->data;
+    size_t username_len = strlen(kf->username);
+    uint8_t trusted = kf->trusted ? 1 : 0;
+
+    if (username_len > UINT32_MAX ||
+        !write_bytes(f, offset, kf->fp, FPRINT_LEN_BYTES) ||
+        !write_bytes(f, offset, &trusted, 1) ||
+        !write_uint32(f, offset, username_len) ||
+        !write_bytes(f, offset, kf->username, username_len)) {
+      return OTRNG_ERROR;
+    }
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result write_section(FILE *f, uint64_t *offset,
+                                  binary_store_section section,
+                                  const otrng_client_s *client) {
+  switch (section) {
+  case BINARY_STORE_ID:
+    return write_id(f, offset, client);
+  case BINARY_STORE_PRIVATE_KEY_V4:
+    if (!client->keypair) {
+      return OTRNG_SUCCESS;
+    }
+    return write_bytes(f, offset, client->keypair->sym, ED448_PRIVATE_BYTES);
+  case BINARY_STORE_FORGING_KEY:
+    return write_forging_key(f, offset, client);
+  case BINARY_STORE_CLIENT_PROFILE:
+    return write_client_profile(f, offset, client->client_profile);
+  case BINARY_STORE_EXP_CLIENT_PROFILE:
+    return write_client_profile(f, offset, client->exp_client_profile);
+  case BINARY_STORE_PREKEY_PROFILE:
+    return write_prekey_profile(f, offset, client->prekey_profile);
+  case BINARY_STORE_EXP_PREKEY_PROFILE:
+    return write_prekey_profile(f, offset, client->exp_prekey_profile);
+  case BINARY_STORE_PREKEY_MESSAGES:
+    return write_prekey_messages(f, offset, client);
+  case BINARY_STORE_FINGERPRINTS:
+    return write_fingerprints(f, offset, client);
+  case BINARY_STORE_SECTIONS:
+  default:
+    return OTRNG_ERROR;
+  }
+}
+
+static otrng_result write_client(FILE *f, uint64_t *offset, uint8_t *entry,
+                                 const otrng_client_s *client) {
+  int section;
+
+  for (section = 0; section < BINARY_STORE_SECTIONS; section++) {
+    uint64_t start = *offset;
+    uint8_t *cursor = entry + section * BINARY_STORE_SECTION_BYTES;
+
+    if (!write_section(f, offset, section, client) ||
+        *offset - start > UINT32_MAX) {
+      return OTRNG_ERROR;
+    }
+
+    cursor += otrng_serialize_uint64(cursor, start);
+    otrng_serialize_uint32(cursor, *offset - start);
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_binary_store_write(FILE *f,
+                                               otrng_client_s **clients,
+                                               size_t len) {
+  uint8_t header[BINARY_STORE_HEADER_BYTES];
+  uint8_t *index = NULL;
+  size_t index_len = len * BINARY_STORE_ENTRY_BYTES;
+  uint64_t offset = 0;
+  size_t i;
+
+  if (!f || len > UINT32_MAX) {
+    return OTRNG_ERROR;
+  }
+
+  qsort(clients, len, sizeof(otrng_client_s *), compare_clients);
+
+  memcpy(header, BINARY_STORE_MAGIC, BINARY_STORE_MAGIC_BYTES);
+  otrng_serialize_uint32(header + BINARY_STORE_MAGIC_BYTES,
+                         OTRNG_BINARY_STORE_VERSION);
+  otrng_serialize_uint32(header + BINARY_STORE_MAGIC_BYTES + 4, len);
+
+  if (len > 0) {
+    index = otrng_xmalloc_z(index_len);
+  }
+
+  /* The index is written once the offsets of the sections are known */
+  if (!write_bytes(f, &offset, header, sizeof(header)) ||
+      !write_bytes(f, &offset, index, index_len)) {
+    otrng_free(index);
+    return OTRNG_ERROR;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (!write_client(f, &offset, index + i * BINARY_STORE_ENTRY_BYTES,
+                      clients[i])) {
+      otrng_free(index);
+      return OTRNG_ERROR;
+    }
+  }
+
+  if (len > 0 && (fseek(f, BINARY_STORE_HEADER_BYTES, SEEK_SET) != 0 ||
+                  fwrite(index, 1, index_len, f) != index_len ||
+                  fseek(f, 0, SEEK_END) != 0)) {
+    otrng_free(index);
+    return OTRNG_ERROR;
+  }
+
+  otrng_free(index);
+
+  return OTRNG_SUCCESS;
+}
+
+static const uint8_t *get_entry(const otrng_binary_store_s *store, size_t i) {
+  return store->map + BINARY_STORE_HEADER_BYTES + i * BINARY_STORE_ENTRY_BYTES;
+}
+
+static void get_section(const uint8_t **data, size_t *len,
+                        const otrng_binary_store_s *store, size_t i,
+                        binary_store_section section) {
+  const uint8_t *cursor =
+      get_entry(store, i) + section * BINARY_STORE_SECTION_BYTES;
+  uint64_t offset = 0;
+  uint32_t section_len = 0;
+
+  /* Only called on entries entry_is_valid accepted */
+  (void)otrng_deserialize_uint64(&offset, cursor, 8, NULL);
+  (void)otrng_deserialize_uint32(&section_len, cursor + 8, 4, NULL);
+
+  *data = store->map + offset;
+  *len = section_len;
+}
+
+/* Entries are checked when they are read, not when the store is opened, so
+   that opening it doesn't depend on the number of clients. Only the entry and
+   the id are looked at: the record is decoded when it is loaded. */
+static otrng_bool entry_is_valid(const otrng_binary_store_s *store, size_t i) {
+  const uint8_t *entry = get_entry(store, i);
+  const uint8_t *id;
+  size_t id_len;
+  int section;
+
+  for (section = 0; section < BINARY_STORE_SECTIONS; section++) {
+    uint64_t offset = 0;
+    uint32_t len = 0;
+
+    (void)otrng_deserialize_uint64(
+        &offset, entry + section * BINARY_STORE_SECTION_BYTES, 8, NULL);
+    (void)otrng_deserialize_uint32(
+        &len, entry + section * BINARY_STORE_SECTION_BYTES + 8, 4, NULL);
+
+    if (offset > store->map_len || len > store->map_len - offset) {
+      return otrng_false;
+    }
+  }
+
+  /* Two zero-terminated strings */
+  get_section(&id, &id_len, store, i, BINARY_STORE_ID);
+  if (id_len < 2 || id[id_len - 1] != 0 ||
+      memchr(id, 0, id_len - 1) == NULL) {
+    return otrng_false;
+  }
+
+  return otrng_true;
+}
+
+INTERNAL /*@null@*/ otrng_binary_store_s *otrng_binary_store_open(FILE *f) {
+  otrng_binary_store_s *store;
+  struct stat st;
+  void *map;
+  uint32_t version = 0, len = 0;
+  int fd;
+
+  if (!f) {
+    return NULL;
+  }
+
+  fd = fileno(f);
+  if (fd < 0 || fstat(fd, &st) != 0 ||
+      st.st_size < BINARY_STORE_HEADER_BYTES) {
+    return NULL;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  store = otrng_xmalloc_z(sizeof(otrng_binary_store_s));
+  store->map = map;
+  store->map_len = st.st_size;
+
+  (void)otrng_deserialize_uint32(
+      &version, store->map + BINARY_STORE_MAGIC_BYTES, 4, NULL);
+  (void)otrng_deserialize_uint32(
+      &len, store->map + BINARY_STORE_MAGIC_BYTES + 4, 4, NULL);
+  store->len = len;
+
+  if (memcmp(store->map, BINARY_STORE_MAGIC, BINARY_STORE_MAGIC_BYTES) != 0 ||
+      version != OTRNG_BINARY_STORE_VERSION ||
+      (store->map_len - BINARY_STORE_HEADER_BYTES) / BINARY_STORE_ENTRY_BYTES <
+          store->len) {
+    otrng_binary_store_free(store);
+    return NULL;
+  }
+
+  return store;
+}
+
+INTERNAL void otrng_binary_store_free(otrng_binary_store_s *store) {
+  if (!store) {
+    return;
+  }
+
+  munmap(store->map, store->map_len);
+  otrng_free(store);
+}
+
+INTERNAL size_t otrng_binary_store_len(const otrng_binary_store_s *store) {
+  return store->len;
+}
+
+INTERNAL otrng_bool otrng_binary_store_client_id(
+    otrng_client_id_s *client_id, const otrng_binary_store_s *store, size_t i) {
+  const uint8_t *id;
+  size_t id_len;
+
+  if (!entry_is_valid(store, i)) {
+    return otrng_false;
+  }
+
+  get_section(&id, &id_len, store, i, BINARY_STORE_ID);
+  client_id->protocol = (const char *)id;
+  client_id->account = client_id->protocol + strlen(client_id->protocol) + 1;
+
+  return otrng_true;
+}
+
+static otrng_bool find_client(size_t *i, const otrng_binary_store_s *store,
+                              const otrng_client_id_s client_id) {
+  size_t low = 0, high = store->len;
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    otrng_client_id_s id;
+    int c;
+
+    if (!otrng_binary_store_client_id(&id, store, middle)) {
+      return otrng_false;
+    }
+
+    c = strcmp(client_id.protocol, id.protocol);
+
+    if (c == 0) {
+      c = strcmp(client_id.account, id.account);
+    }
+
+    if (c == 0) {
+      *i = middle;
+      return otrng_true;
+    }
+
+    if (c < 0) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+
+  return otrng_false;
+}
+
+static otrng_result load_private_key_v4(otrng_client_s *client,
+                                        const uint8_t *data, size_t len) {
+  if (len != ED448_PRIVATE_BYTES) {
+    return OTRNG_ERROR;
+  }
+
+  otrng_keypair_free(client->keypair);
+  client->keypair = NULL;
+
+  return otrng_client_add_private_key_v4(client, data);
+}
+
+static otrng_result load_prekey_messages(otrng_client_s *client,
+                                         const uint8_t *data, size_t len) {
+  otrng_client_forget_my_prekey_messages(client);
+
+  while (len > 0) {
+    uint32_t msg_len = 0;
+
+    if (!otrng_deserialize_uint32(&msg_len, data, len, NULL) ||
+        msg_len > len - 4) {
+      return OTRNG_ERROR;
+    }
+
+    if (!otrng_client_prekey_message_deserialize_into(client, data + 4,
+                                                      msg_len)) {
+      return OTRNG_ERROR;
+    }
+
+    data += 4 + msg_len;
+    len -= 4 + msg_len;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+static otrng_result load_fingerprints(otrng_client_s *client,
+                                      const uint8_t *data, size_t len) {
+  otrng_known_fingerprints_free(client->fingerprints);
+  client->fingerprints = otrng_known_fingerprints_new();
+
+  while (len > 0) {
+    otrng_known_fingerprint_s *kf;
+    uint32_t username_len = 0;
+
+    if (len < BINARY_STORE_FINGERPRINT_BYTES) {
+      return OTRNG_ERROR;
+    }
+
+    (void)otrng_deserialize_uint32(&username_len, data + FPRINT_LEN_BYTES + 1,
+                                   4, NULL);
+    if (username_len > len - BINARY_STORE_FINGERPRINT_BYTES) {
+      return OTRNG_ERROR;
+    }
+
+    kf = otrng_xmalloc_z(sizeof(otrng_known_fingerprint_s));
+    memcpy(kf->fp, data, FPRINT_LEN_BYTES);
+    kf->trusted = data[FPRINT_LEN_BYTES] ? otrng_true : otrng_false;
+    kf->username = otrng_xmalloc(username_len + 1);
+    memcpy(kf->username, data + BINARY_STORE_FINGERPRINT_BYTES, username_len);
+    kf->username[username_len] = '\0';
+
+    otrng_known_fingerprints_add(client->fingerprints, kf);
+
+    data += BINARY_STORE_FINGERPRINT_BYTES + username_len;
+    len -= BINARY_STORE_FINGERPRINT_BYTES + username_len;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+/* An empty section is state the client doesn't have */
+static void clear_section(otrng_client_s *client,
+                          binary_store_section section) {
+  switch (section) {
+  case BINARY_STORE_PRIVATE_KEY_V4:
+    otrng_keypair_free(client->keypair);
+    client->keypair = NULL;
+    break;
+  case BINARY_STORE_FORGING_KEY:
+    if (client->forging_key) {
+      otrng_ec_point_destroy(*client->forging_key);
+      otrng_free(client->forging_key);
+      client->forging_key = NULL;
+    }
+    break;
+  case BINARY_STORE_CLIENT_PROFILE:
+    otrng_client_profile_free(client->client_profile);
+    client->client_profile = NULL;
+    break;
+  case BINARY_STORE_EXP_CLIENT_PROFILE:
+    otrng_client_profile_free(client->exp_client_profile);
+    client->exp_client_profile = NULL;
+    break;
+  case BINARY_STORE_PREKEY_PROFILE:
+    otrng_prekey_profile_free(client->prekey_profile);
+    client->prekey_profile = NULL;
+    break;
+  case BINARY_STORE_EXP_PREKEY_PROFILE:
+    otrng_prekey_profile_free(client->exp_prekey_profile);
+    client->exp_prekey_profile = NULL;
+    break;
+  case BINARY_STORE_PREKEY_MESSAGES:
+    otrng_client_forget_my_prekey_messages(client);
+    break;
+  case BINARY_STORE_FINGERPRINTS:
+    otrng_known_fingerprints_free(client->fingerprints);
+    client->fingerprints = otrng_known_fingerprints_new();
+    break;
+  case BINARY_STORE_ID:
+  case BINARY_STORE_SECTIONS:
+  default:
+    break;
+  }
+}
+
+static otrng_result load_section(otrng_client_s *client,
+                                 binary_store_section section,
+                                 const uint8_t *data, size_t len) {
+  switch (section) {
+  case BINARY_STORE_ID:
+    return OTRNG_SUCCESS;
+  case BINARY_STORE_PRIVATE_KEY_V4:
+    return load_private_key_v4(client, data, len);
+  case BINARY_STORE_FORGING_KEY:
+    return otrng_client_forging_key_deserialize_into(client, data, len);
+  case BINARY_STORE_CLIENT_PROFILE:
+    return otrng_client_client_profile_deserialize_into(client, data, len);
+  case BINARY_STORE_EXP_CLIENT_PROFILE:
+    return otrng_client_expired_client_profile_deserialize_into(client, data,
+                                                                len);
+  case BINARY_STORE_PREKEY_PROFILE:
+    return otrng_client_prekey_profile_deserialize_into(client, data, len);
+  case BINARY_STORE_EXP_PREKEY_PROFILE:
+    return otrng_client_expired_prekey_profile_deserialize_into(client, data,
+                                                                len);
+  case BINARY_STORE_PREKEY_MESSAGES:
+    return load_prekey_messages(client, data, len);
+  case BINARY_STORE_FINGERPRINTS:
+    return load_fingerprints(client, data, len);
+  case BINARY_STORE_SECTIONS:
+  default:
+    return OTRNG_ERROR;
+  }
+}
+
+INTERNAL otrng_result otrng_binary_store_load_client(
+    const otrng_binary_store_s *store, otrng_client_s *client) {
+  size_t i;
+  int section;
+
+  if (!find_client(&i, store, client->client_id)) {
+    return OTRNG_ERROR;
+  }
+
+  for (section = 0; section < BINARY_STORE_SECTIONS; section++) {
+    const uint8_t *data;
+    size_t len;
+
+    get_section(&data, &len, store, i, section);
+    if (len == 0) {
+      clear_section(client, section);
+      continue;
+    }
+
+    if (!load_section(client, section, data, len)) {
+      return OTRNG_ERROR;
+    }
+  }
+
+  return OTRNG_SUCCESS;
+}
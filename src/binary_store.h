@@ -0,0 +1,144 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A binary alternative to the text files of persistence.c, holding the state
+ * of many clients in one file: their long-term and forging keys, their client
+ * and prekey profiles (current and expired), their prekey messages and their
+ * known fingerprints. Instance tags and OTRv3 keys are stored by libotr, and
+ * are not part of it.
+ *
+ * The file is mapped into memory and nothing is decoded or checked when it is
+ * opened: a client's index entry is only checked when it is read, and its
+ * record only decoded when it is loaded, so opening a store costs the same for
+ * any number of clients.
+ *
+ * The format, with every integer in big endian:
+ *
+ *   header  "OTRNGBS\0", the version (4 bytes), the number of clients
+ *           (4 bytes).
+ *   index   one fixed-size entry per client, sorted by protocol and then by
+ *           account. An entry holds the offset and the length (8 and 4 bytes)
+ *           of each of the client's sections, in the order of
+ *           binary_store_section.
+ *   data    the sections. The id is the protocol and the account, each one
+ *           followed by a zero byte. The private key is the symmetric key.
+ *           The forging key, profiles and prekey messages are serialized as
+ *           in the text files. Prekey messages are each preceded by their
+ *           length (4 bytes), and fingerprints are the fingerprint, a
+ *           trusted byte, the length of the username (4 bytes) and the
+ *           username. An empty section is one the client doesn't have.
+ *
+ * A store doesn't change once opened, so it can be read from different
+ * threads at the same time.
+ */
+
+#ifndef OTRNG_BINARY_STORE_H
+#define OTRNG_BINARY_STORE_H
+
+#include <stdio.h>
+
+#include "client.h"
+#include "error.h"
+#include "shared.h"
+
+#define OTRNG_BINARY_STORE_VERSION 1
+
+typedef enum {
+  BINARY_STORE_ID = 0,
+  BINARY_STORE_PRIVATE_KEY_V4 = 1,
+  BINARY_STORE_FORGING_KEY = 2,
+  BINARY_STORE_CLIENT_PROFILE = 3,
+  BINARY_STORE_EXP_CLIENT_PROFILE = 4,
+  BINARY_STORE_PREKEY_PROFILE = 5,
+  BINARY_STORE_EXP_PREKEY_PROFILE = 6,
+  BINARY_STORE_PREKEY_MESSAGES = 7,
+  BINARY_STORE_FINGERPRINTS = 8,
+  BINARY_STORE_SECTIONS = 9
+} binary_store_section;
+
+typedef struct otrng_binary_store_s otrng_binary_store_s;
+
+/**
+ * @brief Writes the state of the given clients as a binary store. The clients
+ * are sorted in place.
+ *
+ * @param [f]        An empty file, open for writing. It must be seekable.
+ * @param [clients]  The clients.
+ * @param [len]      The number of clients.
+ */
+INTERNAL otrng_result otrng_binary_store_write(FILE *f,
+                                               otrng_client_s **clients,
+                                               size_t len);
+
+/**
+ * @brief Maps a binary store into memory. The file can be closed afterwards,
+ * but must not be changed while the store is open: write a new one and rename
+ * it over the old one instead.
+ *
+ * @param [f]   The file, open for reading.
+ *
+ * @return The store, or NULL if the file can't be mapped or isn't a binary
+ * store of a known version.
+ */
+INTERNAL /*@null@*/ otrng_binary_store_s *otrng_binary_store_open(FILE *f);
+
+/**
+ * @brief Unmaps and frees a store.
+ *
+ * @param [store]   The store.
+ */
+INTERNAL void otrng_binary_store_free(/*@null@*/ otrng_binary_store_s *store);
+
+/**
+ * @brief The number of clients in a store.
+ *
+ * @param [store]   The store.
+ */
+INTERNAL size_t otrng_binary_store_len(const otrng_binary_store_s *store);
+
+/**
+ * @brief The id of a client in a store. Its strings point into the store.
+ *
+ * @param [client_id]   Where the id is written.
+ * @param [store]       The store.
+ * @param [i]           The position of the client, under
+ *                      otrng_binary_store_len.
+ *
+ * @return otrng_false if the index entry of the client is corrupt.
+ */
+INTERNAL otrng_bool otrng_binary_store_client_id(
+    otrng_client_id_s *client_id, const otrng_binary_store_s *store, size_t i);
+
+/**
+ * @brief Decodes the record with the client's id into the client. What the
+ * record holds replaces what the client has, and what it doesn't hold is
+ * cleared from the client.
+ *
+ * @param [store]   The store.
+ * @param [client]  The client.
+ *
+ * @return OTRNG_ERROR if the store has no record for the client, or the
+ * record can't be decoded.
+ */
+INTERNAL otrng_result otrng_binary_store_load_client(
+    const otrng_binary_store_s *store, otrng_client_s *client);
+
+#endif
@@ -26,6 +26,8 @@
 #endif
 
 #include <assert.h>
+#include <sodium.h>
+#include <string.h>
 #include <time.h>
 
 #define OTRNG_CLIENT_PRIVATE
@@ -33,6 +35,7 @@
 #include "alloc.h"
 #include "client.h"
 #include "client_callbacks.h"
+#include "client_orchestration.h"
 #include "debug.h"
 #include "deserialize.h"
 #include "instance_tag.h"
@@ -43,6 +46,8 @@
 
 #define MAX_NUMBER_PUBLISHED_PREKEY_MSGS 255
 #define HEARTBEAT_INTERVAL 60
+#define CONVERSATIONS_MIN_CAPACITY 16
+#define PREKEY_MESSAGES_MIN_CAPACITY 16
 
 tstatic otrng_conversation_s *new_conversation_with(const char *recipient,
                                                     otrng_s *conn) {
@@ -100,6 +105,8 @@ API otrng_client_s *otrng_client_new(const otrng_client_id_s client_id) {
 #define FRAGMENTS_EXPIRATION_SECONDS 1 * 7 * 24 * 60 * 60; /* 1 weeks */
   client->fragments_exp_time = FRAGMENTS_EXPIRATION_SECONDS;
 
+  pthread_mutex_init(&client->lock, NULL);
+
   return client;
 }
 
@@ -118,10 +125,12 @@ API void otrng_client_free(otrng_client_s *client) {
   }
   otrng_free(client->forging_key);
   otrng_list_free(client->our_prekeys, prekey_message_free_from_list);
+  otrng_free(client->our_prekeys_index.slots);
   otrng_client_profile_free(client->client_profile);
   otrng_client_profile_free(client->exp_client_profile);
   otrng_prekey_profile_free(client->prekey_profile);
   otrng_prekey_profile_free(client->exp_prekey_profile);
+  conversations_index_free(client->conversations_index);
   otrng_list_free(client->conversations, conversation_free);
   if (client->fingerprints) {
     otrng_known_fingerprints_free(client->fingerprints);
@@ -131,26 +140,196 @@ API void otrng_client_free(otrng_client_s *client) {
 
   otrng_prekey_manager_free(client->prekey_manager);
 
+  pthread_mutex_destroy(&client->lock);
   otrng_free(client);
 }
 
-// TODO: @instance_tag There may be multiple conversations with the same
-// recipient if they use multiple instance tags. We are not allowing this yet.
-tstatic /*@null@*/ otrng_conversation_s *
-get_conversation_with(const char *recipient, list_element_s *conversations) {
-  const list_element_s *el = NULL;
-  otrng_conversation_s *conv = NULL;
+API void otrng_client_lock(otrng_client_s *client) {
+  pthread_mutex_lock(&client->lock);
+}
 
-  for (el = conversations; el; el = el->next) {
-    conv = el->data;
-    if (!strcmp(conv->recipient, recipient)) {
-      return conv;
+API void otrng_client_unlock(otrng_client_s *client) {
+  pthread_mutex_unlock(&client->lock);
+}
+
+tstatic conversations_index_s *conversations_index_new(void) {
+  conversations_index_s *index =
+      otrng_xmalloc_z(sizeof(conversations_index_s));
+
+  /* Recipients come from the network, so the table is keyed to keep them
+   * from forcing collisions. */
+  randombytes_buf(index->hash_key, CONVERSATIONS_HASH_KEY_BYTES);
+
+  return index;
+}
+
+/* The conversations themselves are owned by the list */
+tstatic void conversations_index_free(conversations_index_s *index) {
+  if (!index) {
+    return;
+  }
+
+  otrng_free(index->slots);
+  otrng_free(index);
+}
+
+static uint64_t conversations_index_hash(const conversations_index_s *index,
+                                         const char *recipient) {
+  uint8_t out[crypto_shorthash_BYTES];
+  uint64_t hash = 0;
+  size_t i;
+
+  crypto_shorthash(out, (const uint8_t *)recipient, strlen(recipient),
+                   index->hash_key);
+
+  for (i = 0; i < crypto_shorthash_BYTES; i++) {
+    hash = (hash << 8) | out[i];
+  }
+
+  return hash;
+}
+
+static void insert_conversation_slot(conversations_slot_s *slots,
+                                     size_t capacity, uint64_t hash,
+                                     otrng_conversation_s *conv) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)(hash & mask);
+
+  while (slots[i].conv) {
+    i = (i + 1) & mask;
+  }
+
+  slots[i].hash = hash;
+  slots[i].conv = conv;
+}
+
+static void conversations_index_grow(conversations_index_s *index) {
+  size_t capacity =
+      index->capacity ? index->capacity * 2 : CONVERSATIONS_MIN_CAPACITY;
+  conversations_slot_s *slots =
+      otrng_xmalloc_z(capacity * sizeof(conversations_slot_s));
+  size_t i;
+
+  for (i = 0; i < index->capacity; i++) {
+    if (index->slots[i].conv) {
+      insert_conversation_slot(slots, capacity, index->slots[i].hash,
+                               index->slots[i].conv);
+    }
+  }
+
+  otrng_free(index->slots);
+  index->slots = slots;
+  index->capacity = capacity;
+}
+
+tstatic void conversations_index_add(conversations_index_s *index,
+                                     otrng_conversation_s *conv) {
+  /* Keep the load factor under 3/4 */
+  if ((index->len + 1) * 4 > index->capacity * 3) {
+    conversations_index_grow(index);
+  }
+
+  insert_conversation_slot(index->slots, index->capacity,
+                           conversations_index_hash(index, conv->recipient),
+                           conv);
+  index->len++;
+}
+
+static /*@null@*/ conversations_slot_s *
+find_conversation_slot(const conversations_index_s *index,
+                       const char *recipient) {
+  size_t mask, i;
+  uint64_t hash;
+
+  if (!index || index->len == 0) {
+    return NULL;
+  }
+
+  mask = index->capacity - 1;
+  hash = conversations_index_hash(index, recipient);
+  i = (size_t)(hash & mask);
+
+  while (index->slots[i].conv) {
+    if (index->slots[i].hash == hash &&
+        strcmp(index->slots[i].conv->recipient, recipient) == 0) {
+      return &index->slots[i];
     }
+
+    i = (i + 1) & mask;
   }
 
   return NULL;
 }
 
+tstatic /*@null@*/ otrng_conversation_s *
+conversations_index_get(const conversations_index_s *index,
+                        const char *recipient) {
+  conversations_slot_s *slot = find_conversation_slot(index, recipient);
+
+  return slot ? slot->conv : NULL;
+}
+
+tstatic void conversations_index_remove(conversations_index_s *index,
+                                        const otrng_conversation_s *conv) {
+  conversations_slot_s *slot = find_conversation_slot(index, conv->recipient);
+  size_t mask, i, j;
+
+  if (!slot || slot->conv != conv) {
+    return;
+  }
+
+  mask = index->capacity - 1;
+  i = (size_t)(slot - index->slots);
+  j = i;
+
+  /* Backward shift deletion, as in the skipped keys store */
+  for (;;) {
+    size_t ideal;
+
+    j = (j + 1) & mask;
+    if (!index->slots[j].conv) {
+      break;
+    }
+
+    ideal = (size_t)(index->slots[j].hash & mask);
+    if (((j - ideal) & mask) >= ((j - i) & mask)) {
+      index->slots[i] = index->slots[j];
+      i = j;
+    }
+  }
+
+  index->slots[i].conv = NULL;
+  index->slots[i].hash = 0;
+  index->len--;
+}
+
+tstatic void add_conversation(otrng_client_s *client,
+                              otrng_conversation_s *conv) {
+  list_element_s *element;
+
+  if (!client->conversations_index) {
+    client->conversations_index = conversations_index_new();
+  }
+
+  conversations_index_add(client->conversations_index, conv);
+
+  /* Appending through the tail keeps this constant time */
+  element = otrng_list_add(conv, NULL);
+  if (client->last_conversation) {
+    client->last_conversation->next = element;
+  } else {
+    client->conversations = element;
+  }
+  client->last_conversation = element;
+}
+
+// TODO: @instance_tag There may be multiple conversations with the same
+// recipient if they use multiple instance tags. We are not allowing this yet.
+tstatic /*@null@*/ otrng_conversation_s *
+get_conversation_with(const char *recipient, const otrng_client_s *client) {
+  return conversations_index_get(client->conversations_index, recipient);
+}
+
 tstatic otrng_policy_s get_policy_for(otrng_client_s *client) {
   const otrng_client_callbacks_s *cb = client->global_state->callbacks;
   otrng_policy_s policy = otrng_client_callbacks_define_policy(cb, client);
@@ -206,6 +385,9 @@ create_connection_for(const char *recipient, otrng_client_s *client) {
     return NULL;
   }
 
+  /* Whatever a lazy orchestration deferred is needed from here on */
+  (void)otrng_client_materialize(client, OTRNG_CLIENT_STATE_ALL);
+
   conn = otrng_new(client, get_policy_for(client));
   if (!conn) {
     otrng_v3_conn_free(v3_conn);
@@ -225,7 +407,7 @@ get_or_create_conversation_with(const char *recipient, otrng_client_s *client) {
   otrng_conversation_s *conv = NULL;
   otrng_s *conn = NULL;
 
-  conv = get_conversation_with(recipient, client->conversations);
+  conv = get_conversation_with(recipient, client);
   if (conv) {
     return conv;
   }
@@ -241,7 +423,7 @@ get_or_create_conversation_with(const char *recipient, otrng_client_s *client) {
     return NULL;
   }
 
-  client->conversations = otrng_list_add(conv, client->conversations);
+  add_conversation(client, conv);
 
   return conv;
 }
@@ -253,7 +435,7 @@ otrng_client_get_conversation(int force_create, const char *recipient,
     return get_or_create_conversation_with(recipient, client);
   }
 
-  return get_conversation_with(recipient, client->conversations);
+  return get_conversation_with(recipient, client);
 }
 
 // TODO: @client this should allow TLVs to be added to the message
@@ -363,6 +545,205 @@ API otrng_result otrng_client_send(char **new_msg, const char *msg,
   return send_message(new_msg, msg, recipient, client);
 }
 
+API otrng_result otrng_client_send_into(char *buf, size_t buf_len,
+                                        size_t *written, const char *msg,
+                                        const char *recipient,
+                                        otrng_client_s *client) {
+  otrng_conversation_s *conv = NULL;
+  char *to_send = NULL;
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+  size_t len;
+  otrng_result result;
+
+  conv = get_or_create_conversation_with(recipient, client);
+  if (!conv) {
+    return OTRNG_ERROR;
+  }
+
+  if (conv->conn->running_version == OTRNG_PROTOCOL_VERSION_4 &&
+      conv->conn->state == OTRNG_STATE_ENCRYPTED_MESSAGES) {
+    if (!otrng_prepare_data_message_plaintext(&plaintext, &plaintext_len, msg,
+                                              NULL, conv->conn)) {
+      return OTRNG_ERROR;
+    }
+
+    result = otrng_send_data_message_plaintext_into(
+        buf, buf_len, written, plaintext, plaintext_len, conv->conn, 0);
+    otrng_free(plaintext);
+    otrng_schedule_session_expiry(conv->conn);
+
+    return result;
+  }
+
+  if (!otrng_send_message(&to_send, msg, NULL, 0, conv->conn)) {
+    otrng_free(to_send);
+    return OTRNG_ERROR;
+  }
+
+  len = to_send ? strlen(to_send) : 0;
+  if (len + 1 > buf_len) {
+    otrng_free(to_send);
+    if (written) {
+      *written = len + 1;
+    }
+    return OTRNG_ERROR;
+  }
+
+  if (to_send) {
+    memcpy(buf, to_send, len);
+  }
+  buf[len] = '\0';
+  otrng_free(to_send);
+
+  if (written) {
+    *written = len;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+typedef struct send_many_context_s {
+  char **results;
+  otrng_conversation_s **batched;
+  const uint8_t *plaintext;
+  size_t plaintext_len;
+  otrng_bool *failed;
+} send_many_context_s;
+
+static void send_many_task(void *data, size_t index) {
+  send_many_context_s *ctx = data;
+  otrng_s *conn;
+
+  if (!ctx->batched[index]) {
+    return;
+  }
+
+  conn = ctx->batched[index]->conn;
+  if (!otrng_send_data_message_plaintext(&ctx->results[index], ctx->plaintext,
+                                         ctx->plaintext_len, conn, 0)) {
+    ctx->failed[index] = otrng_true;
+  }
+}
+
+static otrng_bool already_batched(otrng_conversation_s *conv,
+                                  otrng_conversation_s **batched,
+                                  size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if (batched[i] == conv) {
+      return otrng_true;
+    }
+  }
+
+  return otrng_false;
+}
+
+API otrng_result otrng_client_send_many(char ***new_msgs, const char *msg,
+                                        const char *const *recipients,
+                                        size_t recipients_len,
+                                        const otrng_client_thread_pool_s *pool,
+                                        otrng_client_s *client) {
+  send_many_context_s ctx;
+  otrng_conversation_s *first = NULL;
+  uint8_t *plaintext = NULL;
+  size_t plaintext_len = 0;
+  otrng_result result = OTRNG_SUCCESS;
+  size_t i;
+
+  *new_msgs = NULL;
+  if (recipients_len == 0) {
+    return OTRNG_SUCCESS;
+  }
+
+  if (recipients_len > SIZE_MAX / sizeof(otrng_conversation_s *)) {
+    return OTRNG_ERROR;
+  }
+
+  ctx.results = otrng_xmalloc_z(recipients_len * sizeof(char *));
+  ctx.batched =
+      otrng_xmalloc_z(recipients_len * sizeof(otrng_conversation_s *));
+  ctx.failed = otrng_xmalloc_z(recipients_len * sizeof(otrng_bool));
+
+  /* Conversations are looked up or created serially. Only v4 conversations in
+     the encrypted state share the plaintext; anything else (v3, not yet
+     started) takes the regular path after the batch. With a pool, a
+     conversation repeated in [recipients] is also sent after the batch, so
+     that it is never ratcheted from two threads at once. */
+  for (i = 0; i < recipients_len; i++) {
+    otrng_conversation_s *conv =
+        get_or_create_conversation_with(recipients[i], client);
+    if (!conv) {
+      ctx.failed[i] = otrng_true;
+      continue;
+    }
+
+    if (conv->conn->running_version == OTRNG_PROTOCOL_VERSION_4 &&
+        conv->conn->state == OTRNG_STATE_ENCRYPTED_MESSAGES &&
+        !(pool && already_batched(conv, ctx.batched, i))) {
+      ctx.batched[i] = conv;
+      if (!first) {
+        first = conv;
+      }
+    }
+  }
+
+  if (first && !otrng_prepare_data_message_plaintext(
+                   &plaintext, &plaintext_len, msg, NULL, first->conn)) {
+    for (i = 0; i < recipients_len; i++) {
+      if (ctx.batched[i]) {
+        ctx.batched[i] = NULL;
+        ctx.failed[i] = otrng_true;
+      }
+    }
+  }
+
+  ctx.plaintext = plaintext;
+  ctx.plaintext_len = plaintext_len;
+
+  if (pool && first) {
+    pool->run(pool->pool_data, send_many_task, &ctx, recipients_len);
+  } else if (first) {
+    for (i = 0; i < recipients_len; i++) {
+      send_many_task(&ctx, i);
+    }
+  }
+
+  otrng_free(plaintext);
+
+  /* Not from the tasks, so that the pool threads only touch their session */
+  for (i = 0; i < recipients_len; i++) {
+    if (ctx.batched[i]) {
+      otrng_schedule_session_expiry(ctx.batched[i]->conn);
+    }
+  }
+
+  for (i = 0; i < recipients_len; i++) {
+    if (ctx.batched[i] || ctx.failed[i]) {
+      continue;
+    }
+
+    if (!send_message(&ctx.results[i], msg, recipients[i], client)) {
+      ctx.failed[i] = otrng_true;
+    }
+  }
+
+  for (i = 0; i < recipients_len; i++) {
+    if (ctx.failed[i]) {
+      otrng_free(ctx.results[i]);
+      ctx.results[i] = NULL;
+      result = OTRNG_ERROR;
+    }
+  }
+
+  otrng_free(ctx.batched);
+  otrng_free(ctx.failed);
+  *new_msgs = ctx.results;
+
+  return result;
+}
+
 API otrng_result otrng_client_send_non_interactive_auth(
     char **new_msg, const prekey_ensemble_s *ensemble, const char *recipient,
     otrng_client_s *client) {
@@ -497,11 +878,57 @@ API otrng_result otrng_client_receive(char **new_msg, char **to_display,
   return result;
 }
 
+API otrng_result otrng_client_receive_plaintext(char **new_msg,
+                                                otrng_plaintext_s *plaintext,
+                                                const char *msg,
+                                                const char *recipient,
+                                                otrng_client_s *client,
+                                                otrng_bool *should_ignore) {
+  otrng_result result;
+  otrng_response_s *response = NULL;
+  otrng_conversation_s *conv = NULL;
+
+  *should_ignore = otrng_false;
+  memset(plaintext, 0, sizeof(otrng_plaintext_s));
+
+  if (!client || !new_msg) {
+    return OTRNG_ERROR;
+  }
+
+  *new_msg = NULL;
+
+  conv = get_or_create_conversation_with(recipient, client);
+  if (!conv) {
+    *should_ignore = otrng_true;
+    return OTRNG_SUCCESS;
+  }
+
+  response = otrng_response_new();
+  response->borrow_plaintext = otrng_true;
+
+  result = otrng_receive_message(response, msg, conv->conn);
+
+  if (response->to_send) {
+    *new_msg = response->to_send;
+    response->to_send = NULL;
+  }
+
+  otrng_response_take_plaintext(plaintext, response);
+  otrng_response_free(response);
+
+  if (plaintext->text_len) {
+    return OTRNG_SUCCESS;
+  }
+
+  return result;
+}
+
 tstatic void destroy_client_conversation(const otrng_conversation_s *conv,
                                          otrng_client_s *client) {
-  list_element_s *elem = otrng_list_get_by_value(conv, client->conversations);
-  client->conversations =
-      otrng_list_remove_element(elem, client->conversations);
+  list_element_s *elem = otrng_list_unlink(conv, &client->conversations,
+                                           &client->last_conversation);
+
+  conversations_index_remove(client->conversations_index, conv);
   otrng_list_free_nodes(elem);
 }
 
@@ -519,8 +946,7 @@ INTERNAL otrng_result otrng_client_disconnect_conversation(
 
 API otrng_result otrng_client_disconnect(char **new_msg, const char *recipient,
                                          otrng_client_s *client) {
-  otrng_conversation_s *conv =
-      get_conversation_with(recipient, client->conversations);
+  otrng_conversation_s *conv = get_conversation_with(recipient, client);
   if (!conv) {
     return OTRNG_ERROR;
   }
@@ -533,22 +959,30 @@ tstatic uint32_t get_session_expiry_time_from(otrng_s *otr) {
 
 INTERNAL void otrng_client_expire_session(otrng_conversation_s *conv) {
   string_p msg = NULL;
-  otrng_result res;
   otrng_expiration_policy expiration_policy = OTRNG_SESSION_EXPIRY_DO_TEARDOWN;
   otrng_s *otr = conv->conn;
+  otrng_client_s *client = otr->client;
+  const otrng_client_callbacks_s *callbacks = client->global_state->callbacks;
 
-  if (otr->client->global_state->callbacks->session_expiration_policy_for) {
-    expiration_policy =
-        otr->client->global_state->callbacks->session_expiration_policy_for(
-            otr);
+  if (callbacks->session_expiration_policy_for) {
+    expiration_policy = callbacks->session_expiration_policy_for(otr);
   }
 
   switch (expiration_policy) {
   case OTRNG_SESSION_EXPIRY_DO_TEARDOWN:
-    res = otrng_client_disconnect_conversation(&msg, conv);
-    if (msg != NULL && !otrng_failed(res)) {
-      otr->client->global_state->callbacks->inject_message(otr, msg);
+    /* As otrng_client_disconnect_conversation, but the message is injected
+     * while [otr] is still alive */
+    if (otrng_failed(otrng_close(&msg, otr))) {
+      otrng_free(msg);
+      break;
     }
+
+    if (msg != NULL) {
+      callbacks->inject_message(otr, msg);
+    }
+
+    destroy_client_conversation(conv, client);
+    conversation_free(conv);
     break;
   case OTRNG_SESSION_EXPIRY_DO_NOTHING:
     break;
@@ -584,6 +1018,17 @@ INTERNAL void otrng_client_expire_sessions(otrng_client_s *client) {
   }
 }
 
+INTERNAL void otrng_client_expire_session_of(otrng_s *otr) {
+  otrng_conversation_s *conv = get_conversation_with(otr->peer, otr->client);
+
+  if (!conv || conv->conn != otr ||
+      otr->state != OTRNG_STATE_ENCRYPTED_MESSAGES) {
+    return;
+  }
+
+  otrng_client_expire_session(conv);
+}
+
 INTERNAL otrng_result otrng_client_expire_fragments(otrng_client_s *client) {
   const list_element_s *el = NULL;
   otrng_conversation_s *conv = NULL;
@@ -593,7 +1038,7 @@ INTERNAL otrng_result otrng_client_expire_fragments(otrng_client_s *client) {
   for (el = client->conversations; el; el = el->next) {
     conv = el->data;
     if (otrng_failed(otrng_expire_fragments(now, client->fragments_exp_time,
-                                            &conv->conn->pending_fragments))) {
+                                            conv->conn->pending_fragments))) {
       return OTRNG_ERROR;
     }
   }
@@ -601,7 +1046,7 @@ INTERNAL otrng_result otrng_client_expire_fragments(otrng_client_s *client) {
   if (client->prekey_manager) {
     if (otrng_failed(otrng_expire_fragments(
             now, client->fragments_exp_time,
-            &client->prekey_manager->pending_fragments))) {
+            client->prekey_manager->pending_fragments))) {
       return OTRNG_ERROR;
     }
   }
@@ -609,9 +1054,11 @@ INTERNAL otrng_result otrng_client_expire_fragments(otrng_client_s *client) {
   return OTRNG_SUCCESS;
 }
 
-API otrng_result otrng_client_get_our_fingerprint(
-    otrng_fingerprint fp, const otrng_client_s *client) {
-  if (!client->keypair) {
+API otrng_result otrng_client_get_our_fingerprint(otrng_fingerprint fp,
+                                                  otrng_client_s *client) {
+  (void)otrng_client_materialize(client, OTRNG_CLIENT_STATE_LONG_TERM_KEY |
+                                             OTRNG_CLIENT_STATE_FORGING_KEY);
+  if (!client->keypair || !client->forging_key) {
     return OTRNG_ERROR;
   }
 
@@ -626,13 +1073,152 @@ otrng_client_get_client_profile_exp_time(otrng_client_s *client) {
   return client->client_profile_exp_time;
 }
 
+/* Prekey message ids are drawn at random by us, so they are used as their
+ * own hash. */
+static void insert_prekey_message_slot(prekey_messages_slot_s *slots,
+                                       size_t capacity, uint32_t id,
+                                       list_element_s *node) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)(id & mask);
+
+  while (slots[i].node) {
+    i = (i + 1) & mask;
+  }
+
+  slots[i].id = id;
+  slots[i].node = node;
+}
+
+static void prekey_messages_index_grow(prekey_messages_index_s *index) {
+  size_t capacity =
+      index->capacity ? index->capacity * 2 : PREKEY_MESSAGES_MIN_CAPACITY;
+  prekey_messages_slot_s *slots =
+      otrng_xmalloc_z(capacity * sizeof(prekey_messages_slot_s));
+  size_t i;
+
+  for (i = 0; i < index->capacity; i++) {
+    if (index->slots[i].node) {
+      insert_prekey_message_slot(slots, capacity, index->slots[i].id,
+                                 index->slots[i].node);
+    }
+  }
+
+  otrng_free(index->slots);
+  index->slots = slots;
+  index->capacity = capacity;
+}
+
+static /*@null@*/ prekey_messages_slot_s *
+find_prekey_message_slot(const prekey_messages_index_s *index, uint32_t id) {
+  size_t mask, i;
+
+  if (index->len == 0) {
+    return NULL;
+  }
+
+  mask = index->capacity - 1;
+  i = (size_t)(id & mask);
+
+  while (index->slots[i].node) {
+    if (index->slots[i].id == id) {
+      return &index->slots[i];
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+static void prekey_messages_index_add(prekey_messages_index_s *index,
+                                      list_element_s *node) {
+  const prekey_message_s *msg = node->data;
+
+  /* On a repeated id, lookups keep finding the first one stored */
+  if (find_prekey_message_slot(index, msg->id)) {
+    return;
+  }
+
+  /* Keep the load factor under 3/4 */
+  if ((index->len + 1) * 4 > index->capacity * 3) {
+    prekey_messages_index_grow(index);
+  }
+
+  insert_prekey_message_slot(index->slots, index->capacity, msg->id, node);
+  index->len++;
+}
+
+static void prekey_messages_index_remove(prekey_messages_index_s *index,
+                                         prekey_messages_slot_s *slot) {
+  size_t mask = index->capacity - 1;
+  size_t i = (size_t)(slot - index->slots);
+  size_t j = i;
+
+  /* Backward shift deletion, as in the skipped keys store */
+  for (;;) {
+    size_t ideal;
+
+    j = (j + 1) & mask;
+    if (!index->slots[j].node) {
+      break;
+    }
+
+    ideal = (size_t)(index->slots[j].id & mask);
+    if (((j - ideal) & mask) >= ((j - i) & mask)) {
+      index->slots[i] = index->slots[j];
+      i = j;
+    }
+  }
+
+  index->slots[i].node = NULL;
+  index->slots[i].id = 0;
+  index->len--;
+}
+
+static void prekey_messages_index_clear(prekey_messages_index_s *index) {
+  otrng_free(index->slots);
+  index->slots = NULL;
+  index->capacity = 0;
+  index->len = 0;
+}
+
 INTERNAL void otrng_client_store_my_prekey_message(prekey_message_s *msg,
                                                    otrng_client_s *client) {
+  list_element_s *element;
+
   if (!client) {
     return;
   }
 
-  client->our_prekeys = otrng_list_add(msg, client->our_prekeys);
+  /* Appending through the tail keeps this constant time */
+  element = otrng_list_add(msg, NULL);
+  if (client->last_prekey) {
+    client->last_prekey->next = element;
+  } else {
+    client->our_prekeys = element;
+  }
+  client->last_prekey = element;
+
+  prekey_messages_index_add(&client->our_prekeys_index, element);
+}
+
+INTERNAL void otrng_client_forget_my_prekey_messages(otrng_client_s *client) {
+  otrng_list_free(client->our_prekeys, prekey_message_free_from_list);
+  client->our_prekeys = NULL;
+  client->last_prekey = NULL;
+  prekey_messages_index_clear(&client->our_prekeys_index);
+}
+
+INTERNAL void otrng_client_reindex_my_prekey_messages(otrng_client_s *client) {
+  list_element_s *current;
+
+  prekey_messages_index_clear(&client->our_prekeys_index);
+  client->last_prekey = NULL;
+
+  for (current = client->our_prekeys; current; current = current->next) {
+    prekey_messages_index_add(&client->our_prekeys_index, current);
+    client->last_prekey = current;
+  }
 }
 
 API /*@null@*/ prekey_message_s **
@@ -656,7 +1242,8 @@ otrng_client_build_prekey_messages(uint8_t num_messages,
   for (i = 0; i < num_messages; i++) {
     ecdh_keypair_s ecdh;
     dh_keypair_s dh;
-    if (!otrng_generate_ephemeral_keys(&ecdh, &dh)) {
+    if (!otrng_keypair_pool_generate(&ecdh, &dh,
+                                     otrng_client_keypair_pool(client))) {
       otrng_free(messages);
       return NULL;
     }
@@ -768,6 +1355,7 @@ otrng_client_get_private_key_v3(const otrng_client_s *client) {
 INTERNAL otrng_keypair_s *otrng_client_get_keypair_v4(otrng_client_s *client) {
   assert(client != NULL);
 
+  (void)otrng_client_materialize(client, OTRNG_CLIENT_STATE_LONG_TERM_KEY);
   if (client->keypair) {
     return client->keypair;
   }
@@ -807,6 +1395,8 @@ INTERNAL otrng_result otrng_client_add_private_key_v4(
 INTERNAL otrng_public_key *
 otrng_client_get_forging_key(otrng_client_s *client) {
   assert(client != NULL);
+
+  (void)otrng_client_materialize(client, OTRNG_CLIENT_STATE_FORGING_KEY);
   assert(client->forging_key != NULL);
 
   return client->forging_key;
@@ -830,6 +1420,8 @@ INTERNAL otrng_result otrng_client_add_forging_key(
 API otrng_client_profile_s *
 otrng_client_get_client_profile(otrng_client_s *client) {
   assert(client != NULL);
+
+  (void)otrng_client_materialize(client, OTRNG_CLIENT_STATE_CLIENT_PROFILE);
   assert(client->client_profile != NULL);
 
   return client->client_profile;
@@ -877,6 +1469,9 @@ API const otrng_client_profile_s *
 otrng_client_get_exp_client_profile(otrng_client_s *client) {
   assert(client != NULL);
 
+  (void)otrng_client_materialize(client,
+                                 OTRNG_CLIENT_STATE_EXP_CLIENT_PROFILE);
+
   return client->exp_client_profile;
 }
 
@@ -890,7 +1485,7 @@ API otrng_result otrng_client_add_exp_client_profile(
 
   client->exp_client_profile = otrng_xmalloc_z(sizeof(otrng_client_profile_s));
 
-  if (otrng_client_profile_copy(client->exp_client_profile, exp_profile)) {
+  if (!otrng_client_profile_copy(client->exp_client_profile, exp_profile)) {
     return OTRNG_ERROR;
   }
 
@@ -901,6 +1496,7 @@ API otrng_prekey_profile_s *
 otrng_client_get_prekey_profile(otrng_client_s *client) {
   assert(client != NULL);
 
+  (void)otrng_client_materialize(client, OTRNG_CLIENT_STATE_PREKEY_PROFILE);
   if (client->prekey_profile) {
     return client->prekey_profile;
   }
@@ -936,11 +1532,10 @@ API /*@null@*/ const otrng_prekey_profile_s *
 otrng_client_get_exp_prekey_profile(otrng_client_s *client) {
   assert(client != NULL);
 
-  if (client->exp_prekey_profile) {
-    return client->prekey_profile;
-  }
+  (void)otrng_client_materialize(client,
+                                 OTRNG_CLIENT_STATE_EXP_PREKEY_PROFILE);
 
-  return NULL;
+  return client->exp_prekey_profile;
 }
 
 API otrng_result otrng_client_add_exp_prekey_profile(
@@ -987,8 +1582,27 @@ tstatic void otrl_userstate_instance_tag_add(OtrlUserState us,
   us->instag_root = instag;
 }
 
+INTERNAL otrng_keypair_pool_s *
+otrng_client_keypair_pool(const otrng_client_s *client) {
+  if (!client || !client->global_state) {
+    return NULL;
+  }
+
+  return client->global_state->keypair_pool;
+}
+
+INTERNAL otrng_expiry_scheduler_s *
+otrng_client_expiry_scheduler(const otrng_client_s *client) {
+  if (!client || !client->global_state) {
+    return NULL;
+  }
+
+  return client->global_state->expiry;
+}
+
 INTERNAL unsigned int otrng_client_get_instance_tag(otrng_client_s *client) {
   OtrlInsTag *instag;
+  unsigned int result;
 
   if (client->global_state->user_state_v3 == NULL) {
     return (unsigned int)0;
@@ -996,24 +1610,27 @@ INTERNAL unsigned int otrng_client_get_instance_tag(otrng_client_s *client) {
 
   //  fprintf(stderr,"first: %s\n",
   //  client->global_state->user_state_v3->instag_root->accountname);
+  otrng_global_state_lock(client->global_state);
   instag =
       otrl_instag_find(client->global_state->user_state_v3,
                        client->client_id.account, client->client_id.protocol);
+  otrng_global_state_unlock(client->global_state);
 
+  /* The callback runs without the lock, since it will usually generate the
+   * instance tag through the global state. */
   if (!instag) {
     otrng_client_callbacks_create_instag(client->global_state->callbacks,
                                          client);
   }
 
+  otrng_global_state_lock(client->global_state);
   instag =
       otrl_instag_find(client->global_state->user_state_v3,
                        client->client_id.account, client->client_id.protocol);
+  result = instag ? instag->instag : 0;
+  otrng_global_state_unlock(client->global_state);
 
-  if (!instag) {
-    return (unsigned int)0;
-  }
-
-  return instag->instag;
+  return result;
 }
 
 INTERNAL otrng_result otrng_client_add_instance_tag(otrng_client_s *client,
@@ -1028,9 +1645,11 @@ INTERNAL otrng_result otrng_client_add_instance_tag(otrng_client_s *client,
     return OTRNG_ERROR;
   }
 
+  otrng_global_state_lock(client->global_state);
   p = otrl_instag_find(client->global_state->user_state_v3,
                        client->client_id.account, client->client_id.protocol);
   if (p) {
+    otrng_global_state_unlock(client->global_state);
     return OTRNG_ERROR;
   }
 
@@ -1038,51 +1657,63 @@ INTERNAL otrng_result otrng_client_add_instance_tag(otrng_client_s *client,
                              client->client_id.account, instag);
 
   if (!p) {
+    otrng_global_state_unlock(client->global_state);
     return OTRNG_ERROR;
   }
 
   otrl_userstate_instance_tag_add(client->global_state->user_state_v3, p);
-  return OTRNG_SUCCESS;
-}
-
-tstatic /*@null@*/ list_element_s *
-get_stored_prekey_node_by_id(uint32_t id, list_element_s *l) {
-  while (l) {
-    const prekey_message_s *s = l->data;
-    if (!s) {
-      continue;
-    }
-
-    if (s->id == id) {
-      return l;
-    }
-
-    l = l->next;
-  }
+  otrng_global_state_unlock(client->global_state);
 
-  return NULL;
+  return OTRNG_SUCCESS;
 }
 
 INTERNAL /*@null@*/ const prekey_message_s *
 otrng_client_get_prekey_by_id(uint32_t id, const otrng_client_s *client) {
-  list_element_s *node = get_stored_prekey_node_by_id(id, client->our_prekeys);
-  if (!node) {
+  const prekey_messages_slot_s *slot =
+      find_prekey_message_slot(&client->our_prekeys_index, id);
+  if (!slot) {
     return NULL;
   }
 
-  return node->data;
+  return slot->node->data;
 }
 
 INTERNAL void
 otrng_client_delete_my_prekey_message_by_id(uint32_t id,
                                             otrng_client_s *client) {
-  list_element_s *node = get_stored_prekey_node_by_id(id, client->our_prekeys);
-  if (!node) {
+  prekey_messages_index_s *index = &client->our_prekeys_index;
+  prekey_messages_slot_s *slot = find_prekey_message_slot(index, id);
+  list_element_s *node, *head;
+
+  if (!slot) {
     return;
   }
 
-  client->our_prekeys = otrng_list_remove_element(node, client->our_prekeys);
-  otrng_list_free(node, prekey_message_free_from_list);
+  node = slot->node;
+  head = client->our_prekeys;
+  prekey_messages_index_remove(index, slot);
+
+  /* The list is singly linked: rather than searching for the node before
+   * this one, swap in the message at the head and unlink the head */
+  if (node != head) {
+    prekey_message_s *moved = head->data;
+
+    slot = find_prekey_message_slot(index, moved->id);
+    if (slot && slot->node == head) {
+      slot->node = node;
+    }
+
+    head->data = node->data;
+    node->data = moved;
+  }
+
+  client->our_prekeys = head->next;
+  if (client->last_prekey == head) {
+    client->last_prekey = NULL;
+  }
+  head->next = NULL;
+
+  otrng_list_free(head, prekey_message_free_from_list);
   client->global_state->callbacks->store_prekey_messages(client);
 }
 
@@ -28,6 +28,8 @@
 #pragma clang diagnostic pop
 #endif
 
+#include <pthread.h>
+
 #include "list.h"
 #include "otrng.h"
 #include "prekey_manager.h"
@@ -49,9 +51,56 @@ typedef struct otrng_client_id_s {
   const char *account;
 } otrng_client_id_s;
 
+typedef struct conversations_slot_s {
+  uint64_t hash;
+  /*@null@*/ otrng_conversation_s *conv;
+} conversations_slot_s;
+
+#define CONVERSATIONS_HASH_KEY_BYTES 16
+
+/* Conversations by recipient, in an open addressing table with linear
+ * probing. */
+typedef struct conversations_index_s {
+  /*@null@*/ conversations_slot_s *slots;
+  size_t capacity; /* Zero or a power of two */
+  size_t len;
+  uint8_t hash_key[CONVERSATIONS_HASH_KEY_BYTES];
+} conversations_index_s;
+
+typedef struct prekey_messages_slot_s {
+  uint32_t id;
+  /* the element of our_prekeys holding the prekey message with this id */
+  /*@null@*/ list_element_s *node;
+} prekey_messages_slot_s;
+
+/* Our prekey messages by id, in an open addressing table with linear
+ * probing. */
+typedef struct prekey_messages_index_s {
+  /*@null@*/ prekey_messages_slot_s *slots;
+  size_t capacity; /* Zero or a power of two */
+  size_t len;
+} prekey_messages_index_s;
+
+/* The parts of a client's long-term state that the orchestration ensures */
+typedef enum {
+  OTRNG_CLIENT_STATE_LONG_TERM_KEY = 1 << 0,
+  OTRNG_CLIENT_STATE_LONG_TERM_KEY_V3 = 1 << 1,
+  OTRNG_CLIENT_STATE_FORGING_KEY = 1 << 2,
+  OTRNG_CLIENT_STATE_CLIENT_PROFILE = 1 << 3,
+  OTRNG_CLIENT_STATE_EXP_CLIENT_PROFILE = 1 << 4,
+  OTRNG_CLIENT_STATE_PREKEY_PROFILE = 1 << 5,
+  OTRNG_CLIENT_STATE_EXP_PREKEY_PROFILE = 1 << 6,
+  OTRNG_CLIENT_STATE_PREKEY_MESSAGES = 1 << 7,
+  OTRNG_CLIENT_STATE_ALL = (1 << 8) - 1
+} otrng_client_state_part;
+
 /* A client handle messages from/to a sender to/from multiple recipients. */
 typedef struct otrng_client_s {
+  /* in creation order, for iterating */
   list_element_s *conversations;
+  /*@null@*/ list_element_s *last_conversation;
+  /* the same conversations, for lookups by recipient */
+  /*@null@*/ conversations_index_s *conversations_index;
 
   otrng_client_id_s client_id;
 
@@ -65,6 +114,9 @@ typedef struct otrng_client_s {
   otrng_prekey_profile_s *prekey_profile;
   otrng_prekey_profile_s *exp_prekey_profile;
   list_element_s *our_prekeys; /* prekey_message_s */
+  /*@null@*/ list_element_s *last_prekey;
+  /* the same prekey messages, for lookups by id */
+  prekey_messages_index_s our_prekeys_index;
 
   unsigned int max_stored_msg_keys;
   unsigned int max_published_prekey_msg;
@@ -92,6 +144,10 @@ typedef struct otrng_client_s {
 
   otrng_known_fingerprints_s *fingerprints;
 
+  /* otrng_client_state_part flags deferred by a lazy
+     otrng_client_ensure_correct_state, ensured on first use */
+  unsigned int pending_state;
+
   /* Contains the prekey manager if prekey management has been enabled.
      It is NOT safe to assume that this will be non-null - it is a
      plugins/clients responsibility to ensure that the prekey management system
@@ -99,12 +155,35 @@ typedef struct otrng_client_s {
   */
   // TODO: @prekey - this should be freed
   /*@null@*/ otrng_prekey_manager_s *prekey_manager;
+
+  /* Taken by callers of the library and by otrng_global_state_warm: see
+     otrng_client_lock */
+  pthread_mutex_t lock;
 } otrng_client_s;
 
 API otrng_client_s *otrng_client_new(const otrng_client_id_s client_id);
 
 API void otrng_client_free(otrng_client_s *client);
 
+/**
+ * @brief Locks the client. A client, and everything reachable from it, can
+ * only be used by one thread at a time: when a client is shared between
+ * threads, every call taking it (or one of its conversations) must be made
+ * while holding this lock. The library only takes it itself in
+ * otrng_global_state_warm, so callbacks invoked during any other call must not
+ * lock the same client again.
+ *
+ * @param [client]   The client.
+ */
+API void otrng_client_lock(otrng_client_s *client);
+
+/**
+ * @brief Unlocks a client locked with otrng_client_lock.
+ *
+ * @param [client]   The client.
+ */
+API void otrng_client_unlock(otrng_client_s *client);
+
 API /*@null@*/ otrng_conversation_s *
 otrng_client_get_conversation(int force_create, const char *recipient,
                               otrng_client_s *client);
@@ -128,6 +207,56 @@ API otrng_result otrng_client_send(char **new_msg, const char *msg,
                                    const char *recipient,
                                    otrng_client_s *client);
 
+/**
+ * @brief Sends a message into a buffer supplied by the caller.
+ *
+ * In a v4 conversation in the encrypted state, the data message is
+ * serialized, authenticated and encoded straight into [buf], and no state is
+ * changed if [buf] might be too small: the call fails and [written] is set to
+ * a size that is enough. Any other message (query message, v3) is built as
+ * with otrng_client_send and copied into [buf], and is lost if it does not
+ * fit.
+ *
+ * @param [written] The length of the NUL-terminated message written to [buf],
+ * without the NUL.
+ */
+API otrng_result otrng_client_send_into(char *buf, size_t buf_len,
+                                        size_t *written, const char *msg,
+                                        const char *recipient,
+                                        otrng_client_s *client);
+
+/* A task run by a thread pool. It is called once for every index. */
+typedef void (*otrng_client_task_f)(void *ctx, size_t index);
+
+/* A thread pool supplied by the caller. */
+typedef struct otrng_client_thread_pool_s {
+  /* Runs task(ctx, i) for every i in [0, count), possibly concurrently, and
+     returns only once all of them have finished. */
+  void (*run)(void *pool_data, otrng_client_task_f task, void *ctx,
+              size_t count);
+  void *pool_data;
+} otrng_client_thread_pool_s;
+
+/**
+ * @brief Sends the same message to many recipients.
+ *
+ * The plaintext and its padding are built once, and only the ratchet,
+ * encryption and authentication are done for every conversation. If [pool] is
+ * not NULL, conversations in the encrypted state are processed through it, and
+ * the client callbacks can be invoked from its threads.
+ *
+ * @param [new_msgs] Is set to an array of [recipients_len] messages, in the
+ * same order as [recipients]. The entry of a recipient that failed is NULL.
+ * The array and every message must be freed by the caller.
+ *
+ * @return OTRNG_ERROR if sending to any of the recipients failed.
+ */
+API otrng_result otrng_client_send_many(char ***new_msgs, const char *msg,
+                                        const char *const *recipients,
+                                        size_t recipients_len,
+                                        const otrng_client_thread_pool_s *pool,
+                                        otrng_client_s *client);
+
 API otrng_result otrng_client_send_non_interactive_auth(
     char **new_msg, const prekey_ensemble_s *ensemble, const char *recipient,
     otrng_client_s *client);
@@ -157,6 +286,20 @@ API otrng_result otrng_client_receive(char **new_msg, char **to_display,
                                       otrng_client_s *client,
                                       otrng_bool *should_ignore);
 
+/**
+ * @brief Like otrng_client_receive, but a data message is decrypted in place
+ * and handed over without copying it.
+ *
+ * @param [plaintext] Is set to the received message. Its text and TLVs point
+ * into a single buffer, which must be released with otrng_plaintext_release.
+ */
+API otrng_result otrng_client_receive_plaintext(char **new_msg,
+                                                otrng_plaintext_s *plaintext,
+                                                const char *msg,
+                                                const char *recipient,
+                                                otrng_client_s *client,
+                                                otrng_bool *should_ignore);
+
 API otrng_result otrng_client_disconnect(char **new_msg, const char *recipient,
                                          otrng_client_s *client);
 
@@ -164,6 +307,14 @@ INTERNAL void otrng_client_expire_session(otrng_conversation_s *conv);
 
 INTERNAL void otrng_client_expire_sessions(otrng_client_s *client);
 
+/**
+ * @brief Expires the encrypted session of a connection whose expiry came due
+ * in the scheduler.
+ *
+ * @param [otr]   The connection.
+ */
+INTERNAL void otrng_client_expire_session_of(otrng_s *otr);
+
 /**
  * @brief Expires old fragments based on the threshold set in the client struct
  *
@@ -177,7 +328,7 @@ INTERNAL void otrng_client_expire_sessions(otrng_client_s *client);
 INTERNAL otrng_result otrng_client_expire_fragments(otrng_client_s *client);
 
 API otrng_result otrng_client_get_our_fingerprint(otrng_fingerprint fp,
-                                                  const otrng_client_s *client);
+                                                  otrng_client_s *client);
 
 INTERNAL void otrng_client_store_my_prekey_message(prekey_message_s *msg,
                                                    otrng_client_s *client);
@@ -231,6 +382,22 @@ otrng_client_get_exp_prekey_profile(otrng_client_s *client);
 API otrng_result otrng_client_add_exp_prekey_profile(
     otrng_client_s *client, const otrng_prekey_profile_s *exp_profile);
 
+/**
+ * @brief The ephemeral keypair pool of the client's global state.
+ *
+ * @return The pool, or NULL if the pool isn't enabled.
+ */
+INTERNAL /*@null@*/ otrng_keypair_pool_s *
+otrng_client_keypair_pool(const otrng_client_s *client);
+
+/**
+ * @brief The expiry scheduler of the client's global state.
+ *
+ * @return The scheduler, or NULL if the client has no global state.
+ */
+INTERNAL /*@null@*/ otrng_expiry_scheduler_s *
+otrng_client_expiry_scheduler(const otrng_client_s *client);
+
 INTERNAL unsigned int otrng_client_get_instance_tag(otrng_client_s *client);
 
 INTERNAL otrng_result otrng_client_add_instance_tag(otrng_client_s *client,
@@ -243,6 +410,22 @@ INTERNAL void
 otrng_client_delete_my_prekey_message_by_id(uint32_t id,
                                             otrng_client_s *client);
 
+/**
+ * @brief Frees all our stored prekey messages.
+ *
+ * @param [client]   The client.
+ */
+INTERNAL void otrng_client_forget_my_prekey_messages(otrng_client_s *client);
+
+/**
+ * @brief Rebuilds the index of our prekey messages from client->our_prekeys.
+ * Needed after anything other than the functions above changed the list,
+ * like a load_prekey_messages callback assigning it.
+ *
+ * @param [client]   The client.
+ */
+INTERNAL void otrng_client_reindex_my_prekey_messages(otrng_client_s *client);
+
 API void otrng_client_set_padding(size_t granularity, otrng_client_s *client);
 
 API void otrng_client_set_max_stored_msg_keys(unsigned int max_stored_msg_keys,
@@ -292,6 +475,35 @@ API void otrng_conversation_debug_print(FILE *, int, otrng_conversation_s *);
 tstatic uint64_t
 otrng_client_get_client_profile_exp_time(otrng_client_s *client);
 
+tstatic conversations_index_s *conversations_index_new(void);
+
+tstatic void
+conversations_index_free(/*@null@*/ conversations_index_s *index);
+
+tstatic void conversations_index_add(conversations_index_s *index,
+                                     otrng_conversation_s *conv);
+
+tstatic void conversations_index_remove(conversations_index_s *index,
+                                        const otrng_conversation_s *conv);
+
+tstatic /*@null@*/ otrng_conversation_s *
+conversations_index_get(/*@null@*/ const conversations_index_s *index,
+                        const char *recipient);
+
+tstatic otrng_conversation_s *new_conversation_with(const char *recipient,
+                                                    otrng_s *conn);
+
+tstatic void add_conversation(otrng_client_s *client,
+                              otrng_conversation_s *conv);
+
+tstatic /*@null@*/ otrng_conversation_s *
+get_conversation_with(const char *recipient, const otrng_client_s *client);
+
+tstatic void destroy_client_conversation(const otrng_conversation_s *conv,
+                                         otrng_client_s *client);
+
+tstatic void conversation_free(void *data);
+
 #endif
 
 #endif
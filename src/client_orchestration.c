@@ -372,36 +372,40 @@ tstatic otrng_bool ensure_valid_client_profile(otrng_client_s *client) {
   return otrng_false;
 }
 
-tstatic void ensure_valid_expired_client_profile(otrng_client_s *client) {
+/* Never fails: an invalid expired profile is just dropped */
+tstatic otrng_bool ensure_valid_expired_client_profile(otrng_client_s *client) {
   if (verify_valid_expired_client_profile(client)) {
-    return;
+    return otrng_true;
   }
 
   clean_expired_client_profile(client);
   load_expired_client_profile_from_storage(client);
 
   if (verify_valid_expired_client_profile(client)) {
-    return;
+    return otrng_true;
   }
 
   clean_expired_client_profile(client);
   client->global_state->callbacks->store_expired_client_profile(client);
+  return otrng_true;
 }
 
-tstatic void ensure_valid_expired_prekey_profile(otrng_client_s *client) {
+/* Never fails: an invalid expired profile is just dropped */
+tstatic otrng_bool ensure_valid_expired_prekey_profile(otrng_client_s *client) {
   if (verify_valid_expired_prekey_profile(client)) {
-    return;
+    return otrng_true;
   }
 
   clean_expired_prekey_profile(client);
   load_expired_prekey_profile_from_storage(client);
 
   if (verify_valid_expired_prekey_profile(client)) {
-    return;
+    return otrng_true;
   }
 
   clean_expired_prekey_profile(client);
   client->global_state->callbacks->store_expired_prekey_profile(client);
+  return otrng_true;
 }
 
 tstatic otrng_bool ensure_valid_prekey_profile(otrng_client_s *client) {
@@ -466,6 +470,8 @@ tstatic void create_new_prekey_messages(otrng_client_s *client) {
 tstatic void load_prekey_messages_from_storage(otrng_client_s *client) {
   otrng_debug_enter("orchestration.load_prekey_messages_from_storage");
   client->global_state->callbacks->load_prekey_messages(client);
+  /* The callback can also have assigned the list directly */
+  otrng_client_reindex_my_prekey_messages(client);
   otrng_debug_exit("orchestration.load_prekey_messages_from_storage");
 }
 
@@ -556,7 +562,7 @@ tstatic void load_fingerprints_v3_from_storage(otrng_client_s *client) {
 }
 
 tstatic void create_fingerprints(otrng_client_s *client) {
-  client->fingerprints = otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
+  client->fingerprints = otrng_known_fingerprints_new();
 }
 
 tstatic void create_fingerprints_v3(otrng_client_s *client) {
@@ -606,6 +612,76 @@ tstatic void ensure_loaded_fingerprints_v3(otrng_client_s *client) {
   signal_error_in_state_management(client, "Couldn't load v3 fingerprints");
 }
 
+typedef struct client_state_part_s {
+  otrng_client_state_part part;
+  /* the parts that have to be ensured first */
+  unsigned int requires;
+  otrng_bool (*ensure)(otrng_client_s *client);
+} client_state_part_s;
+
+/* In the order they are ensured, which puts every part after the ones it
+ * requires. The client profile carries the v3 key, and the expired profiles
+ * are where the current ones are moved to. */
+static const client_state_part_s client_state_parts[] = {
+    {OTRNG_CLIENT_STATE_LONG_TERM_KEY, 0, ensure_valid_long_term_key},
+    {OTRNG_CLIENT_STATE_LONG_TERM_KEY_V3, 0, ensure_valid_long_term_key_v3},
+    {OTRNG_CLIENT_STATE_FORGING_KEY, 0, ensure_valid_forging_key},
+    {OTRNG_CLIENT_STATE_CLIENT_PROFILE,
+     OTRNG_CLIENT_STATE_LONG_TERM_KEY | OTRNG_CLIENT_STATE_LONG_TERM_KEY_V3 |
+         OTRNG_CLIENT_STATE_FORGING_KEY,
+     ensure_valid_client_profile},
+    {OTRNG_CLIENT_STATE_EXP_CLIENT_PROFILE, OTRNG_CLIENT_STATE_CLIENT_PROFILE,
+     ensure_valid_expired_client_profile},
+    {OTRNG_CLIENT_STATE_PREKEY_PROFILE, OTRNG_CLIENT_STATE_LONG_TERM_KEY,
+     ensure_valid_prekey_profile},
+    {OTRNG_CLIENT_STATE_EXP_PREKEY_PROFILE, OTRNG_CLIENT_STATE_PREKEY_PROFILE,
+     ensure_valid_expired_prekey_profile},
+    {OTRNG_CLIENT_STATE_PREKEY_MESSAGES, 0, ensure_enough_prekey_messages},
+};
+
+#define CLIENT_STATE_PARTS                                                     \
+  (sizeof(client_state_parts) / sizeof(client_state_parts[0]))
+
+INTERNAL otrng_bool otrng_client_materialize(otrng_client_s *client,
+                                             unsigned int parts) {
+  unsigned int wanted = parts & client->pending_state;
+  size_t i;
+
+  if (!wanted) {
+    return otrng_true;
+  }
+
+  otrng_debug_enter("otrng_client_materialize");
+
+  /* Requirements always come earlier in the table, so one pass backwards
+   * pulls them all in */
+  for (i = CLIENT_STATE_PARTS; i > 0; i--) {
+    if (wanted & client_state_parts[i - 1].part) {
+      wanted |= client_state_parts[i - 1].requires;
+    }
+  }
+
+  for (i = 0; i < CLIENT_STATE_PARTS; i++) {
+    const client_state_part_s *p = &client_state_parts[i];
+
+    if (!(wanted & client->pending_state & p->part)) {
+      continue;
+    }
+
+    /* Cleared first, since the callbacks can use the accessors that got us
+     * here. Left pending on failure, to be tried again on the next use. */
+    client->pending_state &= ~(unsigned int)p->part;
+    if (!p->ensure(client)) {
+      client->pending_state |= (unsigned int)p->part;
+      otrng_debug_exit("otrng_client_materialize");
+      return otrng_false;
+    }
+  }
+
+  otrng_debug_exit("otrng_client_materialize");
+  return otrng_true;
+}
+
 /* Note, the ensure_ family of functions will check whether the
    values are there and correct, and try to fix them if not.
    The verify_ family of functions will just check that the values
@@ -614,48 +690,57 @@ tstatic void ensure_loaded_fingerprints_v3(otrng_client_s *client) {
    by default every 67'th minute. This way we don't have to set specific
    timers to check for expiry of prekey profiles and client profiles */
 API void otrng_client_ensure_correct_state(otrng_client_s *client) {
+  size_t i;
+
   otrng_debug_enter("otrng_client_ensure_correct_state");
   otrng_debug_fprintf(stderr, "client=%s\n", client->client_id.account);
 
-  if (!ensure_valid_long_term_key(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
-    return;
+  if (client->global_state->lazy_orchestration) {
+    /* Everything is checked again on its next use. Fingerprints are looked
+     * up through const clients, so they can't wait. */
+    client->pending_state = OTRNG_CLIENT_STATE_ALL;
+  } else {
+    for (i = 0; i < CLIENT_STATE_PARTS; i++) {
+      if (!client_state_parts[i].ensure(client)) {
+        otrng_debug_exit("otrng_client_ensure_correct_state");
+        return;
+      }
+      client->pending_state &= ~(unsigned int)client_state_parts[i].part;
+    }
   }
 
-  if (!ensure_valid_long_term_key_v3(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
-    return;
-  }
+  ensure_loaded_fingerprints(client);
 
-  if (!ensure_valid_forging_key(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
-    return;
-  }
+  ensure_loaded_fingerprints_v3(client);
 
-  if (!ensure_valid_client_profile(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
-    return;
-  }
+  otrng_debug_exit("otrng_client_ensure_correct_state");
+}
 
-  ensure_valid_expired_client_profile(client);
+API otrng_bool otrng_client_warm(otrng_client_s *client) {
+  return otrng_client_materialize(client, OTRNG_CLIENT_STATE_ALL);
+}
 
-  if (!ensure_valid_prekey_profile(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
-    return;
-  }
+API void otrng_global_state_warm(otrng_global_state_s *gs,
+                                 const otrng_client_id_s *client_ids,
+                                 size_t len) {
+  otrng_client_s *client;
+  size_t i;
 
-  ensure_valid_expired_prekey_profile(client);
+  for (i = 0; i < len; i++) {
+    client = otrng_client_get(gs, client_ids[i]);
+    if (!client) {
+      continue;
+    }
 
-  if (!ensure_enough_prekey_messages(client)) {
-    otrng_debug_exit("otrng_client_ensure_correct_state");
-    return;
+    otrng_client_lock(client);
+    (void)otrng_client_warm(client);
+    otrng_client_unlock(client);
   }
+}
 
-  ensure_loaded_fingerprints(client);
-
-  ensure_loaded_fingerprints_v3(client);
-
-  otrng_debug_exit("otrng_client_ensure_correct_state");
+API void otrng_global_state_set_lazy_orchestration(otrng_global_state_s *gs,
+                                                   otrng_bool lazy) {
+  gs->lazy_orchestration = lazy;
 }
 
 API otrng_bool otrng_client_verify_correct_state(otrng_client_s *client) {
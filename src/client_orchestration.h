@@ -24,8 +24,72 @@
 #include "client.h"
 #include "shared.h"
 
+#include "messaging.h"
+
+/**
+ * @brief Makes sure the client has valid long-term keys, profiles, prekey
+ * messages and fingerprints, loading them through the callbacks or creating
+ * them when needed.
+ *
+ * With lazy orchestration (see otrng_global_state_set_lazy_orchestration),
+ * only the fingerprints are loaded here. Everything else is marked as pending
+ * and is ensured on first use: when it is asked for (for example with
+ * otrng_client_get_client_profile), when a conversation is created or when
+ * talking to a prekey server.
+ *
+ * @param [client]   The client.
+ */
 API void otrng_client_ensure_correct_state(otrng_client_s *client);
 
 API otrng_bool otrng_client_verify_correct_state(otrng_client_s *client);
 
+/**
+ * @brief Chooses whether otrng_client_ensure_correct_state defers the work
+ * until the state is first used. Off by default. Set it before using any
+ * client.
+ *
+ * @param [gs]     The global state.
+ * @param [lazy]   Whether to defer.
+ */
+API void otrng_global_state_set_lazy_orchestration(otrng_global_state_s *gs,
+                                                   otrng_bool lazy);
+
+/**
+ * @brief Ensures now everything a lazy otrng_client_ensure_correct_state
+ * deferred for the client.
+ *
+ * @param [client]   The client.
+ *
+ * @return otrng_false if some of the state couldn't be ensured. It will be
+ * tried again on its next use.
+ */
+API otrng_bool otrng_client_warm(otrng_client_s *client);
+
+/**
+ * @brief Warms the given clients, for example the accounts that were used most
+ * recently, so their first conversation doesn't wait on storage. Each client
+ * is warmed while holding its lock, so this can run on a background thread
+ * while the clients are used from others under their lock. The callbacks are
+ * called from the calling thread.
+ *
+ * @param [gs]           The global state.
+ * @param [client_ids]   The clients to warm.
+ * @param [len]          The number of clients.
+ */
+API void otrng_global_state_warm(otrng_global_state_s *gs,
+                                 const otrng_client_id_s *client_ids,
+                                 size_t len);
+
+/**
+ * @brief Ensures the given parts of the client's state, if they were deferred,
+ * along with the parts they require.
+ *
+ * @param [client]   The client.
+ * @param [parts]    The otrng_client_state_part flags to ensure.
+ *
+ * @return otrng_false if one of the parts couldn't be ensured.
+ */
+INTERNAL otrng_bool otrng_client_materialize(otrng_client_s *client,
+                                             unsigned int parts);
+
 #endif // OTRNG_CLIENT_ORCHESTRATION_H
@@ -31,6 +31,7 @@
 #include "debug.h"
 #include "deserialize.h"
 #include "instance_tag.h"
+#include "profile_cache.h"
 #include "serialize.h"
 #include "util.h"
 
@@ -752,17 +753,13 @@ verify_transitional_signature(const otrng_client_profile_s *client_profile) {
   return otrng_true;
 }
 
-static otrng_bool client_profile_valid_without_expiry(
-    const otrng_client_profile_s *client_profile,
-    const uint32_t sender_instance_tag) {
+/* Everything that only depends on the contents of the profile */
+static otrng_bool
+client_profile_checks_pass(const otrng_client_profile_s *client_profile) {
   if (!client_profile_verify_signature(client_profile)) {
     return otrng_false;
   }
 
-  if (sender_instance_tag != client_profile->sender_instance_tag) {
-    return otrng_false;
-  }
-
   if (rollback_detected(client_profile->versions)) {
     return otrng_false;
   }
@@ -782,6 +779,37 @@ static otrng_bool client_profile_valid_without_expiry(
   return otrng_true;
 }
 
+static otrng_bool client_profile_valid_without_expiry(
+    const otrng_client_profile_s *client_profile,
+    const uint32_t sender_instance_tag) {
+  uint8_t digest[OTRNG_PROFILE_CACHE_DIGEST_BYTES];
+  uint8_t *serialized = NULL;
+  size_t serialized_len = 0;
+  otrng_bool valid;
+
+  if (sender_instance_tag != client_profile->sender_instance_tag) {
+    return otrng_false;
+  }
+
+  if (!otrng_client_profile_serialize(&serialized, &serialized_len,
+                                      client_profile) ||
+      !otrng_profile_cache_digest(digest, OTRNG_PROFILE_CACHE_CLIENT_PROFILE,
+                                  serialized, serialized_len, NULL, 0)) {
+    otrng_free(serialized);
+    return client_profile_checks_pass(client_profile);
+  }
+  otrng_free(serialized);
+
+  if (otrng_profile_cache_get(&valid, digest)) {
+    return valid;
+  }
+
+  valid = client_profile_checks_pass(client_profile);
+  otrng_profile_cache_put(digest, valid, client_profile->expires);
+
+  return valid;
+}
+
 INTERNAL otrng_bool
 otrng_client_profile_valid(const otrng_client_profile_s *client_profile,
                            const uint32_t sender_instance_tag) {
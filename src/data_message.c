@@ -46,20 +46,32 @@ INTERNAL void otrng_data_message_free(data_message_s *data_msg) {
   otrng_ec_point_destroy(data_msg->ecdh);
   otrng_dh_mpi_release(data_msg->dh);
   otrng_secure_wipe(data_msg->nonce, DATA_MSG_NONCE_BYTES);
-  otrng_free(data_msg->enc_msg);
+  if (data_msg->enc_msg_secure) {
+    otrng_secure_free(data_msg->enc_msg);
+  } else {
+    otrng_free(data_msg->enc_msg);
+  }
   otrng_secure_wipe(data_msg->mac, DATA_MSG_MAC_BYTES);
 
   otrng_free(data_msg);
 }
 
-INTERNAL otrng_result otrng_data_message_body_serialize(
-    uint8_t **body, size_t *body_len, const data_message_s *data_msg) {
-  size_t size = DATA_MSG_MAX_BYTES + data_msg->enc_msg_len;
-  uint8_t *cursor;
-  size_t len = 0;
-  uint8_t *dst = otrng_xmalloc_z(size);
+INTERNAL size_t otrng_data_message_body_len(const data_message_s *data_msg) {
+  /* The DH MPI and the encrypted message are prefixed by their length */
+  return DATA_MSG_MIN_BYTES + 4 + otrng_dh_mpi_serialized_len(data_msg->dh) +
+         4 + data_msg->enc_msg_len;
+}
+
+INTERNAL otrng_result otrng_data_message_body_serialize_into(
+    uint8_t *dst, size_t dst_len, size_t *written,
+    const data_message_s *data_msg) {
+  uint8_t *cursor = dst;
+  size_t dh_len = 0;
+
+  if (dst_len < otrng_data_message_body_len(data_msg)) {
+    return OTRNG_ERROR;
+  }
 
-  cursor = dst;
   cursor += otrng_serialize_uint16(cursor, OTRNG_PROTOCOL_VERSION_4);
   cursor += otrng_serialize_uint8(cursor, DATA_MSG_TYPE);
   cursor += otrng_serialize_uint32(cursor, data_msg->sender_instance_tag);
@@ -70,24 +82,41 @@ INTERNAL otrng_result otrng_data_message_body_serialize(
   cursor += otrng_serialize_uint32(cursor, data_msg->message_id);
   cursor += otrng_serialize_ec_point(cursor, data_msg->ecdh);
 
-  // TODO: @freeing @sanitizer This could be NULL. We need to test.
-  if (!otrng_serialize_dh_public_key(cursor, (size - (cursor - dst)), &len,
-                                     data_msg->dh)) {
-    otrng_free(dst);
+  /* The DH key is written as an OTR MPI, straight after its length */
+  if (!otrng_dh_mpi_serialize(cursor + 4, dst_len - (cursor + 4 - dst),
+                              &dh_len, data_msg->dh)) {
     return OTRNG_ERROR;
   }
-  cursor += len;
+  cursor += otrng_serialize_uint32(cursor, dh_len);
+  cursor += dh_len;
+
   cursor += otrng_serialize_bytes_array(cursor, data_msg->nonce,
                                         DATA_MSG_NONCE_BYTES);
   cursor +=
       otrng_serialize_data(cursor, data_msg->enc_msg, data_msg->enc_msg_len);
 
-  if (body) {
-    *body = dst;
+  if (written) {
+    *written = cursor - dst;
   }
 
-  if (body_len) {
-    *body_len = cursor - dst;
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_data_message_body_serialize(
+    uint8_t **body, size_t *body_len, const data_message_s *data_msg) {
+  size_t size = otrng_data_message_body_len(data_msg);
+  uint8_t *dst = otrng_xmalloc_z(size);
+
+  if (!otrng_data_message_body_serialize_into(dst, size, body_len,
+                                              data_msg)) {
+    otrng_free(dst);
+    return OTRNG_ERROR;
+  }
+
+  if (body) {
+    *body = dst;
+  } else {
+    otrng_free(dst);
   }
 
   return OTRNG_SUCCESS;
@@ -197,10 +226,12 @@ INTERNAL otrng_result otrng_data_message_deserialize(data_message_s *dst,
   cursor += DATA_MSG_NONCE_BYTES;
   len -= DATA_MSG_NONCE_BYTES;
 
-  if (!otrng_deserialize_data(&dst->enc_msg, &dst->enc_msg_len, cursor, len,
-                              &read)) {
+  /* Decrypted in place later, so it goes in secure memory */
+  if (!otrng_deserialize_secure_data(&dst->enc_msg, &dst->enc_msg_len, cursor,
+                                     len, &read)) {
     return OTRNG_ERROR;
   }
+  dst->enc_msg_secure = otrng_true;
 
   cursor += read;
   len -= read;
@@ -42,6 +42,9 @@ typedef struct data_message_s {
   uint8_t nonce[DATA_MSG_NONCE_BYTES];
   uint8_t *enc_msg;
   size_t enc_msg_len;
+  /* Received ciphertexts are decrypted in place, so they are deserialized
+   * into otrng_secure_alloc memory. Sent ones are not secret. */
+  otrng_bool enc_msg_secure;
   uint8_t mac[DATA_MSG_MAC_BYTES];
 } data_message_s;
 
@@ -49,6 +52,13 @@ INTERNAL data_message_s *otrng_data_message_new(void);
 
 INTERNAL void otrng_data_message_free(data_message_s *data_msg);
 
+/* Exact number of bytes taken by the serialized body of [data_msg] */
+INTERNAL size_t otrng_data_message_body_len(const data_message_s *data_msg);
+
+INTERNAL otrng_result otrng_data_message_body_serialize_into(
+    uint8_t *dst, size_t dst_len, size_t *written,
+    const data_message_s *data_msg);
+
 INTERNAL otrng_result otrng_data_message_body_serialize(
     uint8_t **body, size_t *bodylen, const data_message_s *data_msg);
 
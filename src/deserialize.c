@@ -98,9 +98,10 @@ INTERNAL otrng_result otrng_deserialize_uint8(uint8_t *n, const uint8_t *buffer,
   return OTRNG_SUCCESS;
 }
 
-INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
-                                             const uint8_t *buffer,
-                                             size_t buff_len, size_t *read) {
+static otrng_result deserialize_data_into(uint8_t **dst, size_t *dst_len,
+                                          const uint8_t *buffer,
+                                          size_t buff_len, size_t *read,
+                                          void *(*alloc)(size_t)) {
   size_t r = 0;
   uint32_t s = 0;
   uint8_t *t;
@@ -127,7 +128,7 @@ INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
     return OTRNG_ERROR;
   }
 
-  t = otrng_xmalloc_z(s);
+  t = alloc(s);
 
   memcpy(t, buffer + r, s);
 
@@ -143,6 +144,22 @@ INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
+                                             const uint8_t *buffer,
+                                             size_t buff_len, size_t *read) {
+  return deserialize_data_into(dst, dst_len, buffer, buff_len, read,
+                               otrng_xmalloc_z);
+}
+
+INTERNAL otrng_result otrng_deserialize_secure_data(uint8_t **dst,
+                                                    size_t *dst_len,
+                                                    const uint8_t *buffer,
+                                                    size_t buff_len,
+                                                    size_t *read) {
+  return deserialize_data_into(dst, dst_len, buffer, buff_len, read,
+                               otrng_secure_alloc);
+}
+
 INTERNAL otrng_result otrng_deserialize_bytes_array(uint8_t *dst,
                                                     size_t dst_len,
                                                     const uint8_t *buffer,
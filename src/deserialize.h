@@ -45,6 +45,13 @@ INTERNAL otrng_result otrng_deserialize_data(uint8_t **dst, size_t *dst_len,
                                              const uint8_t *buffer,
                                              size_t buff_len, size_t *read);
 
+/* Like otrng_deserialize_data, but into otrng_secure_alloc memory */
+INTERNAL otrng_result otrng_deserialize_secure_data(uint8_t **dst,
+                                                    size_t *dst_len,
+                                                    const uint8_t *buffer,
+                                                    size_t buff_len,
+                                                    size_t *read);
+
 INTERNAL otrng_result otrng_deserialize_bytes_array(uint8_t *dst,
                                                     size_t dst_len,
                                                     const uint8_t *buffer,
@@ -51,6 +51,18 @@ INTERNAL void otrng_dh_free(void);
 INTERNAL void otrng_dh_calculate_public_key(dh_public_key pub,
                                             const dh_private_key priv);
 
+/**
+ * @brief Computes the product of bases[i]^e_i mod p, for i < count.
+ *
+ * @param [exps]    The exponents, count big-endian numbers of exp_len bytes
+ *                  each, one after the other.
+ *
+ * @warning This is not constant time. Only use it with public exponents.
+ */
+INTERNAL void otrng_dh_multi_powm(dh_mpi dst, const dh_mpi *bases,
+                                  const uint8_t *exps, size_t exp_len,
+                                  size_t count);
+
 INTERNAL otrng_result otrng_dh_keypair_generate(dh_keypair_s *keypair);
 
 /**
@@ -73,10 +85,15 @@ INTERNAL otrng_result otrng_dh_shared_secret(dh_shared_secret buffer,
 INTERNAL otrng_result otrng_dh_mpi_serialize(uint8_t *dst, size_t dst_len,
                                              size_t *written, const dh_mpi src);
 
+/* Number of bytes otrng_dh_mpi_serialize writes for [src] */
+INTERNAL size_t otrng_dh_mpi_serialized_len(const dh_mpi src);
+
 INTERNAL otrng_result otrng_dh_mpi_deserialize(dh_mpi *dst,
                                                const uint8_t *buffer,
                                                size_t buf_len, size_t *nread);
 
+/* Checks that [mpi] is in the range [2, p - 2] and in the subgroup of order q
+ * generated by g */
 INTERNAL otrng_bool otrng_dh_mpi_valid(dh_mpi mpi);
 
 INTERNAL dh_mpi otrng_dh_mpi_copy(const dh_mpi src);
@@ -96,6 +113,9 @@ API void otrng_dh_private_key_debug_print(FILE *, dh_private_key);
 
 INTERNAL /*@null@*/ dh_mpi otrng_dh_mpi_generator(void);
 
+/* The Jacobi symbol (a/n), for an odd n > 0 */
+tstatic int otrng_dh_mpi_jacobi(const dh_mpi a, const dh_mpi n);
+
 #endif
 
 #endif
@@ -130,6 +130,137 @@ INTERNAL void otrng_ec_calculate_public_key(ec_point pub,
                                        priv);
 }
 
+/* Below this many points, pairs of double scalar multiplications are faster
+ * than filling the buckets */
+#define EC_MSM_MIN_POINTS 4
+#define EC_MSM_MAX_WINDOW 8
+
+static void ec_pairwise_scalarmul(ec_point dst, const ec_point *points,
+                                  const uint8_t *scalars, size_t scalar_len,
+                                  size_t count) {
+  size_t i;
+
+  goldilocks_448_point_copy(dst, goldilocks_448_point_identity);
+
+  for (i = 0; i + 1 < count; i += 2) {
+    goldilocks_448_scalar_p t1, t2;
+    goldilocks_448_point_p res;
+
+    goldilocks_448_scalar_decode_long(t1, scalars + i * scalar_len,
+                                      scalar_len);
+    goldilocks_448_scalar_decode_long(t2, scalars + (i + 1) * scalar_len,
+                                      scalar_len);
+
+    goldilocks_448_point_double_scalarmul(res, points[i], t1, points[i + 1],
+                                          t2);
+    goldilocks_448_point_add(dst, dst, res);
+  }
+
+  if (i < count) {
+    goldilocks_448_scalar_p t;
+    goldilocks_448_point_p res;
+
+    goldilocks_448_scalar_decode_long(t, scalars + i * scalar_len, scalar_len);
+    goldilocks_448_point_scalarmul(res, points[i], t);
+    goldilocks_448_point_add(dst, dst, res);
+  }
+}
+
+/* The [window] bits of [scalar] starting at bit [offset] */
+static unsigned int scalar_digit(const uint8_t *scalar, size_t scalar_len,
+                                 size_t offset, unsigned int window) {
+  size_t byte = offset / 8;
+  unsigned int bits = scalar[byte];
+
+  if (byte + 1 < scalar_len) {
+    bits |= (unsigned int)scalar[byte + 1] << 8;
+  }
+
+  return (bits >> (offset % 8)) & ((1u << window) - 1);
+}
+
+/* Pippenger's bucket method. For every window, from the most significant,
+ * each point is added to the bucket of its digit, and the buckets are summed
+ * weighted by their digit with two running sums. That is about
+ * count + 2^(window + 1) additions per window, instead of one scalar
+ * multiplication per point. */
+INTERNAL void otrng_ec_point_multi_scalarmul(ec_point dst,
+                                             const ec_point *points,
+                                             const uint8_t *scalars,
+                                             size_t scalar_len, size_t count) {
+  goldilocks_448_point_s *buckets;
+  otrng_bool *used;
+  goldilocks_448_point_p acc, running, window_sum;
+  unsigned int window = 2;
+  size_t buckets_len, windows, w, i, j;
+
+  if (count < EC_MSM_MIN_POINTS) {
+    ec_pairwise_scalarmul(dst, points, scalars, scalar_len, count);
+    return;
+  }
+
+  while (window < EC_MSM_MAX_WINDOW && ((size_t)1 << (window + 2)) <= count) {
+    window++;
+  }
+
+  buckets_len = ((size_t)1 << window) - 1;
+  buckets = otrng_xmalloc(buckets_len * sizeof(goldilocks_448_point_s));
+  used = otrng_xmalloc(buckets_len * sizeof(otrng_bool));
+  windows = (scalar_len * 8 + window - 1) / window;
+
+  goldilocks_448_point_copy(acc, goldilocks_448_point_identity);
+
+  for (w = windows; w-- > 0;) {
+    otrng_bool running_used = otrng_false;
+
+    for (j = 0; j < window; j++) {
+      goldilocks_448_point_double(acc, acc);
+    }
+
+    memset(used, 0, buckets_len * sizeof(otrng_bool));
+
+    for (i = 0; i < count; i++) {
+      unsigned int digit = scalar_digit(scalars + i * scalar_len, scalar_len,
+                                        w * window, window);
+      if (!digit) {
+        continue;
+      }
+
+      if (used[digit - 1]) {
+        goldilocks_448_point_add(&buckets[digit - 1], &buckets[digit - 1],
+                                 points[i]);
+      } else {
+        goldilocks_448_point_copy(&buckets[digit - 1], points[i]);
+        used[digit - 1] = otrng_true;
+      }
+    }
+
+    /* window_sum = sum of digit * buckets[digit - 1] */
+    goldilocks_448_point_copy(window_sum, goldilocks_448_point_identity);
+    for (j = buckets_len; j > 0; j--) {
+      if (used[j - 1]) {
+        if (running_used) {
+          goldilocks_448_point_add(running, running, &buckets[j - 1]);
+        } else {
+          goldilocks_448_point_copy(running, &buckets[j - 1]);
+          running_used = otrng_true;
+        }
+      }
+
+      if (running_used) {
+        goldilocks_448_point_add(window_sum, window_sum, running);
+      }
+    }
+
+    goldilocks_448_point_add(acc, acc, window_sum);
+  }
+
+  goldilocks_448_point_copy(dst, acc);
+
+  otrng_free(buckets);
+  otrng_free(used);
+}
+
 INTERNAL otrng_result otrng_ecdh_keypair_generate(
     ecdh_keypair_s *keypair, const uint8_t sym[ED448_PRIVATE_BYTES]) {
   /*
@@ -191,6 +191,19 @@ otrng_ec_derive_public_key(uint8_t pub[ED448_POINT_BYTES],
 
 INTERNAL void otrng_ec_calculate_public_key(ec_point pub, const ec_scalar priv);
 
+/**
+ * @brief Computes the sum of points[i] * s_i, for i < count.
+ *
+ * @param [scalars] The scalars, count little-endian numbers of scalar_len
+ *                  bytes each, one after the other.
+ *
+ * @warning This is not constant time. Only use it with public scalars.
+ */
+INTERNAL void otrng_ec_point_multi_scalarmul(ec_point dst,
+                                             const ec_point *points,
+                                             const uint8_t *scalars,
+                                             size_t scalar_len, size_t count);
+
 /**
  * @brief Keypair generation.
  *
@@ -0,0 +1,216 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+#include "alloc.h"
+#include "expiry.h"
+
+#define EXPIRY_MIN_CAPACITY 16
+
+/*
+ * A binary min-heap on the deadline. Every entry knows its position, so it can
+ * be moved or removed without a search.
+ */
+struct otrng_expiry_scheduler_s {
+  otrng_expiry_entry_s **heap; /* heap[0] is unused */
+  size_t len;
+  size_t capacity;
+
+  pthread_mutex_t lock;
+};
+
+INTERNAL otrng_expiry_scheduler_s *otrng_expiry_scheduler_new(void) {
+  otrng_expiry_scheduler_s *scheduler =
+      otrng_xmalloc_z(sizeof(otrng_expiry_scheduler_s));
+
+  pthread_mutex_init(&scheduler->lock, NULL);
+
+  return scheduler;
+}
+
+INTERNAL void
+otrng_expiry_scheduler_free(otrng_expiry_scheduler_s *scheduler) {
+  if (!scheduler) {
+    return;
+  }
+
+  otrng_free(scheduler->heap);
+  pthread_mutex_destroy(&scheduler->lock);
+  otrng_free(scheduler);
+}
+
+static void place(otrng_expiry_scheduler_s *scheduler, size_t position,
+                  otrng_expiry_entry_s *entry) {
+  scheduler->heap[position] = entry;
+  entry->position = position;
+}
+
+static void sift_up(otrng_expiry_scheduler_s *scheduler, size_t position) {
+  otrng_expiry_entry_s *entry = scheduler->heap[position];
+
+  while (position > 1 &&
+         scheduler->heap[position / 2]->deadline > entry->deadline) {
+    place(scheduler, position, scheduler->heap[position / 2]);
+    position /= 2;
+  }
+
+  place(scheduler, position, entry);
+}
+
+static void sift_down(otrng_expiry_scheduler_s *scheduler, size_t position) {
+  otrng_expiry_entry_s *entry = scheduler->heap[position];
+
+  for (;;) {
+    size_t child = position * 2;
+
+    if (child > scheduler->len) {
+      break;
+    }
+
+    if (child < scheduler->len &&
+        scheduler->heap[child + 1]->deadline <
+            scheduler->heap[child]->deadline) {
+      child++;
+    }
+
+    if (scheduler->heap[child]->deadline >= entry->deadline) {
+      break;
+    }
+
+    place(scheduler, position, scheduler->heap[child]);
+    position = child;
+  }
+
+  place(scheduler, position, entry);
+}
+
+/* Must be called with the lock held */
+static void remove_at(otrng_expiry_scheduler_s *scheduler, size_t position) {
+  otrng_expiry_entry_s *last = scheduler->heap[scheduler->len];
+
+  scheduler->heap[position]->position = 0;
+  scheduler->len--;
+
+  if (position > scheduler->len) {
+    return;
+  }
+
+  place(scheduler, position, last);
+  sift_up(scheduler, position);
+  sift_down(scheduler, last->position);
+}
+
+INTERNAL void otrng_expiry_schedule(otrng_expiry_scheduler_s *scheduler,
+                                    otrng_expiry_entry_s *entry,
+                                    time_t deadline) {
+  if (!scheduler) {
+    return;
+  }
+
+  pthread_mutex_lock(&scheduler->lock);
+
+  entry->deadline = deadline;
+
+  if (entry->position) {
+    sift_up(scheduler, entry->position);
+    sift_down(scheduler, entry->position);
+    pthread_mutex_unlock(&scheduler->lock);
+    return;
+  }
+
+  if (scheduler->len + 1 >= scheduler->capacity) {
+    size_t capacity = scheduler->capacity ? scheduler->capacity * 2
+                                          : EXPIRY_MIN_CAPACITY;
+    scheduler->heap = otrng_xrealloc(
+        scheduler->heap, capacity * sizeof(otrng_expiry_entry_s *));
+    scheduler->capacity = capacity;
+  }
+
+  scheduler->len++;
+  place(scheduler, scheduler->len, entry);
+  sift_up(scheduler, scheduler->len);
+
+  pthread_mutex_unlock(&scheduler->lock);
+}
+
+INTERNAL void otrng_expiry_cancel(otrng_expiry_scheduler_s *scheduler,
+                                  otrng_expiry_entry_s *entry) {
+  if (!scheduler) {
+    return;
+  }
+
+  pthread_mutex_lock(&scheduler->lock);
+  if (entry->position) {
+    remove_at(scheduler, entry->position);
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+}
+
+INTERNAL otrng_bool
+otrng_expiry_next_deadline(time_t *deadline,
+                           otrng_expiry_scheduler_s *scheduler) {
+  otrng_bool result = otrng_false;
+
+  if (!scheduler) {
+    return otrng_false;
+  }
+
+  pthread_mutex_lock(&scheduler->lock);
+  if (scheduler->len > 0) {
+    *deadline = scheduler->heap[1]->deadline;
+    result = otrng_true;
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+
+  return result;
+}
+
+INTERNAL otrng_expiry_entry_s *
+otrng_expiry_take_due(otrng_expiry_scheduler_s *scheduler, time_t now) {
+  otrng_expiry_entry_s *entry = NULL;
+
+  if (!scheduler) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&scheduler->lock);
+  if (scheduler->len > 0 && scheduler->heap[1]->deadline <= now) {
+    entry = scheduler->heap[1];
+    remove_at(scheduler, 1);
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+
+  return entry;
+}
+
+INTERNAL size_t otrng_expiry_len(otrng_expiry_scheduler_s *scheduler) {
+  size_t len;
+
+  if (!scheduler) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&scheduler->lock);
+  len = scheduler->len;
+  pthread_mutex_unlock(&scheduler->lock);
+
+  return len;
+}
@@ -0,0 +1,123 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A min-heap of the things that expire at a known time: sessions, some time
+ * after their ephemeral keys were last generated, and fragment contexts, some
+ * time after their last fragment arrived. Polling only looks at the entries
+ * that are due, instead of every conversation and fragment context. All the
+ * functions in this file can be called concurrently from different threads on
+ * the same scheduler.
+ */
+
+#ifndef OTRNG_EXPIRY_H
+#define OTRNG_EXPIRY_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "error.h"
+#include "shared.h"
+
+typedef enum {
+  OTRNG_EXPIRY_SESSION = 1,    /* [owner] is an otrng_s */
+  OTRNG_EXPIRY_FRAGMENTS = 2,  /* [owner] is a fragment_context_s, [context]
+                                  the fragment_contexts_s holding it */
+} otrng_expiry_kind;
+
+/* Embedded in whatever expires. It must be cancelled before it is freed. */
+typedef struct otrng_expiry_entry_s {
+  otrng_expiry_kind kind;
+  void *owner;
+  /*@null@*/ void *context;
+  /* the time the deadline was computed from */
+  time_t scheduled_from;
+  time_t deadline;
+  size_t position; /* 1-based, in the heap. 0 while not scheduled */
+} otrng_expiry_entry_s;
+
+typedef struct otrng_expiry_scheduler_s otrng_expiry_scheduler_s;
+
+INTERNAL otrng_expiry_scheduler_s *otrng_expiry_scheduler_new(void);
+
+/**
+ * @brief Frees the scheduler. Every entry must have been cancelled, or have
+ * expired, before.
+ *
+ * @param [scheduler]   The scheduler.
+ */
+INTERNAL void
+otrng_expiry_scheduler_free(/*@null@*/ otrng_expiry_scheduler_s *scheduler);
+
+/**
+ * @brief Schedules the entry, or moves it if it is already scheduled.
+ *
+ * @param [scheduler]   The scheduler. Nothing is done if it is NULL.
+ * @param [entry]       The entry.
+ * @param [deadline]    When the entry expires.
+ */
+INTERNAL void
+otrng_expiry_schedule(/*@null@*/ otrng_expiry_scheduler_s *scheduler,
+                      otrng_expiry_entry_s *entry, time_t deadline);
+
+/**
+ * @brief Removes the entry from the scheduler, if it is in it.
+ *
+ * @param [scheduler]   The scheduler. Nothing is done if it is NULL.
+ * @param [entry]       The entry.
+ */
+INTERNAL void
+otrng_expiry_cancel(/*@null@*/ otrng_expiry_scheduler_s *scheduler,
+                    otrng_expiry_entry_s *entry);
+
+/**
+ * @brief The earliest deadline in the scheduler.
+ *
+ * @param [deadline]    Where the deadline is written.
+ * @param [scheduler]   The scheduler.
+ *
+ * @return otrng_false if nothing is scheduled.
+ */
+INTERNAL otrng_bool
+otrng_expiry_next_deadline(time_t *deadline,
+                           /*@null@*/ otrng_expiry_scheduler_s *scheduler);
+
+/**
+ * @brief Removes and returns the entry with the earliest deadline, if it is
+ * due at [now].
+ *
+ * @param [scheduler]   The scheduler.
+ * @param [now]         The current time.
+ *
+ * @return The entry, or NULL if none is due.
+ */
+INTERNAL /*@null@*/ otrng_expiry_entry_s *
+otrng_expiry_take_due(/*@null@*/ otrng_expiry_scheduler_s *scheduler,
+                      time_t now);
+
+/**
+ * @brief The number of scheduled entries.
+ *
+ * @param [scheduler]   The scheduler.
+ */
+INTERNAL size_t
+otrng_expiry_len(/*@null@*/ otrng_expiry_scheduler_s *scheduler);
+
+#endif
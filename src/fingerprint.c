@@ -21,6 +21,8 @@
 #define OTRNG_FINGERPRINT_PRIVATE
 
 #include <assert.h>
+#include <sodium.h>
+#include <string.h>
 
 #include "alloc.h"
 #include "client.h"
@@ -28,6 +30,8 @@
 #include "serialize.h"
 #include "shake.h"
 
+#define KNOWN_FINGERPRINTS_MIN_CAPACITY 16
+
 /* Convert a 56-byte hash value to a 126-byte human-readable value */
 /* The 126-byte output INCLUDES a terminating zero byte. The actual content */
 /* is only 125 bytes */
@@ -118,52 +122,258 @@ tstatic void otrng_known_fingerprint_free(otrng_known_fingerprint_s *kf) {
 
 static void free_fp_proxy(void *kf) { otrng_known_fingerprint_free(kf); }
 
+INTERNAL otrng_known_fingerprints_s *otrng_known_fingerprints_new(void) {
+  otrng_known_fingerprints_s *kfs =
+      otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
+
+  /* Usernames and fingerprints come from peers, so the indexes are keyed to
+   * keep them from forcing collisions. */
+  randombytes_buf(kfs->hash_key, KNOWN_FINGERPRINTS_HASH_KEY_BYTES);
+
+  return kfs;
+}
+
 API void otrng_known_fingerprints_free(otrng_known_fingerprints_s *kf) {
   if (kf == NULL) {
     return;
   }
   otrng_list_free(kf->fps, free_fp_proxy);
+  otrng_free(kf->by_fp.slots);
+  otrng_free(kf->by_username.slots);
   otrng_free(kf);
 }
 
+/* The key of an entry in one of the indexes: the fingerprint or the
+ * username. */
+static const void *index_key(const otrng_known_fingerprint_s *kf,
+                             otrng_bool by_fp) {
+  return by_fp ? (const void *)kf->fp : (const void *)kf->username;
+}
+
+static otrng_bool index_key_matches(const otrng_known_fingerprint_s *kf,
+                                    otrng_bool by_fp, const void *key) {
+  if (by_fp) {
+    return memcmp(kf->fp, key, FPRINT_LEN_BYTES) == 0;
+  }
+
+  return strcmp(kf->username, key) == 0;
+}
+
+static otrng_known_fingerprint_s **index_next(otrng_known_fingerprint_s *kf,
+                                              otrng_bool by_fp) {
+  return by_fp ? &kf->next_by_fp : &kf->next_by_username;
+}
+
+static known_fingerprints_index_s *get_index(otrng_known_fingerprints_s *kfs,
+                                             otrng_bool by_fp) {
+  return by_fp ? &kfs->by_fp : &kfs->by_username;
+}
+
+static uint64_t index_hash(const otrng_known_fingerprints_s *kfs,
+                           otrng_bool by_fp, const void *key) {
+  uint8_t out[crypto_shorthash_BYTES];
+  size_t key_len = by_fp ? FPRINT_LEN_BYTES : strlen(key);
+  uint64_t hash = 0;
+  size_t i;
+
+  crypto_shorthash(out, key, key_len, kfs->hash_key);
+
+  for (i = 0; i < crypto_shorthash_BYTES; i++) {
+    hash = (hash << 8) | out[i];
+  }
+
+  return hash;
+}
+
+static void insert_slot(known_fingerprints_slot_s *slots, size_t capacity,
+                        uint64_t hash, otrng_known_fingerprint_s *first) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)(hash & mask);
+
+  while (slots[i].first) {
+    i = (i + 1) & mask;
+  }
+
+  slots[i].hash = hash;
+  slots[i].first = first;
+}
+
+static void index_grow(known_fingerprints_index_s *index) {
+  size_t capacity = index->capacity ? index->capacity * 2
+                                    : KNOWN_FINGERPRINTS_MIN_CAPACITY;
+  known_fingerprints_slot_s *slots =
+      otrng_xmalloc_z(capacity * sizeof(known_fingerprints_slot_s));
+  size_t i;
+
+  for (i = 0; i < index->capacity; i++) {
+    if (index->slots[i].first) {
+      insert_slot(slots, capacity, index->slots[i].hash,
+                  index->slots[i].first);
+    }
+  }
+
+  otrng_free(index->slots);
+  index->slots = slots;
+  index->capacity = capacity;
+}
+
+static /*@null@*/ known_fingerprints_slot_s *
+index_find_slot(const otrng_known_fingerprints_s *kfs, otrng_bool by_fp,
+                const void *key) {
+  const known_fingerprints_index_s *index =
+      by_fp ? &kfs->by_fp : &kfs->by_username;
+  size_t mask, i;
+  uint64_t hash;
+
+  if (index->len == 0) {
+    return NULL;
+  }
+
+  mask = index->capacity - 1;
+  hash = index_hash(kfs, by_fp, key);
+  i = (size_t)(hash & mask);
+
+  while (index->slots[i].first) {
+    if (index->slots[i].hash == hash &&
+        index_key_matches(index->slots[i].first, by_fp, key)) {
+      return &index->slots[i];
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+static void index_add(otrng_known_fingerprints_s *kfs, otrng_bool by_fp,
+                      otrng_known_fingerprint_s *kf) {
+  known_fingerprints_index_s *index = get_index(kfs, by_fp);
+  const void *key = index_key(kf, by_fp);
+  known_fingerprints_slot_s *slot = index_find_slot(kfs, by_fp, key);
+  otrng_known_fingerprint_s *last;
+
+  *index_next(kf, by_fp) = NULL;
+
+  if (slot) {
+    /* Chains are as long as the fingerprints a peer has, or the peers
+     * sharing a fingerprint: short */
+    for (last = slot->first; *index_next(last, by_fp);
+         last = *index_next(last, by_fp)) {
+    }
+    *index_next(last, by_fp) = kf;
+    return;
+  }
+
+  /* Keep the load factor under 3/4 */
+  if ((index->len + 1) * 4 > index->capacity * 3) {
+    index_grow(index);
+  }
+
+  insert_slot(index->slots, index->capacity, index_hash(kfs, by_fp, key), kf);
+  index->len++;
+}
+
+static void index_remove(otrng_known_fingerprints_s *kfs, otrng_bool by_fp,
+                         otrng_known_fingerprint_s *kf) {
+  known_fingerprints_index_s *index = get_index(kfs, by_fp);
+  known_fingerprints_slot_s *slot =
+      index_find_slot(kfs, by_fp, index_key(kf, by_fp));
+  otrng_known_fingerprint_s **cursor;
+  size_t mask, i, j;
+
+  if (!slot) {
+    return;
+  }
+
+  if (slot->first != kf || *index_next(kf, by_fp)) {
+    for (cursor = &slot->first; *cursor && *cursor != kf;
+         cursor = index_next(*cursor, by_fp)) {
+    }
+    if (*cursor) {
+      *cursor = *index_next(kf, by_fp);
+      *index_next(kf, by_fp) = NULL;
+    }
+    return;
+  }
+
+  /* kf was the only entry with its key: backward shift deletion, as in the
+   * skipped keys store */
+  mask = index->capacity - 1;
+  i = (size_t)(slot - index->slots);
+  j = i;
+
+  for (;;) {
+    size_t ideal;
+
+    j = (j + 1) & mask;
+    if (!index->slots[j].first) {
+      break;
+    }
+
+    ideal = (size_t)(index->slots[j].hash & mask);
+    if (((j - ideal) & mask) >= ((j - i) & mask)) {
+      index->slots[i] = index->slots[j];
+      i = j;
+    }
+  }
+
+  index->slots[i].first = NULL;
+  index->slots[i].hash = 0;
+  index->len--;
+}
+
+INTERNAL void otrng_known_fingerprints_add(otrng_known_fingerprints_s *kfs,
+                                           otrng_known_fingerprint_s *kf) {
+  list_element_s *element = otrng_list_add(kf, NULL);
+
+  index_add(kfs, otrng_true, kf);
+  index_add(kfs, otrng_false, kf);
+
+  /* Appending through the tail keeps bulk loading linear */
+  if (kfs->last) {
+    kfs->last->next = element;
+  } else {
+    kfs->fps = element;
+  }
+  kfs->last = element;
+}
+
+static void known_fingerprints_remove(otrng_known_fingerprints_s *kfs,
+                                      otrng_known_fingerprint_s *kf) {
+  index_remove(kfs, otrng_true, kf);
+  index_remove(kfs, otrng_false, kf);
+
+  otrng_list_free_nodes(otrng_list_unlink(kf, &kfs->fps, &kfs->last));
+}
+
 API /*@null@*/ otrng_known_fingerprint_s *
 otrng_fingerprint_get_by_fp(const otrng_client_s *client,
                             const otrng_fingerprint fp) {
-  list_element_s *c;
+  known_fingerprints_slot_s *slot;
   assert(client != NULL);
 
   if (client->fingerprints == NULL) {
     return NULL;
   }
 
-  for (c = client->fingerprints->fps; c; c = c->next) {
-    otrng_known_fingerprint_s *kf = c->data;
-    if (memcmp(fp, kf->fp, FPRINT_LEN_BYTES) == 0) {
-      return kf;
-    }
-  }
+  slot = index_find_slot(client->fingerprints, otrng_true, fp);
 
-  return NULL;
+  return slot ? slot->first : NULL;
 }
 
 API /*@null@*/ otrng_known_fingerprint_s *
 otrng_fingerprint_get_by_username(const otrng_client_s *client,
                                   const char *username) {
-  list_element_s *c;
+  known_fingerprints_slot_s *slot;
   assert(client != NULL);
 
   if (client->fingerprints == NULL) {
     return NULL;
   }
 
-  for (c = client->fingerprints->fps; c; c = c->next) {
-    otrng_known_fingerprint_s *kf = c->data;
-    if (strcmp(username, kf->username) == 0) {
-      return kf;
-    }
-  }
+  slot = index_find_slot(client->fingerprints, otrng_false, username);
 
-  return NULL;
+  return slot ? slot->first : NULL;
 }
 
 API otrng_known_fingerprint_s *otrng_fingerprint_add(otrng_client_s *client,
@@ -174,7 +384,7 @@ API otrng_known_fingerprint_s *otrng_fingerprint_add(otrng_client_s *client,
   assert(client != NULL);
 
   if (client->fingerprints == NULL) {
-    client->fingerprints = otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
+    client->fingerprints = otrng_known_fingerprints_new();
   }
 
   nfp = otrng_xmalloc_z(sizeof(otrng_known_fingerprint_s));
@@ -182,7 +392,7 @@ API otrng_known_fingerprint_s *otrng_fingerprint_add(otrng_client_s *client,
   nfp->trusted = trusted;
   memcpy(nfp->fp, fp, FPRINT_LEN_BYTES);
 
-  client->fingerprints->fps = otrng_list_add(nfp, client->fingerprints->fps);
+  otrng_known_fingerprints_add(client->fingerprints, nfp);
 
   return nfp;
 }
@@ -206,31 +416,39 @@ API void otrng_fingerprints_do_all(const struct otrng_client_s *client,
 
 API void otrng_fingerprint_forget(const otrng_client_s *client,
                                   otrng_known_fingerprint_s *fp) {
-  list_element_s *prev = NULL, *c, *work;
+  otrng_known_fingerprints_s *kfs;
+  otrng_known_fingerprint_s *kf;
+  known_fingerprints_slot_s *slot;
+  otrng_fingerprint key;
+  char *username;
   assert(client != NULL);
 
-  if (client->fingerprints == NULL) {
+  kfs = client->fingerprints;
+  if (kfs == NULL) {
     return;
   }
 
-  for (c = client->fingerprints->fps; c;) {
-    otrng_known_fingerprint_s *kf = c->data;
-    if (memcmp(fp->fp, kf->fp, FPRINT_LEN_BYTES) == 0 &&
-        strcmp(fp->username, kf->username) == 0) {
-      work = c;
-      c = work->next;
-      if (prev) {
-        prev->next = c;
-      } else {
-        client->fingerprints->fps = c;
+  /* fp itself can be one of the entries removed */
+  memcpy(key, fp->fp, FPRINT_LEN_BYTES);
+  username = otrng_xstrdup(fp->username);
+
+  for (;;) {
+    slot = index_find_slot(kfs, otrng_true, key);
+    for (kf = slot ? slot->first : NULL; kf; kf = kf->next_by_fp) {
+      if (strcmp(username, kf->username) == 0) {
+        break;
       }
-      otrng_known_fingerprint_free(kf);
-      otrng_free(work);
-    } else {
-      prev = c;
-      c = c->next;
     }
+
+    if (!kf) {
+      break;
+    }
+
+    known_fingerprints_remove(kfs, kf);
+    otrng_known_fingerprint_free(kf);
   }
+
+  otrng_free(username);
 }
 
 /* This returns the fingerprint of the peer, not the self.
@@ -56,6 +56,11 @@ typedef struct otrng_known_fingerprint_s {
   char *username;
   otrng_fingerprint fp;
   otrng_bool trusted;
+
+  /* the next known fingerprints with the same fp and the same username, in
+   * the order they were added */
+  /*@null@*/ struct otrng_known_fingerprint_s *next_by_fp;
+  /*@null@*/ struct otrng_known_fingerprint_s *next_by_username;
 } otrng_known_fingerprint_s;
 
 /* the OTRv3 fingerprint, its associated username and its trust value */
@@ -64,9 +69,30 @@ typedef struct otrng_known_fingerprint_v3_s {
   Fingerprint *fp;
 } otrng_known_fingerprint_v3_s;
 
-/* a list of known fingerprints */
+typedef struct known_fingerprints_slot_s {
+  uint64_t hash;
+  /* the first known fingerprint with this key */
+  /*@null@*/ otrng_known_fingerprint_s *first;
+} known_fingerprints_slot_s;
+
+/* Known fingerprints by a key (the fingerprint or the username), in an open
+ * addressing table with linear probing. Entries sharing a key are chained. */
+typedef struct known_fingerprints_index_s {
+  /*@null@*/ known_fingerprints_slot_s *slots;
+  size_t capacity; /* Zero or a power of two */
+  size_t len;
+} known_fingerprints_index_s;
+
+#define KNOWN_FINGERPRINTS_HASH_KEY_BYTES 16
+
+/* a list of known fingerprints, indexed by fingerprint and by username */
 typedef struct otrng_known_fingerprints_s {
   list_element_s *fps;
+  /*@null@*/ list_element_s *last;
+
+  known_fingerprints_index_s by_fp;
+  known_fingerprints_index_s by_username;
+  uint8_t hash_key[KNOWN_FINGERPRINTS_HASH_KEY_BYTES];
 } otrng_known_fingerprints_s;
 
 /**
@@ -99,6 +125,23 @@ INTERNAL otrng_result otrng_serialize_fingerprint(
     otrng_fingerprint fp, const otrng_public_key long_term_pub_key,
     const otrng_public_key long_term_forging_pub_key);
 
+/**
+ * @brief Create an empty set of known fingerprints.
+ *
+ * @return [otrng_known_fingerprints_s]   The known fingerprints.
+ */
+INTERNAL otrng_known_fingerprints_s *otrng_known_fingerprints_new(void);
+
+/**
+ * @brief Add a known fingerprint to the list and to its indexes. The known
+ * fingerprints take ownership of it.
+ *
+ * @param [kfs]    The known fingerprints.
+ * @param [kf]     The known fingerprint to add.
+ */
+INTERNAL void otrng_known_fingerprints_add(otrng_known_fingerprints_s *kfs,
+                                           otrng_known_fingerprint_s *kf);
+
 /**
  * @brief Free a known fingerprints.
  *
@@ -189,5 +232,8 @@ API /*@null@*/ otrng_known_fingerprint_s *
 otrng_fingerprint_get_current(const struct otrng_s *conn);
 
 #ifdef OTRNG_FINGERPRINT_PRIVATE
+
+tstatic void otrng_known_fingerprint_free(otrng_known_fingerprint_s *kf);
+
 #endif
 #endif
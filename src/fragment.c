@@ -18,11 +18,7 @@
  *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef S_SPLINT_S
-#include <gcrypt.h>
-#endif
-
-#include <stdio.h>
+#include <sodium.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -31,114 +27,425 @@
 
 #include "alloc.h"
 #include "fragment.h"
-#include "list.h"
-
-/* Example:
-   ?OTR|00000000|00000001|00000002,00001,00002,one , */
-#define FRAGMENT_FORMAT "?OTR|%08x|%08x|%08x,%05hu,%05hu,%.*s,"
-#define UNFRAGMENT_FORMAT "?OTR|%08x|%08x|%08x,%05hu,%05hu,%n%*[^,],%n"
 
-otrng_message_to_send_s *otrng_message_new(void) {
+API otrng_message_to_send_s *otrng_message_new(void) {
   otrng_message_to_send_s *msg =
       otrng_xmalloc_z(sizeof(otrng_message_to_send_s));
 
   return msg;
 }
 
-tstatic void otrng_message_free(otrng_message_to_send_s *msg) {
-  int i;
-
+API void otrng_message_free(otrng_message_to_send_s *msg) {
   if (!msg) {
     return;
   }
 
-  for (i = 0; i < msg->total; i++) {
-    otrng_free(msg->pieces[i]);
-  }
-
+  /* The pieces point into the same allocation as the index */
   otrng_free(msg->pieces);
   otrng_free(msg);
 }
 
+/* An upper bound on the reassembly buffer of a single message, so a lone
+   fragment claiming a huge total is rejected straight away */
+#define FRAGMENT_MAX_REASSEMBLY_BYTES (64 * 1024 * 1024)
+
+#define FRAGMENT_CONTEXTS_MIN_CAPACITY 8
+
+/* Drops the least recently updated context other than [keep]. Returns
+   otrng_false if there is none. */
+static otrng_bool evict_oldest(fragment_contexts_s *contexts,
+                               /*@null@*/ const fragment_context_s *keep) {
+  fragment_context_s *victim = contexts->oldest;
+
+  if (victim == keep) {
+    victim = victim->newer;
+  }
+
+  if (!victim) {
+    return otrng_false;
+  }
+
+  otrng_fragment_contexts_forget(contexts, victim);
+  return otrng_true;
+}
+
+/* Accounts [bytes] more to [context]. Other contexts are dropped if they do
+   not fit under the bound of its owner; fragments are rejected, instead of
+   exiting through otrng_xmalloc, only when they cannot fit at all. */
+static otrng_bool fragment_pending_reserve(fragment_context_s *context,
+                                           size_t bytes) {
+  fragment_contexts_s *contexts = context->owner;
+
+  if (contexts) {
+    while (bytes > contexts->max_pending_bytes - contexts->pending_bytes) {
+      if (!evict_oldest(contexts, context)) {
+        return otrng_false;
+      }
+    }
+
+    contexts->pending_bytes += bytes;
+  }
+
+  context->reserved += bytes;
+  return otrng_true;
+}
+
+static void fragment_pending_release(fragment_context_s *context,
+                                     size_t bytes) {
+  if (context->owner) {
+    context->owner->pending_bytes -= bytes;
+  }
+
+  context->reserved -= bytes;
+}
+
+static void unlink_context(fragment_contexts_s *contexts,
+                           fragment_context_s *context) {
+  if (context->older) {
+    context->older->newer = context->newer;
+  } else {
+    contexts->oldest = context->newer;
+  }
+
+  if (context->newer) {
+    context->newer->older = context->older;
+  } else {
+    contexts->newest = context->older;
+  }
+
+  context->older = NULL;
+  context->newer = NULL;
+}
+
+static void link_newest(fragment_contexts_s *contexts,
+                        fragment_context_s *context) {
+  context->older = contexts->newest;
+  context->newer = NULL;
+
+  if (contexts->newest) {
+    contexts->newest->newer = context;
+  } else {
+    contexts->oldest = context;
+  }
+
+  contexts->newest = context;
+}
+
 tstatic void initialize_fragment_context(fragment_context_s *context) {
   context->identifier = 0;
+  context->sender_tag = 0;
   context->count = 0;
   context->total = 0;
   context->last_fragment_received_at = 0;
   context->total_message_len = 0;
-  context->fragments = NULL;
+  context->buffer = NULL;
+  context->buffer_len = 0;
+  context->stride = 0;
+  context->pieces = NULL;
 }
 
 tstatic void free_fragments_in_context(fragment_context_s *context) {
-  unsigned int i;
-
-  if (!context->fragments) {
-    return;
-  }
-
-  for (i = 0; i < context->total; i++) {
-    otrng_free(context->fragments[i]);
-    context->fragments[i] = NULL;
-  }
+  otrng_free(context->buffer);
+  context->buffer = NULL;
+  context->buffer_len = 0;
+  otrng_free(context->pieces);
+  context->pieces = NULL;
+  fragment_pending_release(context, context->reserved);
 }
 
 tstatic void reset_fragment_context(fragment_context_s *context) {
+  uint32_t identifier = context->identifier;
+  uint32_t sender_tag = context->sender_tag;
+
   free_fragments_in_context(context);
   initialize_fragment_context(context);
+
+  /* It is still stored under its key */
+  context->identifier = identifier;
+  context->sender_tag = sender_tag;
 }
 
-tstatic /*@notnull@*/ fragment_context_s *otrng_fragment_context_new(void) {
+tstatic fragment_context_s *otrng_fragment_context_new(void) {
   fragment_context_s *context = otrng_xmalloc_z(sizeof(fragment_context_s));
+
   initialize_fragment_context(context);
   return context;
 }
 
 INTERNAL void otrng_fragment_context_free(fragment_context_s *context) {
   free_fragments_in_context(context);
-  otrng_free(context->fragments);
   otrng_free(context);
 }
 
-static otrng_result create_fragment_message(char **dst, const char *piece,
-                                            size_t piece_len,
-                                            uint32_t identifier,
-                                            uint32_t our_instance,
-                                            uint32_t their_instance,
-                                            uint16_t current, uint16_t total) {
-  int res;
+INTERNAL fragment_contexts_s *otrng_fragment_contexts_new(void) {
+  fragment_contexts_s *contexts = otrng_xmalloc_z(sizeof(fragment_contexts_s));
 
-  if (strlen(piece) < piece_len) {
-    return OTRNG_ERROR;
+  /* Identifiers and instance tags are chosen by the peer, so the table is
+   * keyed to keep them from forcing collisions. */
+  randombytes_buf(contexts->hash_key, FRAGMENT_CONTEXTS_HASH_KEY_BYTES);
+
+  contexts->max_pending_bytes = FRAGMENT_MAX_PENDING_BYTES;
+  contexts->max_pending_contexts = FRAGMENT_MAX_PENDING_CONTEXTS;
+
+  return contexts;
+}
+
+INTERNAL void
+otrng_fragment_contexts_free(/*@null@*/ fragment_contexts_s *contexts) {
+  size_t i;
+
+  if (!contexts) {
+    return;
+  }
+
+  for (i = 0; i < contexts->capacity; i++) {
+    if (contexts->slots[i].context) {
+      otrng_expiry_cancel(contexts->scheduler,
+                          &contexts->slots[i].context->expiry);
+      otrng_fragment_context_free(contexts->slots[i].context);
+    }
   }
 
-  *dst = otrng_xmalloc_z(FRAGMENT_HEADER_LEN + piece_len + 1);
+  otrng_free(contexts->slots);
+  otrng_free(contexts);
+}
 
-  res = snprintf(*dst, FRAGMENT_HEADER_LEN + piece_len + 1, FRAGMENT_FORMAT,
-                 identifier, our_instance, their_instance, current, total,
-                 (int)piece_len, piece);
-  if (res < 0) {
-    return OTRNG_ERROR;
+INTERNAL size_t
+otrng_fragment_contexts_len(/*@null@*/ const fragment_contexts_s *contexts) {
+  if (!contexts) {
+    return 0;
   }
 
-  (*dst)[FRAGMENT_HEADER_LEN + piece_len] = '\0';
+  return contexts->len;
+}
 
-  return OTRNG_SUCCESS;
+INTERNAL void
+otrng_fragment_contexts_set_expiry(fragment_contexts_s **contexts,
+                                   otrng_expiry_scheduler_s *scheduler,
+                                   uint32_t expiration_time) {
+  if (!*contexts) {
+    *contexts = otrng_fragment_contexts_new();
+  }
+
+  (*contexts)->scheduler = scheduler;
+  (*contexts)->expiration_time = expiration_time;
 }
 
-static otrng_result
-init_message_to_send_with_total(otrng_message_to_send_s *fragments, int total) {
-  size_t pieces_len;
+static void schedule_expiry(fragment_contexts_s *contexts,
+                            fragment_context_s *context) {
+  if (!contexts->scheduler) {
+    return;
+  }
 
-  if (total < 1 || total > 65535) {
-    return OTRNG_ERROR;
+  context->expiry.kind = OTRNG_EXPIRY_FRAGMENTS;
+  context->expiry.owner = context;
+  context->expiry.context = contexts;
+  context->expiry.scheduled_from = context->last_fragment_received_at;
+  otrng_expiry_schedule(contexts->scheduler, &context->expiry,
+                        context->last_fragment_received_at +
+                            contexts->expiration_time);
+}
+
+static uint64_t fragment_contexts_hash(const fragment_contexts_s *contexts,
+                                       uint32_t identifier,
+                                       uint32_t sender_tag) {
+  uint8_t buffer[8];
+  uint8_t out[crypto_shorthash_BYTES];
+  uint64_t hash = 0;
+  size_t i;
+
+  buffer[0] = (identifier >> 24) & 0xFF;
+  buffer[1] = (identifier >> 16) & 0xFF;
+  buffer[2] = (identifier >> 8) & 0xFF;
+  buffer[3] = identifier & 0xFF;
+  buffer[4] = (sender_tag >> 24) & 0xFF;
+  buffer[5] = (sender_tag >> 16) & 0xFF;
+  buffer[6] = (sender_tag >> 8) & 0xFF;
+  buffer[7] = sender_tag & 0xFF;
+
+  crypto_shorthash(out, buffer, sizeof(buffer), contexts->hash_key);
+
+  for (i = 0; i < crypto_shorthash_BYTES; i++) {
+    hash = (hash << 8) | out[i];
   }
 
-  fragments->total = total;
+  return hash;
+}
 
-  pieces_len = fragments->total * sizeof(string_p);
-  fragments->pieces = otrng_xmalloc_z(pieces_len);
+static void insert_slot(fragment_contexts_slot_s *slots, size_t capacity,
+                        uint64_t hash, fragment_context_s *context) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)(hash & mask);
 
-  return OTRNG_SUCCESS;
+  while (slots[i].context) {
+    i = (i + 1) & mask;
+  }
+
+  slots[i].hash = hash;
+  slots[i].context = context;
+}
+
+static void fragment_contexts_grow(fragment_contexts_s *contexts) {
+  size_t capacity = contexts->capacity ? contexts->capacity * 2
+                                       : FRAGMENT_CONTEXTS_MIN_CAPACITY;
+  fragment_contexts_slot_s *slots =
+      otrng_xmalloc_z(capacity * sizeof(fragment_contexts_slot_s));
+  size_t i;
+
+  for (i = 0; i < contexts->capacity; i++) {
+    if (contexts->slots[i].context) {
+      insert_slot(slots, capacity, contexts->slots[i].hash,
+                  contexts->slots[i].context);
+    }
+  }
+
+  otrng_free(contexts->slots);
+  contexts->slots = slots;
+  contexts->capacity = capacity;
+}
+
+tstatic void otrng_fragment_contexts_add(fragment_contexts_s *contexts,
+                                         fragment_context_s *context) {
+  /* Keep the load factor under 3/4 */
+  if ((contexts->len + 1) * 4 > contexts->capacity * 3) {
+    fragment_contexts_grow(contexts);
+  }
+
+  insert_slot(contexts->slots, contexts->capacity,
+              fragment_contexts_hash(contexts, context->identifier,
+                                     context->sender_tag),
+              context);
+  contexts->len++;
+
+  context->owner = contexts;
+  contexts->pending_bytes += context->reserved;
+  link_newest(contexts, context);
+}
+
+static /*@null@*/ fragment_contexts_slot_s *
+find_slot(const fragment_contexts_s *contexts, uint32_t identifier,
+          uint32_t sender_tag) {
+  size_t mask, i;
+  uint64_t hash;
+
+  if (!contexts || contexts->len == 0) {
+    return NULL;
+  }
+
+  mask = contexts->capacity - 1;
+  hash = fragment_contexts_hash(contexts, identifier, sender_tag);
+  i = (size_t)(hash & mask);
+
+  while (contexts->slots[i].context) {
+    const fragment_context_s *context = contexts->slots[i].context;
+    if (contexts->slots[i].hash == hash &&
+        context->identifier == identifier &&
+        context->sender_tag == sender_tag) {
+      return &contexts->slots[i];
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+INTERNAL /*@null@*/ fragment_context_s *
+otrng_fragment_contexts_get(/*@null@*/ const fragment_contexts_s *contexts,
+                            uint32_t identifier, uint32_t sender_tag) {
+  fragment_contexts_slot_s *slot = find_slot(contexts, identifier, sender_tag);
+
+  return slot ? slot->context : NULL;
+}
+
+tstatic void otrng_fragment_contexts_remove(fragment_contexts_s *contexts,
+                                            fragment_context_s *context) {
+  fragment_contexts_slot_s *slot =
+      find_slot(contexts, context->identifier, context->sender_tag);
+  size_t mask, i, j;
+
+  otrng_expiry_cancel(contexts->scheduler, &context->expiry);
+
+  if (!slot) {
+    return;
+  }
+
+  unlink_context(contexts, context);
+  contexts->pending_bytes -= context->reserved;
+  context->owner = NULL;
+
+  mask = contexts->capacity - 1;
+  i = (size_t)(slot - contexts->slots);
+  j = i;
+
+  /* Backward shift deletion, as in the skipped keys store */
+  for (;;) {
+    size_t ideal;
+
+    j = (j + 1) & mask;
+    if (!contexts->slots[j].context) {
+      break;
+    }
+
+    ideal = (size_t)(contexts->slots[j].hash & mask);
+    if (((j - ideal) & mask) >= ((j - i) & mask)) {
+      contexts->slots[i] = contexts->slots[j];
+      i = j;
+    }
+  }
+
+  contexts->slots[i].context = NULL;
+  contexts->slots[i].hash = 0;
+  contexts->len--;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char *write_hex32(char *dst, uint32_t value) {
+  int i;
+
+  for (i = 7; i >= 0; i--) {
+    dst[i] = hex_digits[value & 0xF];
+    value >>= 4;
+  }
+
+  return dst + 8;
+}
+
+static char *write_dec16(char *dst, uint16_t value) {
+  int i;
+
+  for (i = 4; i >= 0; i--) {
+    dst[i] = (char)('0' + value % 10);
+    value /= 10;
+  }
+
+  return dst + 5;
+}
+
+/* Writes ?OTR|%08x|%08x|%08x,%05hu,%05hu,[piece], and a NUL. Example:
+   ?OTR|00000000|00000001|00000002,00001,00002,one , */
+static char *write_fragment(char *dst, const char *piece, size_t piece_len,
+                            uint32_t identifier, uint32_t our_instance,
+                            uint32_t their_instance, uint16_t current,
+                            uint16_t total) {
+  memcpy(dst, "?OTR|", 5);
+  dst = write_hex32(dst + 5, identifier);
+  *dst++ = '|';
+  dst = write_hex32(dst, our_instance);
+  *dst++ = '|';
+  dst = write_hex32(dst, their_instance);
+  *dst++ = ',';
+  dst = write_dec16(dst, current);
+  *dst++ = ',';
+  dst = write_dec16(dst, total);
+  *dst++ = ',';
+  memcpy(dst, piece, piece_len);
+  dst += piece_len;
+  *dst++ = ',';
+  *dst++ = '\0';
+
+  return dst;
 }
 
 INTERNAL otrng_result otrng_fragment_message(int max_size,
@@ -149,90 +456,300 @@ INTERNAL otrng_result otrng_fragment_message(int max_size,
   size_t msg_len = strlen(msg);
   size_t limit = max_size - FRAGMENT_HEADER_LEN;
   int total = ((msg_len - 1) / limit) + 1;
-  uint32_t *identifier;
+  size_t pieces_len, arena_len;
+  uint32_t identifier;
+  char *arena;
   int i;
 
-  if (otrng_failed(init_message_to_send_with_total(fragments, total))) {
+  if (total < 1 || total > 65535) {
     return OTRNG_ERROR;
   }
 
-  identifier = gcry_random_bytes(4, GCRY_STRONG_RANDOM);
-  if (!identifier) {
-    return OTRNG_ERROR;
-  }
+  /* The identifier only has to tell our messages apart, so it does not need
+   * to come from the strong pool */
+  randombytes_buf(&identifier, sizeof(identifier));
 
-  for (i = 0; i < fragments->total; i++) {
-    int piece_len = msg_len < limit ? msg_len : limit;
-    char **dst = fragments->pieces + i;
+  /* The pieces index and every piece live in a single allocation */
+  pieces_len = total * sizeof(string_p);
+  arena_len = total * (FRAGMENT_HEADER_LEN + 1) + msg_len;
 
-    if (otrng_failed(create_fragment_message(dst, msg, piece_len, *identifier,
-                                             our_instance, their_instance,
-                                             i + 1, fragments->total))) {
-      otrng_message_free(fragments);
-      return OTRNG_ERROR;
-    }
+  fragments->pieces = otrng_xmalloc(pieces_len + arena_len);
+  fragments->total = total;
+  arena = (char *)(fragments->pieces + total);
+
+  for (i = 0; i < total; i++) {
+    size_t piece_len = msg_len < limit ? msg_len : limit;
+
+    fragments->pieces[i] = arena;
+    arena = write_fragment(arena, msg, piece_len, identifier, our_instance,
+                           their_instance, i + 1, total);
 
     msg += piece_len;
     msg_len -= piece_len;
   }
 
-  gcry_free(identifier);
-
   return OTRNG_SUCCESS;
 }
 
 tstatic otrng_bool is_fragment_generic(const string_p msg, const char *prefix) {
-  if (msg != NULL && strstr(msg, prefix) == msg) {
+  if (msg != NULL && strncmp(msg, prefix, strlen(prefix)) == 0) {
     return otrng_true;
   }
 
   return otrng_false;
 }
 
-tstatic otrng_result initialize_fragments(fragment_context_s *context) {
-  context->fragments = otrng_xmalloc_z(sizeof(string_p) * context->total);
+static otrng_bool parse_hex32(uint32_t *dst, const char **cursor) {
+  const char *p = *cursor;
+  uint32_t value = 0;
+  int i;
+
+  /* A NUL is not a digit, so this never reads past the end of the string */
+  for (i = 0; i < 8; i++) {
+    char c = p[i];
+    uint32_t digit;
+
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return otrng_false;
+    }
+
+    value = (value << 4) | digit;
+  }
+
+  *dst = value;
+  *cursor = p + 8;
+  return otrng_true;
+}
+
+static otrng_bool parse_dec16(uint16_t *dst, const char **cursor) {
+  const char *p = *cursor;
+  uint32_t value = 0;
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    char c = p[i];
+
+    if (c < '0' || c > '9') {
+      return otrng_false;
+    }
+
+    value = value * 10 + (c - '0');
+  }
+
+  if (value > UINT16_MAX) {
+    return otrng_false;
+  }
+
+  *dst = (uint16_t)value;
+  *cursor = p + 5;
+  return otrng_true;
+}
+
+static otrng_bool expect_char(const char **cursor, char c) {
+  if (**cursor != c) {
+    return otrng_false;
+  }
+
+  (*cursor)++;
+  return otrng_true;
+}
+
+INTERNAL otrng_result otrng_fragment_header_parse(fragment_header_s *dst,
+                                                  const char *msg,
+                                                  const char *prefix) {
+  const char *cursor;
+  const char *piece_end;
+
+  if (!is_fragment_generic(msg, prefix)) {
+    return OTRNG_ERROR;
+  }
+
+  cursor = msg + strlen(prefix);
+
+  if (!parse_hex32(&dst->identifier, &cursor) || !expect_char(&cursor, '|') ||
+      !parse_hex32(&dst->sender_tag, &cursor) || !expect_char(&cursor, '|') ||
+      !parse_hex32(&dst->receiver_tag, &cursor) ||
+      !expect_char(&cursor, ',') || !parse_dec16(&dst->index, &cursor) ||
+      !expect_char(&cursor, ',') || !parse_dec16(&dst->total, &cursor) ||
+      !expect_char(&cursor, ',')) {
+    return OTRNG_ERROR;
+  }
+
+  piece_end = strchr(cursor, ',');
+  if (piece_end == NULL || piece_end == cursor) {
+    return OTRNG_ERROR;
+  }
+
+  dst->piece_start = cursor - msg;
+  dst->piece_len = piece_end - cursor;
+
+  return OTRNG_SUCCESS;
+}
+
+static otrng_bool reassembly_len(size_t *dst, unsigned int total,
+                                  size_t stride) {
+  if (stride > FRAGMENT_MAX_REASSEMBLY_BYTES / total) {
+    return otrng_false;
+  }
+
+  *dst = total * stride;
+  return otrng_true;
+}
+
+tstatic otrng_result initialize_fragments(fragment_context_s *context,
+                                          size_t fragment_len) {
+  size_t len;
+  size_t pieces_len = sizeof(fragment_piece_s) * context->total;
+
+  /* All pieces but the last are expected to be as long as the first one */
+  context->stride = fragment_len ? fragment_len : 1;
+  if (!reassembly_len(&len, context->total, context->stride)) {
+    return OTRNG_ERROR;
+  }
+
+  /* The buffer itself only grows as fragments arrive */
+  if (!fragment_pending_reserve(context, pieces_len)) {
+    return OTRNG_ERROR;
+  }
+
+  context->pieces = calloc(context->total, sizeof(fragment_piece_s));
+  if (!context->pieces) {
+    return OTRNG_ERROR;
+  }
 
   return OTRNG_SUCCESS;
 }
 
-tstatic otrng_result join_fragments(char **unfrag_msg,
-                                    fragment_context_s *context) {
-  char *end_msg;
+/* Makes the buffer hold at least [len] bytes and a NUL. It grows
+   geometrically up to the size of the whole message, so fragments received
+   in order are not copied over and over. */
+static otrng_result reserve_fragments(fragment_context_s *context,
+                                      size_t len) {
+  size_t capacity, full;
+  char *buffer;
+
+  if (len + 1 <= context->buffer_len) {
+    return OTRNG_SUCCESS;
+  }
+
+  full = context->total * context->stride + 1;
+  capacity = 2 * context->buffer_len;
+  if (capacity > full) {
+    capacity = full;
+  }
+  if (capacity < len + 1) {
+    capacity = len + 1;
+  }
+
+  if (!fragment_pending_reserve(context, capacity - context->buffer_len)) {
+    return OTRNG_ERROR;
+  }
+
+  buffer = realloc(context->buffer, capacity);
+  if (!buffer) {
+    return OTRNG_ERROR;
+  }
+
+  context->buffer = buffer;
+  context->buffer_len = capacity;
+  return OTRNG_SUCCESS;
+}
+
+/* A fragment is longer than the ones seen so far, so every piece received is
+   moved to a wider position. Pieces are moved from the last one, as they
+   only move forward. */
+static otrng_result widen_fragments(fragment_context_s *context,
+                                    size_t stride) {
+  size_t old_stride = context->stride;
+  size_t len, end = 0;
   unsigned int i;
 
-  *unfrag_msg = otrng_xmalloc_z(context->total_message_len + 1);
+  if (!reassembly_len(&len, context->total, stride)) {
+    return OTRNG_ERROR;
+  }
+
+  for (i = context->total; i > 0; i--) {
+    if (context->pieces[i - 1].received) {
+      end = (i - 1) * stride + context->pieces[i - 1].len;
+      break;
+    }
+  }
+
+  /* reserve_fragments bounds the buffer by the new stride */
+  context->stride = stride;
+  if (otrng_failed(reserve_fragments(context, end))) {
+    context->stride = old_stride;
+    return OTRNG_ERROR;
+  }
 
-  end_msg = *unfrag_msg;
-  for (i = 0; i < context->total; i++) {
-    end_msg = otrng_stpcpy(end_msg, context->fragments[i]);
+  for (i = context->total; i > 0; i--) {
+    if (context->pieces[i - 1].received) {
+      memmove(context->buffer + (i - 1) * stride,
+              context->buffer + (i - 1) * old_stride,
+              context->pieces[i - 1].len);
+    }
   }
 
   return OTRNG_SUCCESS;
 }
 
+tstatic void join_fragments(char **unfrag_msg, fragment_context_s *context) {
+  size_t w = 0;
+  unsigned int i;
+
+  /* Only pieces that were shorter than the stride leave gaps to close. With
+     evenly sized fragments nothing is moved. */
+  for (i = 0; i < context->total; i++) {
+    size_t offset = i * context->stride;
+    if (offset != w) {
+      memmove(context->buffer + w, context->buffer + offset,
+              context->pieces[i].len);
+    }
+    w += context->pieces[i].len;
+  }
+
+  context->buffer[w] = '\0';
+
+  /* The message is the caller's now, and it is not pending anymore */
+  *unfrag_msg = context->buffer;
+  context->buffer = NULL;
+  context->buffer_len = 0;
+  fragment_pending_release(context, context->reserved);
+}
+
 tstatic otrng_result copy_fragment_to_context(fragment_context_s *context,
                                               unsigned short i,
                                               const string_p msg,
-                                              uint32_t fragment_len) {
-  char *fragment = otrng_xmalloc(fragment_len + 1);
+                                              size_t fragment_len) {
+  if (fragment_len > context->stride &&
+      otrng_failed(widen_fragments(context, fragment_len))) {
+    return OTRNG_ERROR;
+  }
 
-  memcpy(fragment, msg, fragment_len);
-  fragment[fragment_len] = '\0';
-  context->fragments[i - 1] = fragment;
+  if (otrng_failed(reserve_fragments(
+          context, (i - 1) * context->stride + fragment_len))) {
+    return OTRNG_ERROR;
+  }
+
+  memcpy(context->buffer + (i - 1) * context->stride, msg, fragment_len);
+  context->pieces[i - 1].len = fragment_len;
+  context->pieces[i - 1].received = otrng_true;
   context->total_message_len += fragment_len;
   return OTRNG_SUCCESS;
 }
 
 INTERNAL otrng_result otrng_unfragment_message_generic(
-    char **unfrag_msg, list_element_s **contexts, const string_p msg,
-    const uint32_t our_instance_tag, const char *prefix, const char *format) {
-  int start = 0, end = 0;
-  uint32_t fragment_identifier = 0, sender_tag = 0, receiver_tag = 0;
-  uint16_t i = 0, t = 0;
+    char **unfrag_msg, fragment_contexts_s **contexts, const string_p msg,
+    const uint32_t our_instance_tag, const char *prefix) {
+  fragment_header_s header;
+  uint16_t i, t;
   fragment_context_s *context = NULL;
-  list_element_s *current = NULL;
-  fragment_context_s *ctx = NULL;
-  uint32_t fragment_len = 0;
 
   *unfrag_msg = NULL;
 
@@ -246,42 +763,38 @@ INTERNAL otrng_result otrng_unfragment_message_generic(
     return OTRNG_SUCCESS;
   }
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
-  if (sscanf(msg, format, &fragment_identifier, &sender_tag, &receiver_tag, &i,
-             &t, &start, &end) == EOF) {
+  if (otrng_failed(otrng_fragment_header_parse(&header, msg, prefix))) {
     return OTRNG_ERROR;
   }
-#pragma GCC diagnostic error "-Wformat-nonliteral"
-#pragma clang diagnostic pop
 
-  if (our_instance_tag != receiver_tag && 0 != receiver_tag) {
+  if (our_instance_tag != header.receiver_tag && 0 != header.receiver_tag) {
     return OTRNG_SUCCESS;
   }
 
-  if (end <= start) {
-    return OTRNG_ERROR;
+  if (!*contexts) {
+    *contexts = otrng_fragment_contexts_new();
   }
 
-  for (current = *contexts; current; current = current->next) {
-    if (!current->data) {
-      continue;
-    }
-
-    ctx = current->data;
-    if (ctx->identifier == fragment_identifier) {
-      context = ctx;
-      break;
+  context = otrng_fragment_contexts_get(*contexts, header.identifier,
+                                        header.sender_tag);
+  if (!context) {
+    /* Contexts are added one at a time, so one has to go at most */
+    if (otrng_fragment_contexts_len(*contexts) >=
+        (*contexts)->max_pending_contexts) {
+      evict_oldest(*contexts, NULL);
     }
-  }
 
-  if (!context) {
     context = otrng_fragment_context_new();
-    context->identifier = fragment_identifier;
-    *contexts = otrng_list_add(context, *contexts);
+    context->identifier = header.identifier;
+    context->sender_tag = header.sender_tag;
+    context->last_fragment_received_at = time(NULL);
+    otrng_fragment_contexts_add(*contexts, context);
+    schedule_expiry(*contexts, context);
   }
 
+  i = header.index;
+  t = header.total;
+
   if (i == 0 || t == 0 || i > t) {
     reset_fragment_context(context);
     return OTRNG_SUCCESS;
@@ -293,65 +806,75 @@ INTERNAL otrng_result otrng_unfragment_message_generic(
 
   context->total = t;
 
-  if (context->fragments == NULL) {
-    if (otrng_failed(initialize_fragments(context))) {
+  if (context->pieces == NULL) {
+    if (otrng_failed(initialize_fragments(context, header.piece_len))) {
+      otrng_fragment_contexts_remove(*contexts, context);
+      otrng_fragment_context_free(context);
       return OTRNG_ERROR;
     }
   }
 
-  if (context->fragments[i - 1] != NULL) {
+  if (context->pieces[i - 1].received) {
     return OTRNG_ERROR;
   }
 
-  fragment_len = end - start - 1;
-  if (otrng_failed(
-          copy_fragment_to_context(context, i, msg + start, fragment_len))) {
+  if (otrng_failed(copy_fragment_to_context(
+          context, i, msg + header.piece_start, header.piece_len))) {
+    otrng_fragment_contexts_remove(*contexts, context);
+    otrng_fragment_context_free(context);
     return OTRNG_ERROR;
   }
 
   context->count++;
   context->last_fragment_received_at = time(NULL);
+  schedule_expiry(*contexts, context);
+  unlink_context(*contexts, context);
+  link_newest(*contexts, context);
 
   if (context->count == t) {
-    if (otrng_succeeded(join_fragments(unfrag_msg, context))) {
-      list_element_s *to_remove = otrng_list_get_by_value(context, *contexts);
-      *contexts = otrng_list_remove_element(to_remove, *contexts);
-      otrng_fragment_context_free(context);
-      otrng_list_free_nodes(to_remove);
-      return OTRNG_SUCCESS;
-    }
-    return OTRNG_ERROR;
+    join_fragments(unfrag_msg, context);
+    otrng_fragment_contexts_remove(*contexts, context);
+    otrng_fragment_context_free(context);
   }
 
   return OTRNG_SUCCESS;
 }
-INTERNAL otrng_result
-otrng_unfragment_message(char **unfrag_msg, list_element_s **contexts,
-                         const string_p msg, const uint32_t our_instance_tag) {
+
+INTERNAL otrng_result otrng_unfragment_message(
+    char **unfrag_msg, fragment_contexts_s **contexts, const string_p msg,
+    const uint32_t our_instance_tag) {
   return otrng_unfragment_message_generic(
-      unfrag_msg, contexts, msg, our_instance_tag, "?OTR|", UNFRAGMENT_FORMAT);
+      unfrag_msg, contexts, msg, our_instance_tag, "?OTR|");
+}
+
+INTERNAL void otrng_fragment_contexts_forget(fragment_contexts_s *contexts,
+                                             fragment_context_s *context) {
+  otrng_fragment_contexts_remove(contexts, context);
+  otrng_fragment_context_free(context);
 }
 
-INTERNAL otrng_result otrng_expire_fragments(time_t now,
-                                             uint32_t expiration_time,
-                                             list_element_s **contexts) {
-  list_element_s *current = *contexts;
+INTERNAL otrng_result
+otrng_expire_fragments(time_t now, uint32_t expiration_time,
+                       /*@null@*/ fragment_contexts_s *contexts) {
+  size_t i = 0;
+
+  if (!contexts) {
+    return OTRNG_SUCCESS;
+  }
 
-  while (current) {
-    fragment_context_s *ctx = current->data;
+  while (i < contexts->capacity) {
+    fragment_context_s *ctx = contexts->slots[i].context;
 
-    list_element_s *to_free = NULL;
     if ((ctx != NULL) &&
         (difftime(now, ctx->last_fragment_received_at) < expiration_time)) {
-      *contexts = otrng_list_remove_element(current, *contexts);
+      otrng_fragment_contexts_remove(contexts, ctx);
       otrng_fragment_context_free(ctx);
-      to_free = current;
-    }
 
-    current = current->next;
-    if (to_free) {
-      otrng_list_free_nodes(to_free);
+      /* The removal may have shifted another context into this slot */
+      continue;
     }
+
+    i++;
   }
 
   return OTRNG_SUCCESS;
@@ -19,16 +19,19 @@
  */
 
 /**
- * The functions in this file only operate on their arguments, and doesn't touch
- * any global state. It is safe to call these functions concurrently from
- * different threads, as long as arguments pointing to the same memory areas are
- * not used from different threads.
+ * The functions in this file only operate on their arguments. It is safe to
+ * call these functions concurrently from different threads, as long as
+ * arguments pointing to the same memory areas are not used from different
+ * threads.
  */
 
 #ifndef OTRNG_FRAGMENT_H
 #define OTRNG_FRAGMENT_H
 
+#include <time.h>
+
 #include "error.h"
+#include "expiry.h"
 #include "list.h"
 #include "shared.h"
 #include "str.h"
@@ -37,47 +40,149 @@
  * index,total,,*/
 #define FRAGMENT_HEADER_LEN 45
 
+/* Fragments are not authenticated, so the memory held by the fragments
+ * waiting for reassembly in a fragment_contexts_s is bounded. When a bound is
+ * hit, the least recently updated contexts are dropped to make room. */
+#define FRAGMENT_MAX_PENDING_BYTES (64 * 1024 * 1024)
+#define FRAGMENT_MAX_PENDING_CONTEXTS 256
+
+/* [pieces] and the strings it points to are a single allocation */
 typedef struct otrng_message_to_send_s {
   string_p *pieces;
   int total;
 } otrng_message_to_send_s;
 
+API otrng_message_to_send_s *otrng_message_new(void);
+
+API void otrng_message_free(/*@only@*/ /*@null@*/ otrng_message_to_send_s *msg);
+
+/* A fragment that has been copied into the reassembly buffer */
+typedef struct fragment_piece_s {
+  size_t len;
+  otrng_bool received;
+} fragment_piece_s;
+
+/* Every fragment [i] is copied to [buffer] + (i - 1) * [stride]. When all
+ * pieces but the last have the same length, which is how fragments are sent,
+ * the buffer already holds the whole message once the last fragment arrives.
+ * The buffer only grows as far as the fragments received need it to.
+ */
 typedef struct fragment_context_s {
   uint32_t identifier;
+  uint32_t sender_tag;
   unsigned int total, count;
   size_t total_message_len;
   time_t last_fragment_received_at;
-  string_p *fragments;
+  /*@null@*/ char *buffer;
+  size_t buffer_len; /* allocated bytes of [buffer] */
+  size_t stride;
+  /*@null@*/ fragment_piece_s *pieces;
+  size_t reserved; /* bytes counted against the bound of [owner] */
+  /* the contexts holding it, if any */
+  /*@null@*/ struct fragment_contexts_s *owner;
+  /* its neighbours in [owner], from the least recently updated */
+  /*@null@*/ struct fragment_context_s *older, *newer;
+  /* scheduled while the context is in a fragment_contexts_s with a scheduler */
+  otrng_expiry_entry_s expiry;
 } fragment_context_s;
 
+typedef struct fragment_contexts_slot_s {
+  uint64_t hash;
+  /*@null@*/ fragment_context_s *context;
+} fragment_contexts_slot_s;
+
+#define FRAGMENT_CONTEXTS_HASH_KEY_BYTES 16
+
+/* Fragment contexts by (identifier, sender instance tag), in an open
+ * addressing table with linear probing. */
+typedef struct fragment_contexts_s {
+  /*@null@*/ fragment_contexts_slot_s *slots;
+  size_t capacity; /* Zero or a power of two */
+  size_t len;
+  uint8_t hash_key[FRAGMENT_CONTEXTS_HASH_KEY_BYTES];
+  /* where the contexts are scheduled to expire, if anywhere */
+  /*@null@*/ otrng_expiry_scheduler_s *scheduler;
+  uint32_t expiration_time;
+  /* the contexts from the least to the most recently updated */
+  /*@null@*/ fragment_context_s *oldest, *newest;
+  size_t pending_bytes; /* reserved by the contexts */
+  size_t max_pending_bytes;
+  size_t max_pending_contexts;
+} fragment_contexts_s;
+
+/* The header of a received fragment:
+ * [prefix]%08x|%08x|%08x,%05hu,%05hu,[piece], */
+typedef struct fragment_header_s {
+  uint32_t identifier;
+  uint32_t sender_tag;
+  uint32_t receiver_tag;
+  uint16_t index;
+  uint16_t total;
+  size_t piece_start; /* Offset of the piece from the start of the message */
+  size_t piece_len;
+} fragment_header_s;
+
 INTERNAL void otrng_fragment_context_free(fragment_context_s *context);
 
+INTERNAL fragment_contexts_s *otrng_fragment_contexts_new(void);
+
+INTERNAL void
+otrng_fragment_contexts_free(/*@null@*/ fragment_contexts_s *contexts);
+
+INTERNAL size_t
+otrng_fragment_contexts_len(/*@null@*/ const fragment_contexts_s *contexts);
+
+/**
+ * @brief Makes the contexts added from now on, and the ones updated by a new
+ * fragment, expire [expiration_time] seconds after their last fragment.
+ * [contexts] is created if it points to NULL.
+ */
+INTERNAL void otrng_fragment_contexts_set_expiry(
+    fragment_contexts_s **contexts,
+    /*@null@*/ otrng_expiry_scheduler_s *scheduler, uint32_t expiration_time);
+
+/* Removes the context from [contexts] and frees it */
+INTERNAL void otrng_fragment_contexts_forget(fragment_contexts_s *contexts,
+                                             fragment_context_s *context);
+
+INTERNAL /*@null@*/ fragment_context_s *
+otrng_fragment_contexts_get(/*@null@*/ const fragment_contexts_s *contexts,
+                            uint32_t identifier, uint32_t sender_tag);
+
 INTERNAL otrng_result otrng_fragment_message(int max_size,
                                              otrng_message_to_send_s *fragments,
                                              uint32_t our_instance,
                                              uint32_t their_instance,
                                              const string_p msg);
 
-INTERNAL otrng_result otrng_unfragment_message(char **unfrag_msg,
-                                               list_element_s **contexts,
-                                               const string_p msg,
-                                               const uint32_t our_instance_tag);
+/* [contexts] is created on the first fragment, if it points to NULL */
+INTERNAL otrng_result otrng_unfragment_message(
+    char **unfrag_msg, fragment_contexts_s **contexts, const string_p msg,
+    const uint32_t our_instance_tag);
+
+/* Parses the header of a fragment starting with [prefix]. Every field has
+ * the exact width it is sent with, and the piece must not be empty. */
+INTERNAL otrng_result otrng_fragment_header_parse(fragment_header_s *dst,
+                                                  const char *msg,
+                                                  const char *prefix);
 
 INTERNAL otrng_result otrng_unfragment_message_generic(
-    char **unfrag_msg, list_element_s **contexts, const string_p msg,
-    const uint32_t our_instance_tag, const char *prefix, const char *format);
+    char **unfrag_msg, fragment_contexts_s **contexts, const string_p msg,
+    const uint32_t our_instance_tag, const char *prefix);
 
-INTERNAL otrng_result otrng_expire_fragments(time_t now,
-                                             uint32_t expiration_time,
-                                             list_element_s **contexts);
+INTERNAL otrng_result
+otrng_expire_fragments(time_t now, uint32_t expiration_time,
+                       /*@null@*/ fragment_contexts_s *contexts);
 
 #ifdef OTRNG_FRAGMENT_PRIVATE
 
-otrng_message_to_send_s *otrng_message_new(void);
+tstatic fragment_context_s *otrng_fragment_context_new(void);
 
-tstatic void otrng_message_free(otrng_message_to_send_s *msg);
+tstatic void otrng_fragment_contexts_add(fragment_contexts_s *contexts,
+                                         fragment_context_s *context);
 
-tstatic /*@notnull@*/ fragment_context_s *otrng_fragment_context_new(void);
+tstatic void otrng_fragment_contexts_remove(fragment_contexts_s *contexts,
+                                            fragment_context_s *context);
 
 #endif
 
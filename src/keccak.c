@@ -0,0 +1,230 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define OTRNG_KECCAK_PRIVATE
+
+#include "alloc.h"
+#include "keccak.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KECCAK_AVX2
+#include <immintrin.h>
+#endif
+
+#define KECCAK_ROUNDS 24
+
+static const uint64_t round_constants[KECCAK_ROUNDS] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
+    0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
+    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL,
+    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
+    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL};
+
+/*
+ * One round, on the words a[0..24] with b, c and d as scratch space. It is
+ * written out with constant indices so that the compiler keeps the words in
+ * registers. XOR, ANDNOT (~x & y) and ROTL are defined by each
+ * implementation, for its own word type. Word x + 5y is moved to
+ * y + 5(2x + 3y) by the pi step.
+ */
+#define KECCAK_ROUND(a, b, c, d, rc)                                           \
+  /* theta */                                                                  \
+  c[0] = XOR(XOR(XOR(a[0], a[5]), XOR(a[10], a[15])), a[20]);                  \
+  c[1] = XOR(XOR(XOR(a[1], a[6]), XOR(a[11], a[16])), a[21]);                  \
+  c[2] = XOR(XOR(XOR(a[2], a[7]), XOR(a[12], a[17])), a[22]);                  \
+  c[3] = XOR(XOR(XOR(a[3], a[8]), XOR(a[13], a[18])), a[23]);                  \
+  c[4] = XOR(XOR(XOR(a[4], a[9]), XOR(a[14], a[19])), a[24]);                  \
+  d[0] = XOR(c[4], ROTL(c[1], 1));                                             \
+  d[1] = XOR(c[0], ROTL(c[2], 1));                                             \
+  d[2] = XOR(c[1], ROTL(c[3], 1));                                             \
+  d[3] = XOR(c[2], ROTL(c[4], 1));                                             \
+  d[4] = XOR(c[3], ROTL(c[0], 1));                                             \
+  a[0] = XOR(a[0], d[0]);                                                      \
+  a[1] = XOR(a[1], d[1]);                                                      \
+  a[2] = XOR(a[2], d[2]);                                                      \
+  a[3] = XOR(a[3], d[3]);                                                      \
+  a[4] = XOR(a[4], d[4]);                                                      \
+  a[5] = XOR(a[5], d[0]);                                                      \
+  a[6] = XOR(a[6], d[1]);                                                      \
+  a[7] = XOR(a[7], d[2]);                                                      \
+  a[8] = XOR(a[8], d[3]);                                                      \
+  a[9] = XOR(a[9], d[4]);                                                      \
+  a[10] = XOR(a[10], d[0]);                                                    \
+  a[11] = XOR(a[11], d[1]);                                                    \
+  a[12] = XOR(a[12], d[2]);                                                    \
+  a[13] = XOR(a[13], d[3]);                                                    \
+  a[14] = XOR(a[14], d[4]);                                                    \
+  a[15] = XOR(a[15], d[0]);                                                    \
+  a[16] = XOR(a[16], d[1]);                                                    \
+  a[17] = XOR(a[17], d[2]);                                                    \
+  a[18] = XOR(a[18], d[3]);                                                    \
+  a[19] = XOR(a[19], d[4]);                                                    \
+  a[20] = XOR(a[20], d[0]);                                                    \
+  a[21] = XOR(a[21], d[1]);                                                    \
+  a[22] = XOR(a[22], d[2]);                                                    \
+  a[23] = XOR(a[23], d[3]);                                                    \
+  a[24] = XOR(a[24], d[4]);                                                    \
+  /* rho and pi */                                                             \
+  b[0] = ROTL(a[0], 0);                                                        \
+  b[10] = ROTL(a[1], 1);                                                       \
+  b[20] = ROTL(a[2], 62);                                                      \
+  b[5] = ROTL(a[3], 28);                                                       \
+  b[15] = ROTL(a[4], 27);                                                      \
+  b[16] = ROTL(a[5], 36);                                                      \
+  b[1] = ROTL(a[6], 44);                                                       \
+  b[11] = ROTL(a[7], 6);                                                       \
+  b[21] = ROTL(a[8], 55);                                                      \
+  b[6] = ROTL(a[9], 20);                                                       \
+  b[7] = ROTL(a[10], 3);                                                       \
+  b[17] = ROTL(a[11], 10);                                                     \
+  b[2] = ROTL(a[12], 43);                                                      \
+  b[12] = ROTL(a[13], 25);                                                     \
+  b[22] = ROTL(a[14], 39);                                                     \
+  b[23] = ROTL(a[15], 41);                                                     \
+  b[8] = ROTL(a[16], 45);                                                      \
+  b[18] = ROTL(a[17], 15);                                                     \
+  b[3] = ROTL(a[18], 21);                                                      \
+  b[13] = ROTL(a[19], 8);                                                      \
+  b[14] = ROTL(a[20], 18);                                                     \
+  b[24] = ROTL(a[21], 2);                                                      \
+  b[9] = ROTL(a[22], 61);                                                      \
+  b[19] = ROTL(a[23], 56);                                                     \
+  b[4] = ROTL(a[24], 14);                                                      \
+  /* chi */                                                                    \
+  a[0] = XOR(b[0], ANDNOT(b[1], b[2]));                                        \
+  a[1] = XOR(b[1], ANDNOT(b[2], b[3]));                                        \
+  a[2] = XOR(b[2], ANDNOT(b[3], b[4]));                                        \
+  a[3] = XOR(b[3], ANDNOT(b[4], b[0]));                                        \
+  a[4] = XOR(b[4], ANDNOT(b[0], b[1]));                                        \
+  a[5] = XOR(b[5], ANDNOT(b[6], b[7]));                                        \
+  a[6] = XOR(b[6], ANDNOT(b[7], b[8]));                                        \
+  a[7] = XOR(b[7], ANDNOT(b[8], b[9]));                                        \
+  a[8] = XOR(b[8], ANDNOT(b[9], b[5]));                                        \
+  a[9] = XOR(b[9], ANDNOT(b[5], b[6]));                                        \
+  a[10] = XOR(b[10], ANDNOT(b[11], b[12]));                                    \
+  a[11] = XOR(b[11], ANDNOT(b[12], b[13]));                                    \
+  a[12] = XOR(b[12], ANDNOT(b[13], b[14]));                                    \
+  a[13] = XOR(b[13], ANDNOT(b[14], b[10]));                                    \
+  a[14] = XOR(b[14], ANDNOT(b[10], b[11]));                                    \
+  a[15] = XOR(b[15], ANDNOT(b[16], b[17]));                                    \
+  a[16] = XOR(b[16], ANDNOT(b[17], b[18]));                                    \
+  a[17] = XOR(b[17], ANDNOT(b[18], b[19]));                                    \
+  a[18] = XOR(b[18], ANDNOT(b[19], b[15]));                                    \
+  a[19] = XOR(b[19], ANDNOT(b[15], b[16]));                                    \
+  a[20] = XOR(b[20], ANDNOT(b[21], b[22]));                                    \
+  a[21] = XOR(b[21], ANDNOT(b[22], b[23]));                                    \
+  a[22] = XOR(b[22], ANDNOT(b[23], b[24]));                                    \
+  a[23] = XOR(b[23], ANDNOT(b[24], b[20]));                                    \
+  a[24] = XOR(b[24], ANDNOT(b[20], b[21]));                                    \
+  /* iota */                                                                   \
+  a[0] = XOR(a[0], rc)
+
+#define XOR(x, y) ((x) ^ (y))
+#define ANDNOT(x, y) (~(x) & (y))
+#define ROTL(x, n) rotl64((x), (n))
+
+static uint64_t rotl64(uint64_t v, unsigned int n) {
+  return (v << n) | (v >> ((64 - n) & 63));
+}
+
+static void keccak_f1600(uint64_t *a) {
+  uint64_t b[OTRNG_KECCAK_WORDS], c[5], d[5];
+  unsigned int round;
+
+  for (round = 0; round < KECCAK_ROUNDS; round++) {
+    KECCAK_ROUND(a, b, c, d, round_constants[round]);
+  }
+
+  otrng_secure_wipe(b, sizeof(b));
+}
+
+#undef XOR
+#undef ANDNOT
+#undef ROTL
+
+tstatic void keccak_f1600_x4_portable(otrng_keccak_x4_s *state) {
+  uint64_t a[OTRNG_KECCAK_WORDS];
+  unsigned int lane, i;
+
+  for (lane = 0; lane < OTRNG_KECCAK_LANES; lane++) {
+    for (i = 0; i < OTRNG_KECCAK_WORDS; i++) {
+      a[i] = state->words[i][lane];
+    }
+
+    keccak_f1600(a);
+
+    for (i = 0; i < OTRNG_KECCAK_WORDS; i++) {
+      state->words[i][lane] = a[i];
+    }
+  }
+
+  /* the words are the secrets being hashed */
+  otrng_secure_wipe(a, sizeof(a));
+}
+
+#ifdef KECCAK_AVX2
+
+/* AVX2 has no 64-bit rotation, so it is made of two shifts */
+#define XOR(x, y) _mm256_xor_si256((x), (y))
+#define ANDNOT(x, y) _mm256_andnot_si256((x), (y))
+#define ROTL(x, n)                                                             \
+  _mm256_or_si256(_mm256_slli_epi64((x), (n)), _mm256_srli_epi64((x), 64 - (n)))
+
+__attribute__((target("avx2"))) static void
+keccak_f1600_x4_avx2(otrng_keccak_x4_s *state) {
+  __m256i a[OTRNG_KECCAK_WORDS], b[OTRNG_KECCAK_WORDS], c[5], d[5];
+  unsigned int round, i;
+
+  for (i = 0; i < OTRNG_KECCAK_WORDS; i++) {
+    a[i] = _mm256_loadu_si256((const __m256i *)state->words[i]);
+  }
+
+  for (round = 0; round < KECCAK_ROUNDS; round++) {
+    KECCAK_ROUND(a, b, c, d,
+                 _mm256_set1_epi64x((long long)round_constants[round]));
+  }
+
+  for (i = 0; i < OTRNG_KECCAK_WORDS; i++) {
+    _mm256_storeu_si256((__m256i *)state->words[i], a[i]);
+  }
+
+  otrng_secure_wipe(a, sizeof(a));
+  otrng_secure_wipe(b, sizeof(b));
+}
+
+#undef XOR
+#undef ANDNOT
+#undef ROTL
+
+#endif
+
+INTERNAL void otrng_keccak_f1600_x4(otrng_keccak_x4_s *state) {
+#ifdef KECCAK_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    keccak_f1600_x4_avx2(state);
+    return;
+  }
+#endif
+
+  keccak_f1600_x4_portable(state);
+}
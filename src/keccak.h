@@ -0,0 +1,56 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The Keccak-f[1600] permutation on four independent states at once, for
+ * hashing short inputs in parallel (see shake_256_kdf1_x4). On x86-64 it uses
+ * AVX2 when the CPU has it, and a portable implementation otherwise.
+ */
+
+#ifndef OTRNG_KECCAK_H
+#define OTRNG_KECCAK_H
+
+#include <stdint.h>
+
+#include "shared.h"
+
+#define OTRNG_KECCAK_LANES 4
+#define OTRNG_KECCAK_WORDS 25
+
+/* The same word of every state is stored next to each other, so that one AVX2
+ * register holds it for all four states */
+typedef struct otrng_keccak_x4_s {
+  uint64_t words[OTRNG_KECCAK_WORDS][OTRNG_KECCAK_LANES];
+} otrng_keccak_x4_s;
+
+/**
+ * @brief Applies Keccak-f[1600] to each of the four states.
+ *
+ * @param [state]   The states.
+ */
+INTERNAL void otrng_keccak_f1600_x4(otrng_keccak_x4_s *state);
+
+#ifdef OTRNG_KECCAK_PRIVATE
+
+tstatic void keccak_f1600_x4_portable(otrng_keccak_x4_s *state);
+
+#endif
+
+#endif
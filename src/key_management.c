@@ -59,6 +59,9 @@ INTERNAL void otrng_key_manager_init(key_manager_s *manager) {
   manager->our_dh = otrng_secure_alloc(sizeof(dh_keypair_s));
   manager->our_dh->pub = NULL;
   manager->our_dh->priv = NULL;
+  manager->skipped_keys = otrng_skipped_keys_store_new();
+  manager->receiving = otrng_secure_alloc(sizeof(receiving_ratchet_s));
+  manager->receiving->skipped_keys = otrng_skipped_keys_store_new();
 }
 
 INTERNAL key_manager_s *otrng_key_manager_new(void) {
@@ -93,9 +96,16 @@ INTERNAL void otrng_key_manager_destroy(key_manager_s *manager) {
   manager->ssid_half_first = otrng_false;
   otrng_secure_wipe(manager->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
 
-  otrng_list_free(manager->skipped_keys, otrng_secure_free);
+  otrng_skipped_keys_store_free(manager->skipped_keys);
   manager->skipped_keys = NULL;
 
+  if (manager->receiving) {
+    otrng_receiving_ratchet_rollback(manager->receiving);
+    otrng_skipped_keys_store_free(manager->receiving->skipped_keys);
+    otrng_secure_free(manager->receiving);
+    manager->receiving = NULL;
+  }
+
   otrng_list_free(manager->old_mac_keys, otrng_secure_free);
   manager->old_mac_keys = NULL;
 
@@ -114,87 +124,83 @@ INTERNAL void otrng_key_manager_wipe_shared_prekeys(key_manager_s *manager) {
                     sizeof(otrng_shared_prekey_pub));
 }
 
-INTERNAL /*@null@*/ receiving_ratchet_s *
-otrng_receiving_ratchet_new(key_manager_s *manager) {
-  receiving_ratchet_s *ratchet =
-      otrng_secure_alloc(sizeof(receiving_ratchet_s));
-  otrng_ec_scalar_copy(ratchet->our_ecdh_priv, manager->our_ecdh->priv);
-  ratchet->our_dh_priv = NULL;
-
-  otrng_secure_wipe(ratchet->their_ecdh, ED448_POINT_BYTES);
-  ratchet->their_dh = NULL;
-
-  memset(ratchet->brace_key, 0, BRACE_KEY_BYTES);
+INTERNAL receiving_ratchet_s *
+otrng_receiving_ratchet_begin(key_manager_s *manager) {
+  receiving_ratchet_s *ratchet = manager->receiving;
 
   ratchet->i = manager->i;
   ratchet->j = manager->j;
   ratchet->k = manager->k;
   ratchet->pn = manager->pn;
 
-  memcpy(ratchet->root_key, manager->current->root_key, ROOT_KEY_BYTES);
   memcpy(ratchet->chain_r, manager->current->chain_r, CHAIN_KEY_BYTES);
 
-  memcpy(ratchet->extra_symmetric_key, manager->extra_symmetric_key,
-         EXTRA_SYMMETRIC_KEY_BYTES);
-
-  ratchet->skipped_keys = manager->skipped_keys;
+  ratchet->dh_ratcheted = otrng_false;
+  ratchet->used_skipped_keys = NULL;
 
   return ratchet;
 }
 
-tstatic void otrng_key_manager_set_their_keys(ec_point their_ecdh,
-                                              dh_public_key their_dh,
-                                              key_manager_s *manager) {
-  otrng_ec_point_destroy(manager->their_ecdh);
-  otrng_ec_point_copy(manager->their_ecdh, their_ecdh);
-  otrng_dh_mpi_release(manager->their_dh);
-  manager->their_dh = otrng_dh_mpi_copy(their_dh);
-}
+INTERNAL void otrng_receiving_ratchet_rollback(receiving_ratchet_s *ratchet) {
+  otrng_ec_point_destroy(ratchet->their_ecdh);
+  otrng_dh_mpi_release(ratchet->their_dh);
+  ratchet->their_dh = NULL;
 
-INTERNAL void otrng_receiving_ratchet_copy(key_manager_s *dst,
-                                           receiving_ratchet_s *src) {
-  if (!dst || !src) {
-    return;
+  if (ratchet->dh_ratcheted) {
+    otrng_secure_wipe(ratchet->brace_key, BRACE_KEY_BYTES);
+    otrng_secure_wipe(ratchet->shared_secret, SHARED_SECRET_BYTES);
+    otrng_secure_wipe(ratchet->root_key, ROOT_KEY_BYTES);
   }
-  otrng_ec_scalar_copy(dst->our_ecdh->priv, src->our_ecdh_priv);
-
-  otrng_key_manager_set_their_keys(src->their_ecdh, src->their_dh, dst);
-
-  memcpy(dst->brace_key, src->brace_key, BRACE_KEY_BYTES);
-  memcpy(dst->shared_secret, src->shared_secret, SHARED_SECRET_BYTES);
-
-  dst->i = src->i;
-  dst->j = src->j;
-  dst->k = src->k;
-  dst->pn = src->pn;
 
-  memcpy(dst->current->root_key, src->root_key, ROOT_KEY_BYTES);
-  memcpy(dst->current->chain_r, src->chain_r, CHAIN_KEY_BYTES);
-
-  memcpy(dst->extra_symmetric_key, src->extra_symmetric_key,
-         EXTRA_SYMMETRIC_KEY_BYTES);
+  otrng_secure_wipe(ratchet->chain_r, CHAIN_KEY_BYTES);
+  otrng_secure_wipe(ratchet->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
 
-  dst->skipped_keys = src->skipped_keys;
+  /* Discards any skipped keys that were not committed into the key manager */
+  otrng_skipped_keys_store_clear(ratchet->skipped_keys);
+  ratchet->used_skipped_keys = NULL;
+  ratchet->dh_ratcheted = otrng_false;
 }
 
-INTERNAL void otrng_receiving_ratchet_destroy(receiving_ratchet_s *ratchet) {
-  otrng_secure_wipe(ratchet->our_ecdh_priv, ED448_SCALAR_BYTES);
+INTERNAL void otrng_receiving_ratchet_commit(key_manager_s *manager,
+                                             receiving_ratchet_s *ratchet) {
+  if (!manager || !ratchet) {
+    return;
+  }
+
+  if (ratchet->dh_ratcheted) {
+    /* Our ECDH private key is not needed after entering the new ratchet */
+    otrng_ec_scalar_destroy(manager->our_ecdh->priv);
 
-  if (ratchet->our_dh_priv) {
-    gcry_mpi_release(ratchet->our_dh_priv);
+    otrng_ec_point_destroy(manager->their_ecdh);
+    otrng_ec_point_copy(manager->their_ecdh, ratchet->their_ecdh);
+    otrng_dh_mpi_release(manager->their_dh);
+    manager->their_dh = ratchet->their_dh;
+    ratchet->their_dh = NULL;
+
+    memcpy(manager->brace_key, ratchet->brace_key, BRACE_KEY_BYTES);
+    memcpy(manager->shared_secret, ratchet->shared_secret,
+           SHARED_SECRET_BYTES);
+    memcpy(manager->current->root_key, ratchet->root_key, ROOT_KEY_BYTES);
   }
 
-  otrng_secure_wipe(ratchet->their_ecdh, ED448_POINT_BYTES);
+  manager->i = ratchet->i;
+  manager->j = ratchet->j;
+  manager->k = ratchet->k;
+  manager->pn = ratchet->pn;
 
-  gcry_mpi_release(ratchet->their_dh);
+  memcpy(manager->current->chain_r, ratchet->chain_r, CHAIN_KEY_BYTES);
+  memcpy(manager->extra_symmetric_key, ratchet->extra_symmetric_key,
+         EXTRA_SYMMETRIC_KEY_BYTES);
 
-  memset(ratchet->brace_key, 0, BRACE_KEY_BYTES);
+  if (ratchet->used_skipped_keys) {
+    otrng_skipped_keys_free(otrng_skipped_keys_store_remove(
+        manager->skipped_keys, ratchet->used_skipped_keys));
+    ratchet->used_skipped_keys = NULL;
+  }
 
-  otrng_secure_wipe(ratchet->root_key, ROOT_KEY_BYTES);
-  otrng_secure_wipe(ratchet->chain_r, CHAIN_KEY_BYTES);
-  otrng_secure_wipe(ratchet->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
+  otrng_skipped_keys_store_move(manager->skipped_keys, ratchet->skipped_keys);
 
-  otrng_secure_free(ratchet);
+  otrng_receiving_ratchet_rollback(ratchet);
 }
 
 INTERNAL void otrng_key_manager_set_their_tmp_keys(
@@ -220,11 +226,26 @@ INTERNAL void otrng_key_manager_set_their_dh(const dh_public_key their_dh,
 INTERNAL otrng_result
 otrng_key_manager_generate_ephemeral_keys(key_manager_s *manager) {
   time_t now;
-  uint8_t *sym = otrng_secure_alloc(ED448_PRIVATE_BYTES);
+  uint8_t *sym;
+
+  now = time(NULL);
+
+  /* The pool holds both keypairs, so it is only used when a new DH keypair
+     is needed: generating the ECDH one alone is cheap. */
+  if (manager->i % 3 == 0 && manager->keypair_pool) {
+    otrng_ecdh_keypair_destroy(manager->our_ecdh);
+    otrng_dh_keypair_destroy(manager->our_dh);
+
+    if (otrng_keypair_pool_take(manager->our_ecdh, manager->our_dh,
+                                manager->keypair_pool)) {
+      manager->last_generated = now;
+      return OTRNG_SUCCESS;
+    }
+  }
 
+  sym = otrng_secure_alloc(ED448_PRIVATE_BYTES);
   random_bytes(sym, ED448_PRIVATE_BYTES);
 
-  now = time(NULL);
   otrng_ecdh_keypair_destroy(manager->our_ecdh);
   /* @secret the ecdh keypair will last
      1. for the first generation: until the ratchet is initialized
@@ -697,11 +718,15 @@ tstatic otrng_result rotate_keys(key_manager_s *manager,
   }
 
   if (action == 'r') {
+    /* The root key is only journaled when entering a new DH ratchet */
+    memcpy(tmp_receiving_ratchet->root_key, manager->current->root_key,
+           ROOT_KEY_BYTES);
+    tmp_receiving_ratchet->dh_ratcheted = otrng_true;
+
     if (!enter_new_ratchet(manager, tmp_receiving_ratchet, action)) {
       return OTRNG_ERROR;
     }
 
-    otrng_ec_scalar_destroy(tmp_receiving_ratchet->our_ecdh_priv);
     // TODO: this should destroy the tmp data
     if (tmp_receiving_ratchet->i % 3 == 0) {
       otrng_dh_priv_key_destroy(manager->our_dh);
@@ -927,8 +952,7 @@ tstatic otrng_result calculate_extra_key(
     if (hash_update(hd, tmp_receiving_ratchet->chain_r, CHAIN_KEY_BYTES) ==
         GOLDILOCKS_FAILURE) {
       hash_destroy(hd);
-      otrng_secure_wipe(extra_key_buffer, EXTRA_SYMMETRIC_KEY_BYTES);
-      otrng_free(extra_key_buffer);
+      otrng_secure_free(extra_key_buffer);
       return OTRNG_ERROR;
     }
 
@@ -950,89 +974,93 @@ tstatic otrng_result calculate_extra_key(
   return OTRNG_SUCCESS;
 }
 
+/*
+   MKenc, extra_symm_key and the next chain key only depend on the current
+   chain key, so each step derives the three of them in one multi-lane call:
+   MKenc = KDF_1(usage_message_key || chain_key, 64)
+   extra_symm_key = KDF_1(usage_extra_symm_key || 0xFF || chain_key, 64)
+   chain_key = KDF_1(usage_next_chain_key || chain_key, 64)
+*/
 tstatic otrng_result store_enc_keys(
     k_msg_enc enc_key, receiving_ratchet_s *tmp_receiving_ratchet,
     const uint32_t until, const unsigned int max_skip, const char ratchet_type,
     const otrng_client_callbacks_s *cb, key_manager_s *manager) {
-  goldilocks_shake256_ctx_p hd;
-  uint8_t *extra_key = otrng_secure_alloc(EXTRA_SYMMETRIC_KEY_BYTES);
-  uint8_t magic[1] = {0xFF};
+  uint8_t *extra_key;
+  uint8_t *extra_input;
+  uint8_t *chain_key = tmp_receiving_ratchet->chain_r;
+  uint8_t *dst[3];
+  const uint8_t usages[3] = {usage_message_key, usage_extra_symm_key,
+                             usage_next_chain_key};
+  const uint8_t *values[3];
+  const size_t values_len[3] = {CHAIN_KEY_BYTES, 1 + CHAIN_KEY_BYTES,
+                                CHAIN_KEY_BYTES};
   skipped_keys_s *skipped_msg_enc_key;
 
   if ((tmp_receiving_ratchet->k + max_skip) < until) {
     otrng_client_callbacks_handle_event(cb,
                                         OTRNG_MSG_EVENT_MSG_KEYS_STORAGE_FULL);
 
-    otrng_secure_free(extra_key);
     return OTRNG_SUCCESS;
   }
 
-  if (!otrng_bool_is_true(otrng_is_empty_array(tmp_receiving_ratchet->chain_r,
-                                               CHAIN_KEY_BYTES))) {
-    while (tmp_receiving_ratchet->k < until) {
-      if (!shake_256_kdf1(enc_key, ENC_KEY_BYTES, usage_message_key,
-                          tmp_receiving_ratchet->chain_r, CHAIN_KEY_BYTES)) {
-        otrng_secure_free(extra_key);
-        return OTRNG_ERROR;
-      }
-
-      if (!hash_init_with_usage(hd, usage_extra_symm_key)) {
-        otrng_secure_free(extra_key);
-        return OTRNG_ERROR;
-      }
-
-      if (hash_update(hd, magic, 1) == GOLDILOCKS_FAILURE) {
-        hash_destroy(hd);
-        otrng_secure_free(extra_key);
-        return OTRNG_ERROR;
-      }
-
-      if (hash_update(hd, tmp_receiving_ratchet->chain_r, CHAIN_KEY_BYTES) ==
-          GOLDILOCKS_FAILURE) {
-        hash_destroy(hd);
-        otrng_secure_free(extra_key);
-        return OTRNG_ERROR;
-      }
+  if (otrng_bool_is_true(otrng_is_empty_array(chain_key, CHAIN_KEY_BYTES))) {
+    return OTRNG_SUCCESS;
+  }
 
-      hash_final(hd, extra_key, EXTRA_SYMMETRIC_KEY_BYTES);
-      hash_destroy(hd);
+  extra_key = otrng_secure_alloc(EXTRA_SYMMETRIC_KEY_BYTES);
+  extra_input = otrng_secure_alloc(1 + CHAIN_KEY_BYTES);
+  extra_input[0] = 0xFF;
+
+  /* The next chain key goes last, as it overwrites its own input */
+  dst[0] = enc_key;
+  dst[1] = extra_key;
+  dst[2] = chain_key;
+  values[0] = chain_key;
+  values[1] = extra_input;
+  values[2] = chain_key;
+
+  while (tmp_receiving_ratchet->k < until) {
+    memcpy(extra_input + 1, chain_key, CHAIN_KEY_BYTES);
+
+    if (!shake_256_kdf1_x4(dst, ENC_KEY_BYTES, usages, values, values_len,
+                           3)) {
+      otrng_secure_free(extra_input);
+      otrng_secure_free(extra_key);
+      return OTRNG_ERROR;
+    }
 
-      if (!shake_256_kdf1(tmp_receiving_ratchet->chain_r, CHAIN_KEY_BYTES,
-                          usage_next_chain_key, tmp_receiving_ratchet->chain_r,
-                          CHAIN_KEY_BYTES)) {
-        otrng_secure_free(extra_key);
-        return OTRNG_ERROR;
-      }
+    assert(ratchet_type == 'd' || ratchet_type == 'c');
 
-      skipped_msg_enc_key = otrng_secure_alloc(sizeof(skipped_keys_s));
+    if (ratchet_type == 'd') {
+      skipped_msg_enc_key = otrng_skipped_keys_new(manager->their_ecdh,
+                                                   tmp_receiving_ratchet->k);
+    } else {
+      skipped_msg_enc_key = otrng_skipped_keys_new(
+          tmp_receiving_ratchet->their_ecdh, tmp_receiving_ratchet->k);
+    }
 
-      assert(ratchet_type == 'd' || ratchet_type == 'c');
+    if (!skipped_msg_enc_key) {
+      otrng_secure_free(extra_input);
+      otrng_secure_free(extra_key);
+      return OTRNG_ERROR;
+    }
 
-      if (ratchet_type == 'd') {
-        otrng_ec_point_copy(skipped_msg_enc_key->their_ecdh,
-                            manager->their_ecdh);
-      } else if (ratchet_type == 'c') {
-        otrng_ec_point_copy(skipped_msg_enc_key->their_ecdh,
-                            tmp_receiving_ratchet->their_ecdh);
-      }
+    memcpy(skipped_msg_enc_key->extra_symmetric_key, extra_key,
+           EXTRA_SYMMETRIC_KEY_BYTES);
+    memcpy(skipped_msg_enc_key->enc_key, enc_key, ENC_KEY_BYTES);
 
-      skipped_msg_enc_key->k = tmp_receiving_ratchet->k;
-
-      memcpy(skipped_msg_enc_key->extra_symmetric_key, extra_key,
-             EXTRA_SYMMETRIC_KEY_BYTES);
-      memcpy(skipped_msg_enc_key->enc_key, enc_key, ENC_KEY_BYTES);
-
-      /*
-         @secret: should be deleted when:
-         1. session expired
-         2. the key is retrieved
-      */
-      tmp_receiving_ratchet->skipped_keys = otrng_list_add(
-          skipped_msg_enc_key, tmp_receiving_ratchet->skipped_keys);
-      otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
-      tmp_receiving_ratchet->k++;
-    }
+    /*
+       @secret: should be deleted when:
+       1. session expired
+       2. the key is retrieved
+    */
+    otrng_skipped_keys_store_add(tmp_receiving_ratchet->skipped_keys,
+                                 skipped_msg_enc_key);
+    otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
+    tmp_receiving_ratchet->k++;
   }
+
+  otrng_secure_free(extra_input);
   otrng_secure_free(extra_key);
 
   return OTRNG_SUCCESS;
@@ -1046,37 +1074,29 @@ INTERNAL otrng_result otrng_key_get_skipped_keys(
     k_msg_enc enc_key, k_msg_mac mac_key, ec_point msg_ecdh,
     unsigned int msg_id, key_manager_s *manager,
     receiving_ratchet_s *tmp_receiving_ratchet) {
-  list_element_s *current = tmp_receiving_ratchet->skipped_keys;
-  (void)manager;
-
-  while (current) {
-    skipped_keys_s *skipped_keys = current->data;
-
-    if ((goldilocks_448_point_eq(msg_ecdh, skipped_keys->their_ecdh) ==
-         GOLDILOCKS_TRUE) &&
-        skipped_keys->k == msg_id) {
-      memcpy(enc_key, skipped_keys->enc_key, ENC_KEY_BYTES);
-      if (!shake_256_kdf1(mac_key, MAC_KEY_BYTES, usage_mac_key, enc_key,
-                          ENC_KEY_BYTES)) {
-        return OTRNG_ERROR;
-      }
+  const skipped_keys_s *skipped_keys =
+      otrng_skipped_keys_store_get(manager->skipped_keys, msg_ecdh, msg_id);
 
-      memcpy(tmp_receiving_ratchet->extra_symmetric_key,
-             skipped_keys->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
+  if (!skipped_keys) {
+    /* This is not an actual error, it is just that the key we need was not
+    skipped */
+    return OTRNG_ERROR;
+  }
 
-      tmp_receiving_ratchet->skipped_keys = otrng_list_remove_element(
-          current, tmp_receiving_ratchet->skipped_keys);
-      otrng_list_free(current, otrng_secure_free);
+  memcpy(enc_key, skipped_keys->enc_key, ENC_KEY_BYTES);
+  if (!shake_256_kdf1(mac_key, MAC_KEY_BYTES, usage_mac_key, enc_key,
+                      ENC_KEY_BYTES)) {
+    return OTRNG_ERROR;
+  }
 
-      return OTRNG_SUCCESS;
-    }
+  memcpy(tmp_receiving_ratchet->extra_symmetric_key,
+         skipped_keys->extra_symmetric_key, EXTRA_SYMMETRIC_KEY_BYTES);
 
-    current = current->next;
-  }
+  /* The keys are only removed from the store once the message is
+     authenticated and the receiving ratchet is copied */
+  tmp_receiving_ratchet->used_skipped_keys = skipped_keys;
 
-  /* This is not an actual error, it is just that the key we need was not
-  skipped */
-  return OTRNG_ERROR;
+  return OTRNG_SUCCESS;
 }
 
 INTERNAL otrng_result otrng_key_manager_derive_chain_keys(
@@ -1161,40 +1181,48 @@ INTERNAL otrng_result otrng_store_old_mac_keys(key_manager_s *manager,
   return OTRNG_SUCCESS;
 }
 
-INTERNAL /*@null@*/ uint8_t *
-otrng_reveal_mac_keys_on_tlv(key_manager_s *manager) {
-  size_t num_stored_keys = otrng_list_len(manager->skipped_keys);
-  size_t serlen = num_stored_keys * MAC_KEY_BYTES;
+typedef struct reveal_mac_keys_context_s {
   uint8_t *ser_mac_keys;
-  k_msg_mac mac_key;
-  k_msg_enc enc_key;
   size_t i;
+  otrng_result result;
+} reveal_mac_keys_context_s;
 
-  if (serlen != 0) {
-    ser_mac_keys = otrng_secure_alloc(serlen);
+static void reveal_mac_key(const skipped_keys_s *skipped_keys, void *context) {
+  reveal_mac_keys_context_s *ctx = context;
+  k_msg_mac mac_key;
 
-    memset(enc_key, 0, ENC_KEY_BYTES);
-    memset(mac_key, 0, MAC_KEY_BYTES);
+  if (!shake_256_kdf1(mac_key, MAC_KEY_BYTES, usage_mac_key,
+                      skipped_keys->enc_key, ENC_KEY_BYTES)) {
+    ctx->result = OTRNG_ERROR;
+    return;
+  }
 
-    for (i = 0; i < num_stored_keys; i++) {
-      list_element_s *last = otrng_list_get_last(manager->skipped_keys);
-      skipped_keys_s *skipped_keys = last->data;
-      memcpy(enc_key, skipped_keys->enc_key, ENC_KEY_BYTES);
+  memcpy(ctx->ser_mac_keys + ctx->i * MAC_KEY_BYTES, mac_key, MAC_KEY_BYTES);
+  otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
+  ctx->i++;
+}
 
-      if (!shake_256_kdf1(mac_key, MAC_KEY_BYTES, usage_mac_key, enc_key,
-                          ENC_KEY_BYTES)) {
-        otrng_secure_free(ser_mac_keys);
-        return NULL;
-      }
+INTERNAL /*@null@*/ uint8_t *
+otrng_reveal_mac_keys_on_tlv(key_manager_s *manager) {
+  size_t num_stored_keys = otrng_skipped_keys_store_len(manager->skipped_keys);
+  size_t serlen = num_stored_keys * MAC_KEY_BYTES;
+  reveal_mac_keys_context_s ctx;
+
+  if (serlen != 0) {
+    ctx.ser_mac_keys = otrng_secure_alloc(serlen);
+    ctx.i = 0;
+    ctx.result = OTRNG_SUCCESS;
+
+    otrng_skipped_keys_store_foreach(manager->skipped_keys, reveal_mac_key,
+                                     &ctx);
+    otrng_skipped_keys_store_clear(manager->skipped_keys);
 
-      memcpy(ser_mac_keys + i * MAC_KEY_BYTES, mac_key, MAC_KEY_BYTES);
-      manager->skipped_keys =
-          otrng_list_remove_element(last, manager->skipped_keys);
-      otrng_list_free(last, otrng_secure_free);
+    if (!ctx.result) {
+      otrng_secure_free(ctx.ser_mac_keys);
+      return NULL;
     }
-    otrng_list_free_nodes(manager->skipped_keys);
 
-    return ser_mac_keys;
+    return ctx.ser_mac_keys;
   }
 
   return NULL;
@@ -32,9 +32,11 @@
 #include "constants.h"
 #include "dh.h"
 #include "ed448.h"
+#include "keypair_pool.h"
 #include "keys.h"
 #include "list.h"
 #include "shared.h"
+#include "skipped_keys.h"
 
 /* the different kind of keys for the key management */
 typedef uint8_t k_brace[BRACE_KEY_BYTES];
@@ -55,19 +57,10 @@ typedef struct ratchet_s {
   k_receiving_chain chain_r;
 } ratchet_s;
 
-/* the list of stored message and extra symmetric keys */
-typedef struct skipped_keys_s {
-  ec_point their_ecdh; /* Current their_ecdh key */
-  uint32_t k;          /* Counter of the receiving messages */
-  k_extra_symmetric extra_symmetric_key;
-  k_msg_enc enc_key;
-} skipped_keys_s;
-
-/* a temporary structure used to hold the values of the receiving ratchet */
+/* a journal of the values of the receiving ratchet changed by a received
+ * data message. It is committed into the key manager only once the message is
+ * authenticated, and rolled back otherwise. */
 typedef struct receiving_ratchet_s {
-  ec_scalar our_ecdh_priv;
-  /*@null@*/ dh_private_key our_dh_priv;
-
   ec_point their_ecdh;
   /*@null@*/ dh_public_key their_dh;
 
@@ -78,12 +71,18 @@ typedef struct receiving_ratchet_s {
   uint32_t k;  /* Counter of the receiving ratchet */
   uint32_t j;  /* Counter of the sending ratchet */
   uint32_t pn; /* the number of messages in the previous DH ratchet. */
-  k_root root_key;
+  k_root root_key; /* Only journaled when entering a new DH ratchet */
   k_receiving_chain chain_r;
 
   k_extra_symmetric extra_symmetric_key;
 
-  list_element_s *skipped_keys;
+  otrng_bool dh_ratcheted; /* If a new DH ratchet was entered */
+
+  /* the message keys skipped while receiving, moved into the key manager on
+   * copy */
+  skipped_keys_store_s *skipped_keys;
+  /* the stored keys used to receive, removed from the key manager on copy */
+  /*@null@*/ const skipped_keys_s *used_skipped_keys;
 } receiving_ratchet_s;
 
 /* represents the different values needed for key management */
@@ -117,10 +116,16 @@ typedef struct key_manager_s {
   k_extra_symmetric extra_symmetric_key;
   uint8_t tmp_key[HASH_BYTES];
 
-  list_element_s *skipped_keys;
+  skipped_keys_store_s *skipped_keys;
   list_element_s *old_mac_keys;
 
+  /* reused by every received data message */
+  receiving_ratchet_s *receiving;
+
   time_t last_generated;
+
+  /* the pool new DH keypairs are taken from, owned by the global state */
+  /*@null@*/ otrng_keypair_pool_s *keypair_pool;
 } key_manager_s;
 
 /*
@@ -159,33 +164,34 @@ INTERNAL void otrng_key_manager_free(key_manager_s *manager);
 INTERNAL void otrng_key_manager_wipe_shared_prekeys(key_manager_s *manager);
 
 /**
- * @brief Create a temporary receiving ratchet to be used to prevent a ratchet
- * corruption.
+ * @brief Start a receiving ratchet transaction, to prevent a ratchet
+ * corruption. Only the values changed by the received message are recorded
+ * on it.
  *
  * @param [manager]    The current key manager.
  *
- * @return [manager]   The receiving ratchet [receiving_ratchet_s].
+ * @return The receiving ratchet [receiving_ratchet_s], owned by the key
+ * manager.
  */
-
-INTERNAL /*@null@*/ receiving_ratchet_s *
-otrng_receiving_ratchet_new(key_manager_s *manager);
+INTERNAL receiving_ratchet_s *
+otrng_receiving_ratchet_begin(key_manager_s *manager);
 
 /**
- * @brief Copy a temporary receiving ratchet into the key manager.
+ * @brief Commit the receiving ratchet transaction into the key manager.
  *
- * @param [dst]   The key manager.
- * @param [src]   The receiving ratchet.
+ * @param [manager]   The key manager.
+ * @param [ratchet]   The receiving ratchet.
  */
-INTERNAL void otrng_receiving_ratchet_copy(key_manager_s *dst,
-                                           receiving_ratchet_s *src);
+INTERNAL void otrng_receiving_ratchet_commit(key_manager_s *manager,
+                                             receiving_ratchet_s *ratchet);
 
 /**
- * @brief Destroy a temporary receiving ratchet to be used to prevent a ratchet
- * corruption.
+ * @brief Discard the receiving ratchet transaction, leaving the key manager
+ * untouched.
  *
- * @param [manager]   The receiving ratchet.
+ * @param [ratchet]   The receiving ratchet.
  */
-INTERNAL void otrng_receiving_ratchet_destroy(receiving_ratchet_s *ratchet);
+INTERNAL void otrng_receiving_ratchet_rollback(receiving_ratchet_s *ratchet);
 
 /**
  * @brief Securely replace their ecdh and their dh keys.
@@ -376,6 +382,22 @@ tstatic otrng_result calculate_extra_key(
     key_manager_s *manager, receiving_ratchet_s *tmp_receiving_ratchet,
     const char action);
 
+/**
+ * @brief Derive and store the message keys skipped up to [until].
+ *
+ * @param [enc_key]                 Scratch space for the encryption key.
+ * @param [tmp_receiving_ratchet]   The receiving ratchet to advance.
+ * @param [until]                   The first message id not to skip.
+ * @param [max_skip]                The maximum number of keys to store.
+ * @param [ratchet_type]            'd' for a DH ratchet, 'c' for a chain one.
+ * @param [cb]                      The client callbacks.
+ * @param [manager]                 The key manager.
+ */
+tstatic otrng_result store_enc_keys(
+    k_msg_enc enc_key, receiving_ratchet_s *tmp_receiving_ratchet,
+    const uint32_t until, const unsigned int max_skip, const char ratchet_type,
+    const otrng_client_callbacks_s *cb, key_manager_s *manager);
+
 #endif
 
 #endif
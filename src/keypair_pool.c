@@ -0,0 +1,222 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+#define OTRNG_KEYPAIR_POOL_PRIVATE
+
+#include "alloc.h"
+#include "keypair_pool.h"
+#include "keys.h"
+
+/*
+ * The entries live in a ring of pointers. The lock is only held to push or
+ * pop a pointer: the keys are generated, moved and wiped outside of it.
+ */
+struct otrng_keypair_pool_s {
+  keypair_pool_entry_s **entries;
+  size_t capacity;
+  size_t low_water;
+  size_t head;
+  size_t len;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t worker;
+  otrng_bool refilling;
+  otrng_bool stopping;
+};
+
+tstatic keypair_pool_entry_s *keypair_pool_entry_new(void) {
+  keypair_pool_entry_s *entry =
+      otrng_secure_alloc(sizeof(keypair_pool_entry_s));
+
+  if (!otrng_generate_ephemeral_keys(&entry->ecdh, &entry->dh)) {
+    keypair_pool_entry_free(entry);
+    return NULL;
+  }
+
+  return entry;
+}
+
+tstatic void keypair_pool_entry_free(keypair_pool_entry_s *entry) {
+  if (!entry) {
+    return;
+  }
+
+  otrng_ecdh_keypair_destroy(&entry->ecdh);
+  otrng_dh_keypair_destroy(&entry->dh);
+  otrng_secure_free(entry);
+}
+
+static void *keypair_pool_worker(void *data) {
+  otrng_keypair_pool_s *pool = data;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    keypair_pool_entry_s *entry;
+
+    while (!pool->stopping && !pool->refilling) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+
+    if (pool->stopping) {
+      break;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    entry = keypair_pool_entry_new();
+    pthread_mutex_lock(&pool->lock);
+
+    if (!entry) {
+      /* Don't spin on a failing generator: wait until the next take */
+      pool->refilling = otrng_false;
+      continue;
+    }
+
+    /* Only this thread adds entries, so there is always room */
+    pool->entries[(pool->head + pool->len) % pool->capacity] = entry;
+    pool->len++;
+
+    if (pool->len == pool->capacity) {
+      pool->refilling = otrng_false;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+INTERNAL otrng_keypair_pool_s *otrng_keypair_pool_new(size_t capacity,
+                                                      size_t low_water) {
+  otrng_keypair_pool_s *pool;
+
+  if (capacity == 0 || low_water > capacity) {
+    return NULL;
+  }
+
+  pool = otrng_xmalloc_z(sizeof(otrng_keypair_pool_s));
+  pool->entries = otrng_xmalloc_z(capacity * sizeof(keypair_pool_entry_s *));
+  pool->capacity = capacity;
+  pool->low_water = low_water;
+  pool->refilling = otrng_true;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+
+  if (pthread_create(&pool->worker, NULL, keypair_pool_worker, pool) != 0) {
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    otrng_free(pool->entries);
+    otrng_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+INTERNAL void otrng_keypair_pool_free(otrng_keypair_pool_s *pool) {
+  size_t i;
+
+  if (!pool) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = otrng_true;
+  pthread_cond_signal(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_join(pool->worker, NULL);
+
+  for (i = 0; i < pool->len; i++) {
+    keypair_pool_entry_free(
+        pool->entries[(pool->head + i) % pool->capacity]);
+  }
+
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  otrng_free(pool->entries);
+  otrng_free(pool);
+}
+
+INTERNAL size_t otrng_keypair_pool_len(otrng_keypair_pool_s *pool) {
+  size_t len;
+
+  if (!pool) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  len = pool->len;
+  pthread_mutex_unlock(&pool->lock);
+
+  return len;
+}
+
+INTERNAL otrng_bool otrng_keypair_pool_take(ecdh_keypair_s *ecdh,
+                                            dh_keypair_s *dh,
+                                            otrng_keypair_pool_s *pool) {
+  keypair_pool_entry_s *entry = NULL;
+
+  if (!pool) {
+    return otrng_false;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->len > 0) {
+    entry = pool->entries[pool->head];
+    pool->entries[pool->head] = NULL;
+    pool->head = (pool->head + 1) % pool->capacity;
+    pool->len--;
+  }
+
+  if (pool->len < pool->low_water || pool->len == 0) {
+    pool->refilling = otrng_true;
+    pthread_cond_signal(&pool->wake);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (!entry) {
+    return otrng_false;
+  }
+
+  otrng_ec_scalar_copy(ecdh->priv, entry->ecdh.priv);
+  otrng_ec_point_copy(ecdh->pub, entry->ecdh.pub);
+
+  dh->priv = entry->dh.priv;
+  dh->pub = entry->dh.pub;
+  entry->dh.priv = NULL;
+  entry->dh.pub = NULL;
+
+  keypair_pool_entry_free(entry);
+
+  return otrng_true;
+}
+
+INTERNAL otrng_result otrng_keypair_pool_generate(ecdh_keypair_s *ecdh,
+                                                  dh_keypair_s *dh,
+                                                  otrng_keypair_pool_s *pool) {
+  if (otrng_keypair_pool_take(ecdh, dh, pool)) {
+    return OTRNG_SUCCESS;
+  }
+
+  return otrng_generate_ephemeral_keys(ecdh, dh);
+}
@@ -0,0 +1,108 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A pool of pre-generated ephemeral (ECDH, DH) keypairs. A background thread
+ * keeps the pool filled, so the ratchet and the prekey code don't pay for the
+ * DH key generation on the sending path. All the functions in this file can be
+ * called concurrently from different threads on the same pool.
+ */
+
+#ifndef OTRNG_KEYPAIR_POOL_H
+#define OTRNG_KEYPAIR_POOL_H
+
+#include <stddef.h>
+
+#include "dh.h"
+#include "ed448.h"
+#include "error.h"
+#include "shared.h"
+
+typedef struct otrng_keypair_pool_s otrng_keypair_pool_s;
+
+/**
+ * @brief Creates a new pool and starts the thread that fills it.
+ *
+ * @param [capacity]   The number of keypairs the pool is filled up to.
+ * @param [low_water]  The pool is refilled when it holds fewer keypairs than
+ *                     this. It must not be larger than the capacity.
+ *
+ * @return A new pool, or NULL if the arguments are invalid or the thread
+ * can't be started.
+ */
+INTERNAL /*@null@*/ otrng_keypair_pool_s *
+otrng_keypair_pool_new(size_t capacity, size_t low_water);
+
+/**
+ * @brief Stops the thread filling the pool and securely frees the pool and
+ * every keypair left in it.
+ *
+ * @param [pool]   The pool.
+ */
+INTERNAL void otrng_keypair_pool_free(/*@null@*/ otrng_keypair_pool_s *pool);
+
+/**
+ * @brief The number of keypairs ready in the pool.
+ *
+ * @param [pool]   The pool.
+ */
+INTERNAL size_t
+otrng_keypair_pool_len(/*@null@*/ otrng_keypair_pool_s *pool);
+
+/**
+ * @brief Moves a pre-generated keypair out of the pool. It never waits for the
+ * background thread.
+ *
+ * @param [ecdh]   The destination of the ECDH keypair.
+ * @param [dh]     The destination of the DH keypair.
+ * @param [pool]   The pool. It can be NULL.
+ *
+ * @return otrng_true if the keypairs were taken, otrng_false if the pool is
+ * NULL or empty, in which case the destinations are left untouched.
+ */
+INTERNAL otrng_bool
+otrng_keypair_pool_take(ecdh_keypair_s *ecdh, dh_keypair_s *dh,
+                        /*@null@*/ otrng_keypair_pool_s *pool);
+
+/**
+ * @brief Takes a keypair from the pool, or generates one if there is none.
+ *
+ * @param [ecdh]   The destination of the ECDH keypair.
+ * @param [dh]     The destination of the DH keypair.
+ * @param [pool]   The pool. It can be NULL.
+ */
+INTERNAL otrng_result
+otrng_keypair_pool_generate(ecdh_keypair_s *ecdh, dh_keypair_s *dh,
+                            /*@null@*/ otrng_keypair_pool_s *pool);
+
+#ifdef OTRNG_KEYPAIR_POOL_PRIVATE
+
+typedef struct keypair_pool_entry_s {
+  ecdh_keypair_s ecdh;
+  dh_keypair_s dh;
+} keypair_pool_entry_s;
+
+tstatic /*@null@*/ keypair_pool_entry_s *keypair_pool_entry_new(void);
+
+tstatic void keypair_pool_entry_free(/*@null@*/ keypair_pool_entry_s *entry);
+
+#endif
+
+#endif
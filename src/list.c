@@ -180,6 +180,35 @@ INTERNAL list_element_s *otrng_list_remove_element(const list_element_s *wanted,
   return head;
 }
 
+INTERNAL /*@null@*/ list_element_s *otrng_list_unlink(const void *wanted,
+                                                      list_element_s **head,
+                                                      list_element_s **last) {
+  list_element_s *previous = NULL;
+  list_element_s *cursor = *head;
+
+  while (cursor && cursor->data != wanted) {
+    previous = cursor;
+    cursor = cursor->next;
+  }
+
+  if (!cursor) {
+    return NULL;
+  }
+
+  if (previous) {
+    previous->next = cursor->next;
+  } else {
+    *head = cursor->next;
+  }
+
+  if (*last == cursor) {
+    *last = previous;
+  }
+
+  cursor->next = NULL;
+  return cursor;
+}
+
 INTERNAL size_t otrng_list_len(list_element_s *head) {
   list_element_s *cursor = head;
   size_t size = 0;
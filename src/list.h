@@ -68,6 +68,12 @@ otrng_list_get_by_value(const void *wanted, list_element_s *head);
 INTERNAL list_element_s *otrng_list_remove_element(const list_element_s *wanted,
                                                    list_element_s *head);
 
+// Unlink the first node holding [wanted] in a single walk, keeping [*last] on
+// the last node. Returns the node, which the caller frees, or NULL.
+INTERNAL /*@null@*/ list_element_s *otrng_list_unlink(const void *wanted,
+                                                      list_element_s **head,
+                                                      list_element_s **last);
+
 INTERNAL size_t otrng_list_len(list_element_s *head);
 
 #ifdef OTRNG_LIST_PRIVATE
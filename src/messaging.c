@@ -25,6 +25,9 @@
 #pragma clang diagnostic pop
 #endif
 
+#include <sodium.h>
+#include <string.h>
+
 #define OTRNG_MESSAGING_PRIVATE
 #define OTRNG_PERSISTENCE_PRIVATE
 
@@ -46,6 +49,13 @@ otrng_global_state_new(const otrng_client_callbacks_s *cb, otrng_bool die) {
     }
   }
 
+  pthread_mutex_init(&gs->lock, NULL);
+
+  /* Accounts are chosen by the user, but keying the table costs nothing */
+  randombytes_buf(gs->clients_index.hash_key, CLIENTS_HASH_KEY_BYTES);
+
+  gs->expiry = otrng_expiry_scheduler_new();
+
   gs->callbacks = cb;
   gs->user_state_v3 = otrl_userstate_create();
   if (gs->user_state_v3 == NULL) {
@@ -59,52 +69,221 @@ otrng_global_state_new(const otrng_client_callbacks_s *cb, otrng_bool die) {
 
 tstatic void free_client(void *data) { otrng_client_free(data); }
 
+INTERNAL void otrng_global_state_lock(const otrng_global_state_s *gs) {
+  pthread_mutex_lock((pthread_mutex_t *)&gs->lock);
+}
+
+INTERNAL void otrng_global_state_unlock(const otrng_global_state_s *gs) {
+  pthread_mutex_unlock((pthread_mutex_t *)&gs->lock);
+}
+
+/* Clients are never removed before the global state is freed, so the list
+ * elements stay valid once the lock is released. fn runs without the lock, and
+ * can look up or create clients. */
+tstatic void clients_foreach(const otrng_global_state_s *gs,
+                             void (*fn)(list_element_s *, void *),
+                             void *context) {
+  list_element_s **elements;
+  list_element_s *el;
+  size_t len, i = 0;
+
+  otrng_global_state_lock(gs);
+  len = otrng_list_len(gs->clients);
+  if (len == 0) {
+    otrng_global_state_unlock(gs);
+    return;
+  }
+
+  elements = otrng_xmalloc(len * sizeof(list_element_s *));
+  for (el = gs->clients; el; el = el->next) {
+    elements[i++] = el;
+  }
+  otrng_global_state_unlock(gs);
+
+  for (i = 0; i < len; i++) {
+    fn(elements[i], context);
+  }
+
+  otrng_free(elements);
+}
+
+API otrng_result otrng_global_state_enable_keypair_pool(
+    otrng_global_state_s *gs, size_t capacity, size_t low_water) {
+  otrng_result result = OTRNG_SUCCESS;
+
+  otrng_global_state_lock(gs);
+  if (gs->keypair_pool) {
+    result = OTRNG_ERROR;
+  } else {
+    gs->keypair_pool = otrng_keypair_pool_new(capacity, low_water);
+    if (!gs->keypair_pool) {
+      result = OTRNG_ERROR;
+    }
+  }
+  otrng_global_state_unlock(gs);
+
+  return result;
+}
+
 API void otrng_global_state_free(otrng_global_state_s *gs) {
   if (!gs) {
     return;
   }
 
   otrng_list_free(gs->clients, free_client);
+  otrng_free(gs->clients_index.slots);
+  /* after the clients, which cancel their entries when freed */
+  otrng_expiry_scheduler_free(gs->expiry);
   otrl_userstate_free(gs->user_state_v3);
+  otrng_keypair_pool_free(gs->keypair_pool);
+  otrng_binary_store_free(gs->store);
+  pthread_mutex_destroy(&gs->lock);
 
   otrng_free(gs);
 }
 
-tstatic int find_client_by_client_id(const void *current, const void *wanted) {
-  const otrng_client_s *client = current;
-  const otrng_client_id_s *cid = wanted;
-  return strcmp(client->client_id.protocol, cid->protocol) == 0 &&
-         strcmp(client->client_id.account, cid->account) == 0;
+#define CLIENTS_MIN_CAPACITY 16
+
+/* Only the account is hashed: the protocol is compared on lookup */
+static uint64_t clients_index_hash(const clients_index_s *index,
+                                   const char *account) {
+  uint8_t out[crypto_shorthash_BYTES];
+  uint64_t hash = 0;
+  size_t i;
+
+  crypto_shorthash(out, (const uint8_t *)account, strlen(account),
+                   index->hash_key);
+
+  for (i = 0; i < crypto_shorthash_BYTES; i++) {
+    hash = (hash << 8) | out[i];
+  }
+
+  return hash;
+}
+
+static void insert_client_slot(clients_slot_s *slots, size_t capacity,
+                               uint64_t hash, otrng_client_s *client) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)(hash & mask);
+
+  while (slots[i].client) {
+    i = (i + 1) & mask;
+  }
+
+  slots[i].hash = hash;
+  slots[i].client = client;
+}
+
+static void clients_index_grow(clients_index_s *index) {
+  size_t capacity =
+      index->capacity ? index->capacity * 2 : CLIENTS_MIN_CAPACITY;
+  clients_slot_s *slots = otrng_xmalloc_z(capacity * sizeof(clients_slot_s));
+  size_t i;
+
+  for (i = 0; i < index->capacity; i++) {
+    if (index->slots[i].client) {
+      insert_client_slot(slots, capacity, index->slots[i].hash,
+                         index->slots[i].client);
+    }
+  }
+
+  otrng_free(index->slots);
+  index->slots = slots;
+  index->capacity = capacity;
+}
+
+static /*@null@*/ otrng_client_s *
+clients_index_get(const clients_index_s *index,
+                  const otrng_client_id_s client_id) {
+  size_t mask, i;
+  uint64_t hash;
+
+  if (index->len == 0) {
+    return NULL;
+  }
+
+  mask = index->capacity - 1;
+  hash = clients_index_hash(index, client_id.account);
+  i = (size_t)(hash & mask);
+
+  while (index->slots[i].client) {
+    const otrng_client_s *client = index->slots[i].client;
+
+    if (index->slots[i].hash == hash &&
+        strcmp(client->client_id.account, client_id.account) == 0 &&
+        strcmp(client->client_id.protocol, client_id.protocol) == 0) {
+      return index->slots[i].client;
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+/* Must be called with the lock held */
+static void add_client(otrng_global_state_s *gs, otrng_client_s *client) {
+  clients_index_s *index = &gs->clients_index;
+  list_element_s *element;
+
+  /* Keep the load factor under 3/4 */
+  if ((index->len + 1) * 4 > index->capacity * 3) {
+    clients_index_grow(index);
+  }
+
+  insert_client_slot(index->slots, index->capacity,
+                     clients_index_hash(index, client->client_id.account),
+                     client);
+  index->len++;
+
+  /* Appending through the tail keeps this constant time */
+  element = otrng_list_add(client, NULL);
+  if (gs->last_client) {
+    gs->last_client->next = element;
+  } else {
+    gs->clients = element;
+  }
+  gs->last_client = element;
+}
+
+INTERNAL void otrng_global_state_add_client(otrng_global_state_s *gs,
+                                            otrng_client_s *client) {
+  otrng_global_state_lock(gs);
+  add_client(gs, client);
+  otrng_global_state_unlock(gs);
 }
 
 tstatic otrng_client_s *get_client(otrng_global_state_s *gs,
                                    const otrng_client_id_s client_id) {
   otrng_client_s *client;
-  list_element_s *el =
-      otrng_list_get(&client_id, gs->clients, find_client_by_client_id);
-  if (el) {
-    return el->data;
+
+  otrng_global_state_lock(gs);
+  client = clients_index_get(&gs->clients_index, client_id);
+  if (client) {
+    otrng_global_state_unlock(gs);
+    return client;
   }
 
   client = otrng_client_new(client_id);
   if (!client) {
+    otrng_global_state_unlock(gs);
     return NULL;
   }
 
   client->global_state = gs;
-  gs->clients = otrng_list_add(client, gs->clients);
+  if (gs->store) {
+    /* Decoded under the lock, so the client is never seen half loaded. Not
+     * being in the store is not an error. */
+    (void)otrng_binary_store_load_client(gs->store, client);
+  }
+  add_client(gs, client);
+  otrng_global_state_unlock(gs);
 
   return client;
 }
 
 API otrng_client_s *otrng_client_get(otrng_global_state_s *gs,
-
                                      const otrng_client_id_s client_id) {
-  list_element_s *el =
-      otrng_list_get(&client_id, gs->clients, find_client_by_client_id);
-  if (el) {
-    return el->data;
-  }
   return get_client(gs, client_id);
 }
 
@@ -240,7 +419,7 @@ tstatic otrng_result global_state_write_to(const otrng_global_state_s *gs,
     return OTRNG_ERROR;
   }
 
-  otrng_list_foreach(gs->clients, fn, f);
+  clients_foreach(gs, fn, f);
 
   return OTRNG_SUCCESS;
 }
@@ -321,7 +500,12 @@ API otrng_result otrng_global_state_prekey_messages_write_to(
 API otrng_result otrng_global_state_instance_tags_read_from(
     otrng_global_state_s *gs, FILE *instag) {
   /* We use v3 global_state also for v4 instance tags, for now. */
-  gcry_error_t res = otrl_instag_read_FILEp(gs->user_state_v3, instag);
+  gcry_error_t res;
+
+  otrng_global_state_lock(gs);
+  res = otrl_instag_read_FILEp(gs->user_state_v3, instag);
+  otrng_global_state_unlock(gs);
+
   if (res) {
     return OTRNG_ERROR;
   }
@@ -475,22 +659,16 @@ API otrng_result otrng_global_state_expired_prekey_profile_read_from(
                                 otrng_client_expired_prekey_profile_read_from);
 }
 
-tstatic void prekey_global_state_message_free_from_list(void *prekeys) {
-  otrng_prekey_message_free(prekeys);
-}
-
 tstatic void free_prekeys_from(list_element_s *node, void *ignored) {
   otrng_client_s *client = node->data;
   (void)ignored;
-  otrng_list_free(client->our_prekeys,
-                  prekey_global_state_message_free_from_list);
-  client->our_prekeys = NULL;
+  otrng_client_forget_my_prekey_messages(client);
 }
 
 API otrng_result otrng_global_state_prekeys_read_from(
     otrng_global_state_s *gs, FILE *f,
     otrng_client_id_s (*read_client_id_for_line)(FILE *)) {
-  otrng_list_foreach(gs->clients, free_prekeys_from, NULL);
+  clients_foreach(gs, free_prekeys_from, NULL);
   return global_state_read_from(gs, f, read_client_id_for_line,
                                 otrng_client_prekey_messages_read_from);
 }
@@ -514,7 +692,7 @@ tstatic void remove_fingerprints_from(list_element_s *node, void *ignored) {
 }
 
 API void otrng_global_state_clean_all(otrng_global_state_s *gs) {
-  otrng_list_foreach(gs->clients, remove_fingerprints_from, NULL);
+  clients_foreach(gs, remove_fingerprints_from, NULL);
 }
 
 tstatic void free_fingerprints_from(list_element_s *node, void *ignored) {
@@ -528,7 +706,7 @@ API otrng_result otrng_global_state_fingerprints_v4_read_from(
     otrng_global_state_s *gs, FILE *f, otrng_client_id_s (*ignored)(FILE *)) {
   (void)ignored;
 
-  otrng_list_foreach(gs->clients, free_fingerprints_from, NULL);
+  clients_foreach(gs, free_fingerprints_from, NULL);
 
   if (!f) {
     return OTRNG_ERROR;
@@ -541,6 +719,72 @@ API otrng_result otrng_global_state_fingerprints_v4_read_from(
   return OTRNG_SUCCESS;
 }
 
+API otrng_result otrng_global_state_store_load_all(otrng_global_state_s *gs) {
+  size_t i;
+
+  if (!gs->store) {
+    return OTRNG_SUCCESS;
+  }
+
+  for (i = 0; i < otrng_binary_store_len(gs->store); i++) {
+    otrng_client_id_s client_id;
+
+    if (!otrng_binary_store_client_id(&client_id, gs->store, i) ||
+        !get_client(gs, client_id)) {
+      return OTRNG_ERROR;
+    }
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+API otrng_result otrng_global_state_store_write_to(otrng_global_state_s *gs,
+                                                   FILE *f) {
+  otrng_client_s **clients = NULL;
+  list_element_s *el;
+  size_t len, i = 0;
+  otrng_result result;
+
+  if (!f || !otrng_global_state_store_load_all(gs)) {
+    return OTRNG_ERROR;
+  }
+
+  otrng_global_state_lock(gs);
+  len = otrng_list_len(gs->clients);
+  if (len > 0) {
+    clients = otrng_xmalloc(len * sizeof(otrng_client_s *));
+  }
+  for (el = gs->clients; el; el = el->next) {
+    clients[i++] = el->data;
+  }
+  otrng_global_state_unlock(gs);
+
+  result = otrng_binary_store_write(f, clients, len);
+  otrng_free(clients);
+
+  return result;
+}
+
+API otrng_result otrng_global_state_store_read_from(otrng_global_state_s *gs,
+                                                    FILE *f) {
+  otrng_binary_store_s *store = otrng_binary_store_open(f);
+  otrng_binary_store_s *previous;
+
+  if (!store) {
+    return OTRNG_ERROR;
+  }
+
+  otrng_global_state_lock(gs);
+  previous = gs->store;
+  gs->store = store;
+  otrng_global_state_unlock(gs);
+
+  /* Loaded clients copied what they needed out of it */
+  otrng_binary_store_free(previous);
+
+  return OTRNG_SUCCESS;
+}
+
 static void add_fingerprints_v4_to(list_element_s *node, void *fp) {
   if (!otrng_client_fingerprints_v4_write_to(node->data, fp)) {
     return;
@@ -582,7 +826,7 @@ API void otrng_global_state_do_all_fingerprints(
       .fn = fn,
       .context = context,
   };
-  otrng_list_foreach(gs->clients, do_all_fingerprints, &fctx);
+  clients_foreach(gs, do_all_fingerprints, &fctx);
 }
 
 /* This function will actually not return ALL fingerprints.
@@ -597,7 +841,7 @@ API void otrng_global_state_do_all_fingerprints_v3(
   otrng_client_id_s cid;
   ConnContext *cc;
   Fingerprint *fprint;
-  list_element_s *el;
+  const otrng_client_s *client;
   otrng_known_fingerprint_v3_s fp;
 
   for (cc = gs->user_state_v3->context_root; cc; cc = cc->next) {
@@ -609,11 +853,13 @@ API void otrng_global_state_do_all_fingerprints_v3(
     for (fprint = cc->fingerprint_root.next; fprint; fprint = fprint->next) {
       cid.protocol = cc->protocol;
       cid.account = cc->accountname;
-      el = otrng_list_get(&cid, gs->clients, find_client_by_client_id);
-      if (el) {
+      otrng_global_state_lock(gs);
+      client = clients_index_get(&gs->clients_index, cid);
+      otrng_global_state_unlock(gs);
+      if (client) {
         fp.username = cc->username;
         fp.fp = fprint;
-        fn(el->data, &fp, context);
+        fn(client, &fp, context);
       }
     }
   }
@@ -622,16 +868,43 @@ API void otrng_global_state_do_all_fingerprints_v3(
 tstatic void poll_for_client(list_element_s *node, void *context) {
   otrng_client_s *client = node->data;
   (void)context;
-  otrng_client_expire_sessions(client);
-  (void)otrng_client_expire_fragments(client);
   otrng_prekey_check_account_request(client);
 }
 
 API void otrng_poll(otrng_global_state_s *gs) {
-  otrng_list_foreach(gs->clients, poll_for_client, NULL);
+  otrng_global_state_run_due(gs, time(NULL));
+  clients_foreach(gs, poll_for_client, NULL);
   otrl_message_poll(gs->user_state_v3, NULL, NULL);
 }
 
+API otrng_bool otrng_global_state_next_deadline(const otrng_global_state_s *gs,
+                                                time_t *deadline) {
+  return otrng_expiry_next_deadline(deadline, gs->expiry);
+}
+
+API void otrng_global_state_run_due(otrng_global_state_s *gs, time_t now) {
+  otrng_expiry_entry_s *entry;
+  /* Expiring a session can schedule it again. Bounding the loop keeps an
+   * entry that is due again from being taken twice in one run. */
+  size_t remaining = otrng_expiry_len(gs->expiry);
+
+  for (; remaining > 0; remaining--) {
+    entry = otrng_expiry_take_due(gs->expiry, now);
+    if (!entry) {
+      return;
+    }
+
+    switch (entry->kind) {
+    case OTRNG_EXPIRY_SESSION:
+      otrng_client_expire_session_of(entry->owner);
+      break;
+    case OTRNG_EXPIRY_FRAGMENTS:
+      otrng_fragment_contexts_forget(entry->context, entry->owner);
+      break;
+    }
+  }
+}
+
 INTERNAL void
 otrng_global_state_fingerprints_v3_loaded(otrng_global_state_s *gs) {
   gs->fingerprints_v3_loaded = otrng_true;
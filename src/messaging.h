@@ -19,13 +19,24 @@
  */
 
 /**
- * The functions in this file only operate on their arguments, and doesn't touch
- * any global state. It is safe to call these functions concurrently from
- * different threads, as long as arguments pointing to the same memory areas are
- * not used from different threads. However, since the global state points to
- * everything related to a specific OTR clients functionality, it has a lot of
- * references to subordinate objects. To be on the safe side, it's a good idea
- * to serialize access.
+ * The concurrency model of the library:
+ *
+ * - otrng_init can be called from any thread, any number of times. It must
+ *   have returned before any other function is used.
+ * - Looking up and creating clients (otrng_client_get) and enabling the
+ *   keypair pool are safe to call concurrently on the same global state.
+ * - Everything reachable from a client (its conversations, keys, profiles and
+ *   prekeys) is only safe to use from one thread at a time. A client can either
+ *   be confined to one thread, or every call touching it can be made while
+ *   holding its lock (see otrng_client_lock). The library only takes the
+ *   client lock itself in otrng_global_state_warm.
+ * - Different clients can be used concurrently. Instance tags live in the
+ *   OTRv3 user state shared by all clients, and the library serializes their
+ *   lookups. OTRv3 conversations go through libotr, which is not thread safe:
+ *   they must be serialized across all the clients of a global state.
+ * - The functions iterating over every client (otrng_poll, the persistence
+ *   functions) touch all of them: no other thread may be using any client
+ *   while they run.
  */
 
 #ifndef OTRNG_MESSAGING_H_
@@ -51,16 +62,54 @@
  * otrng_messaging_client_receiving(client, alice_talking_to_bob);
  */
 
+#include <pthread.h>
+
+#include "binary_store.h"
 #include "client.h"
+#include "expiry.h"
+#include "keypair_pool.h"
 #include "list.h"
 #include "shared.h"
 
+typedef struct clients_slot_s {
+  uint64_t hash;
+  /*@null@*/ otrng_client_s *client;
+} clients_slot_s;
+
+#define CLIENTS_HASH_KEY_BYTES 16
+
+/* Clients by id, in an open addressing table with linear probing. Clients are
+ * never removed before the global state is freed. */
+typedef struct clients_index_s {
+  /*@null@*/ clients_slot_s *slots;
+  size_t capacity; /* Zero or a power of two */
+  size_t len;
+  uint8_t hash_key[CLIENTS_HASH_KEY_BYTES];
+} clients_index_s;
+
 typedef struct otrng_global_state_s {
+  /* in creation order, for iterating */
   list_element_s *clients;
+  /*@null@*/ list_element_s *last_client;
+  /* the same clients, for lookups by id */
+  clients_index_s clients_index;
+  /* protects the clients and the instance tags in user_state_v3 */
+  pthread_mutex_t lock;
 
   const otrng_client_callbacks_s *callbacks;
   OtrlUserState user_state_v3;
   otrng_bool fingerprints_v3_loaded;
+  /* see otrng_global_state_set_lazy_orchestration */
+  otrng_bool lazy_orchestration;
+
+  /* session and fragment deadlines, see otrng_global_state_run_due */
+  otrng_expiry_scheduler_s *expiry;
+
+  /* pre-generated ephemeral keypairs, NULL unless enabled */
+  /*@null@*/ otrng_keypair_pool_s *keypair_pool;
+  /* the binary store clients are loaded from when first looked up, NULL
+     unless one was read */
+  /*@null@*/ otrng_binary_store_s *store;
 } otrng_global_state_s;
 
 API otrng_global_state_s *
@@ -68,6 +117,22 @@ otrng_global_state_new(const otrng_client_callbacks_s *cb, otrng_bool die);
 
 API void otrng_global_state_free(otrng_global_state_s *gs);
 
+/**
+ * @brief Starts a background thread that keeps a pool of ephemeral ECDH and DH
+ * keypairs, used by the ratchet and when building prekey messages. Only
+ * conversations started after this call draw from the pool.
+ *
+ * @param [gs]         The global state.
+ * @param [capacity]   The number of keypairs the pool is filled up to.
+ * @param [low_water]  The pool is refilled when it holds fewer keypairs than
+ *                     this.
+ *
+ * @return OTRNG_ERROR if the pool is already enabled, the arguments are
+ * invalid or the thread can't be started.
+ */
+API otrng_result otrng_global_state_enable_keypair_pool(
+    otrng_global_state_s *gs, size_t capacity, size_t low_water);
+
 API otrng_client_s *otrng_client_get(otrng_global_state_s *gs,
                                      const otrng_client_id_s client_id);
 
@@ -167,6 +232,45 @@ API otrng_result otrng_global_state_fingerprints_v4_write_to(
 API otrng_result otrng_global_state_fingerprints_v3_write_to(
     const otrng_global_state_s *gs, FILE *privf);
 
+/**
+ * @brief Writes the keys, profiles, prekey messages and fingerprints of every
+ * client to a binary store (see binary_store.h). Clients still waiting in a
+ * store that was read are loaded first, so none of them is lost.
+ *
+ * Together with otrng_global_state_store_read_from and
+ * otrng_global_state_store_load_all this converts between the formats: to go
+ * from the text files to a binary store, read the text files and write the
+ * store. To go back, read the store, load all of it and write the text files.
+ *
+ * @param [gs]  The global state.
+ * @param [f]   An empty file, open for writing. It must be seekable.
+ */
+API otrng_result otrng_global_state_store_write_to(otrng_global_state_s *gs,
+                                                   FILE *f);
+
+/**
+ * @brief Opens a binary store written by otrng_global_state_store_write_to,
+ * in place of any store read before. No client is decoded here: each one is
+ * loaded from the store when it is first looked up. Clients that already
+ * exist are left as they are.
+ *
+ * The file can be closed afterwards, but must not be changed while the global
+ * state uses it: write a new store and rename it over the old one instead.
+ *
+ * @param [gs]  The global state.
+ * @param [f]   The file, open for reading.
+ */
+API otrng_result otrng_global_state_store_read_from(otrng_global_state_s *gs,
+                                                    FILE *f);
+
+/**
+ * @brief Loads every client of the store read with
+ * otrng_global_state_store_read_from that hasn't been looked up yet.
+ *
+ * @param [gs]  The global state.
+ */
+API otrng_result otrng_global_state_store_load_all(otrng_global_state_s *gs);
+
 API void otrng_global_state_do_all_fingerprints(
     const otrng_global_state_s *gs,
     void (*fn)(const otrng_client_s *, otrng_known_fingerprint_s *, void *),
@@ -186,9 +290,46 @@ API void otrng_global_state_do_all_fingerprints_v3(
  */
 API void otrng_poll(otrng_global_state_s *gs);
 
+/**
+ * @brief The earliest time at which a session or a set of pending fragments
+ * expires.
+ *
+ * Can be used to arm a single timer, instead of polling at a fixed interval.
+ *
+ * @param [gs]       The global state.
+ * @param [deadline] Set to the earliest deadline, when there is one.
+ *
+ * @return otrng_true if anything is scheduled to expire.
+ */
+API otrng_bool otrng_global_state_next_deadline(const otrng_global_state_s *gs,
+                                                time_t *deadline);
+
+/**
+ * @brief Expires every session and set of pending fragments whose deadline is
+ * at or before now.
+ *
+ * Only touches what is due, instead of walking every client. Like otrng_poll,
+ * no other thread may be using any client while it runs.
+ *
+ * @param [gs]  The global state.
+ * @param [now] The current time.
+ */
+API void otrng_global_state_run_due(otrng_global_state_s *gs, time_t now);
+
 INTERNAL void
 otrng_global_state_fingerprints_v3_loaded(otrng_global_state_s *gs);
 
+INTERNAL void otrng_global_state_lock(const otrng_global_state_s *gs);
+
+INTERNAL void otrng_global_state_unlock(const otrng_global_state_s *gs);
+
+/**
+ * @brief Adds a client that was created outside of otrng_client_get, so it
+ * can be looked up. The global state takes ownership of it.
+ */
+INTERNAL void otrng_global_state_add_client(otrng_global_state_s *gs,
+                                            otrng_client_s *client);
+
 #ifdef DEBUG_API
 
 API void otrng_global_state_debug_print(FILE *, int, otrng_global_state_s *gs);
@@ -29,6 +29,7 @@
 #pragma clang diagnostic pop
 #endif
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -162,6 +163,9 @@ INTERNAL otrng_s *otrng_new(otrng_client_s *client, otrng_policy_s policy) {
   otr->running_version = OTRNG_PROTOCOL_VERSION_NONE;
 
   otr->keys = otrng_key_manager_new();
+  otr->keys->keypair_pool = otrng_client_keypair_pool(client);
+  otr->session_expiry.kind = OTRNG_EXPIRY_SESSION;
+  otr->session_expiry.owner = otr;
   otr->smp = otrng_secure_alloc(sizeof(smp_protocol_s));
 
   otrng_smp_protocol_init(otr->smp);
@@ -169,9 +173,10 @@ INTERNAL otrng_s *otrng_new(otrng_client_s *client, otrng_policy_s policy) {
   return otr;
 }
 
-static void free_fragment_context(void *p) { otrng_fragment_context_free(p); }
-
 tstatic void otrng_destroy(/*@only@ */ otrng_s *otr) {
+  otrng_expiry_cancel(otrng_client_expiry_scheduler(otr->client),
+                      &otr->session_expiry);
+
   otrng_free(otr->peer);
 
   otrng_key_manager_free(otr->keys);
@@ -187,7 +192,7 @@ tstatic void otrng_destroy(/*@only@ */ otrng_s *otr) {
   otrng_secure_free(otr->smp);
   otr->smp = NULL;
 
-  otrng_list_free(otr->pending_fragments, free_fragment_context);
+  otrng_fragment_contexts_free(otr->pending_fragments);
   otr->pending_fragments = NULL;
 
   otrng_v3_conn_free(otr->v3_conn);
@@ -206,6 +211,28 @@ INTERNAL void otrng_conn_free(/*@only@ */ otrng_s *otr) {
   otrng_free(otr);
 }
 
+/* Called after anything that can generate new ephemeral keys. The session
+ * is only moved in the scheduler when they actually changed. */
+INTERNAL void otrng_schedule_session_expiry(otrng_s *otr) {
+  otrng_expiry_scheduler_s *scheduler =
+      otrng_client_expiry_scheduler(otr->client);
+  time_t last_generated = otr->keys->last_generated;
+  uint32_t expiration_time;
+
+  if (!scheduler || last_generated == 0 ||
+      last_generated == otr->session_expiry.scheduled_from ||
+      !otr->client->global_state->callbacks->session_expiration_time_for) {
+    return;
+  }
+
+  expiration_time =
+      otr->client->global_state->callbacks->session_expiration_time_for(otr);
+
+  otr->session_expiry.scheduled_from = last_generated;
+  otrng_expiry_schedule(scheduler, &otr->session_expiry,
+                        last_generated + expiration_time);
+}
+
 INTERNAL otrng_result otrng_build_query_message(string_p *dst,
                                                 const string_p msg,
                                                 otrng_s *otr) {
@@ -311,6 +338,7 @@ API otrng_result otrng_build_identity_message(string_p *dst, otrng_s *otr) {
   if (otrng_key_manager_generate_ephemeral_keys(otr->keys) == OTRNG_ERROR) {
     return OTRNG_ERROR;
   }
+  otrng_schedule_session_expiry(otr);
 
   maybe_create_keys(otr->client);
 
@@ -434,6 +462,57 @@ tstatic otrng_bool message_is_otr_error(const string_p msg) {
   return otrng_false;
 }
 
+API void otrng_plaintext_tlvs(tlv_iterator_s *it,
+                              const otrng_plaintext_s *plaintext) {
+  otrng_tlv_iterator_init(it, plaintext->tlvs, plaintext->tlvs_len);
+}
+
+API void otrng_plaintext_release(otrng_plaintext_s *plaintext) {
+  if (!plaintext) {
+    return;
+  }
+
+  /* otrng_secure_free wipes it */
+  otrng_secure_free(plaintext->buffer);
+
+  memset(plaintext, 0, sizeof(otrng_plaintext_s));
+}
+
+/* Takes ownership of [buffer] and splits it into the text and the TLVs */
+static void set_plaintext(otrng_plaintext_s *plaintext, uint8_t *buffer,
+                          size_t len) {
+  const uint8_t *nul = buffer ? memchr(buffer, 0, len) : NULL;
+
+  plaintext->buffer = buffer;
+  plaintext->buffer_len = len;
+  plaintext->text = (const char *)buffer;
+  plaintext->text_len = nul ? (size_t)(nul - buffer) : len;
+  plaintext->tlvs = nul ? nul + 1 : NULL;
+  plaintext->tlvs_len = nul ? len - (nul + 1 - buffer) : 0;
+}
+
+INTERNAL void otrng_response_take_plaintext(otrng_plaintext_s *dst,
+                                           otrng_response_s *response) {
+  memset(dst, 0, sizeof(otrng_plaintext_s));
+
+  if (response->plaintext.buffer) {
+    *dst = response->plaintext;
+    memset(&response->plaintext, 0, sizeof(otrng_plaintext_s));
+    return;
+  }
+
+  /* Anything that was not a data message, like a plaintext message */
+  if (response->to_display) {
+    size_t len = strlen(response->to_display) + 1;
+    uint8_t *buffer = otrng_secure_alloc(len);
+
+    memcpy(buffer, response->to_display, len);
+    set_plaintext(dst, buffer, len);
+    otrng_free(response->to_display);
+    response->to_display = NULL;
+  }
+}
+
 INTERNAL otrng_response_s *otrng_response_new(void) {
   otrng_response_s *response = otrng_xmalloc_z(sizeof(otrng_response_s));
 
@@ -449,6 +528,7 @@ INTERNAL void otrng_response_free(otrng_response_s *response) {
   otrng_free(response->to_send);
 
   otrng_tlv_list_free(response->tlvs);
+  otrng_plaintext_release(&response->plaintext);
 
   otrng_free(response);
 }
@@ -995,7 +1075,8 @@ otrng_build_prekey_ensemble(otrng_s *otr) {
   otrng_prekey_profile_copy(ensemble->prekey_profile,
                             get_my_prekey_profile(otr));
 
-  if (!otrng_generate_ephemeral_keys(&ecdh, &dh)) {
+  if (!otrng_keypair_pool_generate(&ecdh, &dh,
+                                   otrng_client_keypair_pool(otr->client))) {
     otrng_prekey_ensemble_free(ensemble);
     return NULL;
   }
@@ -1159,6 +1240,7 @@ tstatic otrng_result receive_prekey_ensemble(const prekey_ensemble_s *ensemble,
 API otrng_result otrng_send_non_interactive_auth(
     char **dst, const prekey_ensemble_s *ensemble, otrng_s *otr) {
   otrng_fingerprint fp;
+  otrng_result result;
   *dst = NULL;
 
   if (!receive_prekey_ensemble(ensemble, otr)) {
@@ -1173,7 +1255,10 @@ API otrng_result otrng_send_non_interactive_auth(
     fingerprint_seen_cb_v4(fp, otr);
   }
 
-  return reply_with_non_interactive_auth_message(dst, otr);
+  result = reply_with_non_interactive_auth_message(dst, otr);
+  otrng_schedule_session_expiry(otr);
+
+  return result;
 }
 
 tstatic otrng_result generate_tmp_key_i(uint8_t *dst, otrng_s *otr) {
@@ -1784,25 +1869,10 @@ tstatic otrng_result receive_auth_i(char **dst, const uint8_t *buffer,
   return otrng_send_message(dst, "", NULL, MSG_FLAGS_IGNORE_UNREADABLE, otr);
 }
 
-/*@null@*/ tstatic tlv_list_s *deserialize_received_tlvs(const uint8_t *src,
-                                                         size_t len) {
-  uint8_t *tlvs_start = NULL;
-  size_t tlvs_len;
-
-  tlvs_start = memchr(src, 0, len);
-  if (!tlvs_start) {
-    return NULL;
-  }
-
-  tlvs_len = len - (tlvs_start + 1 - src);
-  return otrng_parse_tlvs(tlvs_start + 1, tlvs_len);
-}
-
 tstatic otrng_result decrypt_data_message(otrng_response_s *response,
                                           const k_msg_enc enc_key,
-                                          const data_message_s *msg) {
-  string_p *dst = &response->to_display;
-  uint8_t *plain;
+                                          data_message_s *msg) {
+  otrng_plaintext_s *plaintext = &response->plaintext;
   uint8_t actual_enc_key[ENC_ACTUAL_KEY_BYTES];
   int err;
 
@@ -1815,26 +1885,37 @@ tstatic otrng_result decrypt_data_message(otrng_response_s *response,
   otrng_memdump(msg->nonce, DATA_MSG_NONCE_BYTES);
 #endif
 
-  // TODO: @initialization What if message->enc_msg_len == 0?
-  plain = otrng_secure_alloc(msg->enc_msg_len);
-
+  /* The ciphertext is not needed once the MAC has been checked, so it is
+     decrypted in place. It was deserialized into secure memory. */
   memcpy(actual_enc_key, enc_key, ENC_ACTUAL_KEY_BYTES);
-  err = crypto_stream_xor(plain, msg->enc_msg, msg->enc_msg_len, msg->nonce,
-                          actual_enc_key);
+  err = crypto_stream_xor(msg->enc_msg, msg->enc_msg, msg->enc_msg_len,
+                          msg->nonce, actual_enc_key);
   otrng_secure_wipe(actual_enc_key, ENC_ACTUAL_KEY_BYTES);
 
   if (err) {
-    otrng_secure_free(plain);
+    otrng_secure_wipe(msg->enc_msg, msg->enc_msg_len);
     return OTRNG_ERROR;
   }
 
+  otrng_plaintext_release(plaintext);
+  set_plaintext(plaintext, msg->enc_msg, msg->enc_msg_len);
+  msg->enc_msg = NULL;
+  msg->enc_msg_len = 0;
+
+  if (response->borrow_plaintext) {
+    return OTRNG_SUCCESS;
+  }
+
   /* If plain != "" and msg->enc_msg_len != 0 */
-  if (otrng_strnlen((string_p)plain, msg->enc_msg_len)) {
-    *dst = otrng_xstrndup((char *)plain, msg->enc_msg_len);
+  if (plaintext->text_len) {
+    response->to_display =
+        otrng_xstrndup(plaintext->text, plaintext->text_len);
+  }
+
+  if (plaintext->tlvs) {
+    response->tlvs = otrng_parse_tlvs(plaintext->tlvs, plaintext->tlvs_len);
   }
 
-  response->tlvs = deserialize_received_tlvs(plain, msg->enc_msg_len);
-  otrng_secure_free(plain);
   return OTRNG_SUCCESS;
 }
 
@@ -1872,10 +1953,13 @@ tstatic unsigned int extract_word(const unsigned char *bufp) {
 
 /*@null@*/ tstatic otrng_result process_received_tlvs(
     tlv_list_s **to_send, otrng_response_s *response, otrng_s *otr) {
-  const tlv_list_s *current = response->tlvs;
-  while (current) {
-    tlv_s *tlv = process_tlv(current->data, otr);
-    current = current->next;
+  tlv_iterator_s it;
+  tlv_s current;
+
+  /* The TLVs are read from the decrypted message, without copying them */
+  otrng_plaintext_tlvs(&it, &response->plaintext);
+  while (otrng_tlv_iterator_next(&it, &current)) {
+    tlv_s *tlv = process_tlv(&current, otr);
 
     if (!tlv) {
       continue;
@@ -1950,7 +2034,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
   }
 
   // TODO: we still need to persist our_dh->priv
-  tmp_receiving_ratchet = otrng_receiving_ratchet_new(otr->keys);
+  tmp_receiving_ratchet = otrng_receiving_ratchet_begin(otr->keys);
 
   otrng_key_manager_set_their_tmp_keys(msg->ecdh, msg->dh,
                                        tmp_receiving_ratchet);
@@ -1965,7 +2049,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
               otr->keys, otr->client->max_stored_msg_keys,
               tmp_receiving_ratchet, msg->ecdh, msg->previous_chain_n, 'r',
               otr->client->global_state->callbacks))) {
-        otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
+        otrng_receiving_ratchet_rollback(tmp_receiving_ratchet);
 
         return OTRNG_ERROR;
       }
@@ -1974,6 +2058,8 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
               enc_key, mac_key, otr->keys, tmp_receiving_ratchet,
               otr->client->max_stored_msg_keys, msg->message_id, 'r',
               otr->client->global_state->callbacks))) {
+        otrng_receiving_ratchet_rollback(tmp_receiving_ratchet);
+
         return OTRNG_ERROR;
       }
 
@@ -1984,10 +2070,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
       otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
       otrng_data_message_free(msg);
 
-      if (tmp_receiving_ratchet->skipped_keys) {
-        otrng_list_free(tmp_receiving_ratchet->skipped_keys, otrng_secure_free);
-      }
-      otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
+      otrng_receiving_ratchet_rollback(tmp_receiving_ratchet);
 
       otrng_client_callbacks_handle_event(otr->client->global_state->callbacks,
                                           OTRNG_MSG_EVENT_INVALID_MSG);
@@ -2002,11 +2085,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
         otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
         otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
 
-        if (tmp_receiving_ratchet->skipped_keys) {
-          otrng_list_free(tmp_receiving_ratchet->skipped_keys,
-                          otrng_secure_free);
-        }
-        otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
+        otrng_receiving_ratchet_rollback(tmp_receiving_ratchet);
 
         otrng_data_message_free(msg);
 
@@ -2015,11 +2094,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
       if (msg->flags == MSG_FLAGS_IGNORE_UNREADABLE) {
         otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
         otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
-        if (tmp_receiving_ratchet->skipped_keys) {
-          otrng_list_free(tmp_receiving_ratchet->skipped_keys,
-                          otrng_secure_free);
-        }
-        otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
+        otrng_receiving_ratchet_rollback(tmp_receiving_ratchet);
         otrng_data_message_free(msg);
 
         return OTRNG_ERROR;
@@ -2028,8 +2103,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
 
     otrng_secure_wipe(enc_key, ENC_KEY_BYTES);
 
-    otrng_receiving_ratchet_copy(otr->keys, tmp_receiving_ratchet);
-    otrng_receiving_ratchet_destroy(tmp_receiving_ratchet);
+    otrng_receiving_ratchet_commit(otr->keys, tmp_receiving_ratchet);
 
     if (otrng_failed(receive_tlvs(response, otr))) {
       continue;
@@ -2039,7 +2113,7 @@ tstatic otrng_result otrng_receive_data_message_after_dake(
       continue;
     }
 
-    if (!response->to_display) {
+    if (!response->plaintext.text_len) {
       otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
       otrng_data_message_free(msg);
       return OTRNG_SUCCESS;
@@ -2294,6 +2368,9 @@ INTERNAL otrng_result otrng_receive_message(otrng_response_s *response,
 
   response->to_display = NULL;
 
+  otrng_fragment_contexts_set_expiry(&otr->pending_fragments,
+                                     otrng_client_expiry_scheduler(otr->client),
+                                     otr->client->fragments_exp_time);
   if (otrng_failed(otrng_unfragment_message(&defrag, &otr->pending_fragments,
                                             msg, our_instance_tag(otr)))) {
     return OTRNG_ERROR;
@@ -2301,12 +2378,15 @@ INTERNAL otrng_result otrng_receive_message(otrng_response_s *response,
 
   ret = receive_defragmented_message(response, defrag, otr);
   otrng_free(defrag);
+  otrng_schedule_session_expiry(otr);
   return ret;
 }
 
 INTERNAL otrng_result otrng_send_message(string_p *to_send, const string_p msg,
                                          const tlv_list_s *tlvs, uint8_t flags,
                                          otrng_s *otr) {
+  otrng_result result;
+
   if (!otr) {
     return OTRNG_ERROR;
   }
@@ -2328,7 +2408,10 @@ INTERNAL otrng_result otrng_send_message(string_p *to_send, const string_p msg,
   case OTRNG_PROTOCOL_VERSION_3:
     return otrng_v3_send_message(to_send, msg, tlvs, otr->v3_conn);
   case OTRNG_PROTOCOL_VERSION_4:
-    return otrng_prepare_to_send_data_message(to_send, msg, tlvs, otr, flags);
+    result =
+        otrng_prepare_to_send_data_message(to_send, msg, tlvs, otr, flags);
+    otrng_schedule_session_expiry(otr);
+    return result;
   default:
     return OTRNG_ERROR;
   }
@@ -2344,9 +2427,9 @@ tstatic otrng_result otrng_close_v4(string_p *to_send, otrng_s *otr) {
     return OTRNG_SUCCESS;
   }
 
-  ser_len = otrng_list_len(otr->keys->skipped_keys) * MAC_KEY_BYTES;
+  ser_len = otrng_skipped_keys_store_len(otr->keys->skipped_keys) *
+            MAC_KEY_BYTES;
   ser_mac_keys = otrng_reveal_mac_keys_on_tlv(otr->keys);
-  otr->keys->skipped_keys = NULL;
 
   disconnected = otrng_tlv_list_one(
       otrng_tlv_new(OTRNG_TLV_DISCONNECTED, ser_len, ser_mac_keys));
@@ -2436,6 +2519,8 @@ API otrng_result otrng_send_symkey_message(string_p *to_send, unsigned int use,
                                            const unsigned char *use_data,
                                            size_t use_data_len,
                                            uint8_t *extra_key, otrng_s *otr) {
+  otrng_result result;
+
   if (!otr) {
     return OTRNG_ERROR;
   }
@@ -2445,8 +2530,10 @@ API otrng_result otrng_send_symkey_message(string_p *to_send, unsigned int use,
     return otrng_v3_send_symkey_message(to_send, otr->v3_conn, use, use_data,
                                         use_data_len, extra_key);
   case OTRNG_PROTOCOL_VERSION_4:
-    return otrng_send_symkey_message_v4(to_send, use, use_data, use_data_len,
-                                        otr, extra_key);
+    result = otrng_send_symkey_message_v4(to_send, use, use_data, use_data_len,
+                                          otr, extra_key);
+    otrng_schedule_session_expiry(otr);
+    return result;
   default:
     return OTRNG_ERROR;
   }
@@ -2456,6 +2543,8 @@ API otrng_result otrng_send_symkey_message(string_p *to_send, unsigned int use,
 #define GCRYPT_WANTED_VERSION_17 "1.7.6"
 #define GCRYPT_WANTED_VERSION_18 "1.8.0"
 
+/* Serializes otrng_init, so it can be called from several threads */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 static int otrl_initialized = 0;
 
 static otrng_result otrng_v3_init(otrng_bool die) {
@@ -2476,7 +2565,7 @@ static otrng_result otrng_v3_init(otrng_bool die) {
   return OTRNG_SUCCESS;
 }
 
-API otrng_result otrng_init(otrng_bool die) {
+static otrng_result library_init(otrng_bool die) {
   const char *real;
   otrng_result r;
 
@@ -2522,3 +2611,13 @@ API otrng_result otrng_init(otrng_bool die) {
 
   return otrng_dh_init(die);
 }
+
+API otrng_result otrng_init(otrng_bool die) {
+  otrng_result result;
+
+  pthread_mutex_lock(&init_lock);
+  result = library_init(die);
+  pthread_mutex_unlock(&init_lock);
+
+  return result;
+}
@@ -55,10 +55,33 @@
 #define OTRNG_INIT otrng_init(otrng_true)
 #define OTRNG_FREE otrng_dh_free()
 
+/**
+ * @brief A received data message, decrypted in place.
+ *
+ *  [buffer] the decrypted message. It is owned by this structure and wiped
+ *           by otrng_plaintext_release.
+ *  [text]   the displayable text, pointing into [buffer]. It is not NUL
+ *           terminated if the message has no TLVs.
+ *  [tlvs]   the serialized TLVs after the text, pointing into [buffer].
+ **/
+typedef struct otrng_plaintext_s {
+  /*@null@*/ uint8_t *buffer;
+  size_t buffer_len;
+  /*@null@*/ const char *text;
+  size_t text_len;
+  /*@null@*/ const uint8_t *tlvs;
+  size_t tlvs_len;
+} otrng_plaintext_s;
+
 typedef struct otrng_response_s {
   string_p to_display;
   string_p to_send;
   tlv_list_s *tlvs;
+
+  /* If set before receiving, a data message is only exposed through
+     [plaintext]: [to_display] and [tlvs] are not built. */
+  otrng_bool borrow_plaintext;
+  otrng_plaintext_s plaintext;
 } otrng_response_s;
 
 typedef struct otrng_header_s {
@@ -80,13 +103,30 @@ API otrng_result otrng_build_whitespace_tag(string_p *whitespace_tag,
 
 API otrng_result otrng_build_identity_message(string_p *dst, otrng_s *otr);
 
+API void otrng_plaintext_tlvs(tlv_iterator_s *it,
+                              const otrng_plaintext_s *plaintext);
+
+API void otrng_plaintext_release(otrng_plaintext_s *plaintext);
+
 INTERNAL otrng_response_s *otrng_response_new(void);
 
+/* Moves the received message out of [response], whatever its kind */
+INTERNAL void otrng_response_take_plaintext(otrng_plaintext_s *dst,
+                                           otrng_response_s *response);
+
 INTERNAL void otrng_response_free(otrng_response_s *response);
 
 INTERNAL otrng_result otrng_receive_message(otrng_response_s *response,
                                             const string_p msg, otrng_s *otr);
 
+/**
+ * @brief Schedules the session to expire, counting from its last generated
+ * ephemeral keys. Call it after sending anything that can ratchet them.
+ *
+ * @param [otr]   The session.
+ */
+INTERNAL void otrng_schedule_session_expiry(otrng_s *otr);
+
 INTERNAL otrng_result otrng_send_message(string_p *to_send, const string_p msg,
                                          /*@null@*/ const tlv_list_s *tlvs,
                                          uint8_t flags, otrng_s *otr);
@@ -286,6 +286,19 @@ static const unsigned int hextable_ok[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
+static const char hexdigits[] = "0123456789abcdef";
+
+/* Writes 2 * len lowercase hex digits and a terminating zero into dst */
+static void bytes_to_hex(char *dst, const uint8_t *src, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    dst[2 * i] = hexdigits[src[i] >> 4];
+    dst[2 * i + 1] = hexdigits[src[i] & 0x0F];
+  }
+  dst[2 * len] = '\0';
+}
+
 tstatic void fingerprint_hex_to_bytes(otrng_known_fingerprint_s *fp,
                                       const char *hex) {
   size_t count;
@@ -342,7 +355,7 @@ INTERNAL otrng_result otrng_client_fingerprint_v4_read_from(
   client = get_client(gs, client_id);
 
   if (client->fingerprints == NULL) {
-    client->fingerprints = otrng_xmalloc_z(sizeof(otrng_known_fingerprints_s));
+    client->fingerprints = otrng_known_fingerprints_new();
   }
 
   fpr = otrng_xmalloc_z(sizeof(otrng_known_fingerprint_s));
@@ -353,7 +366,7 @@ INTERNAL otrng_result otrng_client_fingerprint_v4_read_from(
   free(line);
   free(items);
 
-  client->fingerprints->fps = otrng_list_add(fpr, client->fingerprints->fps);
+  otrng_known_fingerprints_add(client->fingerprints, fpr);
 
   return OTRNG_SUCCESS;
 }
@@ -400,40 +413,48 @@ otrng_client_private_key_v4_read_from(otrng_client_s *client, FILE *privf) {
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result otrng_client_forging_key_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen) {
+  otrng_public_key key;
+
+  if (otrng_failed(otrng_deserialize_forging_key(key, buf, buflen, NULL))) {
+    return OTRNG_ERROR;
+  }
+
+  if (client->forging_key) {
+    otrng_ec_point_destroy(*client->forging_key);
+    otrng_free(client->forging_key);
+    client->forging_key = NULL;
+  }
+
+  return otrng_client_add_forging_key(client, key);
+}
+
 INTERNAL otrng_result otrng_client_forging_key_read_from(otrng_client_s *client,
                                                          FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_public_key key;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
-  result = otrng_deserialize_forging_key(key, dec, dec_len, NULL);
+  result = otrng_client_forging_key_deserialize_into(client, dec, dec_len);
   otrng_free(dec);
 
-  if (otrng_failed(result)) {
-    return result;
-  }
-
-  if (client->forging_key) {
-    otrng_ec_point_destroy(*client->forging_key);
-    otrng_free(client->forging_key);
-    client->forging_key = NULL;
-  }
-
-  return otrng_client_add_forging_key(client, key);
+  return result;
 }
 
 INTERNAL otrng_result otrng_client_instance_tag_write_to(otrng_client_s *client,
                                                          FILE *instagf) {
   gcry_error_t ret;
 
+  otrng_global_state_lock(client->global_state);
   ret = otrl_instag_generate_FILEp(client->global_state->user_state_v3, instagf,
                                    client->client_id.account,
                                    client->client_id.protocol);
+  otrng_global_state_unlock(client->global_state);
 
   if (ret) {
     return OTRNG_ERROR;
@@ -449,7 +470,9 @@ otrng_client_instance_tag_read_from(otrng_client_s *client, FILE *instagf) {
     return OTRNG_ERROR;
   }
 
+  otrng_global_state_lock(client->global_state);
   ret = otrl_instag_read_FILEp(client->global_state->user_state_v3, instagf);
+  otrng_global_state_unlock(client->global_state);
 
   if (ret) {
     return OTRNG_ERROR;
@@ -468,22 +491,14 @@ otrng_client_private_key_v3_read_from(const otrng_client_s *client, FILE *fp) {
   return OTRNG_SUCCESS;
 }
 
-INTERNAL otrng_result
-otrng_client_client_profile_read_from(otrng_client_s *client, FILE *fp) {
-  uint8_t *dec = NULL;
-  size_t dec_len = 0;
+INTERNAL otrng_result otrng_client_client_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen) {
   otrng_client_profile_s profile;
-  otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
-
-  if (otrng_failed(result)) {
-    return result;
-  }
+  otrng_result result;
 
   memset(&profile, 0, sizeof(otrng_client_profile_s));
-  result = otrng_client_profile_deserialize_with_metadata(&profile, dec,
-                                                          dec_len, NULL);
-  otrng_free(dec);
-
+  result = otrng_client_profile_deserialize_with_metadata(&profile, buf,
+                                                          buflen, NULL);
   if (result == OTRNG_ERROR) {
     return result;
   }
@@ -497,21 +512,29 @@ otrng_client_client_profile_read_from(otrng_client_s *client, FILE *fp) {
   return result;
 }
 
-INTERNAL otrng_result otrng_client_expired_client_profile_read_from(
-    otrng_client_s *client, FILE *fp) {
+INTERNAL otrng_result
+otrng_client_client_profile_read_from(otrng_client_s *client, FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_client_profile_s exp_profile;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
-  memset(&exp_profile, 0, sizeof(otrng_client_profile_s));
-  result = otrng_client_profile_deserialize(&exp_profile, dec, dec_len, NULL);
+  result = otrng_client_client_profile_deserialize_into(client, dec, dec_len);
   otrng_free(dec);
 
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_expired_client_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen) {
+  otrng_client_profile_s exp_profile;
+  otrng_result result;
+
+  memset(&exp_profile, 0, sizeof(otrng_client_profile_s));
+  result = otrng_client_profile_deserialize(&exp_profile, buf, buflen, NULL);
   if (result == OTRNG_ERROR) {
     return result;
   }
@@ -526,6 +549,23 @@ INTERNAL otrng_result otrng_client_expired_client_profile_read_from(
   return result;
 }
 
+INTERNAL otrng_result otrng_client_expired_client_profile_read_from(
+    otrng_client_s *client, FILE *fp) {
+  uint8_t *dec = NULL;
+  size_t dec_len = 0;
+  otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
+
+  if (otrng_failed(result)) {
+    return result;
+  }
+
+  result = otrng_client_expired_client_profile_deserialize_into(client, dec,
+                                                                dec_len);
+  otrng_free(dec);
+
+  return result;
+}
+
 INTERNAL otrng_result otrng_client_client_profile_write_to(
     const otrng_client_s *client, FILE *profilef) {
   uint8_t *buffer = NULL;
@@ -683,31 +723,37 @@ otrng_client_prekeys_write_to(const otrng_client_s *client, FILE *prekeyf) {
   return OTRNG_SUCCESS;
 }
 
+INTERNAL otrng_result otrng_client_prekey_message_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen) {
+  prekey_message_s *prekey_msg = otrng_xmalloc_z(sizeof(prekey_message_s));
+  otrng_result result = otrng_prekey_message_deserialize_with_metadata(
+      prekey_msg, buf, buflen, NULL);
+
+  if (otrng_failed(result)) {
+    otrng_free(prekey_msg);
+    return result;
+  }
+
+  otrng_client_store_my_prekey_message(prekey_msg, client);
+
+  return OTRNG_SUCCESS;
+}
+
 static otrng_result read_and_deserialize_prekey(otrng_client_s *client,
                                                 FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  prekey_message_s *prekey_msg = NULL;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
-  prekey_msg = otrng_xmalloc_z(sizeof(prekey_message_s));
-
-  result = otrng_prekey_message_deserialize_with_metadata(prekey_msg, dec,
-                                                          dec_len, NULL);
+  result = otrng_client_prekey_message_deserialize_into(client, dec, dec_len);
   otrng_secure_wipe(dec, dec_len);
   otrng_free(dec);
-  if (otrng_failed(result)) {
-    otrng_free(prekey_msg);
-    return result;
-  }
-
-  client->our_prekeys = otrng_list_add(prekey_msg, client->our_prekeys);
 
-  return OTRNG_SUCCESS;
+  return result;
 }
 
 INTERNAL otrng_result
@@ -811,22 +857,14 @@ INTERNAL otrng_result otrng_client_expired_prekey_profile_write_to(
   return OTRNG_SUCCESS;
 }
 
-INTERNAL otrng_result
-otrng_client_prekey_profile_read_from(otrng_client_s *client, FILE *fp) {
-  uint8_t *dec = NULL;
-  size_t dec_len = 0;
+INTERNAL otrng_result otrng_client_prekey_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen) {
   otrng_prekey_profile_s profile;
-  otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
-
-  if (otrng_failed(result)) {
-    return result;
-  }
+  otrng_result result;
 
   memset(&profile, 0, sizeof(otrng_prekey_profile_s));
-  result = otrng_prekey_profile_deserialize_with_metadata(&profile, dec,
-                                                          dec_len, NULL);
-  otrng_free(dec);
-
+  result = otrng_prekey_profile_deserialize_with_metadata(&profile, buf,
+                                                          buflen, NULL);
   if (result == OTRNG_ERROR) {
     return result;
   }
@@ -840,21 +878,29 @@ otrng_client_prekey_profile_read_from(otrng_client_s *client, FILE *fp) {
   return result;
 }
 
-INTERNAL otrng_result otrng_client_expired_prekey_profile_read_from(
-    otrng_client_s *client, FILE *fp) {
+INTERNAL otrng_result
+otrng_client_prekey_profile_read_from(otrng_client_s *client, FILE *fp) {
   uint8_t *dec = NULL;
   size_t dec_len = 0;
-  otrng_prekey_profile_s exp_profile;
   otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
 
   if (otrng_failed(result)) {
     return result;
   }
 
-  memset(&exp_profile, 0, sizeof(otrng_prekey_profile_s));
-  result = otrng_prekey_profile_deserialize(&exp_profile, dec, dec_len, NULL);
+  result = otrng_client_prekey_profile_deserialize_into(client, dec, dec_len);
   otrng_free(dec);
 
+  return result;
+}
+
+INTERNAL otrng_result otrng_client_expired_prekey_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen) {
+  otrng_prekey_profile_s exp_profile;
+  otrng_result result;
+
+  memset(&exp_profile, 0, sizeof(otrng_prekey_profile_s));
+  result = otrng_prekey_profile_deserialize(&exp_profile, buf, buflen, NULL);
   if (otrng_failed(result)) {
     return result;
   }
@@ -869,6 +915,23 @@ INTERNAL otrng_result otrng_client_expired_prekey_profile_read_from(
   return result;
 }
 
+INTERNAL otrng_result otrng_client_expired_prekey_profile_read_from(
+    otrng_client_s *client, FILE *fp) {
+  uint8_t *dec = NULL;
+  size_t dec_len = 0;
+  otrng_result result = otrng_client_read_from_prefix(fp, &dec, &dec_len);
+
+  if (otrng_failed(result)) {
+    return result;
+  }
+
+  result = otrng_client_expired_prekey_profile_deserialize_into(client, dec,
+                                                                dec_len);
+  otrng_free(dec);
+
+  return result;
+}
+
 typedef struct fingerprint_writing_context_s {
   FILE *fp;
   otrng_client_id_s client_id;
@@ -877,14 +940,12 @@ typedef struct fingerprint_writing_context_s {
 tstatic void add_fingerprint_to_file(list_element_s *node, void *c) {
   fingerprint_writing_context_s *ctx = c;
   otrng_known_fingerprint_s *fp = node->data;
-  int i;
+  char fp_hex[FPRINT_LEN_BYTES * 2 + 1];
 
-  fprintf(ctx->fp, "%s\t%s\t%s\t", fp->username, ctx->client_id.account,
-          ctx->client_id.protocol);
-  for (i = 0; i < FPRINT_LEN_BYTES; i++) {
-    fprintf(ctx->fp, "%02x", fp->fp[i]);
-  }
-  fprintf(ctx->fp, "\t%s\n", fp->trusted ? "trusted" : "");
+  bytes_to_hex(fp_hex, fp->fp, FPRINT_LEN_BYTES);
+  fprintf(ctx->fp, "%s\t%s\t%s\t%s\t%s\n", fp->username,
+          ctx->client_id.account, ctx->client_id.protocol, fp_hex,
+          fp->trusted ? "trusted" : "");
 }
 
 INTERNAL otrng_result
@@ -909,9 +970,9 @@ otrng_client_fingerprints_v4_write_to(const otrng_client_s *client, FILE *fp) {
 
 API otrng_result otrng_client_export_v4_identity(otrng_client_s *client,
                                                  FILE *fp) {
-  int i;
   uint8_t forg_ser[ED448_POINT_BYTES];
   uint8_t hash_ser[32];
+  char hex[ED448_POINT_BYTES * 2 + 1];
   goldilocks_shake256_ctx_p hd;
   const char *domain = "v4";
 
@@ -925,16 +986,12 @@ API otrng_result otrng_client_export_v4_identity(otrng_client_s *client,
     return OTRNG_ERROR;
   }
 
-  fprintf(fp, "v4:");
-  for (i = 0; i < ED448_PRIVATE_BYTES; i++) {
-    fprintf(fp, "%02x", client->keypair->sym[i]);
-  }
-  fprintf(fp, ":");
+  bytes_to_hex(hex, client->keypair->sym, ED448_PRIVATE_BYTES);
+  fprintf(fp, "v4:%s:", hex);
+  otrng_secure_wipe(hex, sizeof(hex));
 
-  for (i = 0; i < ED448_POINT_BYTES; i++) {
-    fprintf(fp, "%02x", forg_ser[i]);
-  }
-  fprintf(fp, ":");
+  bytes_to_hex(hex, forg_ser, ED448_POINT_BYTES);
+  fprintf(fp, "%s:", hex);
 
   goldilocks_shake256_init(hd);
   if (goldilocks_shake256_update(hd, (const unsigned char *)domain,
@@ -956,9 +1013,8 @@ API otrng_result otrng_client_export_v4_identity(otrng_client_s *client,
   goldilocks_shake256_final(hd, hash_ser, 32);
   goldilocks_shake256_destroy(hd);
 
-  for (i = 0; i < 32; i++) {
-    fprintf(fp, "%02x", hash_ser[i]);
-  }
+  bytes_to_hex(hex, hash_ser, 32);
+  fprintf(fp, "%s", hex);
 
   return OTRNG_SUCCESS;
 }
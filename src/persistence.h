@@ -94,6 +94,27 @@ INTERNAL otrng_result otrng_client_fingerprint_v4_read_from(
 INTERNAL otrng_result
 otrng_client_fingerprints_v4_write_to(const otrng_client_s *client, FILE *fp);
 
+/* The following functions decode one record, already read out of a file, into
+   the client. They are shared by the text files above and the binary store. */
+
+INTERNAL otrng_result otrng_client_forging_key_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen);
+
+INTERNAL otrng_result otrng_client_client_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen);
+
+INTERNAL otrng_result otrng_client_expired_client_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen);
+
+INTERNAL otrng_result otrng_client_prekey_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen);
+
+INTERNAL otrng_result otrng_client_expired_prekey_profile_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen);
+
+INTERNAL otrng_result otrng_client_prekey_message_deserialize_into(
+    otrng_client_s *client, const uint8_t *buf, size_t buflen);
+
 /* This function will export the private identity necessary to reform it on
    another device in a standard format.
    It will export the private v4 long term key, and the public forging key. The
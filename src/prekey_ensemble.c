@@ -19,6 +19,10 @@
  */
 
 #include "prekey_ensemble.h"
+
+#include <pthread.h>
+#include <string.h>
+
 #include "alloc.h"
 
 INTERNAL prekey_ensemble_s *otrng_prekey_ensemble_new() {
@@ -31,57 +35,300 @@ INTERNAL prekey_ensemble_s *otrng_prekey_ensemble_new() {
   return ensemble;
 }
 
-INTERNAL otrng_result
-otrng_prekey_ensemble_validate(const prekey_ensemble_s *dst) {
-  /* Check that all the instance tags on the Prekey Ensemble's values are the
-   * same. */
-  char *versions;
-  otrng_bool found;
+/* Check that all the instance tags on the Prekey Ensemble's values are the
+ * same, and that the OTR version of the prekey message matches one of the
+ * versions signed in the Client Profile. */
+static otrng_bool
+ensemble_tags_and_version_valid(const prekey_ensemble_s *dst) {
+  const char *versions;
   uint32_t instance = dst->client_profile->sender_instance_tag;
+
   if (instance != dst->prekey_profile->instance_tag) {
-    return OTRNG_ERROR;
+    return otrng_false;
   }
 
   if (instance != dst->message->sender_instance_tag) {
-    return OTRNG_ERROR;
+    return otrng_false;
   }
 
-  if (!otrng_client_profile_valid(dst->client_profile,
-                                  dst->message->sender_instance_tag)) {
-    return OTRNG_ERROR;
+  for (versions = dst->client_profile->versions; *versions != '\0';
+       versions++) {
+    if (*versions == '4') {
+      return otrng_true;
+    }
   }
 
-  if (!otrng_prekey_profile_valid(dst->prekey_profile,
-                                  dst->message->sender_instance_tag,
-                                  dst->client_profile->long_term_pub_key)) {
-    return OTRNG_ERROR;
-  }
+  return otrng_false;
+}
 
-  /* Verify the prekey message values */
+static otrng_bool client_profile_valid(const prekey_ensemble_s *dst) {
+  return otrng_client_profile_valid(dst->client_profile,
+                                    dst->message->sender_instance_tag);
+}
+
+static otrng_bool prekey_profile_valid(const prekey_ensemble_s *dst) {
+  return otrng_prekey_profile_valid(dst->prekey_profile,
+                                    dst->message->sender_instance_tag,
+                                    dst->client_profile->long_term_pub_key);
+}
+
+/* Verify the prekey message values */
+static otrng_bool prekey_message_valid(const prekey_ensemble_s *dst) {
   /* Verify that the point their_ecdh received is on curve 448. */
   if (!otrng_ec_point_valid(dst->message->Y)) {
-    return OTRNG_ERROR;
+    return otrng_false;
   }
 
   /* Verify that the DH public key their_dh is from the correct group. */
-  if (!otrng_dh_mpi_valid(dst->message->B)) {
+  return otrng_dh_mpi_valid(dst->message->B);
+}
+
+INTERNAL otrng_result
+otrng_prekey_ensemble_validate(const prekey_ensemble_s *dst) {
+  if (!ensemble_tags_and_version_valid(dst) || !client_profile_valid(dst) ||
+      !prekey_profile_valid(dst) || !prekey_message_valid(dst)) {
     return OTRNG_ERROR;
   }
 
-  /* Check that the OTR version of the prekey message matches one of the
-  versions signed in the Client Profile contained in the Prekey Ensemble. */
-  versions = dst->client_profile->versions;
-  found = otrng_false;
-  while ((*versions != '\0') && !found) {
-    found = (*versions == '4');
-    versions++;
+  return OTRNG_SUCCESS;
+}
+
+typedef enum {
+  ENSEMBLE_CHECK_CLIENT_PROFILE,
+  ENSEMBLE_CHECK_PREKEY_PROFILE,
+  ENSEMBLE_CHECK_MESSAGE,
+} ensemble_check;
+
+typedef struct {
+  ensemble_check check;
+  size_t ensemble;
+} ensemble_job_s;
+
+/*
+ * Every ensemble points at the first ensemble carrying the same client
+ * profile and the same prekey profile, whose profiles are the ones verified.
+ * Each job writes its own slot of the result arrays, so the lock only guards
+ * handing out the jobs.
+ */
+typedef struct {
+  prekey_ensemble_s *const *ensembles;
+  size_t *client_profile_of;
+  size_t *prekey_profile_of;
+  otrng_bool *client_profile_valid;
+  otrng_bool *prekey_profile_valid;
+  otrng_bool *message_valid;
+  otrng_bool *well_formed;
+
+  ensemble_job_s *jobs;
+  size_t num_jobs;
+  size_t next_job;
+  pthread_mutex_t lock;
+} ensembles_validation_s;
+
+static void *ensembles_validation_worker(void *data) {
+  ensembles_validation_s *validation = data;
+  const prekey_ensemble_s *ensemble;
+  ensemble_job_s *job;
+
+  for (;;) {
+    pthread_mutex_lock(&validation->lock);
+    if (validation->next_job == validation->num_jobs) {
+      pthread_mutex_unlock(&validation->lock);
+      return NULL;
+    }
+    job = &validation->jobs[validation->next_job++];
+    pthread_mutex_unlock(&validation->lock);
+
+    ensemble = validation->ensembles[job->ensemble];
+    switch (job->check) {
+    case ENSEMBLE_CHECK_CLIENT_PROFILE:
+      validation->client_profile_valid[job->ensemble] =
+          client_profile_valid(ensemble);
+      break;
+    case ENSEMBLE_CHECK_PREKEY_PROFILE:
+      validation->prekey_profile_valid[job->ensemble] =
+          prekey_profile_valid(ensemble);
+      break;
+    case ENSEMBLE_CHECK_MESSAGE:
+      validation->message_valid[job->ensemble] = prekey_message_valid(ensemble);
+      break;
+    }
   }
+}
 
-  if (!found) {
-    return OTRNG_ERROR;
+static otrng_bool same_bytes(const uint8_t *a, size_t a_len, const uint8_t *b,
+                             size_t b_len) {
+  return a && b && a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+/* Points every well formed ensemble at the first well formed one with
+ * identical profiles */
+static void find_duplicate_profiles(ensembles_validation_s *validation,
+                                    size_t len) {
+  uint8_t **client_profiles = otrng_xmalloc_z(len * sizeof(uint8_t *));
+  size_t *client_profile_lens = otrng_xmalloc_z(len * sizeof(size_t));
+  uint8_t **prekey_profiles = otrng_xmalloc_z(len * sizeof(uint8_t *));
+  size_t *prekey_profile_lens = otrng_xmalloc_z(len * sizeof(size_t));
+  size_t i, j;
+
+  for (i = 0; i < len; i++) {
+    prekey_ensemble_s *ensemble = validation->ensembles[i];
+
+    validation->client_profile_of[i] = i;
+    validation->prekey_profile_of[i] = i;
+
+    if (!validation->well_formed[i]) {
+      continue;
+    }
+
+    if (!otrng_client_profile_serialize(&client_profiles[i],
+                                        &client_profile_lens[i],
+                                        ensemble->client_profile)) {
+      otrng_free(client_profiles[i]);
+      client_profiles[i] = NULL;
+    }
+    if (!otrng_prekey_profile_serialize(&prekey_profiles[i],
+                                        &prekey_profile_lens[i],
+                                        ensemble->prekey_profile)) {
+      otrng_free(prekey_profiles[i]);
+      prekey_profiles[i] = NULL;
+    }
+
+    for (j = 0; j < i; j++) {
+      if (validation->well_formed[j] && validation->client_profile_of[j] == j &&
+          same_bytes(client_profiles[i], client_profile_lens[i],
+                     client_profiles[j], client_profile_lens[j])) {
+        validation->client_profile_of[i] = j;
+        break;
+      }
+    }
+
+    /* The prekey profile is verified with the long-term key of the client
+     * profile, so it only is a duplicate under the same client profile */
+    for (j = 0; j < i; j++) {
+      if (validation->well_formed[j] && validation->prekey_profile_of[j] == j &&
+          validation->client_profile_of[j] ==
+              validation->client_profile_of[i] &&
+          same_bytes(prekey_profiles[i], prekey_profile_lens[i],
+                     prekey_profiles[j], prekey_profile_lens[j])) {
+        validation->prekey_profile_of[i] = j;
+        break;
+      }
+    }
   }
 
-  return OTRNG_SUCCESS;
+  for (i = 0; i < len; i++) {
+    otrng_free(client_profiles[i]);
+    otrng_free(prekey_profiles[i]);
+  }
+  otrng_free(client_profiles);
+  otrng_free(client_profile_lens);
+  otrng_free(prekey_profiles);
+  otrng_free(prekey_profile_lens);
+}
+
+static void add_job(ensembles_validation_s *validation, ensemble_check check,
+                    size_t ensemble) {
+  validation->jobs[validation->num_jobs].check = check;
+  validation->jobs[validation->num_jobs].ensemble = ensemble;
+  validation->num_jobs++;
+}
+
+static void run_jobs(ensembles_validation_s *validation) {
+  pthread_t workers[OTRNG_PREKEY_ENSEMBLE_MAX_WORKERS - 1];
+  size_t num_workers = 0, i;
+
+  pthread_mutex_init(&validation->lock, NULL);
+
+  /* The calling thread works too, and does everything if no thread can be
+   * started */
+  while (num_workers < OTRNG_PREKEY_ENSEMBLE_MAX_WORKERS - 1 &&
+         num_workers + 1 < validation->num_jobs) {
+    if (pthread_create(&workers[num_workers], NULL,
+                       ensembles_validation_worker, validation) != 0) {
+      break;
+    }
+    num_workers++;
+  }
+
+  (void)ensembles_validation_worker(validation);
+
+  for (i = 0; i < num_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  pthread_mutex_destroy(&validation->lock);
+}
+
+INTERNAL size_t
+otrng_prekey_ensembles_validate_many(otrng_result *results,
+                                     prekey_ensemble_s *const *ensembles,
+                                     size_t len) {
+  ensembles_validation_s validation;
+  size_t i, num_valid = 0;
+
+  if (len == 0) {
+    return 0;
+  }
+
+  memset(&validation, 0, sizeof(validation));
+  validation.ensembles = ensembles;
+  validation.client_profile_of = otrng_xmalloc_z(len * sizeof(size_t));
+  validation.prekey_profile_of = otrng_xmalloc_z(len * sizeof(size_t));
+  validation.client_profile_valid = otrng_xmalloc_z(len * sizeof(otrng_bool));
+  validation.prekey_profile_valid = otrng_xmalloc_z(len * sizeof(otrng_bool));
+  validation.message_valid = otrng_xmalloc_z(len * sizeof(otrng_bool));
+  validation.well_formed = otrng_xmalloc_z(len * sizeof(otrng_bool));
+  validation.jobs = otrng_xmalloc_z(3 * len * sizeof(ensemble_job_s));
+
+  /* The cheap checks run first, so nothing is verified for an ensemble that
+   * is rejected anyway */
+  for (i = 0; i < len; i++) {
+    validation.well_formed[i] = ensemble_tags_and_version_valid(ensembles[i]);
+  }
+
+  find_duplicate_profiles(&validation, len);
+
+  for (i = 0; i < len; i++) {
+    if (!validation.well_formed[i]) {
+      continue;
+    }
+
+    if (validation.client_profile_of[i] == i) {
+      add_job(&validation, ENSEMBLE_CHECK_CLIENT_PROFILE, i);
+    }
+    if (validation.prekey_profile_of[i] == i) {
+      add_job(&validation, ENSEMBLE_CHECK_PREKEY_PROFILE, i);
+    }
+    add_job(&validation, ENSEMBLE_CHECK_MESSAGE, i);
+  }
+
+  run_jobs(&validation);
+
+  for (i = 0; i < len; i++) {
+    size_t client_profile_of = validation.client_profile_of[i];
+    size_t prekey_profile_of = validation.prekey_profile_of[i];
+
+    if (validation.well_formed[i] &&
+        validation.client_profile_valid[client_profile_of] &&
+        validation.prekey_profile_valid[prekey_profile_of] &&
+        validation.message_valid[i]) {
+      results[i] = OTRNG_SUCCESS;
+      num_valid++;
+    } else {
+      results[i] = OTRNG_ERROR;
+    }
+  }
+
+  otrng_free(validation.client_profile_of);
+  otrng_free(validation.prekey_profile_of);
+  otrng_free(validation.client_profile_valid);
+  otrng_free(validation.prekey_profile_valid);
+  otrng_free(validation.message_valid);
+  otrng_free(validation.well_formed);
+  otrng_free(validation.jobs);
+
+  return num_valid;
 }
 
 INTERNAL otrng_result otrng_prekey_ensemble_deserialize(prekey_ensemble_s *dst,
@@ -46,6 +46,29 @@ INTERNAL prekey_ensemble_s *otrng_prekey_ensemble_new(void);
 INTERNAL otrng_result
 otrng_prekey_ensemble_validate(const prekey_ensemble_s *dst);
 
+/* The most threads, the calling one included, validating ensembles at once */
+#define OTRNG_PREKEY_ENSEMBLE_MAX_WORKERS 4
+
+/**
+ * @brief Validates several ensembles, as otrng_prekey_ensemble_validate would
+ * each one of them.
+ *
+ * Profiles shared by several ensembles (the same client sends the same
+ * profiles along every prekey message) are only verified once, and the
+ * verifications are spread over up to OTRNG_PREKEY_ENSEMBLE_MAX_WORKERS
+ * threads.
+ *
+ * @param [results]   Set to the result for each ensemble.
+ * @param [ensembles] The ensembles. They must not be changed while this runs.
+ * @param [len]       The number of ensembles.
+ *
+ * @return The number of valid ensembles.
+ */
+INTERNAL size_t
+otrng_prekey_ensembles_validate_many(otrng_result *results,
+                                     prekey_ensemble_s *const *ensembles,
+                                     size_t len);
+
 INTERNAL otrng_result otrng_prekey_ensemble_deserialize(prekey_ensemble_s *dst,
                                                         const uint8_t *src,
                                                         size_t src_len,
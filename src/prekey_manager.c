@@ -24,6 +24,7 @@
 
 #include "base64.h"
 #include "client.h"
+#include "client_orchestration.h"
 #include "deserialize.h"
 #include "prekey_client_dake.h"
 #include "prekey_client_shared.h"
@@ -275,6 +276,10 @@ static otrng_result start_dake1(
   assert(client->prekey_manager);
   assert(new_msg);
 
+  /* The DAKE and whatever follows it use our keys, profiles and prekey
+   * messages */
+  (void)otrng_client_materialize(client, OTRNG_CLIENT_STATE_ALL);
+
   domain = get_domain_for_account(client, ctx);
   server = get_prekey_server_for(client->prekey_manager, domain);
   if (!server) {
@@ -819,7 +824,8 @@ void otrng_prekey_check_account_request(otrng_client_s *client) {
 
 static otrng_result process_received_prekey_ensemble_retrieval(
     otrng_client_s *client, otrng_prekey_ensemble_retrieval_message_s *msg) {
-  int i;
+  otrng_result *results;
+  int i, num_valid = 0;
 
   assert(client->prekey_manager != NULL);
 
@@ -827,13 +833,25 @@ static otrng_result process_received_prekey_ensemble_retrieval(
     return OTRNG_ERROR;
   }
 
+  if (msg->num_ensembles == 0) {
+    return OTRNG_ERROR;
+  }
+
+  results = otrng_xmalloc_z(msg->num_ensembles * sizeof(otrng_result));
+  (void)otrng_prekey_ensembles_validate_many(results, msg->ensembles,
+                                             msg->num_ensembles);
+
+  /* Keep the valid ensembles at the front, so the message still frees all of
+   * them */
   for (i = 0; i < msg->num_ensembles; i++) {
-    if (!otrng_prekey_ensemble_validate(msg->ensembles[i])) {
-      otrng_prekey_ensemble_destroy(msg->ensembles[i]);
-      msg->ensembles[i] = NULL;
-      msg->num_ensembles = msg->num_ensembles - 1;
+    if (otrng_failed(results[i])) {
+      otrng_prekey_ensemble_free(msg->ensembles[i]);
+      continue;
     }
+    msg->ensembles[num_valid++] = msg->ensembles[i];
   }
+  msg->num_ensembles = num_valid;
+  otrng_free(results);
 
   if (msg->num_ensembles == 0) {
     return OTRNG_ERROR;
@@ -991,6 +1009,9 @@ API otrng_bool otrng_prekey_receive(/*@notnull@*/ char **to_send,
     return otrng_false;
   }
 
+  otrng_fragment_contexts_set_expiry(
+      &client->prekey_manager->pending_fragments,
+      otrng_client_expiry_scheduler(client), client->fragments_exp_time);
   if (otrng_failed(otrng_fragment_message_receive(
           &defrag, &client->prekey_manager->pending_fragments, msg,
           otrng_client_get_instance_tag(client)))) {
@@ -1423,7 +1444,6 @@ static void otrng_prekey_server_free(otrng_prekey_server_s *server) {
   otrng_free(server);
 }
 
-static void free_fragment_context(void *p) { otrng_fragment_context_free(p); }
 static void free_server_identity(void *p) { otrng_prekey_server_free(p); }
 
 INTERNAL void otrng_prekey_manager_free(otrng_prekey_manager_s *manager) {
@@ -1435,7 +1455,7 @@ INTERNAL void otrng_prekey_manager_free(otrng_prekey_manager_s *manager) {
   otrng_free(manager->publication_policy);
   otrng_free(manager->callbacks);
 
-  otrng_list_free(manager->pending_fragments, free_fragment_context);
+  otrng_fragment_contexts_free(manager->pending_fragments);
   otrng_list_free(manager->server_identities, free_server_identity);
   if (manager->request_for_account != NULL) {
     prekey_request_free(manager->request_for_account);
@@ -33,6 +33,7 @@
 #define OTRNG_PREKEY_MANAGER_H
 
 #include "error.h"
+#include "fragment.h"
 #include "keys.h"
 #include "list.h"
 #include "prekey_client_dake.h"
@@ -168,7 +169,7 @@ typedef struct {
    */
   time_t request_for_account_at;
 
-  /*@null@*/ list_element_s *pending_fragments;
+  /*@null@*/ fragment_contexts_s *pending_fragments;
 
   /*@notnull@*/ otrng_prekey_publication_policy_s *publication_policy;
 
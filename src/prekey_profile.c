@@ -27,6 +27,7 @@
 #include "debug.h"
 #include "deserialize.h"
 #include "instance_tag.h"
+#include "profile_cache.h"
 #include "serialize.h"
 #include "util.h"
 
@@ -377,14 +378,55 @@ static otrng_bool prekey_profile_invalid(time_t expires,
   return difftime(expires + extra_valid_time, time(NULL)) <= 0;
 }
 
-tstatic otrng_bool otrng_prekey_profile_valid_without_expiry(
-    const otrng_prekey_profile_s *profile, const uint32_t sender_instance_tag,
-    const otrng_public_key pub) {
+static otrng_bool
+prekey_profile_checks_pass(const otrng_prekey_profile_s *profile,
+                           const otrng_public_key pub) {
   /* 1. Verify that the Prekey Profile signature is valid. */
   if (!otrng_prekey_profile_verify_signature(profile, pub)) {
     return otrng_false;
   }
 
+  /* 3. Validate that the Public Shared Prekey is on the curve Ed448-Goldilocks.
+   */
+  if (!otrng_ec_point_valid(profile->shared_prekey)) {
+    return otrng_false;
+  }
+
+  return otrng_true;
+}
+
+/* The signature is checked against [pub], so it is part of the key too */
+static otrng_result prekey_profile_cache_digest(
+    uint8_t *dst, const otrng_prekey_profile_s *profile,
+    const otrng_public_key pub) {
+  uint8_t serialized[PREKEY_PROFILE_BODY_BYTES + ED448_SIGNATURE_BYTES];
+  uint8_t pubkey[ED448_POINT_BYTES];
+  size_t written;
+
+  written = prekey_profile_body_serialize(serialized, PREKEY_PROFILE_BODY_BYTES,
+                                          profile);
+  if (written == 0) {
+    return OTRNG_ERROR;
+  }
+
+  written += otrng_serialize_bytes_array(
+      serialized + written, profile->signature, ED448_SIGNATURE_BYTES);
+
+  if (otrng_serialize_ec_point(pubkey, pub) != ED448_POINT_BYTES) {
+    return OTRNG_ERROR;
+  }
+
+  return otrng_profile_cache_digest(dst, OTRNG_PROFILE_CACHE_PREKEY_PROFILE,
+                                    serialized, written, pubkey,
+                                    ED448_POINT_BYTES);
+}
+
+tstatic otrng_bool otrng_prekey_profile_valid_without_expiry(
+    const otrng_prekey_profile_s *profile, const uint32_t sender_instance_tag,
+    const otrng_public_key pub) {
+  uint8_t digest[OTRNG_PROFILE_CACHE_DIGEST_BYTES];
+  otrng_bool valid;
+
   /* 2. Verify that the Prekey Profile owner's instance tag is equal to the
    * Sender Instance tag of the person that sent the DAKE message in which the
    * Prekey Profile is received. */
@@ -392,13 +434,19 @@ tstatic otrng_bool otrng_prekey_profile_valid_without_expiry(
     return otrng_false;
   }
 
-  /* 3. Validate that the Public Shared Prekey is on the curve Ed448-Goldilocks.
-   */
-  if (!otrng_ec_point_valid(profile->shared_prekey)) {
-    return otrng_false;
+  /* Steps 1 and 3 only depend on the profile and the key, and are cached */
+  if (!prekey_profile_cache_digest(digest, profile, pub)) {
+    return prekey_profile_checks_pass(profile, pub);
   }
 
-  return otrng_true;
+  if (otrng_profile_cache_get(&valid, digest)) {
+    return valid;
+  }
+
+  valid = prekey_profile_checks_pass(profile, pub);
+  otrng_profile_cache_put(digest, valid, profile->expires);
+
+  return valid;
 }
 
 INTERNAL otrng_bool otrng_prekey_profile_valid(
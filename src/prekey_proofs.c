@@ -104,6 +104,21 @@ INTERNAL otrng_result otrng_ecdh_proof_generate(
   return OTRNG_SUCCESS;
 }
 
+static otrng_result hash_update_point(goldilocks_shake256_ctx_p hd,
+                                      const ec_point point) {
+  uint8_t enc[ED448_POINT_BYTES];
+
+  if (!otrng_ec_point_encode(enc, ED448_POINT_BYTES, point)) {
+    return OTRNG_ERROR;
+  }
+
+  if (hash_update(hd, enc, ED448_POINT_BYTES) == GOLDILOCKS_FAILURE) {
+    return OTRNG_ERROR;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
 INTERNAL otrng_bool otrng_ecdh_proof_verify(ecdh_proof_s *px,
                                             const ec_point *values_pub,
                                             const size_t values_len,
@@ -114,9 +129,7 @@ INTERNAL otrng_bool otrng_ecdh_proof_verify(ecdh_proof_s *px,
   goldilocks_448_point_p a;
   goldilocks_448_point_p curr;
   size_t p_len = PREKEY_PROOF_LAMBDA * values_len;
-  uint8_t *cbuf;
-  uint8_t *cbuf_curr;
-  size_t cbuf_len = ((values_len + 1) * ED448_POINT_BYTES) + HASH_BYTES;
+  goldilocks_shake256_ctx_p hd;
   uint8_t c2[PROOF_C_SIZE];
 
   p = otrng_xmalloc_z(p_len * sizeof(uint8_t));
@@ -130,72 +143,42 @@ INTERNAL otrng_bool otrng_ecdh_proof_verify(ecdh_proof_s *px,
   goldilocks_448_precomputed_scalarmul(a, goldilocks_448_precomputed_base,
                                        px->v);
 
-  goldilocks_448_point_copy(curr, goldilocks_448_point_identity);
-
-  for (i = 0; i + 1 < values_len; i += 2) {
-    goldilocks_448_scalar_p t1, t2;
-    goldilocks_448_point_p res;
-
-    goldilocks_448_scalar_decode_long(t1, p + i * PREKEY_PROOF_LAMBDA,
-                                      PREKEY_PROOF_LAMBDA);
-    goldilocks_448_scalar_decode_long(t2, p + (i + 1) * PREKEY_PROOF_LAMBDA,
-                                      PREKEY_PROOF_LAMBDA);
-
-    goldilocks_448_point_double_scalarmul(res, values_pub[i], t1,
-                                          values_pub[i + 1], t2);
-    goldilocks_448_point_add(curr, curr, res);
-
-    goldilocks_448_scalar_destroy(t1);
-    goldilocks_448_scalar_destroy(t2);
-    goldilocks_448_point_destroy(res);
-  }
-
-  if (i < values_len) {
-    goldilocks_448_scalar_p t;
-    goldilocks_448_point_p res;
-
-    goldilocks_448_scalar_decode_long(t, p + i * PREKEY_PROOF_LAMBDA,
-                                      PREKEY_PROOF_LAMBDA);
-    goldilocks_448_point_scalarmul(res, values_pub[i], t);
-    goldilocks_448_point_add(curr, curr, res);
-
-    goldilocks_448_scalar_destroy(t);
-    goldilocks_448_point_destroy(res);
-  }
+  /* The t_i are the PREKEY_PROOF_LAMBDA byte numbers in p */
+  otrng_ec_point_multi_scalarmul(curr, values_pub, p, PREKEY_PROOF_LAMBDA,
+                                 values_len);
 
   otrng_free(p);
 
   goldilocks_448_point_sub(a, a, curr);
   goldilocks_448_point_destroy(curr);
 
-  cbuf = otrng_xmalloc_z(cbuf_len * sizeof(uint8_t));
-  cbuf_curr = cbuf;
+  /* The points are encoded straight into the hash, one at a time */
+  if (!hash_init_with_usage_prekey_server(hd, usage)) {
+    goldilocks_448_point_destroy(a);
+    return otrng_false;
+  }
 
-  if (!otrng_ec_point_encode(cbuf_curr, ED448_POINT_BYTES, a)) {
-    otrng_free(cbuf);
+  if (!hash_update_point(hd, a)) {
+    hash_destroy(hd);
     goldilocks_448_point_destroy(a);
     return otrng_false;
   }
   goldilocks_448_point_destroy(a);
 
-  cbuf_curr += ED448_POINT_BYTES;
-
   for (i = 0; i < values_len; i++) {
-    if (!otrng_ec_point_encode(cbuf_curr, ED448_POINT_BYTES, values_pub[i])) {
-      otrng_free(cbuf);
+    if (!hash_update_point(hd, values_pub[i])) {
+      hash_destroy(hd);
       return otrng_false;
     }
-    cbuf_curr += ED448_POINT_BYTES;
   }
 
-  memcpy(cbuf_curr, m, HASH_BYTES);
-
-  if (!shake_256_prekey_server_kdf(c2, PROOF_C_SIZE, usage, cbuf, cbuf_len)) {
-    otrng_free(cbuf);
+  if (hash_update(hd, m, HASH_BYTES) == GOLDILOCKS_FAILURE) {
+    hash_destroy(hd);
     return otrng_false;
   }
 
-  otrng_free(cbuf);
+  hash_final(hd, c2, PROOF_C_SIZE);
+  hash_destroy(hd);
 
   if (sodium_memcmp(px->c, c2, PROOF_C_SIZE) == 0) {
     return otrng_true;
@@ -327,7 +310,6 @@ INTERNAL otrng_bool otrng_dh_proof_verify(dh_proof_s *px,
   size_t i;
   uint8_t *cbuf;
   uint8_t *cbuf_curr;
-  uint8_t *p_curr;
   size_t w = 0;
   size_t cbuf_len = ((values_len + 1) * DH_MPI_MAX_BYTES) + HASH_BYTES;
   size_t p_len = PREKEY_PROOF_LAMBDA * values_len;
@@ -345,24 +327,10 @@ INTERNAL otrng_bool otrng_dh_proof_verify(dh_proof_s *px,
 
   mod = otrng_dh_modulus_p();
 
+  /* The t_i are the PREKEY_PROOF_LAMBDA byte numbers in p, so all the
+   * values_pub[i]^t_i are computed together, sharing the squarings */
   curr = gcry_mpi_new(DH3072_MOD_LEN_BITS);
-  gcry_mpi_set_ui(curr, 1);
-
-  p_curr = p;
-  for (i = 0; i < values_len; i++) {
-    gcry_mpi_t t = NULL;
-    if (!otrng_dh_mpi_deserialize(&t, p_curr, PREKEY_PROOF_LAMBDA, &w)) {
-      otrng_free(p);
-      gcry_mpi_release(a);
-      otrng_dh_mpi_release(curr);
-      return otrng_false;
-    }
-    p_curr += w;
-
-    gcry_mpi_powm(t, values_pub[i], t, mod);
-    gcry_mpi_mulm(curr, curr, t, mod);
-    otrng_dh_mpi_release(t);
-  }
+  otrng_dh_multi_powm(curr, values_pub, p, PREKEY_PROOF_LAMBDA, values_len);
 
   otrng_free(p);
   gcry_mpi_invm(curr, curr, mod);
@@ -0,0 +1,258 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <sodium.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile_cache.h"
+#include "shake.h"
+
+#define PROFILE_CACHE_KEY_BYTES 32
+#define PROFILE_CACHE_BUCKETS (2 * OTRNG_PROFILE_CACHE_CAPACITY)
+
+typedef struct profile_cache_entry_s {
+  uint8_t digest[OTRNG_PROFILE_CACHE_DIGEST_BYTES];
+  otrng_bool valid;
+  uint64_t expires;
+
+  /* most recently used first */
+  struct profile_cache_entry_s *lru_prev;
+  struct profile_cache_entry_s *lru_next;
+  /* the next entry in the same bucket, or in the free list */
+  struct profile_cache_entry_s *bucket_next;
+} profile_cache_entry_s;
+
+/*
+ * The entries are statically allocated, and chained from a bucket picked by
+ * the first bytes of their digest. The digests are keyed with a per-process
+ * secret, so a peer can't choose profiles that pile up in one bucket.
+ */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static uint8_t cache_key[PROFILE_CACHE_KEY_BYTES];
+
+static profile_cache_entry_s entries[OTRNG_PROFILE_CACHE_CAPACITY];
+static profile_cache_entry_s *buckets[PROFILE_CACHE_BUCKETS];
+static profile_cache_entry_s *lru_head = NULL;
+static profile_cache_entry_s *lru_tail = NULL;
+static profile_cache_entry_s *free_entries = NULL;
+/* entries[used..] have never been handed out since the last clear */
+static size_t used = 0;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+
+static void generate_cache_key(void) {
+  randombytes_buf(cache_key, PROFILE_CACHE_KEY_BYTES);
+}
+
+INTERNAL otrng_result otrng_profile_cache_digest(
+    uint8_t *dst, uint8_t kind, const uint8_t *profile, size_t profile_len,
+    const uint8_t *signer, size_t signer_len) {
+  goldilocks_shake256_ctx_p hd;
+
+  (void)pthread_once(&cache_key_once, generate_cache_key);
+
+  hash_init(hd);
+  if (hash_update(hd, cache_key, PROFILE_CACHE_KEY_BYTES) ==
+          GOLDILOCKS_FAILURE ||
+      hash_update(hd, &kind, 1) == GOLDILOCKS_FAILURE ||
+      hash_update(hd, profile, profile_len) == GOLDILOCKS_FAILURE) {
+    hash_destroy(hd);
+    return OTRNG_ERROR;
+  }
+
+  if (signer && hash_update(hd, signer, signer_len) == GOLDILOCKS_FAILURE) {
+    hash_destroy(hd);
+    return OTRNG_ERROR;
+  }
+
+  hash_final(hd, dst, OTRNG_PROFILE_CACHE_DIGEST_BYTES);
+  hash_destroy(hd);
+
+  return OTRNG_SUCCESS;
+}
+
+static profile_cache_entry_s **bucket_of(const uint8_t *digest) {
+  size_t index = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    index = (index << 8) | digest[i];
+  }
+
+  return &buckets[index & (PROFILE_CACHE_BUCKETS - 1)];
+}
+
+static /*@null@*/ profile_cache_entry_s *find_entry(const uint8_t *digest) {
+  profile_cache_entry_s *entry;
+
+  for (entry = *bucket_of(digest); entry; entry = entry->bucket_next) {
+    if (memcmp(entry->digest, digest, OTRNG_PROFILE_CACHE_DIGEST_BYTES) == 0) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static void lru_unlink(profile_cache_entry_s *entry) {
+  if (entry->lru_prev) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    lru_head = entry->lru_next;
+  }
+
+  if (entry->lru_next) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    lru_tail = entry->lru_prev;
+  }
+
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void lru_push_front(profile_cache_entry_s *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = lru_head;
+  if (lru_head) {
+    lru_head->lru_prev = entry;
+  } else {
+    lru_tail = entry;
+  }
+  lru_head = entry;
+}
+
+static void remove_entry(profile_cache_entry_s *entry) {
+  profile_cache_entry_s **link = bucket_of(entry->digest);
+
+  while (*link != entry) {
+    link = &(*link)->bucket_next;
+  }
+  *link = entry->bucket_next;
+
+  lru_unlink(entry);
+
+  entry->bucket_next = free_entries;
+  free_entries = entry;
+}
+
+static profile_cache_entry_s *take_free_entry(void) {
+  profile_cache_entry_s *entry;
+
+  if (!free_entries) {
+    if (used < OTRNG_PROFILE_CACHE_CAPACITY) {
+      return &entries[used++];
+    }
+    remove_entry(lru_tail);
+  }
+
+  entry = free_entries;
+  free_entries = entry->bucket_next;
+
+  return entry;
+}
+
+static otrng_bool has_expired(uint64_t expires) {
+  return difftime((time_t)expires, time(NULL)) <= 0;
+}
+
+INTERNAL otrng_bool otrng_profile_cache_get(otrng_bool *valid,
+                                            const uint8_t *digest) {
+  profile_cache_entry_s *entry;
+  otrng_bool hit = otrng_false;
+
+  pthread_mutex_lock(&cache_lock);
+
+  entry = find_entry(digest);
+  if (entry && has_expired(entry->expires)) {
+    remove_entry(entry);
+    entry = NULL;
+  }
+
+  if (entry) {
+    lru_unlink(entry);
+    lru_push_front(entry);
+    *valid = entry->valid;
+    hit = otrng_true;
+    hits++;
+  } else {
+    misses++;
+  }
+
+  pthread_mutex_unlock(&cache_lock);
+
+  return hit;
+}
+
+INTERNAL void otrng_profile_cache_put(const uint8_t *digest, otrng_bool valid,
+                                      uint64_t expires) {
+  profile_cache_entry_s *entry, **bucket;
+
+  if (has_expired(expires)) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+
+  entry = find_entry(digest);
+  if (entry) {
+    lru_unlink(entry);
+  } else {
+    entry = take_free_entry();
+    memcpy(entry->digest, digest, OTRNG_PROFILE_CACHE_DIGEST_BYTES);
+    bucket = bucket_of(digest);
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+  }
+
+  entry->valid = valid;
+  entry->expires = expires;
+  lru_push_front(entry);
+
+  pthread_mutex_unlock(&cache_lock);
+}
+
+API void otrng_profile_cache_counters(uint64_t *hits_dst,
+                                      uint64_t *misses_dst) {
+  pthread_mutex_lock(&cache_lock);
+  if (hits_dst) {
+    *hits_dst = hits;
+  }
+  if (misses_dst) {
+    *misses_dst = misses;
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+API void otrng_profile_cache_clear(void) {
+  pthread_mutex_lock(&cache_lock);
+  memset(entries, 0, sizeof(entries));
+  memset(buckets, 0, sizeof(buckets));
+  lru_head = NULL;
+  lru_tail = NULL;
+  free_entries = NULL;
+  used = 0;
+  hits = 0;
+  misses = 0;
+  pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,102 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A bounded, least recently used cache of profile validation results. Peers
+ * send the same Client and Prekey Profiles on every DAKE, each time in a fresh
+ * deserialized copy: the cache lets those copies skip the signature checks.
+ *
+ * Entries are keyed by a SHAKE-256 digest of the serialized profile (and of
+ * the key it is signed with), so any change to a profile is a different entry.
+ * A result is only kept until the profile expires. The cache is shared by the
+ * whole process, and all the functions in this file can be called concurrently
+ * from different threads.
+ */
+
+#ifndef OTRNG_PROFILE_CACHE_H
+#define OTRNG_PROFILE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+#include "shared.h"
+
+#define OTRNG_PROFILE_CACHE_DIGEST_BYTES 64
+#define OTRNG_PROFILE_CACHE_CAPACITY 256
+
+#define OTRNG_PROFILE_CACHE_CLIENT_PROFILE 0x01
+#define OTRNG_PROFILE_CACHE_PREKEY_PROFILE 0x02
+
+/**
+ * @brief Computes the key a profile is cached under.
+ *
+ * @param [dst]         The destination, of OTRNG_PROFILE_CACHE_DIGEST_BYTES.
+ * @param [kind]        OTRNG_PROFILE_CACHE_CLIENT_PROFILE or
+ *                      OTRNG_PROFILE_CACHE_PREKEY_PROFILE.
+ * @param [profile]     The serialized profile, with its signatures.
+ * @param [profile_len] The length of the serialized profile.
+ * @param [signer]      The serialized key the profile is verified with, if it
+ *                      is not part of the profile. It can be NULL.
+ * @param [signer_len]  The length of the serialized key.
+ */
+INTERNAL otrng_result otrng_profile_cache_digest(
+    uint8_t *dst, uint8_t kind, const uint8_t *profile, size_t profile_len,
+    /*@null@*/ const uint8_t *signer, size_t signer_len);
+
+/**
+ * @brief Looks up the validation result of a profile.
+ *
+ * @param [valid]   Set to the cached result on a hit.
+ * @param [digest]  The key from otrng_profile_cache_digest.
+ *
+ * @return otrng_true on a hit.
+ */
+INTERNAL otrng_bool otrng_profile_cache_get(otrng_bool *valid,
+                                            const uint8_t *digest);
+
+/**
+ * @brief Records the validation result of a profile, evicting the least
+ * recently used entry if the cache is full. Nothing is recorded for a profile
+ * that already expired.
+ *
+ * @param [digest]  The key from otrng_profile_cache_digest.
+ * @param [valid]   The result of the checks that don't depend on the time.
+ * @param [expires] When the profile expires.
+ */
+INTERNAL void otrng_profile_cache_put(const uint8_t *digest, otrng_bool valid,
+                                      uint64_t expires);
+
+/**
+ * @brief The number of lookups that were answered from the cache, and of those
+ * that were not, since the cache was last cleared.
+ *
+ * @param [hits]    Set to the number of hits. It can be NULL.
+ * @param [misses]  Set to the number of misses. It can be NULL.
+ */
+API void otrng_profile_cache_counters(/*@null@*/ uint64_t *hits,
+                                      /*@null@*/ uint64_t *misses);
+
+/**
+ * @brief Forgets every cached result and resets the counters.
+ */
+API void otrng_profile_cache_clear(void);
+
+#endif
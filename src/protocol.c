@@ -20,6 +20,7 @@
 
 #include "protocol.h"
 
+#include "base64.h"
 #include "data_message.h"
 #include "debug.h"
 #include "messaging.h"
@@ -27,13 +28,6 @@
 #include "random.h"
 #include "serialize.h"
 
-#ifndef S_SPLINT_S
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wstrict-prototypes"
-#include <libotr/b64.h>
-#pragma clang diagnostic pop
-#endif
-
 INTERNAL void maybe_create_keys(otrng_client_s *client) {
   const otrng_client_callbacks_s *cb = client->global_state->callbacks;
   uint32_t instance_tag;
@@ -170,54 +164,127 @@ generate_data_message(const otrng_s *otr, const uint32_t ratchet_id) {
   return data_msg;
 }
 
-tstatic otrng_result serialize_and_encode_data_message(
-    string_p *dst, const k_msg_mac mac_key, uint8_t *to_reveal_mac_keys,
-    size_t to_reveal_mac_keys_len, const data_message_s *data_msg) {
-  uint8_t *body = NULL;
-  size_t body_len = 0;
-  size_t ser_len;
+static const char otr_header[] = "?OTR:";
+
+/* "?OTR:" + base64 + "." + NUL */
+static size_t encoded_message_len(size_t ser_len) {
+  return sizeof(otr_header) - 1 + OTRNG_BASE64_ENCODE_LEN(ser_len) + 2;
+}
+
+/* An upper bound on the encoded size of the next data message sent by [otr].
+   It can be computed before ratcheting, as the DH key and the number of
+   revealed MAC keys are not known exactly until then. */
+static size_t max_encoded_data_message_len(const otrng_s *otr,
+                                           size_t msg_len) {
+  size_t ser_len = DATA_MSG_MAX_BYTES + msg_len + DATA_MSG_MAC_BYTES;
+
+  if (otr->keys->j == 0) {
+    ser_len += otrng_list_len(otr->keys->old_mac_keys) * MAC_KEY_BYTES;
+  }
+
+  return encoded_message_len(ser_len);
+}
+
+tstatic otrng_result serialize_and_encode_data_message_into(
+    char *dst, size_t dst_len, size_t *written, const k_msg_mac mac_key,
+    const uint8_t *to_reveal_mac_keys, size_t to_reveal_mac_keys_len,
+    const data_message_s *data_msg) {
+  size_t prefix_len = sizeof(otr_header) - 1;
+  size_t body_len = otrng_data_message_body_len(data_msg);
+  size_t ser_len = body_len + DATA_MSG_MAC_BYTES + to_reveal_mac_keys_len;
+  size_t len = encoded_message_len(ser_len);
   uint8_t *ser;
+  size_t w;
 
-  if (!otrng_data_message_body_serialize(&body, &body_len, data_msg)) {
+  if (dst_len < len) {
     return OTRNG_ERROR;
   }
 
-  ser_len = body_len + MAC_KEY_BYTES + to_reveal_mac_keys_len;
-
-  ser = otrng_xmalloc_z(ser_len);
+  /* The binary message is written at the end of [dst], and then base64
+     encoded forward, in place, into its beginning. */
+  ser = (uint8_t *)dst + len - ser_len;
 
-  memcpy(ser, body, body_len);
-  otrng_free(body);
+  if (!otrng_data_message_body_serialize_into(ser, ser_len, NULL, data_msg)) {
+    return OTRNG_ERROR;
+  }
 
   if (otrng_failed(otrng_data_message_authenticator(
-          ser + body_len, MAC_KEY_BYTES, mac_key, ser, body_len))) {
-    otrng_free(ser);
+          ser + body_len, DATA_MSG_MAC_BYTES, mac_key, ser, body_len))) {
     return OTRNG_ERROR;
   }
 
   if (to_reveal_mac_keys) {
-    if (otrng_serialize_bytes_array(ser + body_len + DATA_MSG_MAC_BYTES,
-                                    to_reveal_mac_keys,
-                                    to_reveal_mac_keys_len) == 0) {
-      otrng_free(ser);
-      return OTRNG_ERROR;
-    }
+    memcpy(ser + body_len + DATA_MSG_MAC_BYTES, to_reveal_mac_keys,
+           to_reveal_mac_keys_len);
   }
 
-  *dst = otrl_base64_otr_encode(ser, ser_len);
+  memcpy(dst, otr_header, prefix_len);
+  w = prefix_len + otrng_base64_encode_into(dst + prefix_len, ser, ser_len);
+  dst[w++] = '.';
+  dst[w] = '\0';
+
+  if (written) {
+    *written = w;
+  }
 
-  otrng_free(ser);
   return OTRNG_SUCCESS;
 }
 
-tstatic otrng_result send_data_message(string_p *to_send, const uint8_t *msg,
-                                       size_t msg_len, otrng_s *otr,
-                                       unsigned char flags) {
+tstatic otrng_result serialize_and_encode_data_message(
+    string_p *dst, const k_msg_mac mac_key, uint8_t *to_reveal_mac_keys,
+    size_t to_reveal_mac_keys_len, const data_message_s *data_msg) {
+  size_t len = encoded_message_len(otrng_data_message_body_len(data_msg) +
+                                   DATA_MSG_MAC_BYTES +
+                                   to_reveal_mac_keys_len);
+  char *buf = otrng_xmalloc_z(len);
+
+  if (!serialize_and_encode_data_message_into(buf, len, NULL, mac_key,
+                                              to_reveal_mac_keys,
+                                              to_reveal_mac_keys_len,
+                                              data_msg)) {
+    otrng_free(buf);
+    return OTRNG_ERROR;
+  }
+
+  *dst = buf;
+  return OTRNG_SUCCESS;
+}
+
+/* Encodes into [buf] when it is given, or into a new string in [to_send] */
+static otrng_result encode_data_message(string_p *to_send, char *buf,
+                                        size_t buf_len, size_t *written,
+                                        const k_msg_mac mac_key,
+                                        uint8_t *to_reveal_mac_keys,
+                                        size_t to_reveal_mac_keys_len,
+                                        const data_message_s *data_msg) {
+  if (buf) {
+    return serialize_and_encode_data_message_into(
+        buf, buf_len, written, mac_key, to_reveal_mac_keys,
+        to_reveal_mac_keys_len, data_msg);
+  }
+
+  return serialize_and_encode_data_message(
+      to_send, mac_key, to_reveal_mac_keys, to_reveal_mac_keys_len, data_msg);
+}
+
+tstatic otrng_result send_data_message(string_p *to_send, char *buf,
+                                       size_t buf_len, size_t *written,
+                                       const uint8_t *msg, size_t msg_len,
+                                       otrng_s *otr, unsigned char flags) {
   data_message_s *data_msg = NULL;
   uint32_t ratchet_id = otr->keys->i;
   k_msg_enc enc_key;
   k_msg_mac mac_key;
 
+  /* Nothing has been ratcheted yet, so the caller can retry with a larger
+     buffer */
+  if (buf && buf_len < max_encoded_data_message_len(otr, msg_len)) {
+    if (written) {
+      *written = max_encoded_data_message_len(otr, msg_len);
+    }
+    return OTRNG_ERROR;
+  }
+
   /* if j == 0 */
   if (!otrng_key_manager_derive_dh_ratchet_keys(
           otr->keys, otr->client->max_stored_msg_keys, NULL, NULL, 0, 's',
@@ -263,8 +330,8 @@ tstatic otrng_result send_data_message(string_p *to_send, const uint8_t *msg,
         otrng_serialize_old_mac_keys(otr->keys->old_mac_keys);
     otr->keys->old_mac_keys = NULL;
 
-    if (!serialize_and_encode_data_message(to_send, mac_key, ser_mac_keys,
-                                           ser_mac_keys_len, data_msg)) {
+    if (!encode_data_message(to_send, buf, buf_len, written, mac_key,
+                             ser_mac_keys, ser_mac_keys_len, data_msg)) {
       otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
       otrng_free(ser_mac_keys);
       otrng_data_message_free(data_msg);
@@ -273,8 +340,8 @@ tstatic otrng_result send_data_message(string_p *to_send, const uint8_t *msg,
     }
     otrng_free(ser_mac_keys);
   } else {
-    if (!serialize_and_encode_data_message(to_send, mac_key, NULL, 0,
-                                           data_msg)) {
+    if (!encode_data_message(to_send, buf, buf_len, written, mac_key, NULL, 0,
+                             data_msg)) {
       otrng_secure_wipe(mac_key, MAC_KEY_BYTES);
       otrng_data_message_free(data_msg);
       return OTRNG_ERROR;
@@ -354,15 +421,17 @@ tstatic otrng_result append_tlvs(uint8_t **dst, size_t *dst_len,
   return OTRNG_SUCCESS;
 }
 
-INTERNAL otrng_result otrng_prepare_to_send_data_message(string_p *to_send,
-                                                         const string_p msg,
-                                                         const tlv_list_s *tlvs,
-                                                         otrng_s *otr,
-                                                         unsigned char flags) {
-  uint8_t *msg2 = NULL;
-  size_t msg_len = 0;
-  otrng_result result;
+INTERNAL otrng_result otrng_prepare_data_message_plaintext(
+    uint8_t **dst, size_t *dst_len, const string_p msg, const tlv_list_s *tlvs,
+    const otrng_s *otr) {
+  return append_tlvs(dst, dst_len, msg, tlvs, otr);
+}
 
+static otrng_result send_plaintext(string_p *to_send, char *buf,
+                                   size_t buf_len, size_t *written,
+                                   const uint8_t *plaintext,
+                                   size_t plaintext_len, otrng_s *otr,
+                                   unsigned char flags) {
   if (otr->state == OTRNG_STATE_FINISHED) {
     otrng_client_callbacks_handle_event(otr->client->global_state->callbacks,
                                         OTRNG_MSG_EVENT_CONNECTION_ENDED);
@@ -377,22 +446,53 @@ INTERNAL otrng_result otrng_prepare_to_send_data_message(string_p *to_send,
     return OTRNG_ERROR;
   }
 
-  if (!append_tlvs(&msg2, &msg_len, msg, tlvs, otr)) {
-    return OTRNG_ERROR;
-  }
-
-  result = send_data_message(to_send, msg2, msg_len, otr, flags);
-  if (result == OTRNG_ERROR) {
+  if (!send_data_message(to_send, buf, buf_len, written, plaintext,
+                         plaintext_len, otr, flags)) {
     otrng_client_callbacks_handle_event(otr->client->global_state->callbacks,
                                         OTRNG_MSG_EVENT_ENCRYPTION_ERROR);
-    otrng_free(msg2);
-
     return OTRNG_ERROR;
   }
 
   otr->last_sent = time(NULL);
 
+  return OTRNG_SUCCESS;
+}
+
+INTERNAL otrng_result otrng_send_data_message_plaintext(
+    string_p *to_send, const uint8_t *plaintext, size_t plaintext_len,
+    otrng_s *otr, unsigned char flags) {
+  return send_plaintext(to_send, NULL, 0, NULL, plaintext, plaintext_len, otr,
+                        flags);
+}
+
+INTERNAL otrng_result otrng_send_data_message_plaintext_into(
+    char *buf, size_t buf_len, size_t *written, const uint8_t *plaintext,
+    size_t plaintext_len, otrng_s *otr, unsigned char flags) {
+  return send_plaintext(NULL, buf, buf_len, written, plaintext, plaintext_len,
+                        otr, flags);
+}
+
+INTERNAL otrng_result otrng_prepare_to_send_data_message(string_p *to_send,
+                                                         const string_p msg,
+                                                         const tlv_list_s *tlvs,
+                                                         otrng_s *otr,
+                                                         unsigned char flags) {
+  uint8_t *msg2 = NULL;
+  size_t msg_len = 0;
+  otrng_result result;
+
+  if (otr->state != OTRNG_STATE_ENCRYPTED_MESSAGES) {
+    /* Reports the event without building the plaintext */
+    return otrng_send_data_message_plaintext(to_send, NULL, 0, otr, flags);
+  }
+
+  if (!append_tlvs(&msg2, &msg_len, msg, tlvs, otr)) {
+    return OTRNG_ERROR;
+  }
+
+  result =
+      otrng_send_data_message_plaintext(to_send, msg2, msg_len, otr, flags);
   otrng_free(msg2);
 
-  return OTRNG_SUCCESS;
+  return result;
 }
@@ -29,6 +29,7 @@
 #define OTRNG_PROTOCOL_H
 
 #include "client_profile.h"
+#include "fragment.h"
 #include "key_management.h"
 #include "prekey_profile.h"
 #include "smp_protocol.h"
@@ -93,7 +94,10 @@ typedef struct otrng_s {
   key_manager_s *keys;
   smp_protocol_s *smp;
 
-  list_element_s *pending_fragments;
+  fragment_contexts_s *pending_fragments;
+
+  /* scheduled from the time our ephemeral keys were last generated */
+  otrng_expiry_entry_s session_expiry;
 
   time_t last_sent; // TODO: @refactoring not sure if the best place to put
 
@@ -116,6 +120,35 @@ INTERNAL dh_public_key our_dh(const otrng_s *otr);
 
 INTERNAL uint32_t our_instance_tag(const otrng_s *otr);
 
+/**
+ * @brief Builds the plaintext of a data message: the message, its TLVs and
+ * the padding configured for the client of [otr]. The result only depends on
+ * the client, so it can be reused for every conversation of that client.
+ */
+INTERNAL otrng_result otrng_prepare_data_message_plaintext(
+    uint8_t **dst, size_t *dst_len, const string_p msg, const tlv_list_s *tlvs,
+    const otrng_s *otr);
+
+/**
+ * @brief Ratchets, encrypts and authenticates a plaintext built by
+ * otrng_prepare_data_message_plaintext.
+ */
+INTERNAL otrng_result otrng_send_data_message_plaintext(
+    string_p *to_send, const uint8_t *plaintext, size_t plaintext_len,
+    otrng_s *otr, unsigned char flags);
+
+/**
+ * @brief Like otrng_send_data_message_plaintext, but the encoded message is
+ * written, NUL-terminated, into [buf] instead of a new string. [written] is
+ * set to its length without the NUL.
+ *
+ * If [buf] might be too small for the message, nothing is ratcheted and
+ * [written] is set to the size that is enough.
+ */
+INTERNAL otrng_result otrng_send_data_message_plaintext_into(
+    char *buf, size_t buf_len, size_t *written, const uint8_t *plaintext,
+    size_t plaintext_len, otrng_s *otr, unsigned char flags);
+
 INTERNAL otrng_result otrng_prepare_to_send_data_message(string_p *to_send,
                                                          const string_p msg,
                                                          const tlv_list_s *tlvs,
@@ -126,6 +159,11 @@ INTERNAL void otrng_error_message(string_p *to_send, otrng_err_code err_code);
 
 #ifdef OTRNG_PROTOCOL_PRIVATE
 
+tstatic otrng_result serialize_and_encode_data_message_into(
+    char *dst, size_t dst_len, size_t *written, const k_msg_mac mac_key,
+    const uint8_t *to_reveal_mac_keys, size_t to_reveal_mac_keys_len,
+    const data_message_s *data_msg);
+
 tstatic otrng_result serialize_and_encode_data_message(
     string_p *dst, const k_msg_mac mac_key, uint8_t *to_reveal_mac_keys,
     size_t to_reveal_mac_keys_len, const data_message_s *data_msg);
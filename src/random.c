@@ -18,19 +18,33 @@
  *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
+
 #define OTRNG_RANDOM_PRIVATE
 
 #include "random.h"
 
 static /*@null@*/ random_bytes_generator otrng_global_randomness = NULL;
+static pthread_mutex_t randomness_lock = PTHREAD_MUTEX_INITIALIZER;
 
 random_bytes_generator otrng_get_current_randomness(void) {
-  return otrng_global_randomness;
+  random_bytes_generator current;
+
+  pthread_mutex_lock(&randomness_lock);
+  current = otrng_global_randomness;
+  pthread_mutex_unlock(&randomness_lock);
+
+  return current;
 }
 
 random_bytes_generator
 otrng_set_current_randomness(random_bytes_generator new_randomness) {
-  random_bytes_generator old = otrng_global_randomness;
+  random_bytes_generator old;
+
+  pthread_mutex_lock(&randomness_lock);
+  old = otrng_global_randomness;
   otrng_global_randomness = new_randomness;
+  pthread_mutex_unlock(&randomness_lock);
+
   return old;
 }
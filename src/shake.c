@@ -20,6 +20,8 @@
 
 #include <string.h>
 
+#include "alloc.h"
+#include "keccak.h"
 #include "shake.h"
 
 tstatic otrng_result hash_init_with_dom(goldilocks_shake256_ctx_p hd) {
@@ -53,9 +55,8 @@ hash_init_with_usage_and_domain_separation(goldilocks_shake256_ctx_p hd,
   return OTRNG_SUCCESS;
 }
 
-static otrng_result
-hash_init_with_usage_prekey_server(goldilocks_shake256_ctx_p hash,
-                                   uint8_t usage) {
+otrng_result hash_init_with_usage_prekey_server(goldilocks_shake256_ctx_p hash,
+                                                uint8_t usage) {
   const char *domain = "OTR-Prekey-Server";
   if (!hash_init_with_usage_and_domain_separation(hash, usage, domain)) {
     return OTRNG_ERROR;
@@ -121,6 +122,66 @@ otrng_result shake_256_kdf1(uint8_t *dst, size_t dst_len, uint8_t usage,
   return OTRNG_SUCCESS;
 }
 
+#define OTRV4_DOMAIN "OTRv4"
+#define OTRV4_DOMAIN_BYTES 5
+
+otrng_result shake_256_kdf1_x4(uint8_t *const *dst, size_t dst_len,
+                               const uint8_t *usages,
+                               const uint8_t *const *values,
+                               const size_t *values_len, size_t count) {
+  otrng_keccak_x4_s state;
+  uint8_t block[SHAKE_256_RATE];
+  otrng_bool single_block = count <= OTRNG_KECCAK_LANES &&
+                            dst_len <= SHAKE_256_RATE;
+  size_t lane, i;
+
+  for (lane = 0; lane < count; lane++) {
+    /* the padding takes at least one byte */
+    if (OTRV4_DOMAIN_BYTES + 1 + values_len[lane] >= SHAKE_256_RATE) {
+      single_block = otrng_false;
+    }
+  }
+
+  if (!single_block) {
+    for (lane = 0; lane < count; lane++) {
+      if (!shake_256_kdf1(dst[lane], dst_len, usages[lane], values[lane],
+                          values_len[lane])) {
+        return OTRNG_ERROR;
+      }
+    }
+    return OTRNG_SUCCESS;
+  }
+
+  memset(&state, 0, sizeof(state));
+  for (lane = 0; lane < count; lane++) {
+    memset(block, 0, SHAKE_256_RATE);
+    memcpy(block, OTRV4_DOMAIN, OTRV4_DOMAIN_BYTES);
+    block[OTRV4_DOMAIN_BYTES] = usages[lane];
+    memcpy(block + OTRV4_DOMAIN_BYTES + 1, values[lane], values_len[lane]);
+
+    /* SHAKE padding: the domain bits 1111, then 10*1 */
+    block[OTRV4_DOMAIN_BYTES + 1 + values_len[lane]] ^= 0x1F;
+    block[SHAKE_256_RATE - 1] ^= 0x80;
+
+    for (i = 0; i < SHAKE_256_RATE; i++) {
+      state.words[i / 8][lane] |= (uint64_t)block[i] << (8 * (i % 8));
+    }
+  }
+
+  otrng_keccak_f1600_x4(&state);
+
+  for (lane = 0; lane < count; lane++) {
+    for (i = 0; i < dst_len; i++) {
+      dst[lane][i] = (state.words[i / 8][lane] >> (8 * (i % 8))) & 0xFF;
+    }
+  }
+
+  otrng_secure_wipe(&state, sizeof(state));
+  otrng_secure_wipe(block, SHAKE_256_RATE);
+
+  return OTRNG_SUCCESS;
+}
+
 otrng_result shake_256_prekey_server_kdf(uint8_t *dst, size_t dst_len,
                                          uint8_t usage, const uint8_t *values,
                                          size_t values_len) {
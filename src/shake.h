@@ -45,6 +45,10 @@ hash_init_with_usage_and_domain_separation(goldilocks_shake256_ctx_p hash,
 otrng_result hash_init_with_usage(goldilocks_shake256_ctx_p hash,
                                   uint8_t usage);
 
+/* Starts KDF_1("OTR-Prekey-Server" || usageID || ...) */
+otrng_result hash_init_with_usage_prekey_server(goldilocks_shake256_ctx_p hash,
+                                                uint8_t usage);
+
 otrng_result shake_kkdf(uint8_t *dst, size_t dst_len, const uint8_t *key,
                         size_t key_len, const uint8_t *secret,
                         size_t secret_len);
@@ -61,6 +65,20 @@ otrng_result shake_256_prekey_server_kdf(uint8_t *dst, size_t dst_len,
 otrng_result shake_256_hash(uint8_t *dst, size_t dst_len, const uint8_t *secret,
                             size_t secret_len);
 
+/* Bytes absorbed, or squeezed, by one Keccak-f permutation of SHAKE-256 */
+#define SHAKE_256_RATE 136
+
+/*
+ * Up to OTRNG_KECCAK_LANES KDF_1("OTRv4" || usages[i] || values[i], dst_len)
+ * at once. When every input fits in one block and dst_len in the rate, they
+ * take a single multi-lane permutation. Otherwise they are done one by one,
+ * in order, so dst[i] can be values[j] for any j <= i.
+ */
+otrng_result shake_256_kdf1_x4(uint8_t *const *dst, size_t dst_len,
+                               const uint8_t *usages,
+                               const uint8_t *const *values,
+                               const size_t *values_len, size_t count);
+
 #ifdef OTRNG_SHAKE_PRIVATE
 
 tstatic otrng_result hash_init_with_dom(goldilocks_shake256_ctx_p hash);
@@ -0,0 +1,289 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sodium.h>
+#include <string.h>
+
+#define OTRNG_SKIPPED_KEYS_PRIVATE
+
+#include "alloc.h"
+#include "skipped_keys.h"
+
+#define SKIPPED_KEYS_MIN_CAPACITY 16
+
+INTERNAL skipped_keys_store_s *otrng_skipped_keys_store_new(void) {
+  skipped_keys_store_s *store = otrng_xmalloc_z(sizeof(skipped_keys_store_s));
+
+  /* The hash key does not need to come from the (overridable) protocol
+   * randomness: it only protects the table from collisions chosen by the
+   * peer. */
+  randombytes_buf(store->hash_key, SKIPPED_KEYS_HASH_KEY_BYTES);
+
+  return store;
+}
+
+INTERNAL void otrng_skipped_keys_store_clear(skipped_keys_store_s *store) {
+  size_t i;
+
+  if (!store->slots) {
+    return;
+  }
+
+  for (i = 0; i < store->capacity; i++) {
+    otrng_skipped_keys_free(store->slots[i].keys);
+    store->slots[i].keys = NULL;
+    store->slots[i].hash = 0;
+  }
+
+  store->len = 0;
+}
+
+INTERNAL void
+otrng_skipped_keys_store_free(/*@null@*/ skipped_keys_store_s *store) {
+  if (!store) {
+    return;
+  }
+
+  otrng_skipped_keys_store_clear(store);
+  if (store->slots) {
+    otrng_secure_free(store->slots);
+  }
+
+  otrng_secure_wipe(store->hash_key, SKIPPED_KEYS_HASH_KEY_BYTES);
+  otrng_free(store);
+}
+
+INTERNAL size_t
+otrng_skipped_keys_store_len(/*@null@*/ const skipped_keys_store_s *store) {
+  if (!store) {
+    return 0;
+  }
+
+  return store->len;
+}
+
+INTERNAL /*@null@*/ skipped_keys_s *
+otrng_skipped_keys_new(const ec_point their_ecdh, uint32_t k) {
+  skipped_keys_s *keys = otrng_secure_alloc(sizeof(skipped_keys_s));
+
+  if (!otrng_ec_point_encode(keys->their_ecdh, ED448_POINT_BYTES,
+                             their_ecdh)) {
+    otrng_secure_free(keys);
+    return NULL;
+  }
+
+  keys->k = k;
+
+  return keys;
+}
+
+INTERNAL void otrng_skipped_keys_free(/*@null@*/ skipped_keys_s *keys) {
+  if (!keys) {
+    return;
+  }
+
+  /* otrng_secure_free wipes the memory before releasing it */
+  otrng_secure_free(keys);
+}
+
+tstatic uint64_t skipped_keys_hash(const skipped_keys_store_s *store,
+                                   const uint8_t *their_ecdh, uint32_t k) {
+  uint8_t buffer[ED448_POINT_BYTES + 4];
+  uint8_t out[crypto_shorthash_BYTES];
+  uint64_t hash = 0;
+  size_t i;
+
+  memcpy(buffer, their_ecdh, ED448_POINT_BYTES);
+  buffer[ED448_POINT_BYTES] = (k >> 24) & 0xFF;
+  buffer[ED448_POINT_BYTES + 1] = (k >> 16) & 0xFF;
+  buffer[ED448_POINT_BYTES + 2] = (k >> 8) & 0xFF;
+  buffer[ED448_POINT_BYTES + 3] = k & 0xFF;
+
+  crypto_shorthash(out, buffer, sizeof(buffer), store->hash_key);
+
+  for (i = 0; i < crypto_shorthash_BYTES; i++) {
+    hash = (hash << 8) | out[i];
+  }
+
+  return hash;
+}
+
+static void insert_slot(skipped_keys_slot_s *slots, size_t capacity,
+                        uint64_t hash, skipped_keys_s *keys) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)(hash & mask);
+
+  while (slots[i].keys) {
+    i = (i + 1) & mask;
+  }
+
+  slots[i].hash = hash;
+  slots[i].keys = keys;
+}
+
+tstatic void skipped_keys_store_grow(skipped_keys_store_s *store) {
+  size_t capacity = store->capacity ? store->capacity * 2
+                                    : SKIPPED_KEYS_MIN_CAPACITY;
+  skipped_keys_slot_s *slots =
+      otrng_secure_alloc(capacity * sizeof(skipped_keys_slot_s));
+  size_t i;
+
+  for (i = 0; i < store->capacity; i++) {
+    if (store->slots[i].keys) {
+      insert_slot(slots, capacity, store->slots[i].hash, store->slots[i].keys);
+    }
+  }
+
+  if (store->slots) {
+    otrng_secure_free(store->slots);
+  }
+
+  store->slots = slots;
+  store->capacity = capacity;
+}
+
+INTERNAL void otrng_skipped_keys_store_add(skipped_keys_store_s *store,
+                                           skipped_keys_s *keys) {
+  /* Keep the load factor under 3/4 */
+  if ((store->len + 1) * 4 > store->capacity * 3) {
+    skipped_keys_store_grow(store);
+  }
+
+  insert_slot(store->slots, store->capacity,
+              skipped_keys_hash(store, keys->their_ecdh, keys->k), keys);
+  store->len++;
+}
+
+static /*@null@*/ skipped_keys_slot_s *
+find_slot(const skipped_keys_store_s *store, const uint8_t *their_ecdh,
+          uint32_t k) {
+  size_t mask, i;
+  uint64_t hash;
+
+  if (store->len == 0) {
+    return NULL;
+  }
+
+  mask = store->capacity - 1;
+  hash = skipped_keys_hash(store, their_ecdh, k);
+  i = (size_t)(hash & mask);
+
+  while (store->slots[i].keys) {
+    skipped_keys_s *keys = store->slots[i].keys;
+    if (store->slots[i].hash == hash && keys->k == k &&
+        memcmp(keys->their_ecdh, their_ecdh, ED448_POINT_BYTES) == 0) {
+      return &store->slots[i];
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+INTERNAL /*@null@*/ skipped_keys_s *
+otrng_skipped_keys_store_get(const skipped_keys_store_s *store,
+                             const ec_point their_ecdh, uint32_t k) {
+  uint8_t enc[ED448_POINT_BYTES];
+  skipped_keys_slot_s *slot;
+
+  if (!otrng_ec_point_encode(enc, ED448_POINT_BYTES, their_ecdh)) {
+    return NULL;
+  }
+
+  slot = find_slot(store, enc, k);
+  if (!slot) {
+    return NULL;
+  }
+
+  return slot->keys;
+}
+
+INTERNAL /*@null@*/ skipped_keys_s *
+otrng_skipped_keys_store_remove(skipped_keys_store_s *store,
+                                const skipped_keys_s *keys) {
+  skipped_keys_slot_s *slot = find_slot(store, keys->their_ecdh, keys->k);
+  skipped_keys_s *removed;
+  size_t mask, i, j;
+
+  if (!slot) {
+    return NULL;
+  }
+
+  removed = slot->keys;
+  mask = store->capacity - 1;
+  i = (size_t)(slot - store->slots);
+  j = i;
+
+  /* Backward shift deletion: move back every entry of the probe sequence
+   * that would otherwise become unreachable, so no tombstones are needed. */
+  for (;;) {
+    size_t ideal;
+
+    j = (j + 1) & mask;
+    if (!store->slots[j].keys) {
+      break;
+    }
+
+    ideal = (size_t)(store->slots[j].hash & mask);
+    if (((j - ideal) & mask) >= ((j - i) & mask)) {
+      store->slots[i] = store->slots[j];
+      i = j;
+    }
+  }
+
+  store->slots[i].keys = NULL;
+  store->slots[i].hash = 0;
+  store->len--;
+
+  return removed;
+}
+
+INTERNAL void otrng_skipped_keys_store_move(skipped_keys_store_s *dst,
+                                            skipped_keys_store_s *src) {
+  size_t i;
+
+  if (src->len == 0) {
+    return;
+  }
+
+  for (i = 0; i < src->capacity; i++) {
+    if (src->slots[i].keys) {
+      otrng_skipped_keys_store_add(dst, src->slots[i].keys);
+      src->slots[i].keys = NULL;
+      src->slots[i].hash = 0;
+    }
+  }
+
+  src->len = 0;
+}
+
+INTERNAL void otrng_skipped_keys_store_foreach(
+    const skipped_keys_store_s *store,
+    void (*fn)(const skipped_keys_s *keys, void *context),
+    /*@null@*/ void *context) {
+  size_t i;
+
+  for (i = 0; i < store->capacity; i++) {
+    if (store->slots[i].keys) {
+      fn(store->slots[i].keys, context);
+    }
+  }
+}
@@ -0,0 +1,175 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The functions in this file only operate on their arguments, and doesn't touch
+ * any global state. It is safe to call these functions concurrently from
+ * different threads, as long as arguments pointing to the same memory areas are
+ * not used from different threads.
+ */
+
+#ifndef OTRNG_SKIPPED_KEYS_H
+#define OTRNG_SKIPPED_KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "ed448.h"
+#include "error.h"
+#include "shared.h"
+
+#define SKIPPED_KEYS_HASH_KEY_BYTES 16
+
+/* the stored message and extra symmetric keys */
+typedef struct skipped_keys_s {
+  uint8_t their_ecdh[ED448_POINT_BYTES]; /* Encoded their_ecdh key */
+  uint32_t k;                            /* Counter of the receiving messages */
+  uint8_t extra_symmetric_key[EXTRA_SYMMETRIC_KEY_BYTES];
+  uint8_t enc_key[ENC_KEY_BYTES];
+} skipped_keys_s;
+
+typedef struct skipped_keys_slot_s {
+  uint64_t hash;
+  /*@null@*/ skipped_keys_s *keys;
+} skipped_keys_slot_s;
+
+/*
+ * An open-addressing (linear probing) table of skipped message keys, indexed
+ * by their_ecdh and the message id. The slots live in secure memory.
+ */
+typedef struct skipped_keys_store_s {
+  /*@null@*/ skipped_keys_slot_s *slots;
+  size_t capacity; /* always zero or a power of two */
+  size_t len;
+  uint8_t hash_key[SKIPPED_KEYS_HASH_KEY_BYTES];
+} skipped_keys_store_s;
+
+/**
+ * @brief Creates a new, empty, skipped keys store.
+ *
+ * @return A new store [skipped_keys_store_s].
+ */
+INTERNAL skipped_keys_store_s *otrng_skipped_keys_store_new(void);
+
+/**
+ * @brief Securely frees the store and every key stored in it.
+ *
+ * @param [store]   The store.
+ */
+INTERNAL void
+otrng_skipped_keys_store_free(/*@null@*/ skipped_keys_store_s *store);
+
+/**
+ * @brief Securely frees every key stored, leaving the store empty.
+ *
+ * @param [store]   The store.
+ */
+INTERNAL void otrng_skipped_keys_store_clear(skipped_keys_store_s *store);
+
+/**
+ * @brief The number of keys in the store.
+ *
+ * @param [store]   The store.
+ */
+INTERNAL size_t
+otrng_skipped_keys_store_len(/*@null@*/ const skipped_keys_store_s *store);
+
+/**
+ * @brief Allocates new skipped keys in secure memory.
+ *
+ * @param [their_ecdh]  The ECDH key the keys belong to.
+ * @param [k]           The message id.
+ *
+ * @return The skipped keys [skipped_keys_s], or NULL if the point can not be
+ * encoded.
+ */
+INTERNAL /*@null@*/ skipped_keys_s *
+otrng_skipped_keys_new(const ec_point their_ecdh, uint32_t k);
+
+/** Securely frees skipped keys. */
+INTERNAL void otrng_skipped_keys_free(/*@null@*/ skipped_keys_s *keys);
+
+/**
+ * @brief Adds keys to the store. The store takes ownership of the keys.
+ *
+ * @param [store]   The store.
+ * @param [keys]    The keys to add.
+ */
+INTERNAL void otrng_skipped_keys_store_add(skipped_keys_store_s *store,
+                                           skipped_keys_s *keys);
+
+/**
+ * @brief Finds the keys stored for a their_ecdh and message id.
+ *
+ * @param [store]       The store.
+ * @param [their_ecdh]  The ECDH key of the message.
+ * @param [k]           The message id.
+ *
+ * @return The keys, still owned by the store, or NULL if not found.
+ */
+INTERNAL /*@null@*/ skipped_keys_s *
+otrng_skipped_keys_store_get(const skipped_keys_store_s *store,
+                             const ec_point their_ecdh, uint32_t k);
+
+/**
+ * @brief Removes keys from the store without freeing them.
+ *
+ * @param [store]   The store.
+ * @param [keys]    The keys to remove, as returned by the store.
+ *
+ * @return The removed keys, now owned by the caller, or NULL if not found.
+ */
+INTERNAL /*@null@*/ skipped_keys_s *
+otrng_skipped_keys_store_remove(skipped_keys_store_s *store,
+                                const skipped_keys_s *keys);
+
+/**
+ * @brief Moves every key from one store into another. The source store is
+ * left empty.
+ *
+ * @param [dst]   The destination store.
+ * @param [src]   The source store.
+ */
+INTERNAL void otrng_skipped_keys_store_move(skipped_keys_store_s *dst,
+                                            skipped_keys_store_s *src);
+
+/**
+ * @brief Calls fn for every key in the store, in slot order.
+ *
+ * @param [store]     The store.
+ * @param [fn]        The function to call.
+ * @param [context]   Passed to every call to fn.
+ */
+INTERNAL void otrng_skipped_keys_store_foreach(
+    const skipped_keys_store_s *store,
+    void (*fn)(const skipped_keys_s *keys, void *context),
+    /*@null@*/ void *context);
+
+#ifdef OTRNG_SKIPPED_KEYS_PRIVATE
+
+tstatic uint64_t skipped_keys_hash(const skipped_keys_store_s *store,
+                                   const uint8_t *their_ecdh, uint32_t k);
+
+tstatic void skipped_keys_store_grow(skipped_keys_store_s *store);
+
+#endif
+
+#endif
@@ -26,6 +26,7 @@ void functionals_client_add_tests(void);
 void functionals_double_ratchet_add_tests(void);
 void functionals_prekey_client_add_tests(void);
 void functionals_smp_add_tests(void);
+void functionals_threads_add_tests(void);
 
 #define REGISTER_FUNCTIONALS                                                   \
   do {                                                                         \
@@ -34,6 +35,7 @@ void functionals_smp_add_tests(void);
     functionals_double_ratchet_add_tests();                                    \
     functionals_prekey_client_add_tests();                                     \
     functionals_smp_add_tests();                                               \
+    functionals_threads_add_tests();                                           \
   } while (0);
 
 #endif // __TEST_FUNCTIONALS_ALL_H__
@@ -26,6 +26,7 @@
 #include "test_fixtures.h"
 
 #include "client.h"
+#include "expiry.h"
 #include "fragment.h"
 #include "instance_tag.h"
 #include "messaging.h"
@@ -317,6 +318,269 @@ static void test_conversation_with_multiple_locations() {
   otrng_global_state_free(bob->global_state);
 }
 
+static void start_conversation(otrng_client_s *from, const char *from_account,
+                               otrng_client_s *to, const char *to_account) {
+  otrng_bool ignore = otrng_false;
+  char *from_msg = NULL, *to_msg = NULL, *to_display = NULL;
+
+  from_msg = otrng_client_init_message(to_account, "Hi", from);
+
+  /* Query message -> identity message -> Auth-R -> Auth-I -> data message */
+  otrng_client_receive(&to_msg, &to_display, from_msg, from_account, to,
+                       &ignore);
+  otrng_free(from_msg);
+  from_msg = NULL;
+
+  otrng_client_receive(&from_msg, &to_display, to_msg, to_account, from,
+                       &ignore);
+  otrng_free(to_msg);
+  to_msg = NULL;
+
+  otrng_client_receive(&to_msg, &to_display, from_msg, from_account, to,
+                       &ignore);
+  otrng_free(from_msg);
+  from_msg = NULL;
+
+  otrng_client_receive(&from_msg, &to_display, to_msg, to_account, from,
+                       &ignore);
+  otrng_free(to_msg);
+  to_msg = NULL;
+
+  otrng_client_receive(&to_msg, &to_display, from_msg, from_account, to,
+                       &ignore);
+  otrng_free(from_msg);
+
+  otrng_assert(!to_msg);
+  otrng_assert(!to_display);
+}
+
+static void assert_receives(otrng_client_s *to, const char *from_account,
+                            const char *msg, const char *expected) {
+  otrng_bool ignore = otrng_false;
+  char *to_msg = NULL, *to_display = NULL;
+
+  otrng_client_receive(&to_msg, &to_display, msg, from_account, to, &ignore);
+
+  otrng_assert(!ignore);
+  otrng_assert(!to_msg);
+  g_assert_cmpstr(to_display, ==, expected);
+  otrng_free(to_display);
+}
+
+static void run_serially(void *pool_data, otrng_client_task_f task, void *ctx,
+                         size_t count) {
+  size_t i;
+  int *runs = pool_data;
+
+  (*runs)++;
+  for (i = 0; i < count; i++) {
+    task(ctx, i);
+  }
+}
+
+static void test_client_send_many() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob = otrng_client_new(BOB_IDENTITY);
+  otrng_client_s *charlie = otrng_client_new(CHARLIE_IDENTITY);
+  const char *recipients[] = {BOB_ACCOUNT, CHARLIE_ACCOUNT, BOB_ACCOUNT};
+  const char *message = "hello everyone";
+  otrng_client_thread_pool_s pool;
+  int runs = 0;
+  char **to_send = NULL;
+  int i;
+
+  set_up_client(alice, 1);
+  set_up_client(bob, 2);
+  set_up_client(charlie, 3);
+
+  start_conversation(alice, ALICE_ACCOUNT, bob, BOB_ACCOUNT);
+  start_conversation(alice, ALICE_ACCOUNT, charlie, CHARLIE_ACCOUNT);
+
+  otrng_assert_is_success(
+      otrng_client_send_many(&to_send, message, recipients, 2, NULL, alice));
+  otrng_assert(to_send);
+
+  assert_receives(bob, ALICE_ACCOUNT, to_send[0], message);
+  assert_receives(charlie, ALICE_ACCOUNT, to_send[1], message);
+  for (i = 0; i < 2; i++) {
+    otrng_free(to_send[i]);
+  }
+  otrng_free(to_send);
+
+  /* Bob is repeated, so his second message is sent outside the pool */
+  pool.run = run_serially;
+  pool.pool_data = &runs;
+  otrng_assert_is_success(
+      otrng_client_send_many(&to_send, message, recipients, 3, &pool, alice));
+  g_assert_cmpint(runs, ==, 1);
+
+  assert_receives(bob, ALICE_ACCOUNT, to_send[0], message);
+  assert_receives(charlie, ALICE_ACCOUNT, to_send[1], message);
+  assert_receives(bob, ALICE_ACCOUNT, to_send[2], message);
+  for (i = 0; i < 3; i++) {
+    otrng_free(to_send[i]);
+  }
+  otrng_free(to_send);
+
+  otrng_global_state_free(alice->global_state);
+  otrng_global_state_free(bob->global_state);
+  otrng_global_state_free(charlie->global_state);
+}
+
+static string_p expired_injected = NULL;
+
+static uint32_t expire_after_a_minute(const otrng_s *otr) {
+  (void)otr;
+  return 60;
+}
+
+static void store_injected_message(const otrng_s *otr, string_p msg) {
+  /* The session must still be alive while its last message is injected */
+  g_assert_cmpstr(otr->peer, ==, BOB_ACCOUNT);
+  otrng_free(expired_injected);
+  expired_injected = msg;
+}
+
+static void unschedule_session(otrng_client_s *client, const char *recipient) {
+  otrng_conversation_s *conv = get_conversation_with(recipient, client);
+
+  otrng_expiry_cancel(client->global_state->expiry,
+                      &conv->conn->session_expiry);
+  conv->conn->session_expiry.scheduled_from = 0;
+}
+
+static void test_client_expires_session() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob = otrng_client_new(BOB_IDENTITY);
+  otrng_client_callbacks_s callbacks = *test_callbacks;
+  otrng_bool ignore = otrng_false;
+  char *to_alice = NULL, *to_display = NULL;
+  time_t deadline;
+
+  callbacks.session_expiration_time_for = expire_after_a_minute;
+  callbacks.inject_message = store_injected_message;
+
+  set_up_client(alice, 1);
+  set_up_client(bob, 2);
+  alice->global_state->callbacks = &callbacks;
+
+  start_conversation(alice, ALICE_ACCOUNT, bob, BOB_ACCOUNT);
+
+  otrng_assert(
+      otrng_global_state_next_deadline(alice->global_state, &deadline));
+
+  otrng_global_state_run_due(alice->global_state, deadline - 1);
+  otrng_assert(!expired_injected);
+  otrng_assert(get_conversation_with(BOB_ACCOUNT, alice));
+
+  otrng_global_state_run_due(alice->global_state, deadline);
+  otrng_assert(expired_injected);
+  otrng_assert(!get_conversation_with(BOB_ACCOUNT, alice));
+  g_assert_cmpint(otrng_expiry_len(alice->global_state->expiry), ==, 0);
+
+  // Bob is told the session is gone
+  otrng_client_receive(&to_alice, &to_display, expired_injected,
+                       ALICE_ACCOUNT, bob, &ignore);
+  otrng_assert(!to_alice);
+  otrng_free(to_display);
+  otrng_assert(get_conversation_with(ALICE_ACCOUNT, bob)->conn->state ==
+               OTRNG_STATE_FINISHED);
+
+  otrng_free(expired_injected);
+  expired_injected = NULL;
+
+  otrng_global_state_free(alice->global_state);
+  otrng_global_state_free(bob->global_state);
+}
+
+static void test_client_send_paths_schedule_expiry() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob = otrng_client_new(BOB_IDENTITY);
+  otrng_client_callbacks_s callbacks = *test_callbacks;
+  const char *recipients[] = {BOB_ACCOUNT};
+  const char *message = "hello";
+  otrng_client_thread_pool_s pool;
+  int runs = 0;
+  char **to_send = NULL;
+  char buf[4096];
+  size_t written = 0;
+
+  callbacks.session_expiration_time_for = expire_after_a_minute;
+
+  set_up_client(alice, 1);
+  set_up_client(bob, 2);
+  alice->global_state->callbacks = &callbacks;
+
+  start_conversation(alice, ALICE_ACCOUNT, bob, BOB_ACCOUNT);
+
+  unschedule_session(alice, BOB_ACCOUNT);
+  g_assert_cmpint(otrng_expiry_len(alice->global_state->expiry), ==, 0);
+
+  otrng_assert_is_success(otrng_client_send_into(
+      buf, sizeof(buf), &written, message, BOB_ACCOUNT, alice));
+  g_assert_cmpint(otrng_expiry_len(alice->global_state->expiry), ==, 1);
+  buf[written] = 0;
+  assert_receives(bob, ALICE_ACCOUNT, buf, message);
+
+  unschedule_session(alice, BOB_ACCOUNT);
+
+  pool.run = run_serially;
+  pool.pool_data = &runs;
+  otrng_assert_is_success(
+      otrng_client_send_many(&to_send, message, recipients, 1, &pool, alice));
+  g_assert_cmpint(runs, ==, 1);
+  g_assert_cmpint(otrng_expiry_len(alice->global_state->expiry), ==, 1);
+  assert_receives(bob, ALICE_ACCOUNT, to_send[0], message);
+  otrng_free(to_send[0]);
+  otrng_free(to_send);
+
+  otrng_global_state_free(alice->global_state);
+  otrng_global_state_free(bob->global_state);
+}
+
+static void test_client_receive_plaintext() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *bob = otrng_client_new(BOB_IDENTITY);
+  otrng_plaintext_s plaintext;
+  otrng_bool ignore = otrng_false;
+  char *to_send = NULL, *from_bob = NULL;
+  tlv_iterator_s it;
+  tlv_s tlv;
+
+  set_up_client(alice, 1);
+  set_up_client(bob, 2);
+  otrng_client_set_padding(256, alice);
+
+  start_conversation(alice, ALICE_ACCOUNT, bob, BOB_ACCOUNT);
+
+  otrng_assert_is_success(
+      otrng_client_send(&to_send, "hello", BOB_ACCOUNT, alice));
+
+  otrng_assert_is_success(otrng_client_receive_plaintext(
+      &from_bob, &plaintext, to_send, ALICE_ACCOUNT, bob, &ignore));
+  otrng_free(to_send);
+
+  otrng_assert(!ignore);
+  otrng_assert(!from_bob);
+  g_assert_cmpint(plaintext.text_len, ==, 5);
+  otrng_assert_cmpmem(plaintext.text, "hello", 5);
+
+  // The padding TLV is read from the same buffer
+  otrng_plaintext_tlvs(&it, &plaintext);
+  otrng_assert(otrng_tlv_iterator_next(&it, &tlv));
+  g_assert_cmpint(tlv.type, ==, OTRNG_TLV_PADDING);
+  otrng_assert(tlv.data >= plaintext.buffer &&
+               tlv.data + tlv.len <= plaintext.buffer + plaintext.buffer_len);
+  otrng_assert(!otrng_tlv_iterator_next(&it, &tlv));
+
+  otrng_plaintext_release(&plaintext);
+  otrng_assert(!plaintext.buffer);
+  otrng_assert(!plaintext.text);
+
+  otrng_global_state_free(alice->global_state);
+  otrng_global_state_free(bob->global_state);
+}
+
 static void test_initiate_with_identity_msg() {
   otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
   otrng_client_s *bob = otrng_client_new(BOB_IDENTITY);
@@ -1037,11 +1301,13 @@ static void test_client_expires_old_fragments(void) {
 
   otrng_conversation_s *conv =
       otrng_client_get_conversation(0, BOB_ACCOUNT, alice);
-  g_assert_cmpint(otrng_list_len(conv->conn->pending_fragments), ==, 1);
+  g_assert_cmpint(otrng_fragment_contexts_len(conv->conn->pending_fragments),
+                  ==, 1);
 
   otrng_client_expire_fragments(alice);
 
-  g_assert_cmpint(otrng_list_len(conv->conn->pending_fragments), ==, 0);
+  g_assert_cmpint(otrng_fragment_contexts_len(conv->conn->pending_fragments),
+                  ==, 0);
 
   otrng_free(to_display);
   otrng_message_free(fmessage);
@@ -1145,4 +1411,9 @@ void functionals_client_add_tests(void) {
   g_test_add_func("/client/conversation_data_message_multiple_locations",
                   test_conversation_with_multiple_locations);
   g_test_add_func("/client/api", test_client_api);
+  g_test_add_func("/client/send_many", test_client_send_many);
+  g_test_add_func("/client/expires_session", test_client_expires_session);
+  g_test_add_func("/client/send_paths_schedule_expiry",
+                  test_client_send_paths_schedule_expiry);
+  g_test_add_func("/client/receive_plaintext", test_client_receive_plaintext);
 }
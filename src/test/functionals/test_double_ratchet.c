@@ -248,7 +248,8 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 5);
   g_assert_cmpint(bob->keys->pn, ==, 0);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 2);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  2);
 
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_3, bob);
@@ -262,7 +263,8 @@ static void test_double_ratchet_same_ratchet_out_of_order(void) {
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 5);
   g_assert_cmpint(bob->keys->pn, ==, 0);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 1);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  1);
 
   response_to_alice = otrng_response_new();
   result = otrng_receive_message(response_to_alice, to_send_2, bob);
@@ -352,7 +354,8 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   free_message_and_response(response_to_alice, &to_send_2);
 
   g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 3);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  0);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 3);
@@ -405,7 +408,8 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
   g_assert_cmpint(bob->keys->pn, ==, 1);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 1);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  1);
 
   // Bob receives the previous data message
   response_to_alice = otrng_response_new();
@@ -415,7 +419,8 @@ static void test_double_ratchet_new_ratchet_out_of_order(void) {
   free_message_and_response(response_to_alice, &to_send_3);
 
   g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  0);
   g_assert_cmpint(bob->keys->i, ==, 3);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
@@ -497,7 +502,8 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   free_message_and_response(response_to_alice, &to_send_2);
 
   g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 3);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  0);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 3);
@@ -575,7 +581,8 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
   g_assert_cmpint(bob->keys->pn, ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 1);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  1);
 
   // Bob receives the previous data message
   response_to_alice = otrng_response_new();
@@ -585,7 +592,8 @@ static void test_double_ratchet_new_ratchet_out_of_order_2(void) {
   free_message_and_response(response_to_alice, &to_send_3);
 
   g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  0);
   g_assert_cmpint(bob->keys->i, ==, 3);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 1);
@@ -663,7 +671,8 @@ static void test_double_ratchet_corrupted_ratchet(void) {
   free_message_and_response(response_to_alice, &to_send_2);
 
   g_assert_cmpint(otrng_list_len(bob->keys->old_mac_keys), ==, 2);
-  g_assert_cmpint(otrng_list_len(bob->keys->skipped_keys), ==, 0);
+  g_assert_cmpint(otrng_skipped_keys_store_len(bob->keys->skipped_keys), ==,
+                  0);
   g_assert_cmpint(bob->keys->i, ==, 1);
   g_assert_cmpint(bob->keys->j, ==, 0);
   g_assert_cmpint(bob->keys->k, ==, 2);
@@ -0,0 +1,163 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+
+#include "test_helpers.h"
+
+#include "test_fixtures.h"
+
+#define STRESS_THREADS 4
+#define STRESS_CONVERSATIONS 3
+#define STRESS_MESSAGES 6
+
+typedef struct stress_worker_s {
+  otrng_global_state_s *gs;
+  int id;
+  otrng_client_s *shared;
+} stress_worker_s;
+
+static void set_up_shared_state_client(otrng_client_s *client, int byte) {
+  uint8_t long_term_priv[ED448_PRIVATE_BYTES] = {byte + 0xA};
+  uint8_t forging_sym[ED448_PRIVATE_BYTES] = {byte + 0xD};
+  otrng_public_key *forging_key = create_forging_key_from(forging_sym);
+
+  otrng_client_add_private_key_v4(client, long_term_priv);
+  otrng_client_add_forging_key(client, *forging_key);
+  otrng_free(forging_key);
+  otrng_client_add_instance_tag(client, 0x100 + byte);
+
+  client->client_profile = otrng_client_build_default_client_profile(client);
+  client->should_heartbeat = test_should_not_heartbeat;
+}
+
+static void exchange_messages(otrng_s *alice, otrng_s *bob) {
+  int i;
+
+  for (i = 0; i < STRESS_MESSAGES; i++) {
+    otrng_s *sender = i % 3 == 2 ? bob : alice;
+    otrng_s *receiver = sender == alice ? bob : alice;
+    otrng_response_s *response = otrng_response_new();
+    string_p to_send = NULL;
+
+    assert_message_sent(
+        otrng_send_message(&to_send, "hello", NULL, 0, sender), to_send);
+    assert_message_rec(otrng_receive_message(response, to_send, receiver),
+                       "hello", response);
+
+    free_message_and_response(response, &to_send);
+  }
+}
+
+/* Every worker owns its own pair of clients, and they all share the global
+ * state: its client map, the instance tags and the DH constants. */
+static gpointer stress_worker(gpointer data) {
+  stress_worker_s *worker = data;
+  otrng_policy_s policy = {.allows = OTRNG_ALLOW_V34,
+                           .type = OTRNG_POLICY_ALWAYS};
+  otrng_client_s *alice_client, *bob_client;
+  char alice_account[32], bob_account[32];
+  int i;
+
+  otrng_assert_is_success(otrng_init(otrng_false));
+
+  snprintf(alice_account, sizeof(alice_account), "alice%d@localhost",
+           worker->id);
+  snprintf(bob_account, sizeof(bob_account), "bob%d@localhost", worker->id);
+
+  worker->shared =
+      otrng_client_get(worker->gs, create_client_id("otr", "shared"));
+
+  alice_client =
+      otrng_client_get(worker->gs, create_client_id("otr", alice_account));
+  bob_client =
+      otrng_client_get(worker->gs, create_client_id("otr", bob_account));
+  set_up_shared_state_client(alice_client, 2 * worker->id + 1);
+  set_up_shared_state_client(bob_client, 2 * worker->id + 2);
+
+  for (i = 0; i < STRESS_CONVERSATIONS; i++) {
+    otrng_s *alice = otrng_new(alice_client, policy);
+    otrng_s *bob = otrng_new(bob_client, policy);
+
+    do_dake_fixture(alice, bob);
+    exchange_messages(alice, bob);
+
+    otrng_conn_free_all(alice, bob);
+  }
+
+  return NULL;
+}
+
+static void run_stress_workers(stress_worker_s *workers,
+                               otrng_global_state_s *gs) {
+  GThread *threads[STRESS_THREADS];
+  int i;
+
+  for (i = 0; i < STRESS_THREADS; i++) {
+    workers[i].gs = gs;
+    workers[i].id = i;
+    workers[i].shared = NULL;
+    threads[i] = g_thread_new("stress", stress_worker, &workers[i]);
+  }
+
+  for (i = 0; i < STRESS_THREADS; i++) {
+    g_thread_join(threads[i]);
+  }
+}
+
+static void test_threads_share_global_state(void) {
+  otrng_global_state_s *gs =
+      otrng_global_state_new(test_callbacks, otrng_false);
+  stress_worker_s workers[STRESS_THREADS];
+  int i;
+
+  run_stress_workers(workers, gs);
+
+  /* The client every worker asked for was only created once */
+  for (i = 1; i < STRESS_THREADS; i++) {
+    otrng_assert(workers[i].shared == workers[0].shared);
+  }
+  g_assert_cmpint(otrng_list_len(gs->clients), ==, 2 * STRESS_THREADS + 1);
+
+  otrng_global_state_free(gs);
+}
+
+static void test_threads_share_keypair_pool(void) {
+  otrng_global_state_s *gs =
+      otrng_global_state_new(test_callbacks, otrng_false);
+  stress_worker_s workers[STRESS_THREADS];
+
+  otrng_assert_is_success(
+      otrng_global_state_enable_keypair_pool(gs, STRESS_THREADS, 1));
+  otrng_assert_is_error(
+      otrng_global_state_enable_keypair_pool(gs, STRESS_THREADS, 1));
+
+  run_stress_workers(workers, gs);
+
+  otrng_global_state_free(gs);
+}
+
+void functionals_threads_add_tests(void) {
+  g_test_add_func("/threads/share_global_state",
+                  test_threads_share_global_state);
+  g_test_add_func("/threads/share_keypair_pool",
+                  test_threads_share_keypair_pool);
+}
@@ -53,8 +53,7 @@ get_account_and_protocol_cb_empty(char **account, char **protocol,
 
 void set_up_client(otrng_client_s *client, int byte) {
   client->global_state = otrng_global_state_new(test_callbacks, otrng_false);
-  client->global_state->clients =
-      otrng_list_add(client, client->global_state->clients);
+  otrng_global_state_add_client(client->global_state, client);
 
   uint8_t long_term_priv[ED448_PRIVATE_BYTES] = {byte + 0xA};
   uint8_t forging_sym[ED448_PRIVATE_BYTES] = {byte + 0xD};
@@ -76,8 +75,7 @@ void set_up_client(otrng_client_s *client, int byte) {
 void set_up_client_different_policy(otrng_client_s *client, int byte) {
   client->global_state =
       otrng_global_state_new(test_callbacks_policy, otrng_false);
-  client->global_state->clients =
-      otrng_list_add(client, client->global_state->clients);
+  otrng_global_state_add_client(client->global_state, client);
 
   uint8_t long_term_priv[ED448_PRIVATE_BYTES] = {byte + 0xA};
   uint8_t forging_sym[ED448_PRIVATE_BYTES] = {byte + 0xD};
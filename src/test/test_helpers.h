@@ -21,12 +21,14 @@
 #ifndef __TEST_HELPERS_H__
 #define __TEST_HELPERS_H__
 
+#define OTRNG_ALLOC_PRIVATE
 #define OTRNG_AUTH_PRIVATE
 #define OTRNG_CLIENT_PRIVATE
 #define OTRNG_DAKE_PRIVATE
 #define OTRNG_DH_PRIVATE
 #define OTRNG_ED448_PRIVATE
 #define OTRNG_FRAGMENT_PRIVATE
+#define OTRNG_KECCAK_PRIVATE
 #define OTRNG_KEY_MANAGEMENT_PRIVATE
 #define OTRNG_LIST_PRIVATE
 #define OTRNG_OTRNG_PRIVATE
@@ -21,17 +21,22 @@
 #ifndef __TEST_UNIT_ALL_H__
 #define __TEST_UNIT_ALL_H__
 
+void units_alloc_add_tests(void);
 void units_auth_add_tests(void);
+void units_binary_store_add_tests(void);
 void units_client_add_tests(void);
 void units_client_profile_add_tests(void);
 void units_dake_add_tests(void);
 void units_data_message_add_tests(void);
 void units_dh_add_tests(void);
 void units_ed448_add_tests(void);
+void units_expiry_add_tests(void);
 void units_fragment_add_tests(void);
 void units_identity_message_add_tests(void);
 void units_instance_tag_add_tests(void);
+void units_keccak_add_tests(void);
 void units_key_management_add_tests(void);
+void units_keypair_pool_add_tests(void);
 void units_list_add_tests(void);
 void units_messaging_add_tests(void);
 void units_non_interactive_messages_add_tests(void);
@@ -44,23 +49,30 @@ void units_prekey_messages_add_tests(void);
 void units_prekey_profile_add_tests(void);
 void units_prekey_proofs_add_tests(void);
 void units_prekey_server_client_add_tests(void);
+void units_profile_cache_add_tests(void);
 void units_serialize_add_tests(void);
+void units_skipped_keys_add_tests(void);
 void units_standard_add_tests(void);
 void units_tlv_add_tests(void);
 
 #define REGISTER_UNITS                                                         \
   do {                                                                         \
+    units_alloc_add_tests();                                                   \
     units_auth_add_tests();                                                    \
+    units_binary_store_add_tests();                                            \
     units_client_add_tests();                                                  \
     units_client_profile_add_tests();                                          \
     units_dake_add_tests();                                                    \
     units_data_message_add_tests();                                            \
     units_dh_add_tests();                                                      \
     units_ed448_add_tests();                                                   \
+    units_expiry_add_tests();                                                  \
     units_fragment_add_tests();                                                \
     units_identity_message_add_tests();                                        \
     units_instance_tag_add_tests();                                            \
+    units_keccak_add_tests();                                                  \
     units_key_management_add_tests();                                          \
+    units_keypair_pool_add_tests();                                            \
     units_list_add_tests();                                                    \
     units_messaging_add_tests();                                               \
     units_non_interactive_messages_add_tests();                                \
@@ -73,7 +85,9 @@ void units_tlv_add_tests(void);
     units_prekey_profile_add_tests();                                          \
     units_prekey_proofs_add_tests();                                           \
     units_prekey_server_client_add_tests();                                    \
+    units_profile_cache_add_tests();                                           \
     units_serialize_add_tests();                                               \
+    units_skipped_keys_add_tests();                                            \
     units_standard_add_tests();                                                \
     units_tlv_add_tests();                                                     \
   } while (0);
@@ -0,0 +1,130 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test_helpers.h"
+
+#include "alloc.h"
+#include "skipped_keys.h"
+
+static void test_secure_alloc_is_zeroed() {
+  uint8_t *secret = otrng_secure_alloc(64);
+  size_t i;
+
+  for (i = 0; i < 64; i++) {
+    g_assert_cmpint(secret[i], ==, 0);
+  }
+
+  memset(secret, 0xAB, 64);
+  otrng_secure_free(secret);
+
+  /* A reused chunk must come back zeroed as well */
+  secret = otrng_secure_alloc(64);
+  for (i = 0; i < 64; i++) {
+    g_assert_cmpint(secret[i], ==, 0);
+  }
+  otrng_secure_free(secret);
+}
+
+static void test_secure_alloc_uses_arenas() {
+  otrng_secure_alloc_stats_s before, after;
+  uint8_t *secrets[100];
+  uint8_t *big;
+  int i;
+
+  otrng_secure_alloc_get_stats(&before);
+
+  for (i = 0; i < 100; i++) {
+    secrets[i] = otrng_secure_alloc(64);
+  }
+  big = otrng_secure_alloc(SECURE_ARENA_BYTES);
+
+  otrng_secure_alloc_get_stats(&after);
+
+#ifdef OTRNG_SECURE_ALLOC_DEBUG
+  g_assert_cmpint(after.sodium_allocs - before.sodium_allocs, ==, 101);
+#else
+  /* 100 chunks of 64 bytes fit in a single arena */
+  g_assert_cmpint(after.slab_allocs - before.slab_allocs, ==, 100);
+  g_assert_cmpint(after.arenas_mapped - before.arenas_mapped, <=, 1);
+  g_assert_cmpint(after.sodium_allocs - before.sodium_allocs, ==, 1);
+#endif
+
+  for (i = 0; i < 100; i++) {
+    otrng_secure_free(secrets[i]);
+  }
+  otrng_secure_free(big);
+}
+
+static void test_secure_free_finds_the_arena() {
+  otrng_secure_alloc_stats_s before, after;
+  uint8_t *secrets[1200];
+  uint8_t *big = otrng_secure_alloc(1024);
+  int i;
+
+  otrng_secure_alloc_get_stats(&before);
+
+  /* Enough 128-byte secrets to need several arenas */
+  for (i = 0; i < 1200; i++) {
+    secrets[i] = otrng_secure_alloc(128);
+    secrets[i][0] = i & 0xFF;
+  }
+
+  /* Free them out of order, so that arenas empty in between */
+  for (i = 0; i < 1200; i += 2) {
+    otrng_secure_free(secrets[i]);
+  }
+  for (i = 1; i < 1200; i += 2) {
+    g_assert_cmpint(secrets[i][0], ==, i & 0xFF);
+    otrng_secure_free(secrets[i]);
+  }
+  otrng_secure_free(big);
+
+  otrng_secure_alloc_get_stats(&after);
+
+#ifdef OTRNG_SECURE_ALLOC_DEBUG
+  g_assert_cmpint(after.sodium_frees - before.sodium_frees, ==, 1201);
+#else
+  g_assert_cmpint(after.slab_frees - before.slab_frees, ==, 1200);
+  g_assert_cmpint(after.sodium_frees - before.sodium_frees, ==, 1);
+  /* Only one arena of the size class is kept around */
+  g_assert_cmpint(after.arenas_live, <=, before.arenas_live + 1);
+#endif
+}
+
+static void test_secure_size_class() {
+  g_assert_cmpint(secure_size_class(1), ==, 0);
+  g_assert_cmpint(secure_size_class(64), ==, 0);
+  g_assert_cmpint(secure_size_class(65), ==, 1);
+  g_assert_cmpint(secure_size_class(128), ==, 1);
+  g_assert_cmpint(secure_size_class(sizeof(skipped_keys_s)), ==, 2);
+  g_assert_cmpint(secure_size_class(1024), ==, -1);
+}
+
+void units_alloc_add_tests(void) {
+  g_test_add_func("/alloc/secure_alloc_is_zeroed",
+                  test_secure_alloc_is_zeroed);
+  g_test_add_func("/alloc/secure_alloc_uses_arenas",
+                  test_secure_alloc_uses_arenas);
+  g_test_add_func("/alloc/secure_free_finds_the_arena",
+                  test_secure_free_finds_the_arena);
+  g_test_add_func("/alloc/secure_size_class", test_secure_size_class);
+}
@@ -536,9 +536,55 @@ static void test_rsig_compatible_with_prekey_server() {
       (const uint8_t *)msg, 2));
 }
 
+static void test_rsig_verify_batch() {
+  const char *msgs[3] = {"one", "two", "three"};
+  otrng_keypair_s p1, p2, p3;
+  uint8_t sym1[ED448_PRIVATE_BYTES] = {0}, sym2[ED448_PRIVATE_BYTES] = {0},
+          sym3[ED448_PRIVATE_BYTES] = {0};
+  ring_sig_s sigmas[3];
+  rsig_batch_item_s items[3];
+  otrng_bool results[3];
+  int i;
+
+  random_bytes(sym1, ED448_PRIVATE_BYTES);
+  random_bytes(sym2, ED448_PRIVATE_BYTES);
+  random_bytes(sym3, ED448_PRIVATE_BYTES);
+
+  otrng_assert_is_success(otrng_keypair_generate(&p1, sym1));
+  otrng_assert_is_success(otrng_keypair_generate(&p2, sym2));
+  otrng_assert_is_success(otrng_keypair_generate(&p3, sym3));
+
+  for (i = 0; i < 3; i++) {
+    otrng_assert_is_success(otrng_rsig_authenticate(
+        &sigmas[i], p2.priv, p2.pub, p1.pub, p2.pub, p3.pub,
+        (const uint8_t *)msgs[i], strlen(msgs[i])));
+
+    items[i].sigma = &sigmas[i];
+    items[i].A1 = p1.pub;
+    items[i].A2 = p2.pub;
+    items[i].A3 = p3.pub;
+    items[i].msg = (const uint8_t *)msgs[i];
+    items[i].msg_len = strlen(msgs[i]);
+  }
+
+  otrng_assert(otrng_rsig_verify_batch(results, items, 3));
+  otrng_assert(results[0] && results[1] && results[2]);
+  otrng_assert(otrng_rsig_verify_batch(NULL, items, 0));
+
+  /* The second signature does not sign this message */
+  items[1].msg = (const uint8_t *)msgs[0];
+  items[1].msg_len = strlen(msgs[0]);
+
+  otrng_assert(!otrng_rsig_verify_batch(results, items, 3));
+  otrng_assert(results[0]);
+  otrng_assert(!results[1]);
+  otrng_assert(results[2]);
+}
+
 void units_auth_add_tests(void) {
   g_test_add_func("/ring-signature/rsig_auth", test_rsig_auth);
   g_test_add_func("/ring-signature/calculate_c", test_rsig_calculate_c);
+  g_test_add_func("/ring-signature/verify_batch", test_rsig_verify_batch);
   g_test_add_func("/ring-signature/compatible_with_prekey_server",
                   test_rsig_compatible_with_prekey_server);
 }
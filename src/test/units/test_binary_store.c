@@ -0,0 +1,387 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test_fixtures.h"
+#include "test_helpers.h"
+
+#include "binary_store.h"
+#include "fingerprint.h"
+#include "messaging.h"
+
+/* Expects the file pointer to be at the END of the file */
+static char *read_whole_file(FILE *fp) {
+  long fsize = ftell(fp);
+  char *buffer;
+
+  if (fsize < 0) {
+    return NULL;
+  }
+
+  buffer = otrng_xmalloc_z(fsize + 1);
+  rewind(fp);
+  if (fsize > 0 && fread(buffer, fsize, 1, fp) != 1) {
+    otrng_free(buffer);
+    return NULL;
+  }
+
+  return buffer;
+}
+
+static otrng_client_s *set_up_stored_client(void) {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_fingerprint bob_fp = {1}, charlie_fp = {2};
+  prekey_message_s **messages;
+
+  set_up_client(alice, 1);
+  alice->prekey_profile = otrng_client_build_default_prekey_profile(alice);
+  messages = otrng_client_build_prekey_messages(3, alice);
+  otrng_assert(messages);
+  otrng_free(messages);
+
+  otrng_fingerprint_add(alice, bob_fp, "bob@localhost", otrng_true);
+  otrng_fingerprint_add(alice, charlie_fp, "charlie@localhost", otrng_false);
+
+  return alice;
+}
+
+static void test_binary_store_round_trip(void) {
+  otrng_client_s *alice = set_up_stored_client();
+  otrng_global_state_s *gs;
+  otrng_client_s *loaded;
+  otrng_known_fingerprint_s *kf;
+  const list_element_s *el;
+  FILE *f = tmpfile();
+
+  otrng_assert_is_success(
+      otrng_global_state_store_write_to(alice->global_state, f));
+  fflush(f);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(otrng_global_state_store_read_from(gs, f));
+  fclose(f);
+
+  /* Nothing is decoded until the client is looked up */
+  otrng_assert(!gs->clients);
+  g_assert_cmpuint(otrng_binary_store_len(gs->store), ==, 1);
+
+  loaded = otrng_client_get(gs, ALICE_IDENTITY);
+  otrng_assert(loaded);
+  g_assert_cmpuint(otrng_list_len(gs->clients), ==, 1);
+
+  otrng_assert(loaded->keypair);
+  otrng_assert_cmpmem(alice->keypair->sym, loaded->keypair->sym,
+                      ED448_PRIVATE_BYTES);
+  otrng_assert(otrng_ec_point_eq(*alice->forging_key, *loaded->forging_key));
+  otrng_assert_client_profile_eq(loaded->client_profile,
+                                 alice->client_profile);
+  otrng_assert_prekey_profile_eq(loaded->prekey_profile,
+                                 alice->prekey_profile);
+  otrng_assert(!loaded->exp_client_profile);
+  otrng_assert(!loaded->exp_prekey_profile);
+
+  g_assert_cmpuint(otrng_list_len(loaded->our_prekeys), ==, 3);
+  for (el = alice->our_prekeys; el; el = el->next) {
+    const prekey_message_s *msg = el->data;
+    const prekey_message_s *loaded_msg =
+        otrng_client_get_prekey_by_id(msg->id, loaded);
+    otrng_assert(loaded_msg);
+    otrng_assert(otrng_ec_point_eq(msg->Y, loaded_msg->Y));
+  }
+
+  kf = otrng_fingerprint_get_by_username(loaded, "bob@localhost");
+  otrng_assert(kf);
+  otrng_assert(kf->trusted);
+  g_assert_cmpuint(kf->fp[0], ==, 1);
+  kf = otrng_fingerprint_get_by_username(loaded, "charlie@localhost");
+  otrng_assert(kf);
+  otrng_assert(!kf->trusted);
+  g_assert_cmpuint(kf->fp[0], ==, 2);
+
+  /* Clients that aren't in the store are created empty */
+  loaded = otrng_client_get(gs, BOB_IDENTITY);
+  otrng_assert(loaded);
+  otrng_assert(!loaded->keypair);
+
+  otrng_global_state_free(gs);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_binary_store_rejects_invalid_files(void) {
+  otrng_global_state_s *gs =
+      otrng_global_state_new(test_callbacks, otrng_false);
+  /* A version 1 header announcing 1000 clients, with no index */
+  const uint8_t truncated[] = {'O', 'T', 'R', 'N', 'G', 'B', 'S', 0,
+                               0,   0,   0,   1,   0,   0,   0x03, 0xE8};
+  uint8_t future[sizeof(truncated)];
+  FILE *f;
+
+  f = tmpfile();
+  fputs("not a binary store\n", f);
+  fflush(f);
+  otrng_assert_is_error(otrng_global_state_store_read_from(gs, f));
+  fclose(f);
+
+  f = tmpfile();
+  fwrite(truncated, 1, sizeof(truncated), f);
+  fflush(f);
+  otrng_assert_is_error(otrng_global_state_store_read_from(gs, f));
+  fclose(f);
+
+  memcpy(future, truncated, sizeof(future));
+  future[11] = 2;
+  future[15] = 0;
+  f = tmpfile();
+  fwrite(future, 1, sizeof(future), f);
+  fflush(f);
+  otrng_assert_is_error(otrng_global_state_store_read_from(gs, f));
+  fclose(f);
+
+  otrng_assert(!gs->store);
+
+  otrng_global_state_free(gs);
+}
+
+static void test_binary_store_checks_entries_when_read(void) {
+  otrng_client_s *alice = set_up_stored_client();
+  otrng_global_state_s *gs;
+  char *contents;
+  long len;
+  FILE *f = tmpfile();
+
+  otrng_assert_is_success(
+      otrng_global_state_store_write_to(alice->global_state, f));
+  fflush(f);
+  len = ftell(f);
+  contents = read_whole_file(f);
+  fclose(f);
+
+  /* The id of the only entry points past the end of the file */
+  memset(contents + 16, 0xFF, 8);
+  f = tmpfile();
+  fwrite(contents, 1, len, f);
+  fflush(f);
+  otrng_free(contents);
+
+  /* Opening doesn't look at the entries */
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(otrng_global_state_store_read_from(gs, f));
+  fclose(f);
+
+  otrng_assert_is_error(otrng_global_state_store_load_all(gs));
+
+  otrng_global_state_free(gs);
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_binary_store_load_clears_missing_state(void) {
+  otrng_client_s *stored = otrng_client_new(ALICE_IDENTITY);
+  otrng_client_s *alice = set_up_stored_client();
+  otrng_global_state_s *gs;
+  FILE *f = tmpfile();
+
+  set_up_client(stored, 1);
+  otrng_assert_is_success(
+      otrng_global_state_store_write_to(stored->global_state, f));
+  fflush(f);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(otrng_global_state_store_read_from(gs, f));
+  fclose(f);
+
+  /* The record has no prekey profile, prekey messages or fingerprints */
+  otrng_assert_is_success(otrng_binary_store_load_client(gs->store, alice));
+  otrng_assert(alice->keypair);
+  otrng_assert(alice->client_profile);
+  otrng_assert(!alice->prekey_profile);
+  otrng_assert(!alice->our_prekeys);
+  otrng_assert(!otrng_fingerprint_get_by_username(alice, "bob@localhost"));
+
+  otrng_global_state_free(gs);
+  otrng_global_state_free(alice->global_state);
+  otrng_global_state_free(stored->global_state);
+}
+
+static void test_binary_store_converts_text_files(void) {
+  otrng_client_s *alice = set_up_stored_client();
+  otrng_global_state_s *gs;
+  FILE *text_keys = tmpfile(), *text_fps = tmpfile(), *store = tmpfile();
+  char *expected_keys, *expected_fps, *keys, *fps;
+
+  /* What the text files hold survives a trip through a binary store */
+  otrng_global_state_private_key_v4_write_to(alice->global_state, text_keys);
+  otrng_global_state_fingerprints_v4_write_to(alice->global_state, text_fps);
+  expected_keys = read_whole_file(text_keys);
+  expected_fps = read_whole_file(text_fps);
+  fclose(text_keys);
+  fclose(text_fps);
+
+  otrng_assert_is_success(
+      otrng_global_state_store_write_to(alice->global_state, store));
+  fflush(store);
+
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(otrng_global_state_store_read_from(gs, store));
+  fclose(store);
+  otrng_assert_is_success(otrng_global_state_store_load_all(gs));
+  g_assert_cmpuint(otrng_list_len(gs->clients), ==, 1);
+
+  text_keys = tmpfile();
+  text_fps = tmpfile();
+  otrng_global_state_private_key_v4_write_to(gs, text_keys);
+  otrng_global_state_fingerprints_v4_write_to(gs, text_fps);
+  keys = read_whole_file(text_keys);
+  fps = read_whole_file(text_fps);
+  fclose(text_keys);
+  fclose(text_fps);
+
+  g_assert_cmpstr(keys, ==, expected_keys);
+  g_assert_cmpstr(fps, ==, expected_fps);
+
+  otrng_free(expected_keys);
+  otrng_free(expected_fps);
+  otrng_free(keys);
+  otrng_free(fps);
+  otrng_global_state_free(gs);
+  otrng_global_state_free(alice->global_state);
+}
+
+#define BENCHMARK_ACCOUNTS 2000
+
+/* Lines alternate between two buffers: the text readers only look up a new
+ * client when the id pointers change. */
+static otrng_client_id_s read_storage_id(FILE *f) {
+  static char lines[2][64];
+  static int current = 0;
+  otrng_client_id_s client_id = {.protocol = NULL, .account = NULL};
+  char *line = lines[current], *colon;
+
+  if (!fgets(line, sizeof(lines[0]), f)) {
+    return client_id;
+  }
+  current = !current;
+
+  line[strcspn(line, "\n")] = '\0';
+  colon = strchr(line, ':');
+  if (!colon) {
+    return client_id;
+  }
+
+  *colon = '\0';
+  client_id.protocol = line;
+  client_id.account = colon + 1;
+
+  return client_id;
+}
+
+static void test_benchmark_binary_store_startup(void) {
+  otrng_global_state_s *gs =
+      otrng_global_state_new(test_callbacks, otrng_false);
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0};
+  uint8_t forging_sym[ED448_PRIVATE_BYTES] = {1};
+  otrng_fingerprint fp = {0};
+  otrng_keypair_s *forging = otrng_keypair_new();
+  FILE *privf = tmpfile(), *forgingf = tmpfile(), *fpf = tmpfile(),
+       *store = tmpfile();
+  double text_time, open_time, load_all_time;
+  char account[32];
+  int i;
+
+  otrng_keypair_generate(forging, forging_sym);
+
+  for (i = 0; i < BENCHMARK_ACCOUNTS; i++) {
+    otrng_client_s *client;
+
+    snprintf(account, sizeof(account), "user%d@localhost", i);
+    client = otrng_client_get(gs, create_client_id("otr", account));
+    memcpy(sym, &i, sizeof(i));
+    otrng_client_add_private_key_v4(client, sym);
+    otrng_client_add_forging_key(client, forging->pub);
+    memcpy(fp, &i, sizeof(i));
+    otrng_fingerprint_add(client, fp, "peer@localhost", otrng_true);
+  }
+
+  otrng_global_state_private_key_v4_write_to(gs, privf);
+  otrng_global_state_forging_key_write_to(gs, forgingf);
+  otrng_global_state_fingerprints_v4_write_to(gs, fpf);
+  otrng_assert_is_success(otrng_global_state_store_write_to(gs, store));
+  otrng_global_state_free(gs);
+  rewind(privf);
+  rewind(forgingf);
+  rewind(fpf);
+  fflush(store);
+
+  g_test_timer_start();
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_global_state_private_key_v4_read_from(gs, privf, read_storage_id);
+  otrng_global_state_forging_key_read_from(gs, forgingf, read_storage_id);
+  otrng_global_state_fingerprints_v4_read_from(gs, fpf, NULL);
+  text_time = g_test_timer_elapsed();
+  g_assert_cmpuint(otrng_list_len(gs->clients), ==, BENCHMARK_ACCOUNTS);
+  otrng_global_state_free(gs);
+
+  /* Opening the store, and looking up a single account */
+  g_test_timer_start();
+  gs = otrng_global_state_new(test_callbacks, otrng_false);
+  otrng_assert_is_success(otrng_global_state_store_read_from(gs, store));
+  otrng_assert(otrng_client_get(gs, create_client_id("otr", "user0@localhost"))
+                   ->keypair);
+  open_time = g_test_timer_elapsed();
+
+  g_test_timer_start();
+  otrng_assert_is_success(otrng_global_state_store_load_all(gs));
+  load_all_time = g_test_timer_elapsed();
+  g_assert_cmpuint(otrng_list_len(gs->clients), ==, BENCHMARK_ACCOUNTS);
+  otrng_global_state_free(gs);
+
+  g_test_minimized_result(text_time, "text: %d accounts in %.3fs",
+                          BENCHMARK_ACCOUNTS, text_time);
+  g_test_minimized_result(open_time, "binary store: opened in %.3fs",
+                          open_time);
+  g_test_minimized_result(load_all_time,
+                          "binary store: %d accounts loaded in %.3fs",
+                          BENCHMARK_ACCOUNTS, load_all_time);
+
+  fclose(privf);
+  fclose(forgingf);
+  fclose(fpf);
+  fclose(store);
+  otrng_keypair_free(forging);
+}
+
+void units_binary_store_add_tests(void) {
+  g_test_add_func("/binary_store/round_trip", test_binary_store_round_trip);
+  g_test_add_func("/binary_store/rejects_invalid_files",
+                  test_binary_store_rejects_invalid_files);
+  g_test_add_func("/binary_store/checks_entries_when_read",
+                  test_binary_store_checks_entries_when_read);
+  g_test_add_func("/binary_store/load_clears_missing_state",
+                  test_binary_store_load_clears_missing_state);
+  g_test_add_func("/binary_store/converts_text_files",
+                  test_binary_store_converts_text_files);
+
+  if (g_test_perf()) {
+    g_test_add_func("/binary_store/benchmark/startup",
+                    test_benchmark_binary_store_startup);
+  }
+}
@@ -76,9 +76,235 @@ static void test_fingerprint_hash_to_human() {
                   strncmp(expected_fp, fp_human, OTRNG_FPRINT_HUMAN_LEN));
 }
 
+static void test_client_conversations_index() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_conversation_s *convs[100];
+  const list_element_s *el;
+  char recipient[32];
+  int i;
+
+  otrng_assert(!get_conversation_with("bob@localhost", alice));
+
+  for (i = 0; i < 100; i++) {
+    snprintf(recipient, sizeof(recipient), "peer%d@localhost", i);
+    convs[i] = new_conversation_with(recipient, NULL);
+    add_conversation(alice, convs[i]);
+  }
+
+  g_assert_cmpuint(alice->conversations_index->len, ==, 100);
+  for (i = 0; i < 100; i++) {
+    snprintf(recipient, sizeof(recipient), "peer%d@localhost", i);
+    otrng_assert(get_conversation_with(recipient, alice) == convs[i]);
+  }
+  otrng_assert(!get_conversation_with("peer100@localhost", alice));
+
+  destroy_client_conversation(convs[42], alice);
+  conversation_free(convs[42]);
+  otrng_assert(!get_conversation_with("peer42@localhost", alice));
+  otrng_assert(get_conversation_with("peer43@localhost", alice) == convs[43]);
+  g_assert_cmpuint(alice->conversations_index->len, ==, 99);
+
+  /* Removing the last conversation moves the tail back */
+  destroy_client_conversation(convs[99], alice);
+  conversation_free(convs[99]);
+  convs[99] = new_conversation_with("peer100@localhost", NULL);
+  add_conversation(alice, convs[99]);
+  otrng_assert(alice->last_conversation->data == convs[99]);
+
+  /* The list keeps the creation order */
+  el = alice->conversations;
+  for (i = 0; i < 100; i++) {
+    if (i == 42) {
+      continue;
+    }
+    otrng_assert(el->data == convs[i]);
+    el = el->next;
+  }
+  otrng_assert(!el);
+
+  otrng_client_free(alice);
+}
+
+static void test_client_prekey_messages_index() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  prekey_message_s *msgs[50];
+  const list_element_s *el;
+  uint32_t i;
+
+  set_up_client(alice, 1);
+
+  otrng_assert(!otrng_client_get_prekey_by_id(1, alice));
+
+  for (i = 0; i < 50; i++) {
+    msgs[i] = otrng_xmalloc_z(sizeof(prekey_message_s));
+    /* Ids sharing their low bits, to exercise probing */
+    msgs[i]->id = 0x1000 * (i + 1);
+    otrng_client_store_my_prekey_message(msgs[i], alice);
+  }
+
+  g_assert_cmpuint(alice->our_prekeys_index.len, ==, 50);
+  for (i = 0; i < 50; i++) {
+    otrng_assert(otrng_client_get_prekey_by_id(msgs[i]->id, alice) ==
+                 msgs[i]);
+  }
+  otrng_assert(!otrng_client_get_prekey_by_id(0x1000 * 51, alice));
+
+  /* From the middle, the head and the tail */
+  otrng_client_delete_my_prekey_message_by_id(0x1000 * 21, alice);
+  otrng_client_delete_my_prekey_message_by_id(0x1000 * 2, alice);
+  otrng_client_delete_my_prekey_message_by_id(0x1000 * 50, alice);
+  otrng_client_delete_my_prekey_message_by_id(0x1000 * 51, alice);
+
+  g_assert_cmpuint(alice->our_prekeys_index.len, ==, 47);
+  g_assert_cmpuint(otrng_list_len(alice->our_prekeys), ==, 47);
+  for (i = 0; i < 50; i++) {
+    if (i == 1 || i == 20 || i == 49) {
+      otrng_assert(!otrng_client_get_prekey_by_id(0x1000 * (i + 1), alice));
+    } else {
+      otrng_assert(otrng_client_get_prekey_by_id(msgs[i]->id, alice) ==
+                   msgs[i]);
+    }
+  }
+
+  /* Every indexed message is in the list, and stores append to its end */
+  for (el = alice->our_prekeys; el; el = el->next) {
+    const prekey_message_s *msg = el->data;
+    otrng_assert(otrng_client_get_prekey_by_id(msg->id, alice) == msg);
+  }
+  msgs[49] = otrng_xmalloc_z(sizeof(prekey_message_s));
+  msgs[49]->id = 0x1000 * 50;
+  otrng_client_store_my_prekey_message(msgs[49], alice);
+  otrng_assert(alice->last_prekey->data == msgs[49]);
+
+  /* A list assigned from outside can be indexed again */
+  el = alice->our_prekeys;
+  alice->our_prekeys = el->next;
+  otrng_prekey_message_free(el->data);
+  otrng_free((list_element_s *)el);
+  otrng_client_reindex_my_prekey_messages(alice);
+  g_assert_cmpuint(alice->our_prekeys_index.len, ==, 47);
+  otrng_assert(alice->last_prekey->data == msgs[49]);
+
+  otrng_client_forget_my_prekey_messages(alice);
+  otrng_assert(!alice->our_prekeys);
+  otrng_assert(!otrng_client_get_prekey_by_id(0x1000, alice));
+
+  otrng_global_state_free(alice->global_state);
+}
+
+static void test_client_known_fingerprints_index() {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  otrng_known_fingerprint_s *kfs[40], *shared;
+  otrng_fingerprint fps[40];
+  char username[32];
+  const list_element_s *el;
+  int i;
+
+  for (i = 0; i < 40; i++) {
+    memset(fps[i], 0, sizeof(otrng_fingerprint));
+    fps[i][0] = i;
+    /* every peer has two fingerprints */
+    snprintf(username, sizeof(username), "peer%d@localhost", i % 20);
+    kfs[i] = otrng_fingerprint_add(alice, fps[i], username, otrng_false);
+  }
+
+  for (i = 0; i < 40; i++) {
+    otrng_assert(otrng_fingerprint_get_by_fp(alice, fps[i]) == kfs[i]);
+  }
+  for (i = 0; i < 20; i++) {
+    snprintf(username, sizeof(username), "peer%d@localhost", i);
+    otrng_assert(otrng_fingerprint_get_by_username(alice, username) ==
+                 kfs[i]);
+  }
+
+  /* The first fingerprint added for a username is returned */
+  otrng_fingerprint_forget(alice, kfs[3]);
+  otrng_assert(!otrng_fingerprint_get_by_fp(alice, fps[3]));
+  otrng_assert(otrng_fingerprint_get_by_username(alice, "peer3@localhost") ==
+               kfs[23]);
+  otrng_fingerprint_forget(alice, kfs[23]);
+  otrng_assert(!otrng_fingerprint_get_by_username(alice, "peer3@localhost"));
+
+  /* Two peers can share a fingerprint, and only one is forgotten */
+  shared = otrng_fingerprint_add(alice, fps[5], "other@localhost", otrng_true);
+  otrng_assert(otrng_fingerprint_get_by_fp(alice, fps[5]) == kfs[5]);
+  otrng_fingerprint_forget(alice, kfs[5]);
+  otrng_assert(otrng_fingerprint_get_by_fp(alice, fps[5]) == shared);
+
+  /* The list keeps the order they were added in */
+  el = alice->fingerprints->fps;
+  for (i = 0; i < 40; i++) {
+    if (i == 3 || i == 5 || i == 23) {
+      continue;
+    }
+    otrng_assert(el->data == kfs[i]);
+    el = el->next;
+  }
+  otrng_assert(el->data == shared);
+  otrng_assert(!el->next);
+
+  otrng_client_free(alice);
+}
+
+#define BENCHMARK_CONVERSATIONS 100000
+#define BENCHMARK_LIST_LOOKUPS 1000
+
+static void test_benchmark_client_get_conversation(void) {
+  otrng_client_s *alice = otrng_client_new(ALICE_IDENTITY);
+  char recipient[32];
+  const list_element_s *el;
+  double index_time, list_time;
+  int i;
+
+  for (i = 0; i < BENCHMARK_CONVERSATIONS; i++) {
+    snprintf(recipient, sizeof(recipient), "peer%d@localhost", i);
+    add_conversation(alice, new_conversation_with(recipient, NULL));
+  }
+
+  g_test_timer_start();
+  for (i = 0; i < BENCHMARK_CONVERSATIONS; i++) {
+    snprintf(recipient, sizeof(recipient), "peer%d@localhost", i);
+    otrng_assert(get_conversation_with(recipient, alice));
+  }
+  index_time = g_test_timer_elapsed();
+
+  /* The list walk this replaced, over the most recent peers */
+  g_test_timer_start();
+  for (i = BENCHMARK_CONVERSATIONS - BENCHMARK_LIST_LOOKUPS;
+       i < BENCHMARK_CONVERSATIONS; i++) {
+    snprintf(recipient, sizeof(recipient), "peer%d@localhost", i);
+    for (el = alice->conversations; el; el = el->next) {
+      const otrng_conversation_s *conv = el->data;
+      if (!strcmp(conv->recipient, recipient)) {
+        break;
+      }
+    }
+    otrng_assert(el);
+  }
+  list_time = g_test_timer_elapsed();
+
+  g_test_minimized_result(index_time, "index: %d lookups in %.3fs",
+                          BENCHMARK_CONVERSATIONS, index_time);
+  g_test_minimized_result(list_time, "list: %d lookups in %.3fs",
+                          BENCHMARK_LIST_LOOKUPS, list_time);
+
+  otrng_client_free(alice);
+}
+
 void units_client_add_tests(void) {
   g_test_add_func("/client/fingerprint_to_human",
                   test_fingerprint_hash_to_human);
   g_test_add_func("/client/get_our_fingerprint",
                   test_client_get_our_fingerprint);
+  g_test_add_func("/client/conversations_index",
+                  test_client_conversations_index);
+  g_test_add_func("/client/known_fingerprints_index",
+                  test_client_known_fingerprints_index);
+  g_test_add_func("/client/prekey_messages_index",
+                  test_client_prekey_messages_index);
+
+  if (g_test_perf()) {
+    g_test_add_func("/client/benchmark/get_conversation",
+                    test_benchmark_client_get_conversation);
+  }
 }
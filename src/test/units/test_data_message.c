@@ -24,7 +24,9 @@
 
 #include "test_fixtures.h"
 
+#include "base64.h"
 #include "data_message.h"
+#include "protocol.h"
 #include "serialize.h"
 
 static data_message_s *set_up_data_message() {
@@ -191,9 +193,17 @@ static void test_otrng_data_message_deserializes() {
   ser = otrng_xrealloc(ser, ser_len + DATA_MSG_MAC_BYTES);
   memcpy(ser + ser_len, mac_data, DATA_MSG_MAC_BYTES);
 
+  otrng_secure_alloc_stats_s before, after;
   data_message_s *deser = otrng_data_message_new();
+  otrng_secure_alloc_get_stats(&before);
   otrng_assert_is_success(otrng_data_message_deserialize(
       deser, ser, ser_len + DATA_MSG_MAC_BYTES, NULL));
+  otrng_secure_alloc_get_stats(&after);
+
+  /* The ciphertext is decrypted in place, so it lives in secure memory */
+  otrng_assert(after.slab_allocs + after.sodium_allocs ==
+               before.slab_allocs + before.sodium_allocs + 1);
+  otrng_assert(deser->enc_msg_secure);
 
   otrng_assert(data_msg->sender_instance_tag == deser->sender_instance_tag);
   otrng_assert(data_msg->receiver_instance_tag == deser->receiver_instance_tag);
@@ -255,6 +265,65 @@ static void test_data_message_valid() {
   otrng_data_message_free(data_msg);
 }
 
+static void test_data_message_encodes_into_buffer() {
+  data_message_s *data_msg = set_up_data_message();
+  k_msg_mac mac_key = {0x11};
+  uint8_t reveal[MAC_KEY_BYTES] = {0x22};
+  uint8_t *body = NULL;
+  size_t body_len = 0;
+  size_t written = 0;
+
+  otrng_assert_is_success(
+      otrng_data_message_body_serialize(&body, &body_len, data_msg));
+  g_assert_cmpint(otrng_data_message_body_len(data_msg), ==, body_len);
+
+  // The expected encoding of body || authenticator || revealed MAC keys
+  size_t ser_len = body_len + DATA_MSG_MAC_BYTES + MAC_KEY_BYTES;
+  uint8_t *ser = otrng_xmalloc_z(ser_len);
+  memcpy(ser, body, body_len);
+  otrng_assert_is_success(otrng_data_message_authenticator(
+      ser + body_len, DATA_MSG_MAC_BYTES, mac_key, body, body_len));
+  memcpy(ser + body_len + DATA_MSG_MAC_BYTES, reveal, MAC_KEY_BYTES);
+  char *expected = otrl_base64_otr_encode(ser, ser_len);
+
+  size_t buf_len = strlen(expected) + 1;
+  char *buf = otrng_xmalloc_z(buf_len);
+
+  otrng_assert(!serialize_and_encode_data_message_into(
+      buf, buf_len - 1, &written, mac_key, reveal, MAC_KEY_BYTES, data_msg));
+
+  otrng_assert_is_success(serialize_and_encode_data_message_into(
+      buf, buf_len, &written, mac_key, reveal, MAC_KEY_BYTES, data_msg));
+  g_assert_cmpint(written, ==, buf_len - 1);
+  g_assert_cmpstr(buf, ==, expected);
+
+  otrng_free(buf);
+  otrng_free(expected);
+  otrng_free(ser);
+  otrng_free(body);
+  otrng_data_message_free(data_msg);
+}
+
+static void test_base64_encodes_in_place() {
+  uint8_t src[10] = {0x00, 0x01, 0xfe, 0xff, 0x10, 0x20, 0x30, 0x40, 0x50};
+  char expected[OTRNG_BASE64_ENCODE_LEN(10) + 1];
+  char buf[OTRNG_BASE64_ENCODE_LEN(10) + 1];
+  size_t len;
+
+  for (len = 0; len <= sizeof(src); len++) {
+    size_t expected_len = otrl_base64_encode(expected, src, len);
+    size_t offset = (len + 2) / 3;
+
+    // src sits as close to the start of its own destination as allowed
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf + offset, src, len);
+    g_assert_cmpint(
+        otrng_base64_encode_into(buf, (uint8_t *)buf + offset, len), ==,
+        expected_len);
+    otrng_assert_cmpmem(buf, expected, expected_len);
+  }
+}
+
 void units_data_message_add_tests(void) {
   g_test_add_func("/data_message/valid", test_data_message_valid);
   g_test_add_func("/data_message/serialize", test_data_message_serializes);
@@ -262,4 +331,8 @@ void units_data_message_add_tests(void) {
                   test_data_message_serializes_absent_dh);
   g_test_add_func("/data_message/deserialize",
                   test_otrng_data_message_deserializes);
+  g_test_add_func("/data_message/encode_into_buffer",
+                  test_data_message_encodes_into_buffer);
+  g_test_add_func("/data_message/base64_in_place",
+                  test_base64_encodes_in_place);
 }
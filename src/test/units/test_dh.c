@@ -19,6 +19,7 @@
  */
 
 #include <glib.h>
+#include <string.h>
 
 #include "test_helpers.h"
 
@@ -26,6 +27,18 @@
 
 #include "dh.h"
 
+/* The subgroup check as x^q mod p == 1, for comparing */
+static otrng_bool in_subgroup_powm(const dh_mpi mpi) {
+  gcry_mpi_t tmp = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  otrng_bool in_subgroup;
+
+  gcry_mpi_powm(tmp, mpi, otrng_dh_modulus_q(), otrng_dh_modulus_p());
+  in_subgroup = gcry_mpi_cmp_ui(tmp, 1) == 0;
+  gcry_mpi_release(tmp);
+
+  return in_subgroup;
+}
+
 static void test_dh_api() {
   dh_keypair_s alice, bob;
   otrng_dh_keypair_generate(&alice);
@@ -183,9 +196,275 @@ static void test_dh_keypair_destroy() {
   otrng_assert(!alice.pub);
 }
 
+static void assert_generator_powm(const uint8_t *priv, size_t priv_len) {
+  dh_mpi exp = NULL;
+  dh_mpi expected = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  dh_mpi pub = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+
+  otrng_assert_is_success(
+      otrng_dh_mpi_deserialize(&exp, priv, priv_len, NULL));
+
+  gcry_mpi_powm(expected, otrng_dh_mpi_generator(), exp, otrng_dh_modulus_p());
+  otrng_dh_calculate_public_key(pub, exp);
+
+  g_assert_cmpint(gcry_mpi_cmp(pub, expected), ==, 0);
+
+  otrng_dh_mpi_release(exp);
+  otrng_dh_mpi_release(expected);
+  otrng_dh_mpi_release(pub);
+}
+
+static void test_dh_calculate_public_key() {
+  uint8_t priv[DH3072_MOD_LEN_BYTES];
+  int i;
+
+  memset(priv, 0, sizeof(priv));
+  assert_generator_powm(priv, DH_KEY_SIZE);
+
+  priv[DH_KEY_SIZE - 1] = 1;
+  assert_generator_powm(priv, DH_KEY_SIZE);
+
+  memset(priv, 0xff, DH_KEY_SIZE);
+  assert_generator_powm(priv, DH_KEY_SIZE);
+
+  for (i = 0; i < 8; i++) {
+    gcry_randomize(priv, DH_KEY_SIZE, GCRY_WEAK_RANDOM);
+    assert_generator_powm(priv, DH_KEY_SIZE);
+  }
+
+  /* Longer exponents do not fit the table */
+  gcry_randomize(priv, sizeof(priv), GCRY_WEAK_RANDOM);
+  assert_generator_powm(priv, sizeof(priv));
+}
+
+static void test_dh_mpi_valid() {
+  dh_mpi p = otrng_dh_modulus_p();
+  dh_mpi x = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  dh_mpi n = gcry_mpi_new(8);
+  dh_keypair_s keypair;
+  int i;
+
+  /* out of range */
+  otrng_assert(!otrng_dh_mpi_valid(NULL));
+  gcry_mpi_set_ui(x, 1);
+  otrng_assert(!otrng_dh_mpi_valid(x));
+  gcry_mpi_sub_ui(x, p, 1);
+  otrng_assert(!otrng_dh_mpi_valid(x));
+
+  /* in range, but outside of the subgroup: (p - 2 / p) = (-2 / p) = -1 */
+  gcry_mpi_sub_ui(x, p, 2);
+  g_assert_cmpint(otrng_dh_mpi_jacobi(x, p), ==, -1);
+  otrng_assert(!in_subgroup_powm(x));
+  otrng_assert(!otrng_dh_mpi_valid(x));
+
+  /* g = 2 generates the subgroup */
+  otrng_assert(otrng_dh_mpi_valid(otrng_dh_mpi_generator()));
+
+  /* (0/15) = 0, (2/15) = (2/3)(2/5) = 1, (7/15) = (1/3)(2/5) = -1 */
+  gcry_mpi_set_ui(n, 15);
+  gcry_mpi_set_ui(x, 0);
+  g_assert_cmpint(otrng_dh_mpi_jacobi(x, n), ==, 0);
+  gcry_mpi_set_ui(x, 2);
+  g_assert_cmpint(otrng_dh_mpi_jacobi(x, n), ==, 1);
+  gcry_mpi_set_ui(x, 7);
+  g_assert_cmpint(otrng_dh_mpi_jacobi(x, n), ==, -1);
+
+  for (i = 0; i < 16; i++) {
+    otrng_assert_is_success(otrng_dh_keypair_generate(&keypair));
+    otrng_assert(otrng_dh_mpi_valid(keypair.pub));
+
+    /* random values land on both sides, and both checks must agree */
+    gcry_mpi_randomize(x, DH3072_MOD_LEN_BITS - 1, GCRY_WEAK_RANDOM);
+    gcry_mpi_add_ui(x, x, 2);
+    g_assert_cmpint(otrng_dh_mpi_valid(x), ==,
+                    in_subgroup_powm(x));
+
+    otrng_dh_keypair_destroy(&keypair);
+  }
+
+  otrng_dh_mpi_release(x);
+  otrng_dh_mpi_release(n);
+}
+
+#define BENCHMARK_ITERATIONS 200
+
+/* Only runs in performance mode (-m perf). Compares generator
+ * exponentiation through the precomputed table with gcry_mpi_powm. */
+static void test_benchmark_dh_calculate_public_key() {
+  uint8_t priv[DH_KEY_SIZE];
+  dh_mpi exp = NULL;
+  dh_mpi pub = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  double table_time, powm_time;
+  int i;
+
+  gcry_randomize(priv, DH_KEY_SIZE, GCRY_WEAK_RANDOM);
+  otrng_assert_is_success(
+      otrng_dh_mpi_deserialize(&exp, priv, DH_KEY_SIZE, NULL));
+
+  g_test_timer_start();
+  for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    otrng_dh_calculate_public_key(pub, exp);
+  }
+  table_time = g_test_timer_elapsed();
+
+  g_test_timer_start();
+  for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    gcry_mpi_powm(pub, otrng_dh_mpi_generator(), exp, otrng_dh_modulus_p());
+  }
+  powm_time = g_test_timer_elapsed();
+
+  g_test_minimized_result(table_time, "fixed-base table: %d keys in %.3fs",
+                          BENCHMARK_ITERATIONS, table_time);
+  g_test_minimized_result(powm_time, "gcry_mpi_powm: %d keys in %.3fs",
+                          BENCHMARK_ITERATIONS, powm_time);
+
+  otrng_dh_mpi_release(exp);
+  otrng_dh_mpi_release(pub);
+}
+
+/* Only runs in performance mode (-m perf). Compares the subgroup check
+ * through the Legendre symbol with x^q mod p. */
+static void test_benchmark_dh_mpi_valid() {
+  dh_keypair_s keypair;
+  double jacobi_time, powm_time;
+  int i;
+
+  otrng_assert_is_success(otrng_dh_keypair_generate(&keypair));
+
+  g_test_timer_start();
+  for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    otrng_assert(otrng_dh_mpi_valid(keypair.pub));
+  }
+  jacobi_time = g_test_timer_elapsed();
+
+  g_test_timer_start();
+  for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    otrng_assert(in_subgroup_powm(keypair.pub));
+  }
+  powm_time = g_test_timer_elapsed();
+
+  g_test_minimized_result(jacobi_time, "Legendre symbol: %d keys in %.3fs",
+                          BENCHMARK_ITERATIONS, jacobi_time);
+  g_test_minimized_result(powm_time, "x^q mod p: %d keys in %.3fs",
+                          BENCHMARK_ITERATIONS, powm_time);
+
+  otrng_dh_keypair_destroy(&keypair);
+}
+
+#define MULTI_POWM_EXP_LEN 44
+
+static void naive_multi_powm(dh_mpi dst, const dh_mpi *bases,
+                             const uint8_t *exps, size_t count) {
+  size_t i;
+
+  gcry_mpi_set_ui(dst, 1);
+  for (i = 0; i < count; i++) {
+    dh_mpi t = NULL;
+
+    otrng_assert_is_success(otrng_dh_mpi_deserialize(
+        &t, exps + i * MULTI_POWM_EXP_LEN, MULTI_POWM_EXP_LEN, NULL));
+    gcry_mpi_powm(t, bases[i], t, otrng_dh_modulus_p());
+    gcry_mpi_mulm(dst, dst, t, otrng_dh_modulus_p());
+    otrng_dh_mpi_release(t);
+  }
+}
+
+static void random_bases(dh_mpi *bases, size_t count) {
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    dh_keypair_s keypair;
+
+    otrng_assert_is_success(otrng_dh_keypair_generate(&keypair));
+    bases[i] = keypair.pub;
+    otrng_dh_mpi_release(keypair.priv);
+  }
+}
+
+static void release_bases(dh_mpi *bases, size_t count) {
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    otrng_dh_mpi_release(bases[i]);
+  }
+}
+
+static void test_dh_multi_powm() {
+  const size_t counts[] = {0, 1, 3, 17};
+  dh_mpi bases[17];
+  uint8_t exps[17 * MULTI_POWM_EXP_LEN];
+  dh_mpi expected = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  dh_mpi result = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  size_t i;
+
+  random_bases(bases, 17);
+  gcry_randomize(exps, sizeof(exps), GCRY_WEAK_RANDOM);
+
+  /* Leading zeros, and an exponent that is all zero */
+  memset(exps, 0, 5);
+  memset(exps + MULTI_POWM_EXP_LEN, 0, MULTI_POWM_EXP_LEN);
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    naive_multi_powm(expected, (const dh_mpi *)bases, exps, counts[i]);
+    otrng_dh_multi_powm(result, (const dh_mpi *)bases, exps,
+                        MULTI_POWM_EXP_LEN, counts[i]);
+    g_assert_cmpint(gcry_mpi_cmp(result, expected), ==, 0);
+  }
+
+  release_bases(bases, 17);
+  otrng_dh_mpi_release(expected);
+  otrng_dh_mpi_release(result);
+}
+
+/* Only runs in performance mode (-m perf). Compares the multi-exponentiation
+ * with one gcry_mpi_powm per base, as a DH proof with [count] values needs. */
+static void test_benchmark_dh_multi_powm() {
+  const size_t counts[] = {1, 4, 16, 64, 255};
+  dh_mpi *bases = otrng_xmalloc_z(255 * sizeof(dh_mpi));
+  uint8_t *exps = otrng_xmalloc(255 * MULTI_POWM_EXP_LEN);
+  dh_mpi result = gcry_mpi_new(DH3072_MOD_LEN_BITS);
+  size_t i;
+
+  random_bases(bases, 255);
+  gcry_randomize(exps, 255 * MULTI_POWM_EXP_LEN, GCRY_WEAK_RANDOM);
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    double multi_time, naive_time;
+
+    g_test_timer_start();
+    otrng_dh_multi_powm(result, (const dh_mpi *)bases, exps,
+                        MULTI_POWM_EXP_LEN, counts[i]);
+    multi_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    naive_multi_powm(result, (const dh_mpi *)bases, exps, counts[i]);
+    naive_time = g_test_timer_elapsed();
+
+    g_test_minimized_result(multi_time, "multi_powm: %zu values in %.4fs",
+                            counts[i], multi_time);
+    g_test_minimized_result(naive_time, "gcry_mpi_powm: %zu values in %.4fs",
+                            counts[i], naive_time);
+  }
+
+  release_bases(bases, 255);
+  otrng_free(bases);
+  otrng_free(exps);
+  otrng_dh_mpi_release(result);
+}
+
 void units_dh_add_tests(void) {
   g_test_add_func("/dh/api", test_dh_api);
   g_test_add_func("/dh/serialize", test_dh_serialize);
   g_test_add_func("/dh/shared-secret", test_dh_shared_secret);
   g_test_add_func("/dh/destroy", test_dh_keypair_destroy);
+  g_test_add_func("/dh/calculate_public_key", test_dh_calculate_public_key);
+  g_test_add_func("/dh/multi_powm", test_dh_multi_powm);
+  g_test_add_func("/dh/mpi_valid", test_dh_mpi_valid);
+
+  if (g_test_perf()) {
+    g_test_add_func("/dh/benchmark/calculate_public_key",
+                    test_benchmark_dh_calculate_public_key);
+    g_test_add_func("/dh/benchmark/multi_powm", test_benchmark_dh_multi_powm);
+    g_test_add_func("/dh/benchmark/mpi_valid", test_benchmark_dh_mpi_valid);
+  }
 }
@@ -93,6 +93,117 @@ static void test_ed448_signature() {
   otrng_keypair_free(pair);
 }
 
+#define MSM_SCALAR_LEN 44
+#define MSM_MAX_POINTS 255
+
+static void random_points(goldilocks_448_point_s *points, size_t count) {
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    ec_scalar s;
+
+    ed448_random_scalar(s);
+    goldilocks_448_point_scalarmul(&points[i], goldilocks_448_point_base, s);
+  }
+}
+
+static void naive_multi_scalarmul(ec_point dst,
+                                  const goldilocks_448_point_s *points,
+                                  const uint8_t *scalars, size_t count) {
+  size_t i;
+
+  goldilocks_448_point_copy(dst, goldilocks_448_point_identity);
+  for (i = 0; i < count; i++) {
+    ec_scalar s;
+    ec_point res;
+
+    goldilocks_448_scalar_decode_long(s, scalars + i * MSM_SCALAR_LEN,
+                                      MSM_SCALAR_LEN);
+    goldilocks_448_point_scalarmul(res, &points[i], s);
+    goldilocks_448_point_add(dst, dst, res);
+  }
+}
+
+static void test_ed448_multi_scalarmul() {
+  const size_t counts[] = {0, 1, 3, 4, 17, 64};
+  goldilocks_448_point_s points[64];
+  uint8_t scalars[64 * MSM_SCALAR_LEN];
+  ec_point expected, result;
+  size_t i;
+
+  random_points(points, 64);
+  random_bytes(scalars, sizeof(scalars));
+
+  /* A zero scalar, and one with only the top window set */
+  memset(scalars, 0, MSM_SCALAR_LEN);
+  memset(scalars + MSM_SCALAR_LEN, 0, MSM_SCALAR_LEN - 1);
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    naive_multi_scalarmul(expected, points, scalars, counts[i]);
+    otrng_ec_point_multi_scalarmul(result, (const ec_point *)points, scalars,
+                                   MSM_SCALAR_LEN, counts[i]);
+    otrng_assert(otrng_ec_point_eq(result, expected));
+  }
+}
+
+/* Only runs in performance mode (-m perf). Compares the bucket method with
+ * pairs of double scalar multiplications, which is how an ECDH proof over
+ * [count] prekeys was verified before. */
+static void test_benchmark_ed448_multi_scalarmul() {
+  const size_t counts[] = {1, 4, 16, 64, 100, 255};
+  goldilocks_448_point_s *points =
+      otrng_xmalloc(MSM_MAX_POINTS * sizeof(goldilocks_448_point_s));
+  uint8_t *scalars = otrng_xmalloc(MSM_MAX_POINTS * MSM_SCALAR_LEN);
+  ec_point result;
+  size_t i, j;
+
+  random_points(points, MSM_MAX_POINTS);
+  random_bytes(scalars, MSM_MAX_POINTS * MSM_SCALAR_LEN);
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    double msm_time, pairwise_time;
+
+    g_test_timer_start();
+    otrng_ec_point_multi_scalarmul(result, (const ec_point *)points, scalars,
+                                   MSM_SCALAR_LEN, counts[i]);
+    msm_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    goldilocks_448_point_copy(result, goldilocks_448_point_identity);
+    for (j = 0; j + 1 < counts[i]; j += 2) {
+      ec_scalar t1, t2;
+      ec_point res;
+
+      goldilocks_448_scalar_decode_long(t1, scalars + j * MSM_SCALAR_LEN,
+                                        MSM_SCALAR_LEN);
+      goldilocks_448_scalar_decode_long(t2, scalars + (j + 1) * MSM_SCALAR_LEN,
+                                        MSM_SCALAR_LEN);
+      goldilocks_448_point_double_scalarmul(res, &points[j], t1,
+                                            &points[j + 1], t2);
+      goldilocks_448_point_add(result, result, res);
+    }
+    if (j < counts[i]) {
+      ec_scalar t;
+      ec_point res;
+
+      goldilocks_448_scalar_decode_long(t, scalars + j * MSM_SCALAR_LEN,
+                                        MSM_SCALAR_LEN);
+      goldilocks_448_point_scalarmul(res, &points[j], t);
+      goldilocks_448_point_add(result, result, res);
+    }
+    pairwise_time = g_test_timer_elapsed();
+
+    g_test_minimized_result(msm_time, "multi_scalarmul: %zu points in %.4fs",
+                            counts[i], msm_time);
+    g_test_minimized_result(pairwise_time,
+                            "double_scalarmul: %zu points in %.4fs", counts[i],
+                            pairwise_time);
+  }
+
+  otrng_free(points);
+  otrng_free(scalars);
+}
+
 void units_ed448_add_tests(void) {
   g_test_add_func("/edwards448/eddsa_serialization",
                   test_ed448_eddsa_serialization);
@@ -100,4 +211,10 @@ void units_ed448_add_tests(void) {
   g_test_add_func("/edwards448/scalar_serialization",
                   test_ed448_scalar_serialization);
   g_test_add_func("/edwards448/signature", test_ed448_signature);
+  g_test_add_func("/edwards448/multi_scalarmul", test_ed448_multi_scalarmul);
+
+  if (g_test_perf()) {
+    g_test_add_func("/edwards448/benchmark/multi_scalarmul",
+                    test_benchmark_ed448_multi_scalarmul);
+  }
 }
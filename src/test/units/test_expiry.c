@@ -0,0 +1,114 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "test_helpers.h"
+
+#include "expiry.h"
+
+static void test_expiry_takes_entries_in_deadline_order(void) {
+  otrng_expiry_scheduler_s *scheduler = otrng_expiry_scheduler_new();
+  otrng_expiry_entry_s entries[5];
+  time_t deadlines[5] = {50, 10, 40, 20, 30};
+  time_t deadline = 0;
+  int i;
+
+  memset(entries, 0, sizeof(entries));
+  otrng_assert(!otrng_expiry_next_deadline(&deadline, scheduler));
+
+  for (i = 0; i < 5; i++) {
+    otrng_expiry_schedule(scheduler, &entries[i], deadlines[i]);
+  }
+  g_assert_cmpint(otrng_expiry_len(scheduler), ==, 5);
+
+  otrng_assert(otrng_expiry_next_deadline(&deadline, scheduler));
+  g_assert_cmpint(deadline, ==, 10);
+
+  otrng_assert(!otrng_expiry_take_due(scheduler, 9));
+  otrng_assert(otrng_expiry_take_due(scheduler, 100) == &entries[1]);
+  otrng_assert(otrng_expiry_take_due(scheduler, 100) == &entries[3]);
+  otrng_assert(otrng_expiry_take_due(scheduler, 100) == &entries[4]);
+  otrng_assert(otrng_expiry_take_due(scheduler, 100) == &entries[2]);
+  otrng_assert(otrng_expiry_take_due(scheduler, 100) == &entries[0]);
+  otrng_assert(!otrng_expiry_take_due(scheduler, 100));
+
+  g_assert_cmpint(otrng_expiry_len(scheduler), ==, 0);
+  g_assert_cmpint(entries[0].position, ==, 0);
+
+  otrng_expiry_scheduler_free(scheduler);
+}
+
+static void test_expiry_reschedules_and_cancels(void) {
+  otrng_expiry_scheduler_s *scheduler = otrng_expiry_scheduler_new();
+  otrng_expiry_entry_s first, second, third;
+  time_t deadline = 0;
+
+  memset(&first, 0, sizeof(first));
+  memset(&second, 0, sizeof(second));
+  memset(&third, 0, sizeof(third));
+
+  otrng_expiry_schedule(scheduler, &first, 10);
+  otrng_expiry_schedule(scheduler, &second, 20);
+  otrng_expiry_schedule(scheduler, &third, 30);
+
+  /* moving an entry does not add it twice */
+  otrng_expiry_schedule(scheduler, &first, 40);
+  g_assert_cmpint(otrng_expiry_len(scheduler), ==, 3);
+  otrng_assert(otrng_expiry_next_deadline(&deadline, scheduler));
+  g_assert_cmpint(deadline, ==, 20);
+
+  otrng_expiry_schedule(scheduler, &third, 5);
+  otrng_assert(otrng_expiry_next_deadline(&deadline, scheduler));
+  g_assert_cmpint(deadline, ==, 5);
+
+  otrng_expiry_cancel(scheduler, &third);
+  otrng_expiry_cancel(scheduler, &third);
+  g_assert_cmpint(otrng_expiry_len(scheduler), ==, 2);
+  g_assert_cmpint(third.position, ==, 0);
+
+  otrng_assert(otrng_expiry_take_due(scheduler, 100) == &second);
+  otrng_assert(otrng_expiry_take_due(scheduler, 100) == &first);
+
+  otrng_expiry_scheduler_free(scheduler);
+}
+
+static void test_expiry_without_scheduler(void) {
+  otrng_expiry_entry_s entry;
+  time_t deadline = 0;
+
+  memset(&entry, 0, sizeof(entry));
+
+  otrng_expiry_schedule(NULL, &entry, 10);
+  otrng_expiry_cancel(NULL, &entry);
+  g_assert_cmpint(entry.position, ==, 0);
+  otrng_assert(!otrng_expiry_next_deadline(&deadline, NULL));
+  otrng_assert(!otrng_expiry_take_due(NULL, 100));
+  g_assert_cmpint(otrng_expiry_len(NULL), ==, 0);
+}
+
+void units_expiry_add_tests(void) {
+  g_test_add_func("/expiry/takes_entries_in_deadline_order",
+                  test_expiry_takes_entries_in_deadline_order);
+  g_test_add_func("/expiry/reschedules_and_cancels",
+                  test_expiry_reschedules_and_cancels);
+  g_test_add_func("/expiry/without_scheduler", test_expiry_without_scheduler);
+}
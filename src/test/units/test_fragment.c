@@ -71,62 +71,95 @@ static void test_create_fragments_smaller_than_max_size(void) {
   otrng_message_free(frag_message);
 }
 
+static void test_fragments_share_one_allocation(void) {
+  const char *message = "a message sent in several fragments";
+  otrng_message_to_send_s *frag_message = otrng_message_new();
+  fragment_contexts_s *contexts = NULL;
+  char *unfrag = NULL;
+  int i;
+
+  otrng_assert_is_success(
+      otrng_fragment_message(50, frag_message, 1, 2, message));
+  g_assert_cmpint(frag_message->total, ==, 7);
+
+  for (i = 1; i < frag_message->total; i++) {
+    const char *previous = frag_message->pieces[i - 1];
+
+    /* Every piece follows the previous one, and has the same identifier */
+    otrng_assert(frag_message->pieces[i] == previous + strlen(previous) + 1);
+    otrng_assert_cmpmem(frag_message->pieces[i], previous, 14);
+  }
+
+  for (i = 0; i < frag_message->total; i++) {
+    otrng_assert_is_success(otrng_unfragment_message(
+        &unfrag, &contexts, frag_message->pieces[i], 2));
+  }
+
+  g_assert_cmpstr(unfrag, ==, message);
+
+  otrng_free(unfrag);
+  otrng_fragment_contexts_free(contexts);
+  otrng_message_free(frag_message);
+}
+
 static void test_defragment_valid_message(void) {
   const string_p fragments[2];
   fragments[0] = "?OTR|00000000|00000001|00000002,00001,00002,one ,";
   fragments[1] = "?OTR|00000000|00000001|00000002,00002,00002,more,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
 
   char *unfrag = NULL;
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[0], 2));
 
-  context = list->data;
+  context = otrng_fragment_contexts_get(contexts, 0, 1);
   g_assert_cmpint(context->total, ==, 2);
   g_assert_cmpint(context->count, ==, 1);
   otrng_assert(!unfrag);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[1], 2));
 
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 0);
   g_assert_cmpstr(unfrag, ==, "one more");
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_single_fragment(void) {
   const string_p message =
       "?OTR|00000000|00000001|00000002,00001,00001,small lol,";
 
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
   char *unfrag = NULL;
 
-  otrng_assert_is_success(otrng_unfragment_message(&unfrag, &list, message, 2));
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, message, 2));
 
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 0);
   g_assert_cmpstr(unfrag, ==, "small lol");
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_without_comma_fails(void) {
   const string_p message = "?OTR|00000000|00000001|00000002,00001,00001,blergh";
 
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
 
   char *unfrag = NULL;
-  otrng_assert_is_error(otrng_unfragment_message(&unfrag, &list, message, 2));
+  otrng_assert_is_error(
+      otrng_unfragment_message(&unfrag, &contexts, message, 2));
 
-  otrng_assert(list == NULL);
+  otrng_assert(contexts == NULL);
   g_assert_cmpstr(unfrag, ==, NULL);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_with_different_total_fails(void) {
@@ -135,27 +168,26 @@ static void test_defragment_with_different_total_fails(void) {
   fragments[1] = "?OTR|00000000|00000001|00000002,00002,00002,total,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
 
   char *unfrag = NULL;
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[0], 2));
   otrng_assert(!unfrag);
 
-  context = list->data;
+  context = otrng_fragment_contexts_get(contexts, 0, 1);
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_assert_is_error(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[1], 2));
 
-  context = list->data;
+  context = otrng_fragment_contexts_get(contexts, 0, 1);
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 1);
 
-  otrng_fragment_context_free(context);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_fragment_twice_fails(void) {
@@ -164,26 +196,25 @@ static void test_defragment_fragment_twice_fails(void) {
   fragments[1] = "?OTR|00000000|00000001|00000002,00001,00002,same twice,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
 
   char *unfrag = NULL;
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[0], 2));
 
-  context = list->data;
+  context = otrng_fragment_contexts_get(contexts, 0, 1);
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 2);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_assert_is_error(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[1], 2));
 
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 2);
   g_assert_cmpint(context->count, ==, 1);
 
-  otrng_fragment_context_free(context);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_out_of_order_message(void) {
@@ -193,61 +224,63 @@ static void test_defragment_out_of_order_message(void) {
   fragments[2] = "?OTR|00000000|00000001|00000002,00001,00003,one more ,";
 
   fragment_context_s *context = NULL;
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
 
   char *unfrag = NULL;
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[0], 2));
 
-  context = list->data;
+  context = otrng_fragment_contexts_get(contexts, 0, 1);
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 1);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[1], 2));
   otrng_assert(!unfrag);
   g_assert_cmpint(context->total, ==, 3);
   g_assert_cmpint(context->count, ==, 2);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, fragments[2], 2));
+      otrng_unfragment_message(&unfrag, &contexts, fragments[2], 2));
   g_assert_cmpstr(unfrag, ==, "one more fragment send");
 
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 0);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_fails_for_another_instance(void) {
   const string_p message =
       "?OTR|00000000|00000001|00000002,00001,00001,small lol,";
 
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
   char *unfrag = NULL;
 
-  otrng_assert_is_success(otrng_unfragment_message(&unfrag, &list, message, 1));
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, message, 1));
 
-  otrng_assert(list == NULL);
+  otrng_assert(contexts == NULL);
   g_assert_cmpstr(unfrag, ==, NULL);
 
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_regular_otr_message(void) {
   const string_p message = "?OTR:not a fragmented message.";
 
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
   char *unfrag = NULL;
 
-  otrng_assert_is_success(otrng_unfragment_message(&unfrag, &list, message, 1));
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, message, 1));
 
-  otrng_assert(list == NULL);
+  otrng_assert(contexts == NULL);
   g_assert_cmpstr(unfrag, ==, message);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
 }
 
 static void test_defragment_two_messages(void) {
@@ -261,62 +294,347 @@ static void test_defragment_two_messages(void) {
   message2_fragments[1] =
       "?OTR|00000002|00000001|00000002,00002,00002,message,";
 
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = NULL;
 
   char *unfrag = NULL;
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message1_fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &contexts, message1_fragments[0], 2));
 
   otrng_assert(!unfrag);
-  otrng_assert(otrng_list_len(list) == 1);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 1);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message2_fragments[0], 2));
+      otrng_unfragment_message(&unfrag, &contexts, message2_fragments[0], 2));
   otrng_assert(!unfrag);
-  otrng_assert(otrng_list_len(list) == 2);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 2);
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message2_fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &contexts, message2_fragments[1], 2));
   g_assert_cmpstr(unfrag, ==, "second message");
-  otrng_assert(otrng_list_len(list) == 1);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 1);
 
   otrng_free(unfrag);
   unfrag = NULL;
 
   otrng_assert_is_success(
-      otrng_unfragment_message(&unfrag, &list, message1_fragments[1], 2));
+      otrng_unfragment_message(&unfrag, &contexts, message1_fragments[1], 2));
   g_assert_cmpstr(unfrag, ==, "first message");
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 0);
+
+  otrng_free(unfrag);
+  otrng_fragment_contexts_free(contexts);
+}
+
+static void test_defragment_same_identifier_from_two_senders(void) {
+  const string_p fragments[4];
+  fragments[0] = "?OTR|00000001|00000001|00000002,00001,00002,from ,";
+  fragments[1] = "?OTR|00000001|00000003|00000002,00001,00002,other ,";
+  fragments[2] = "?OTR|00000001|00000003|00000002,00002,00002,sender,";
+  fragments[3] = "?OTR|00000001|00000001|00000002,00002,00002,one,";
+
+  fragment_contexts_s *contexts = NULL;
+  char *unfrag = NULL;
+
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, fragments[0], 2));
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, fragments[1], 2));
+  otrng_assert(!unfrag);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 2);
+  otrng_assert(otrng_fragment_contexts_get(contexts, 1, 1));
+  otrng_assert(otrng_fragment_contexts_get(contexts, 1, 3));
+
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, fragments[2], 2));
+  g_assert_cmpstr(unfrag, ==, "other sender");
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 1);
+  otrng_assert(!otrng_fragment_contexts_get(contexts, 1, 3));
+
+  otrng_free(unfrag);
+  unfrag = NULL;
+
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, fragments[3], 2));
+  g_assert_cmpstr(unfrag, ==, "from one");
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 0);
 
   otrng_free(unfrag);
-  otrng_list_free_nodes(list);
+  otrng_fragment_contexts_free(contexts);
+}
+
+static void test_defragment_many_messages(void) {
+  fragment_contexts_s *contexts = NULL;
+  char fragment[64];
+  char *unfrag = NULL;
+  uint32_t id;
+
+  for (id = 1; id <= 100; id++) {
+    snprintf(fragment, sizeof(fragment),
+             "?OTR|%08x|00000001|00000002,00001,00002,message ,", id);
+    otrng_assert_is_success(
+        otrng_unfragment_message(&unfrag, &contexts, fragment, 2));
+    otrng_assert(!unfrag);
+  }
+
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 100);
+
+  for (id = 100; id > 0; id--) {
+    char expected[32];
+
+    snprintf(fragment, sizeof(fragment),
+             "?OTR|%08x|00000001|00000002,00002,00002,%u,", id, id);
+    snprintf(expected, sizeof(expected), "message %u", id);
+
+    otrng_assert_is_success(
+        otrng_unfragment_message(&unfrag, &contexts, fragment, 2));
+    g_assert_cmpstr(unfrag, ==, expected);
+    otrng_assert(otrng_fragment_contexts_len(contexts) == id - 1);
+
+    otrng_free(unfrag);
+    unfrag = NULL;
+  }
+
+  otrng_fragment_contexts_free(contexts);
+}
+
+static void test_defragment_grows_buffer_as_fragments_arrive(void) {
+  const string_p fragment =
+      "?OTR|00000000|00000001|00000002,00001,65535,first,";
+  fragment_contexts_s *contexts = NULL;
+  fragment_context_s *context;
+  char *unfrag = NULL;
+
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, fragment, 2));
+  otrng_assert(!unfrag);
+
+  /* A lone first fragment does not reserve room for the whole message */
+  context = otrng_fragment_contexts_get(contexts, 0, 1);
+  g_assert_cmpint(context->buffer_len, ==, strlen("first") + 1);
+  g_assert_cmpint(contexts->pending_bytes, ==,
+                  65535 * sizeof(fragment_piece_s) + strlen("first") + 1);
+
+  otrng_fragment_contexts_forget(contexts, context);
+  g_assert_cmpint(contexts->pending_bytes, ==, 0);
+
+  otrng_fragment_contexts_free(contexts);
+}
+
+static void test_defragment_evicts_oldest_past_pending_bound(void) {
+  fragment_contexts_s *contexts = otrng_fragment_contexts_new();
+  fragment_contexts_s *other = NULL;
+  char fragment[64];
+  char *unfrag = NULL;
+  uint32_t id;
+
+  /* Every one of these reserves about 1 MiB of pieces */
+  for (id = 1; id <= 100; id++) {
+    snprintf(fragment, sizeof(fragment),
+             "?OTR|%08x|00000001|00000002,00001,65535,piece,", id);
+    otrng_assert_is_success(
+        otrng_unfragment_message(&unfrag, &contexts, fragment, 2));
+  }
+
+  otrng_assert(!unfrag);
+  otrng_assert(otrng_fragment_contexts_len(contexts) < 100);
+  otrng_assert(contexts->pending_bytes <= FRAGMENT_MAX_PENDING_BYTES);
+  otrng_assert(!otrng_fragment_contexts_get(contexts, 1, 1));
+  otrng_assert(otrng_fragment_contexts_get(contexts, 100, 1));
+
+  otrng_fragment_contexts_free(contexts);
+  contexts = otrng_fragment_contexts_new();
+  contexts->max_pending_contexts = 4;
+
+  /* A message in progress is not the oldest anymore once it is updated */
+  otrng_assert_is_success(otrng_unfragment_message(
+      &unfrag, &contexts, "?OTR|00000000|00000001|00000002,00001,00003,a,",
+      2));
+
+  for (id = 1; id <= 10; id++) {
+    snprintf(fragment, sizeof(fragment),
+             "?OTR|%08x|00000001|00000002,00001,00002,piece,", id);
+    otrng_assert_is_success(
+        otrng_unfragment_message(&unfrag, &contexts, fragment, 2));
+    otrng_assert(otrng_fragment_contexts_len(contexts) <= 4);
+
+    if (id == 2) {
+      otrng_assert_is_success(otrng_unfragment_message(
+          &unfrag, &contexts,
+          "?OTR|00000000|00000001|00000002,00002,00003,b,", 2));
+    }
+
+    if (id == 4) {
+      otrng_assert_is_success(otrng_unfragment_message(
+          &unfrag, &contexts,
+          "?OTR|00000000|00000001|00000002,00003,00003,c,", 2));
+      g_assert_cmpstr(unfrag, ==, "abc");
+      otrng_free(unfrag);
+      unfrag = NULL;
+    }
+  }
+
+  otrng_assert(!otrng_fragment_contexts_get(contexts, 1, 1));
+  otrng_assert(otrng_fragment_contexts_get(contexts, 10, 1));
+
+  /* Another connection is not affected by a peer filling this one */
+  otrng_assert_is_success(otrng_unfragment_message(
+      &unfrag, &other, "?OTR|00000000|00000001|00000002,00001,00002,c,", 2));
+  otrng_assert_is_success(otrng_unfragment_message(
+      &unfrag, &other, "?OTR|00000000|00000001|00000002,00002,00002,d,", 2));
+  g_assert_cmpstr(unfrag, ==, "cd");
+  otrng_free(unfrag);
+  unfrag = NULL;
+
+  otrng_fragment_contexts_free(contexts);
+  otrng_fragment_contexts_free(other);
 }
 
 static void test_expiration_of_fragments(void) {
   time_t HOUR_IN_SEC = 3600;
-  list_element_s *list = NULL;
+  fragment_contexts_s *contexts = otrng_fragment_contexts_new();
   fragment_context_s *ctx1 = otrng_fragment_context_new();
   fragment_context_s *ctx2 = otrng_fragment_context_new();
 
+  ctx1->identifier = 1;
   ctx1->last_fragment_received_at = HOUR_IN_SEC;
-  ctx2->last_fragment_received_at = HOUR_IN_SEC + 2;
+  ctx2->identifier = 2;
+  ctx2->last_fragment_received_at = HOUR_IN_SEC - 10;
 
-  list = otrng_list_add(ctx1, list);
-  list = otrng_list_add(ctx2, list);
+  otrng_fragment_contexts_add(contexts, ctx1);
+  otrng_fragment_contexts_add(contexts, ctx2);
 
   time_t now = HOUR_IN_SEC + 1;
-  otrng_assert_is_success(otrng_expire_fragments(now, 5, &list));
-  otrng_assert(otrng_list_len(list) == 1);
+  otrng_assert_is_success(otrng_expire_fragments(now, 5, contexts));
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 1);
+  otrng_assert(otrng_fragment_contexts_get(contexts, 2, 0) == ctx2);
+
+  now = HOUR_IN_SEC - 8;
+  otrng_assert_is_success(otrng_expire_fragments(now, 5, contexts));
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 0);
 
-  now = HOUR_IN_SEC + 3;
-  otrng_assert_is_success(otrng_expire_fragments(now, 5, &list));
-  otrng_assert(otrng_list_len(list) == 0);
+  otrng_fragment_contexts_free(contexts);
+}
+
+static void test_fragments_expire_through_scheduler(void) {
+  const string_p fragment = "?OTR|00000000|00000001|00000002,00001,00002,one ,";
+  otrng_expiry_scheduler_s *scheduler = otrng_expiry_scheduler_new();
+  fragment_contexts_s *contexts = NULL;
+  otrng_expiry_entry_s *entry;
+  time_t deadline = 0;
+  char *unfrag = NULL;
+
+  otrng_fragment_contexts_set_expiry(&contexts, scheduler, 60);
+  otrng_assert_is_success(
+      otrng_unfragment_message(&unfrag, &contexts, fragment, 2));
+  otrng_assert(!unfrag);
+
+  g_assert_cmpint(otrng_expiry_len(scheduler), ==, 1);
+  otrng_assert(otrng_expiry_next_deadline(&deadline, scheduler));
+  g_assert_cmpint(
+      deadline, ==,
+      otrng_fragment_contexts_get(contexts, 0, 1)->last_fragment_received_at +
+          60);
+
+  otrng_assert(!otrng_expiry_take_due(scheduler, deadline - 1));
+  entry = otrng_expiry_take_due(scheduler, deadline);
+  otrng_assert(entry);
+  g_assert_cmpint(entry->kind, ==, OTRNG_EXPIRY_FRAGMENTS);
+  otrng_assert(entry->context == contexts);
+
+  otrng_fragment_contexts_forget(entry->context, entry->owner);
+  otrng_assert(otrng_fragment_contexts_len(contexts) == 0);
+
+  otrng_fragment_contexts_free(contexts);
+  otrng_expiry_scheduler_free(scheduler);
+}
+
+static void test_parse_fragment_header(void) {
+  fragment_header_s header;
+  const char *msg = "?OTR|0000000a|000000FF|00000002,00003,00004,piece,";
+
+  otrng_assert_is_success(otrng_fragment_header_parse(&header, msg, "?OTR|"));
+  g_assert_cmpuint(header.identifier, ==, 0x0a);
+  g_assert_cmpuint(header.sender_tag, ==, 0xff);
+  g_assert_cmpuint(header.receiver_tag, ==, 2);
+  g_assert_cmpuint(header.index, ==, 3);
+  g_assert_cmpuint(header.total, ==, 4);
+  g_assert_cmpuint(header.piece_len, ==, 5);
+  otrng_assert_cmpmem(msg + header.piece_start, "piece", 5);
+
+  otrng_assert_is_success(otrng_fragment_header_parse(
+      &header, "?OTRP|00000001|00000002|00000003,65535,65535,p,", "?OTRP|"));
+  g_assert_cmpuint(header.index, ==, 65535);
+
+  /* Wrong prefix */
+  otrng_assert_is_error(otrng_fragment_header_parse(
+      &header, "?OTR|00000001|00000002|00000003,00001,00001,p,", "?OTRP|"));
+  /* Short field */
+  otrng_assert_is_error(otrng_fragment_header_parse(
+      &header, "?OTR|0001|00000002|00000003,00001,00001,p,", "?OTR|"));
+  /* Not a hex digit */
+  otrng_assert_is_error(otrng_fragment_header_parse(
+      &header, "?OTR|0000000g|00000002|00000003,00001,00001,p,", "?OTR|"));
+  /* Index out of range */
+  otrng_assert_is_error(otrng_fragment_header_parse(
+      &header, "?OTR|00000001|00000002|00000003,65536,65536,p,", "?OTR|"));
+  /* Empty piece */
+  otrng_assert_is_error(otrng_fragment_header_parse(
+      &header, "?OTR|00000001|00000002|00000003,00001,00001,,", "?OTR|"));
+  /* Truncated */
+  otrng_assert_is_error(otrng_fragment_header_parse(
+      &header, "?OTR|00000001|00000002|00000003,00001,00001,p", "?OTR|"));
+  otrng_assert_is_error(
+      otrng_fragment_header_parse(&header, "?OTR|00000001|0000", "?OTR|"));
+}
+
+#define BENCHMARK_ITERATIONS 1000000
+
+/* Only runs in performance mode (-m perf). Compares the header parser with
+ * the sscanf format it replaced. */
+static void test_benchmark_fragment_header_parse(void) {
+  const char *msg = "?OTR|1f2e3d4c|00000101|00000102,00002,00010,"
+                    "T1RSAAQDAAABAQAAAQIAAAAAAA,";
+  fragment_header_s header;
+  uint32_t identifier = 0, sender_tag = 0, receiver_tag = 0;
+  uint16_t index = 0, total = 0;
+  int start = 0, end = 0;
+  double parser_time, sscanf_time;
+  int n;
+
+  g_test_timer_start();
+  for (n = 0; n < BENCHMARK_ITERATIONS; n++) {
+    otrng_assert_is_success(
+        otrng_fragment_header_parse(&header, msg, "?OTR|"));
+  }
+  parser_time = g_test_timer_elapsed();
+
+  g_test_timer_start();
+  for (n = 0; n < BENCHMARK_ITERATIONS; n++) {
+    g_assert_cmpint(sscanf(msg, "?OTR|%08x|%08x|%08x,%05hu,%05hu,%n%*[^,],%n",
+                           &identifier, &sender_tag, &receiver_tag, &index,
+                           &total, &start, &end),
+                    ==, 5);
+  }
+  sscanf_time = g_test_timer_elapsed();
+
+  g_assert_cmpuint(header.identifier, ==, identifier);
+  g_assert_cmpuint(header.piece_start, ==, (size_t)start);
+  g_assert_cmpuint(header.piece_len, ==, (size_t)(end - start - 1));
+
+  g_test_minimized_result(parser_time, "header parser: %d headers in %.3fs",
+                          BENCHMARK_ITERATIONS, parser_time);
+  g_test_minimized_result(sscanf_time, "sscanf: %d headers in %.3fs",
+                          BENCHMARK_ITERATIONS, sscanf_time);
 }
 
 void units_fragment_add_tests(void) {
   g_test_add_func("/fragment/create_fragments_smaller_than_max_size",
                   test_create_fragments_smaller_than_max_size);
   g_test_add_func("/fragment/create_fragments", test_create_fragments);
+  g_test_add_func("/fragment/expire_through_scheduler",
+                  test_fragments_expire_through_scheduler);
+  g_test_add_func("/fragment/fragments_share_one_allocation",
+                  test_fragments_share_one_allocation);
   g_test_add_func("/fragment/defragment_message",
                   test_defragment_valid_message);
   g_test_add_func("/fragment/defragment_single_fragment",
@@ -335,6 +653,20 @@ void units_fragment_add_tests(void) {
                   test_defragment_regular_otr_message);
   g_test_add_func("/fragment/defragment_two_messages",
                   test_defragment_two_messages);
+  g_test_add_func("/fragment/defragment_same_identifier_from_two_senders",
+                  test_defragment_same_identifier_from_two_senders);
+  g_test_add_func("/fragment/defragment_many_messages",
+                  test_defragment_many_messages);
+  g_test_add_func("/fragment/defragment_grows_buffer_as_fragments_arrive",
+                  test_defragment_grows_buffer_as_fragments_arrive);
+  g_test_add_func("/fragment/defragment_evicts_oldest_past_pending_bound",
+                  test_defragment_evicts_oldest_past_pending_bound);
   g_test_add_func("/fragment/expiration_of_fragments",
                   test_expiration_of_fragments);
+  g_test_add_func("/fragment/parse_header", test_parse_fragment_header);
+
+  if (g_test_perf()) {
+    g_test_add_func("/fragment/benchmark/parse_header",
+                    test_benchmark_fragment_header_parse);
+  }
 }
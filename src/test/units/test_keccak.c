@@ -0,0 +1,121 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "test_helpers.h"
+
+#include "keccak.h"
+#include "random.h"
+#include "shake.h"
+
+static void test_keccak_f1600_x4_zero_state(void) {
+  otrng_keccak_x4_s state;
+  /* The first word of Keccak-f[1600] applied to the zero state */
+  const uint64_t expected = 0xf1258f7940e1dde7;
+  int lane;
+
+  memset(&state, 0, sizeof(state));
+  otrng_keccak_f1600_x4(&state);
+
+  for (lane = 0; lane < OTRNG_KECCAK_LANES; lane++) {
+    otrng_assert(state.words[0][lane] == expected);
+  }
+}
+
+static void test_keccak_f1600_x4_matches_portable(void) {
+  otrng_keccak_x4_s state, portable;
+
+  random_bytes(&state, sizeof(state));
+  memcpy(&portable, &state, sizeof(state));
+
+  otrng_keccak_f1600_x4(&state);
+  keccak_f1600_x4_portable(&portable);
+
+  otrng_assert_cmpmem(&portable, &state, sizeof(state));
+}
+
+static void test_shake_256_kdf1_x4(void) {
+  uint8_t values[4][SHAKE_256_RATE];
+  const size_t values_len[4] = {0, 64, 65, SHAKE_256_RATE - 7};
+  const uint8_t usages[4] = {0x16, 0x17, 0x19, 0x01};
+  uint8_t out[4][SHAKE_256_RATE];
+  uint8_t expected[SHAKE_256_RATE];
+  uint8_t *dst[4];
+  const uint8_t *inputs[4];
+  int i;
+
+  random_bytes(values, sizeof(values));
+  for (i = 0; i < 4; i++) {
+    dst[i] = out[i];
+    inputs[i] = values[i];
+  }
+
+  otrng_assert_is_success(shake_256_kdf1_x4(dst, SHAKE_256_RATE, usages,
+                                            inputs, values_len, 4));
+
+  for (i = 0; i < 4; i++) {
+    otrng_assert_is_success(shake_256_kdf1(expected, SHAKE_256_RATE,
+                                           usages[i], values[i],
+                                           values_len[i]));
+    otrng_assert_cmpmem(expected, out[i], SHAKE_256_RATE);
+  }
+}
+
+static void test_shake_256_kdf1_x4_long_inputs(void) {
+  uint8_t value[SHAKE_256_RATE];
+  const size_t values_len[2] = {SHAKE_256_RATE - 6, 32};
+  const uint8_t usages[2] = {0x16, 0x17};
+  uint8_t out[SHAKE_256_RATE + 1];
+  uint8_t expected[SHAKE_256_RATE + 1];
+  uint8_t *dst[2];
+  const uint8_t *inputs[2];
+
+  random_bytes(value, sizeof(value));
+  dst[0] = out;
+  dst[1] = value;
+  inputs[0] = value;
+  inputs[1] = value;
+
+  /* The first input does not fit in a block, so both are done one by one,
+   * and the second one reads the value before overwriting it */
+  otrng_assert_is_success(shake_256_kdf1(expected, 32, usages[1], value, 32));
+  otrng_assert_is_success(
+      shake_256_kdf1_x4(dst, 32, usages, inputs, values_len, 2));
+  otrng_assert_cmpmem(expected, value, 32);
+
+  /* An output longer than the rate takes the same path */
+  otrng_assert_is_success(shake_256_kdf1(expected, sizeof(expected),
+                                         usages[1], value, 32));
+  otrng_assert_is_success(
+      shake_256_kdf1_x4(dst, sizeof(out), usages + 1, inputs + 1,
+                        values_len + 1, 1));
+  otrng_assert_cmpmem(expected, out, sizeof(out));
+}
+
+void units_keccak_add_tests(void) {
+  g_test_add_func("/keccak/zero_state", test_keccak_f1600_x4_zero_state);
+  g_test_add_func("/keccak/matches_portable",
+                  test_keccak_f1600_x4_matches_portable);
+  g_test_add_func("/keccak/shake_256_kdf1_x4", test_shake_256_kdf1_x4);
+  g_test_add_func("/keccak/shake_256_kdf1_x4_long_inputs",
+                  test_shake_256_kdf1_x4_long_inputs);
+}
@@ -154,6 +154,143 @@ static void test_calculate_brace_key() {
   otrng_free(manager);
 }
 
+static void test_receiving_ratchet_commit_and_rollback() {
+  key_manager_s *manager = otrng_key_manager_new();
+  receiving_ratchet_s *ratchet;
+  k_receiving_chain chain_r;
+
+  memset(manager->current->chain_r, 0x01, CHAIN_KEY_BYTES);
+  memcpy(chain_r, manager->current->chain_r, CHAIN_KEY_BYTES);
+  manager->k = 3;
+
+  ratchet = otrng_receiving_ratchet_begin(manager);
+  otrng_assert(ratchet == manager->receiving);
+  otrng_assert_cmpmem(chain_r, ratchet->chain_r, CHAIN_KEY_BYTES);
+  g_assert_cmpint(ratchet->k, ==, 3);
+
+  memset(ratchet->chain_r, 0x02, CHAIN_KEY_BYTES);
+  ratchet->k = 4;
+  otrng_receiving_ratchet_rollback(ratchet);
+
+  otrng_assert_cmpmem(chain_r, manager->current->chain_r, CHAIN_KEY_BYTES);
+  g_assert_cmpint(manager->k, ==, 3);
+
+  ratchet = otrng_receiving_ratchet_begin(manager);
+  memset(ratchet->chain_r, 0x02, CHAIN_KEY_BYTES);
+  ratchet->k = 4;
+  otrng_receiving_ratchet_commit(manager, ratchet);
+
+  memset(chain_r, 0x02, CHAIN_KEY_BYTES);
+  otrng_assert_cmpmem(chain_r, manager->current->chain_r, CHAIN_KEY_BYTES);
+  g_assert_cmpint(manager->k, ==, 4);
+  otrng_assert(!ratchet->dh_ratcheted);
+
+  otrng_key_manager_free(manager);
+}
+
+static otrng_result derive_skipped_key(uint8_t *enc_key, uint8_t *extra_key,
+                                       uint8_t *chain_key) {
+  uint8_t extra_input[1 + CHAIN_KEY_BYTES];
+
+  extra_input[0] = 0xFF;
+  memcpy(extra_input + 1, chain_key, CHAIN_KEY_BYTES);
+
+  /* usage_message_key, usage_extra_symm_key and usage_next_chain_key */
+  if (!shake_256_kdf1(enc_key, ENC_KEY_BYTES, 0x17, chain_key,
+                      CHAIN_KEY_BYTES) ||
+      !shake_256_kdf1(extra_key, EXTRA_SYMMETRIC_KEY_BYTES, 0x19, extra_input,
+                      sizeof(extra_input)) ||
+      !shake_256_kdf1(chain_key, CHAIN_KEY_BYTES, 0x16, chain_key,
+                      CHAIN_KEY_BYTES)) {
+    return OTRNG_ERROR;
+  }
+
+  return OTRNG_SUCCESS;
+}
+
+static void test_store_enc_keys() {
+  key_manager_s *manager = otrng_key_manager_new();
+  receiving_ratchet_s *ratchet;
+  k_msg_enc enc_key, expected_enc_key;
+  k_extra_symmetric expected_extra_key;
+  k_receiving_chain chain_r;
+  const skipped_keys_s *keys;
+  uint32_t k;
+
+  otrng_ec_point_copy(manager->their_ecdh, goldilocks_448_point_base);
+  memset(manager->current->chain_r, 0x01, CHAIN_KEY_BYTES);
+  memcpy(chain_r, manager->current->chain_r, CHAIN_KEY_BYTES);
+
+  ratchet = otrng_receiving_ratchet_begin(manager);
+  otrng_assert_is_success(
+      store_enc_keys(enc_key, ratchet, 5, 10, 'd', NULL, manager));
+  g_assert_cmpint(ratchet->k, ==, 5);
+  g_assert_cmpint(otrng_skipped_keys_store_len(ratchet->skipped_keys), ==, 5);
+
+  for (k = 0; k < 5; k++) {
+    otrng_assert_is_success(
+        derive_skipped_key(expected_enc_key, expected_extra_key, chain_r));
+
+    keys = otrng_skipped_keys_store_get(ratchet->skipped_keys,
+                                        manager->their_ecdh, k);
+    otrng_assert(keys);
+    otrng_assert_cmpmem(expected_enc_key, keys->enc_key, ENC_KEY_BYTES);
+    otrng_assert_cmpmem(expected_extra_key, keys->extra_symmetric_key,
+                        EXTRA_SYMMETRIC_KEY_BYTES);
+  }
+  otrng_assert_cmpmem(chain_r, ratchet->chain_r, CHAIN_KEY_BYTES);
+
+  otrng_receiving_ratchet_rollback(ratchet);
+  otrng_key_manager_free(manager);
+}
+
+/* Only runs in performance mode (-m perf). Skips 1k and 10k message keys,
+ * and compares the derivations with three scalar KDF_1 calls per key. */
+static void benchmark_store_enc_keys(uint32_t skip) {
+  key_manager_s *manager = otrng_key_manager_new();
+  receiving_ratchet_s *ratchet;
+  k_msg_enc enc_key;
+  k_extra_symmetric extra_key;
+  k_receiving_chain chain_r;
+  double store_time, scalar_time;
+  uint32_t k;
+
+  otrng_ec_point_copy(manager->their_ecdh, goldilocks_448_point_base);
+  memset(manager->current->chain_r, 0x01, CHAIN_KEY_BYTES);
+  memcpy(chain_r, manager->current->chain_r, CHAIN_KEY_BYTES);
+
+  ratchet = otrng_receiving_ratchet_begin(manager);
+  g_test_timer_start();
+  otrng_assert_is_success(
+      store_enc_keys(enc_key, ratchet, skip, skip, 'd', NULL, manager));
+  store_time = g_test_timer_elapsed();
+
+  g_test_timer_start();
+  for (k = 0; k < skip; k++) {
+    otrng_assert_is_success(derive_skipped_key(enc_key, extra_key, chain_r));
+  }
+  scalar_time = g_test_timer_elapsed();
+
+  otrng_assert_cmpmem(chain_r, ratchet->chain_r, CHAIN_KEY_BYTES);
+
+  g_test_minimized_result(store_time, "store_enc_keys: %u keys in %.3fs",
+                          skip, store_time);
+  g_test_minimized_result(scalar_time,
+                          "scalar derivations only: %u keys in %.3fs", skip,
+                          scalar_time);
+
+  otrng_receiving_ratchet_rollback(ratchet);
+  otrng_key_manager_free(manager);
+}
+
+static void test_benchmark_store_enc_keys_1k() {
+  benchmark_store_enc_keys(1000);
+}
+
+static void test_benchmark_store_enc_keys_10k() {
+  benchmark_store_enc_keys(10000);
+}
+
 void units_key_management_add_tests(void) {
   g_test_add_func("/key_management/derive_ratchet_keys",
                   test_derive_ratchet_keys);
@@ -161,4 +298,14 @@ void units_key_management_add_tests(void) {
   g_test_add_func("/key_management/extra_symm_key",
                   test_calculate_extra_symm_key);
   g_test_add_func("/key_management/brace_key", test_calculate_brace_key);
+  g_test_add_func("/key_management/receiving_ratchet",
+                  test_receiving_ratchet_commit_and_rollback);
+  g_test_add_func("/key_management/store_enc_keys", test_store_enc_keys);
+
+  if (g_test_perf()) {
+    g_test_add_func("/key_management/benchmark/store_enc_keys_1k",
+                    test_benchmark_store_enc_keys_1k);
+    g_test_add_func("/key_management/benchmark/store_enc_keys_10k",
+                    test_benchmark_store_enc_keys_10k);
+  }
 }
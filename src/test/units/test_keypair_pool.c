@@ -0,0 +1,142 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test_helpers.h"
+
+#include "key_management.h"
+#include "keypair_pool.h"
+
+static void wait_until_filled(otrng_keypair_pool_s *pool, size_t len) {
+  int tries;
+
+  for (tries = 0; tries < 6000; tries++) {
+    if (otrng_keypair_pool_len(pool) == len) {
+      return;
+    }
+    g_usleep(10 * 1000);
+  }
+
+  g_assert_cmpint(otrng_keypair_pool_len(pool), ==, len);
+}
+
+static void test_keypair_pool_new_rejects_invalid_arguments() {
+  otrng_assert(!otrng_keypair_pool_new(0, 0));
+  otrng_assert(!otrng_keypair_pool_new(2, 3));
+}
+
+static void test_keypair_pool_take() {
+  ecdh_keypair_s ecdh, other_ecdh;
+  dh_keypair_s dh, other_dh;
+  otrng_keypair_pool_s *pool = otrng_keypair_pool_new(4, 0);
+
+  otrng_assert(pool);
+  wait_until_filled(pool, 4);
+
+  otrng_assert(otrng_keypair_pool_take(&ecdh, &dh, pool));
+  otrng_assert(otrng_keypair_pool_take(&other_ecdh, &other_dh, pool));
+
+  /* without a low-water mark the pool is only refilled once empty */
+  g_assert_cmpint(otrng_keypair_pool_len(pool), ==, 2);
+
+  otrng_assert(otrng_ec_point_valid(ecdh.pub));
+  otrng_assert(otrng_dh_mpi_valid(dh.pub));
+  otrng_assert(dh.priv);
+  otrng_assert(gcry_mpi_get_flag(dh.priv, GCRYMPI_FLAG_SECURE));
+  otrng_assert(!otrng_ec_point_eq(ecdh.pub, other_ecdh.pub));
+  otrng_assert(gcry_mpi_cmp(dh.pub, other_dh.pub) != 0);
+
+  otrng_ecdh_keypair_destroy(&ecdh);
+  otrng_dh_keypair_destroy(&dh);
+  otrng_ecdh_keypair_destroy(&other_ecdh);
+  otrng_dh_keypair_destroy(&other_dh);
+
+  otrng_keypair_pool_free(pool);
+}
+
+static void test_keypair_pool_refills_below_low_water() {
+  ecdh_keypair_s ecdh;
+  dh_keypair_s dh;
+  otrng_keypair_pool_s *pool = otrng_keypair_pool_new(3, 2);
+
+  otrng_assert(pool);
+  wait_until_filled(pool, 3);
+
+  otrng_assert(otrng_keypair_pool_take(&ecdh, &dh, pool));
+  otrng_ecdh_keypair_destroy(&ecdh);
+  otrng_dh_keypair_destroy(&dh);
+  otrng_assert(otrng_keypair_pool_take(&ecdh, &dh, pool));
+  otrng_ecdh_keypair_destroy(&ecdh);
+  otrng_dh_keypair_destroy(&dh);
+
+  wait_until_filled(pool, 3);
+
+  otrng_keypair_pool_free(pool);
+}
+
+static void test_keypair_pool_generate_without_pool() {
+  ecdh_keypair_s ecdh;
+  dh_keypair_s dh;
+
+  otrng_assert(!otrng_keypair_pool_take(&ecdh, &dh, NULL));
+  g_assert_cmpint(otrng_keypair_pool_len(NULL), ==, 0);
+
+  otrng_assert_is_success(otrng_keypair_pool_generate(&ecdh, &dh, NULL));
+  otrng_assert(otrng_ec_point_valid(ecdh.pub));
+  otrng_assert(otrng_dh_mpi_valid(dh.pub));
+
+  otrng_ecdh_keypair_destroy(&ecdh);
+  otrng_dh_keypair_destroy(&dh);
+}
+
+static void test_key_manager_takes_from_pool() {
+  key_manager_s *manager = otrng_key_manager_new();
+  otrng_keypair_pool_s *pool = otrng_keypair_pool_new(2, 0);
+
+  otrng_assert(pool);
+  wait_until_filled(pool, 2);
+  manager->keypair_pool = pool;
+
+  /* a new DH keypair is needed every third ratchet */
+  manager->i = 0;
+  otrng_assert_is_success(otrng_key_manager_generate_ephemeral_keys(manager));
+  g_assert_cmpint(otrng_keypair_pool_len(pool), ==, 1);
+  otrng_assert(otrng_dh_mpi_valid(manager->our_dh->pub));
+
+  manager->i = 1;
+  otrng_assert_is_success(otrng_key_manager_generate_ephemeral_keys(manager));
+  g_assert_cmpint(otrng_keypair_pool_len(pool), ==, 1);
+
+  otrng_key_manager_free(manager);
+  otrng_keypair_pool_free(pool);
+}
+
+void units_keypair_pool_add_tests(void) {
+  g_test_add_func("/keypair_pool/new_rejects_invalid_arguments",
+                  test_keypair_pool_new_rejects_invalid_arguments);
+  g_test_add_func("/keypair_pool/take", test_keypair_pool_take);
+  g_test_add_func("/keypair_pool/refills_below_low_water",
+                  test_keypair_pool_refills_below_low_water);
+  g_test_add_func("/keypair_pool/generate_without_pool",
+                  test_keypair_pool_generate_without_pool);
+  g_test_add_func("/keypair_pool/key_manager_takes_from_pool",
+                  test_key_manager_takes_from_pool);
+}
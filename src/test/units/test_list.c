@@ -150,6 +150,34 @@ static void test_otrng_list_len() {
   otrng_list_free_nodes(list);
 }
 
+static void test_otrng_list_unlink() {
+  int one = 1, two = 2, three = 3, four = 4;
+  list_element_s *list = NULL, *last, *elem;
+
+  list = otrng_list_add(&one, list);
+  list = otrng_list_add(&two, list);
+  list = otrng_list_add(&three, list);
+  last = otrng_list_get_last(list);
+
+  otrng_assert(!otrng_list_unlink(&four, &list, &last));
+
+  // The last element moves back only when it is the one removed
+  elem = otrng_list_unlink(&two, &list, &last);
+  otrng_assert(elem && elem->data == &two && !elem->next);
+  otrng_assert(last->data == &three);
+  otrng_list_free_nodes(elem);
+
+  elem = otrng_list_unlink(&three, &list, &last);
+  otrng_assert(last == list);
+  otrng_assert(!list->next);
+  otrng_list_free_nodes(elem);
+
+  elem = otrng_list_unlink(&one, &list, &last);
+  otrng_assert(!list);
+  otrng_assert(!last);
+  otrng_list_free_nodes(elem);
+}
+
 static void test_list_empty_size() {
   list_element_s *empty = list_new();
   g_assert_cmpint(otrng_list_len(empty), ==, 0);
@@ -162,5 +190,6 @@ void units_list_add_tests(void) {
   g_test_add_func("/list/get", test_otrng_list_get_last);
   g_test_add_func("/list/get_by_value", test_otrng_list_get_by_value);
   g_test_add_func("/list/length", test_otrng_list_len);
+  g_test_add_func("/list/unlink", test_otrng_list_unlink);
   g_test_add_func("/list/empty_size", test_list_empty_size);
 }
@@ -322,7 +322,7 @@ static void orchestration_fixture_setup(orchestration_fixture_s *f,
   f->client->minimum_stored_prekey_msg = 2;
 
   f->client->global_state = f->gs;
-  f->gs->clients = otrng_list_add(f->client, f->gs->clients);
+  otrng_global_state_add_client(f->gs, f->client);
 
   f->callbacks->load_privkey_v4 = load_privkey_v4;
   f->callbacks->store_privkey_v4 = store_privkey_v4;
@@ -453,6 +453,7 @@ static void orchestration_fixture_teardown(orchestration_fixture_s *f,
   otrng_free(f->callbacks);
   otrng_client_free(f->client);
   otrng_list_free_nodes(f->gs->clients);
+  otrng_free(f->gs->clients_index.slots);
   otrl_userstate_free(f->gs->user_state_v3);
   otrng_free(f->gs);
   otrng_secure_free(f->long_term_key);
@@ -1748,6 +1749,88 @@ static void test__otrng_client_ensure_correct_state__v3_key__fails(
   f->client->keypair = NULL;
 }
 
+static void test__otrng_client_ensure_correct_state__lazy__defers(
+    orchestration_fixture_s *f, gconstpointer data) {
+  (void)data;
+  otrng_global_state_set_lazy_orchestration(f->gs, otrng_true);
+
+  otrng_client_ensure_correct_state(f->client);
+
+  g_assert_cmpint(load_privkey_v4__called, ==, 0);
+  g_assert_cmpint(create_privkey_v4__called, ==, 0);
+  g_assert_cmpint(load_forging_key__called, ==, 0);
+  g_assert_cmpint(load_client_profile__called, ==, 0);
+  g_assert_cmpint(load_prekey_profile__called, ==, 0);
+  g_assert_cmpint(load_prekey_messages__called, ==, 0);
+  g_assert_cmpint(load_privkey_v3__called, ==, 0);
+  g_assert_cmpint(load_fingerprints__called, ==, 1);
+  g_assert_cmpuint(f->client->pending_state, ==, OTRNG_CLIENT_STATE_ALL);
+}
+
+static void
+test__otrng_client_ensure_correct_state__lazy__ensures_on_first_use(
+    orchestration_fixture_s *f, gconstpointer data) {
+  (void)data;
+  otrng_global_state_set_lazy_orchestration(f->gs, otrng_true);
+  load_privkey_v4__assign = f->long_term_key;
+  v3_add_key_to(f->client->global_state->user_state_v3, f->v3_key, f->client);
+  load_forging_key__assign = &f->forging_key->pub;
+  load_client_profile__assign = f->client_profile;
+
+  otrng_client_ensure_correct_state(f->client);
+  g_assert_cmpint(load_privkey_v4__called, ==, 0);
+
+  /* Asking for the client profile ensures what it is built from */
+  g_assert(otrng_client_get_client_profile(f->client) == f->client_profile);
+  g_assert_cmpint(load_privkey_v4__called, ==, 1);
+  g_assert_cmpint(load_forging_key__called, ==, 1);
+  g_assert_cmpint(load_client_profile__called, ==, 1);
+  g_assert_cmpint(create_client_profile__called, ==, 0);
+
+  /* But nothing else */
+  g_assert_cmpint(load_prekey_profile__called, ==, 0);
+  g_assert_cmpint(load_prekey_messages__called, ==, 0);
+  g_assert_cmpuint(f->client->pending_state &
+                       OTRNG_CLIENT_STATE_CLIENT_PROFILE,
+                   ==, 0);
+  g_assert_cmpuint(f->client->pending_state &
+                       OTRNG_CLIENT_STATE_PREKEY_PROFILE,
+                   !=, 0);
+
+  /* Only once */
+  otrng_client_get_client_profile(f->client);
+  g_assert_cmpint(load_client_profile__called, ==, 1);
+
+  f->client->keypair = NULL;
+  v3_remove_key(f->v3_key);
+  f->client->forging_key = NULL;
+  f->client->client_profile = NULL;
+}
+
+static void test__otrng_client_get_our_fingerprint__lazy__ensures_keys(
+    orchestration_fixture_s *f, gconstpointer data) {
+  otrng_fingerprint fp;
+
+  (void)data;
+  otrng_global_state_set_lazy_orchestration(f->gs, otrng_true);
+  load_privkey_v4__assign = f->long_term_key;
+  load_forging_key__assign = &f->forging_key->pub;
+
+  otrng_client_ensure_correct_state(f->client);
+
+  /* Only the long-term key is there yet */
+  otrng_client_get_keypair_v4(f->client);
+  g_assert_cmpint(load_forging_key__called, ==, 0);
+
+  otrng_assert_is_success(otrng_client_get_our_fingerprint(fp, f->client));
+  g_assert_cmpint(load_privkey_v4__called, ==, 1);
+  g_assert_cmpint(load_forging_key__called, ==, 1);
+  g_assert_cmpint(load_client_profile__called, ==, 0);
+
+  f->client->keypair = NULL;
+  f->client->forging_key = NULL;
+}
+
 #define WITH_O_FIXTURE(_p, _c)                                                 \
   WITH_FIXTURE(_p, _c, orchestration_fixture_s, orchestration_fixture)
 
@@ -1894,4 +1977,12 @@ void units_orchestration_add_tests(void) {
                  test__otrng_client_ensure_correct_state__v3_key__creates);
   WITH_O_FIXTURE("/orchestration/ensure_correct_state/v3_key/fails",
                  test__otrng_client_ensure_correct_state__v3_key__fails);
+
+  WITH_O_FIXTURE("/orchestration/ensure_correct_state/lazy/defers",
+                 test__otrng_client_ensure_correct_state__lazy__defers);
+  WITH_O_FIXTURE(
+      "/orchestration/ensure_correct_state/lazy/ensures_on_first_use",
+      test__otrng_client_ensure_correct_state__lazy__ensures_on_first_use);
+  WITH_O_FIXTURE("/orchestration/get_our_fingerprint/lazy/ensures_keys",
+                 test__otrng_client_get_our_fingerprint__lazy__ensures_keys);
 }
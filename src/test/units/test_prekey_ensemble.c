@@ -114,6 +114,81 @@ static void test_prekey_ensemble_validate(void) {
   otrng_prekey_ensemble_free(ensemble);
 }
 
+static prekey_ensemble_s *build_ensemble(const otrng_keypair_s *keypair,
+                                         const otrng_keypair_s *keypair2,
+                                         time_t expires) {
+  uint8_t sym3[ED448_PRIVATE_BYTES] = {0xA2};
+  prekey_ensemble_s *ensemble = otrng_prekey_ensemble_new();
+  otrng_public_key *fk = create_forging_key_from(sym3);
+
+  ensemble->client_profile->versions = otrng_xstrdup("4");
+  ensemble->client_profile->sender_instance_tag = 1;
+  ensemble->client_profile->expires = expires;
+  otrng_ec_point_copy(ensemble->client_profile->forging_pub_key, *fk);
+  otrng_free(fk);
+  otrng_assert_is_success(
+      client_profile_sign(ensemble->client_profile, keypair));
+
+  ensemble->prekey_profile->instance_tag = 1;
+  ensemble->prekey_profile->expires = expires;
+  otrng_ec_point_copy(ensemble->prekey_profile->shared_prekey, keypair->pub);
+  otrng_assert_is_success(
+      otrng_prekey_profile_sign(ensemble->prekey_profile, keypair));
+
+  ensemble->message = otrng_prekey_message_new();
+  ensemble->message->sender_instance_tag = 1;
+  otrng_ec_point_copy(ensemble->message->Y, keypair2->pub);
+  ensemble->message->B = gcry_mpi_set_ui(NULL, 3);
+
+  return ensemble;
+}
+
+static void test_prekey_ensembles_validate_many(void) {
+  uint8_t sym[ED448_PRIVATE_BYTES] = {0xA0};
+  uint8_t sym2[ED448_PRIVATE_BYTES] = {0xA1};
+  otrng_keypair_s *keypair = otrng_keypair_new();
+  otrng_keypair_s *keypair2 = otrng_keypair_new();
+  time_t expires = time(NULL) + 60 * 60 * 24; // one day
+  prekey_ensemble_s *ensembles[5];
+  otrng_result results[5];
+  int i;
+
+  otrng_assert_is_success(otrng_keypair_generate(keypair, sym));
+  otrng_assert_is_success(otrng_keypair_generate(keypair2, sym2));
+
+  for (i = 0; i < 5; i++) {
+    ensembles[i] = build_ensemble(keypair, keypair2, expires);
+  }
+
+  // A bad message only invalidates its own ensemble
+  otrng_dh_mpi_release(ensembles[1]->message->B);
+  ensembles[1]->message->B = NULL;
+
+  // A bad profile invalidates the ensemble, even if it is shared
+  ensembles[2]->prekey_profile->expires -= 1;
+
+  // So does an ensemble that isn't well formed
+  ensembles[3]->message->sender_instance_tag = 2;
+
+  g_assert_cmpint(otrng_prekey_ensembles_validate_many(results, ensembles, 5),
+                  ==, 2);
+  otrng_assert_is_success(results[0]);
+  otrng_assert_is_error(results[1]);
+  otrng_assert_is_error(results[2]);
+  otrng_assert_is_error(results[3]);
+  otrng_assert_is_success(results[4]);
+
+  for (i = 0; i < 5; i++) {
+    otrng_assert(otrng_prekey_ensemble_validate(ensembles[i]) == results[i]);
+    otrng_prekey_ensemble_free(ensembles[i]);
+  }
+
+  otrng_keypair_free(keypair);
+  otrng_keypair_free(keypair2);
+}
+
 void units_prekey_ensemble_add_tests(void) {
   g_test_add_func("/prekey_ensemble/validate", test_prekey_ensemble_validate);
+  g_test_add_func("/prekey_ensemble/validate_many",
+                  test_prekey_ensembles_validate_many);
 }
@@ -53,7 +53,7 @@ test_prekey_manager__otrng_prekey_request_storage_information(void) {
 
   client = otrng_client_new(client_id);
   client->global_state = gs;
-  gs->clients = otrng_list_add(client, gs->clients);
+  otrng_global_state_add_client(gs, client);
 
   set_up_fixed_randomness();
 
@@ -98,6 +98,7 @@ test_prekey_manager__otrng_prekey_request_storage_information(void) {
   otrng_free(output);
   otrng_client_free(client);
   otrng_list_free_nodes(gs->clients);
+  otrng_free(gs->clients_index.slots);
   otrng_free(gs);
   otrng_free((char *)client_id.protocol);
   otrng_free((char *)client_id.account);
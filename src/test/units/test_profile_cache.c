@@ -0,0 +1,160 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_helpers.h"
+
+#include "client_profile.h"
+#include "profile_cache.h"
+
+static void digest_of(uint8_t *digest, uint32_t n) {
+  uint8_t data[4];
+
+  data[0] = (n >> 24) & 0xFF;
+  data[1] = (n >> 16) & 0xFF;
+  data[2] = (n >> 8) & 0xFF;
+  data[3] = n & 0xFF;
+
+  otrng_assert_is_success(otrng_profile_cache_digest(
+      digest, OTRNG_PROFILE_CACHE_CLIENT_PROFILE, data, 4, NULL, 0));
+}
+
+static void test_profile_cache_get_and_put(void) {
+  uint8_t digest[OTRNG_PROFILE_CACHE_DIGEST_BYTES];
+  uint8_t other[OTRNG_PROFILE_CACHE_DIGEST_BYTES];
+  uint64_t expires = time(NULL) + 3600;
+  uint64_t hits = 0, misses = 0;
+  otrng_bool valid = otrng_false;
+
+  otrng_profile_cache_clear();
+  digest_of(digest, 1);
+  digest_of(other, 2);
+
+  otrng_assert(!otrng_profile_cache_get(&valid, digest));
+
+  otrng_profile_cache_put(digest, otrng_true, expires);
+  otrng_profile_cache_put(other, otrng_false, expires);
+
+  otrng_assert(otrng_profile_cache_get(&valid, digest));
+  otrng_assert(valid);
+  otrng_assert(otrng_profile_cache_get(&valid, other));
+  otrng_assert(!valid);
+
+  otrng_profile_cache_counters(&hits, &misses);
+  g_assert_cmpint(hits, ==, 2);
+  g_assert_cmpint(misses, ==, 1);
+
+  otrng_profile_cache_clear();
+  otrng_assert(!otrng_profile_cache_get(&valid, digest));
+}
+
+static void test_profile_cache_skips_expired_profiles(void) {
+  uint8_t digest[OTRNG_PROFILE_CACHE_DIGEST_BYTES];
+  otrng_bool valid;
+
+  otrng_profile_cache_clear();
+  digest_of(digest, 1);
+
+  otrng_profile_cache_put(digest, otrng_true, time(NULL) - 1);
+  otrng_assert(!otrng_profile_cache_get(&valid, digest));
+
+  otrng_profile_cache_clear();
+}
+
+static void test_profile_cache_evicts_least_recently_used(void) {
+  uint8_t digest[OTRNG_PROFILE_CACHE_DIGEST_BYTES];
+  uint64_t expires = time(NULL) + 3600;
+  otrng_bool valid;
+  uint32_t i;
+
+  otrng_profile_cache_clear();
+
+  for (i = 0; i < OTRNG_PROFILE_CACHE_CAPACITY; i++) {
+    digest_of(digest, i);
+    otrng_profile_cache_put(digest, otrng_true, expires);
+  }
+
+  /* the first entry becomes the most recently used */
+  digest_of(digest, 0);
+  otrng_assert(otrng_profile_cache_get(&valid, digest));
+
+  digest_of(digest, OTRNG_PROFILE_CACHE_CAPACITY);
+  otrng_profile_cache_put(digest, otrng_true, expires);
+
+  digest_of(digest, 1);
+  otrng_assert(!otrng_profile_cache_get(&valid, digest));
+  digest_of(digest, 0);
+  otrng_assert(otrng_profile_cache_get(&valid, digest));
+  digest_of(digest, OTRNG_PROFILE_CACHE_CAPACITY);
+  otrng_assert(otrng_profile_cache_get(&valid, digest));
+
+  otrng_profile_cache_clear();
+}
+
+static void test_profile_cache_remembers_client_profile_validation(void) {
+  otrng_keypair_s keypair, forging;
+  uint8_t sym[ED448_PRIVATE_BYTES] = {1};
+  uint8_t forging_sym[ED448_PRIVATE_BYTES] = {2};
+  otrng_client_profile_s *profile;
+  uint64_t hits = 0, misses = 0;
+
+  otrng_assert_is_success(otrng_keypair_generate(&keypair, sym));
+  otrng_assert_is_success(otrng_keypair_generate(&forging, forging_sym));
+
+  profile = otrng_client_profile_build(OTRNG_MIN_VALID_INSTAG + 1, "4",
+                                       &keypair, forging.pub, 3600);
+  otrng_assert(profile);
+
+  otrng_profile_cache_clear();
+
+  otrng_assert(otrng_client_profile_valid(profile, OTRNG_MIN_VALID_INSTAG + 1));
+  otrng_assert(otrng_client_profile_valid(profile, OTRNG_MIN_VALID_INSTAG + 1));
+  otrng_assert(
+      !otrng_client_profile_valid(profile, OTRNG_MIN_VALID_INSTAG + 2));
+
+  otrng_profile_cache_counters(&hits, &misses);
+  g_assert_cmpint(hits, ==, 1);
+  g_assert_cmpint(misses, ==, 1);
+
+  /* a tampered copy is a different entry */
+  profile->signature[0] ^= 0x01;
+  otrng_assert(
+      !otrng_client_profile_valid(profile, OTRNG_MIN_VALID_INSTAG + 1));
+
+  otrng_profile_cache_counters(&hits, &misses);
+  g_assert_cmpint(misses, ==, 2);
+
+  otrng_client_profile_free(profile);
+  otrng_profile_cache_clear();
+}
+
+void units_profile_cache_add_tests(void) {
+  g_test_add_func("/profile_cache/get_and_put",
+                  test_profile_cache_get_and_put);
+  g_test_add_func("/profile_cache/skips_expired_profiles",
+                  test_profile_cache_skips_expired_profiles);
+  g_test_add_func("/profile_cache/evicts_least_recently_used",
+                  test_profile_cache_evicts_least_recently_used);
+  g_test_add_func("/profile_cache/remembers_client_profile_validation",
+                  test_profile_cache_remembers_client_profile_validation);
+}
@@ -0,0 +1,127 @@
+/*
+ *  This file is part of the Off-the-Record Next Generation Messaging
+ *  library (libotr-ng).
+ *
+ *  Copyright (C) 2016-2019, the libotr-ng contributors.
+ *
+ *  This library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test_helpers.h"
+
+#include "random.h"
+#include "skipped_keys.h"
+
+static void random_point(ec_point p) {
+  ec_scalar s;
+  uint8_t random_buff[ED448_SCALAR_BYTES];
+
+  random_bytes(random_buff, ED448_SCALAR_BYTES);
+  goldilocks_448_scalar_decode_long(s, random_buff, ED448_SCALAR_BYTES);
+  goldilocks_448_point_scalarmul(p, goldilocks_448_point_base, s);
+}
+
+static void test_skipped_keys_store_add_and_get() {
+  skipped_keys_store_s *store = otrng_skipped_keys_store_new();
+  skipped_keys_s *keys;
+  ec_point their_ecdh, other_ecdh;
+
+  random_point(their_ecdh);
+  random_point(other_ecdh);
+
+  otrng_assert(!otrng_skipped_keys_store_get(store, their_ecdh, 1));
+  g_assert_cmpint(otrng_skipped_keys_store_len(store), ==, 0);
+
+  keys = otrng_skipped_keys_new(their_ecdh, 1);
+  otrng_assert(keys);
+  memset(keys->enc_key, 0xAB, ENC_KEY_BYTES);
+  otrng_skipped_keys_store_add(store, keys);
+
+  g_assert_cmpint(otrng_skipped_keys_store_len(store), ==, 1);
+  otrng_assert(otrng_skipped_keys_store_get(store, their_ecdh, 1) == keys);
+  otrng_assert(!otrng_skipped_keys_store_get(store, their_ecdh, 2));
+  otrng_assert(!otrng_skipped_keys_store_get(store, other_ecdh, 1));
+
+  otrng_skipped_keys_store_free(store);
+}
+
+static void test_skipped_keys_store_remove() {
+  skipped_keys_store_s *store = otrng_skipped_keys_store_new();
+  skipped_keys_s *keys;
+  ec_point their_ecdh;
+  uint32_t k;
+
+  random_point(their_ecdh);
+
+  /* Enough keys to force the table to grow and to have colliding probes */
+  for (k = 0; k < 100; k++) {
+    otrng_skipped_keys_store_add(store, otrng_skipped_keys_new(their_ecdh, k));
+  }
+  g_assert_cmpint(otrng_skipped_keys_store_len(store), ==, 100);
+
+  for (k = 0; k < 100; k += 2) {
+    keys = otrng_skipped_keys_store_get(store, their_ecdh, k);
+    otrng_assert(keys);
+    otrng_assert(otrng_skipped_keys_store_remove(store, keys) == keys);
+    otrng_skipped_keys_free(keys);
+  }
+  g_assert_cmpint(otrng_skipped_keys_store_len(store), ==, 50);
+
+  for (k = 0; k < 100; k++) {
+    keys = otrng_skipped_keys_store_get(store, their_ecdh, k);
+    if (k % 2 == 0) {
+      otrng_assert(!keys);
+    } else {
+      otrng_assert(keys);
+      g_assert_cmpint(keys->k, ==, k);
+    }
+  }
+
+  otrng_skipped_keys_store_free(store);
+}
+
+static void test_skipped_keys_store_move() {
+  skipped_keys_store_s *dst = otrng_skipped_keys_store_new();
+  skipped_keys_store_s *src = otrng_skipped_keys_store_new();
+  ec_point their_ecdh;
+  uint32_t k;
+
+  random_point(their_ecdh);
+
+  otrng_skipped_keys_store_add(dst, otrng_skipped_keys_new(their_ecdh, 0));
+  for (k = 1; k < 20; k++) {
+    otrng_skipped_keys_store_add(src, otrng_skipped_keys_new(their_ecdh, k));
+  }
+
+  otrng_skipped_keys_store_move(dst, src);
+
+  g_assert_cmpint(otrng_skipped_keys_store_len(src), ==, 0);
+  g_assert_cmpint(otrng_skipped_keys_store_len(dst), ==, 20);
+  for (k = 0; k < 20; k++) {
+    otrng_assert(otrng_skipped_keys_store_get(dst, their_ecdh, k));
+    otrng_assert(!otrng_skipped_keys_store_get(src, their_ecdh, k));
+  }
+
+  otrng_skipped_keys_store_free(src);
+  otrng_skipped_keys_store_free(dst);
+}
+
+void units_skipped_keys_add_tests(void) {
+  g_test_add_func("/skipped_keys/add_and_get",
+                  test_skipped_keys_store_add_and_get);
+  g_test_add_func("/skipped_keys/remove", test_skipped_keys_store_remove);
+  g_test_add_func("/skipped_keys/move", test_skipped_keys_store_move);
+}
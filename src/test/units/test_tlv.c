@@ -59,6 +59,38 @@ static void test_tlv_parse() {
   otrng_tlv_list_free(tlvs);
 }
 
+static void test_tlv_iterator() {
+  uint8_t message[22] = {0x00, 0x06, 0x00, 0x03, 0x08, 0x05, 0x09, 0x00,
+                         0x02, 0x00, 0x04, 0xac, 0x04, 0x05, 0x06, 0x00,
+                         0x05, 0x00, 0x03, 0x08, 0x05, 0x09};
+  tlv_iterator_s it;
+  tlv_s tlv;
+
+  otrng_tlv_iterator_init(&it, message, sizeof(message));
+
+  otrng_assert(otrng_tlv_iterator_next(&it, &tlv));
+  g_assert_cmpint(tlv.type, ==, OTRNG_TLV_SMP_ABORT);
+  g_assert_cmpint(tlv.len, ==, 3);
+  otrng_assert(tlv.data == message + 4);
+
+  otrng_assert(otrng_tlv_iterator_next(&it, &tlv));
+  g_assert_cmpint(tlv.type, ==, OTRNG_TLV_SMP_MSG_1);
+  g_assert_cmpint(tlv.len, ==, 4);
+  otrng_assert(tlv.data == message + 11);
+
+  otrng_assert(otrng_tlv_iterator_next(&it, &tlv));
+  g_assert_cmpint(tlv.type, ==, OTRNG_TLV_SMP_MSG_4);
+  otrng_assert(tlv.data == message + 19);
+
+  otrng_assert(!otrng_tlv_iterator_next(&it, &tlv));
+
+  // A truncated TLV ends the iteration
+  otrng_tlv_iterator_init(&it, message, sizeof(message) - 1);
+  otrng_assert(otrng_tlv_iterator_next(&it, &tlv));
+  otrng_assert(otrng_tlv_iterator_next(&it, &tlv));
+  otrng_assert(!otrng_tlv_iterator_next(&it, &tlv));
+}
+
 static void test_otrng_append_tlv() {
   uint8_t smp2_data[2] = {0x03, 0x04};
   uint8_t smp3_data[3] = {0x05, 0x04, 0x03};
@@ -89,5 +121,6 @@ static void test_otrng_append_tlv() {
 
 void units_tlv_add_tests(void) {
   g_test_add_func("/tlv/parse", test_tlv_parse);
+  g_test_add_func("/tlv/iterator", test_tlv_iterator);
   g_test_add_func("/tlv/append", test_otrng_append_tlv);
 }
@@ -44,20 +44,15 @@ tstatic void set_tlv_type(tlv_s *tlv, uint16_t tlv_type) {
   }
 }
 
-/*@null@*/ tstatic tlv_s *parse_tlv(const uint8_t *src, size_t len,
-                                    size_t *read) {
-  tlv_s *tlv = otrng_tlv_new(OTRNG_TLV_NONE, 0, NULL);
+/* Reads one TLV from [src]. [tlv]->data is left pointing into [src]. */
+static otrng_bool read_tlv(tlv_s *tlv, const uint8_t *src, size_t len,
+                           size_t *read) {
   size_t w = 0;
   uint16_t tlv_type = -1;
   const uint8_t *cursor = src;
 
-  if (!tlv) {
-    return NULL;
-  }
-
   if (!otrng_deserialize_uint16(&tlv_type, cursor, len, &w)) {
-    otrng_tlv_free(tlv);
-    return NULL;
+    return otrng_false;
   }
 
   set_tlv_type(tlv, tlv_type);
@@ -66,30 +61,73 @@ tstatic void set_tlv_type(tlv_s *tlv, uint16_t tlv_type) {
   cursor += w;
 
   if (!otrng_deserialize_uint16(&tlv->len, cursor, len, &w)) {
-    otrng_tlv_free(tlv);
-    return NULL;
+    return otrng_false;
   }
 
   len -= w;
   cursor += w;
 
   if (len < tlv->len) {
-    otrng_tlv_free(tlv);
-    return NULL;
+    return otrng_false;
   }
 
-  tlv->data = otrng_xmalloc_z(tlv->len);
-
-  memcpy(tlv->data, cursor, tlv->len);
+  tlv->data = (uint8_t *)cursor;
   cursor += tlv->len;
 
   if (read) {
     *read = cursor - src;
   }
 
+  return otrng_true;
+}
+
+/*@null@*/ tstatic tlv_s *parse_tlv(const uint8_t *src, size_t len,
+                                    size_t *read) {
+  tlv_s borrowed;
+  tlv_s *tlv;
+
+  if (!read_tlv(&borrowed, src, len, read)) {
+    return NULL;
+  }
+
+  tlv = otrng_tlv_new(OTRNG_TLV_NONE, 0, NULL);
+  if (!tlv) {
+    return NULL;
+  }
+
+  tlv->type = borrowed.type;
+  tlv->len = borrowed.len;
+  tlv->data = otrng_xmalloc_z(tlv->len);
+  memcpy(tlv->data, borrowed.data, tlv->len);
+
   return tlv;
 }
 
+API void otrng_tlv_iterator_init(tlv_iterator_s *it, const uint8_t *src,
+                                 size_t len) {
+  it->cursor = src;
+  it->remaining = src ? len : 0;
+}
+
+API otrng_bool otrng_tlv_iterator_next(tlv_iterator_s *it, tlv_s *tlv) {
+  size_t read = 0;
+
+  if (it->remaining == 0) {
+    return otrng_false;
+  }
+
+  if (!read_tlv(tlv, it->cursor, it->remaining, &read)) {
+    /* Like otrng_parse_tlvs, stop at the first truncated TLV */
+    it->remaining = 0;
+    return otrng_false;
+  }
+
+  it->cursor += read;
+  it->remaining -= read;
+
+  return otrng_true;
+}
+
 /*@null@*/ INTERNAL tlv_list_s *otrng_append_tlv(tlv_list_s *head, tlv_s *tlv) {
   tlv_list_s *current;
   tlv_list_s *n = otrng_tlv_list_one(tlv);
@@ -31,6 +31,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "error.h"
 #include "shared.h"
 
 typedef enum {
@@ -70,6 +71,41 @@ typedef struct tlv_list_s {
   struct tlv_list_s *next;
 } tlv_list_s;
 
+/**
+ * @brief The tlv_iterator_s structure walks over the TLVs serialized in a
+ *    buffer, without copying them.
+ *
+ *  [cursor]    where the next TLV starts
+ *  [remaining] the amount of data left from [cursor]
+ **/
+typedef struct tlv_iterator_s {
+  const uint8_t *cursor;
+  size_t remaining;
+} tlv_iterator_s;
+
+/**
+ * @brief Starts iterating over the TLVs in the memory region from [src] to
+ *    [src]+[len].
+ *
+ * @param [src] the pointer to where to start parsing. can be NULL if [len]
+ *              is 0.
+ * @param [len] the amount of data to parse. can be 0.
+ **/
+API void otrng_tlv_iterator_init(tlv_iterator_s *it, const uint8_t *src,
+                                 size_t len);
+
+/**
+ * @brief Reads the next TLV from the iterator.
+ *
+ * @param [tlv] is set to the TLV read. Its [data] points into the iterated
+ *              buffer, so it must not be freed, and is only valid as long as
+ *              that buffer is.
+ *
+ * @return otrng_true if a TLV was read. otrng_false when there are no more
+ *    TLVs, or the next one is truncated.
+ **/
+API otrng_bool otrng_tlv_iterator_next(tlv_iterator_s *it, tlv_s *tlv);
+
 /**
  * @brief Frees the given list of TLVs
  *